@@ -3,6 +3,7 @@
 // local
 #include "KeyboardMovementController.h"
 #include "RenderSystem.h"
+#include "GpuTimer.h"
 #include "Camera.h"
 #include "Buffer.h"
 #include "Frame_info.h"
@@ -28,17 +29,26 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <unordered_map>
 
 
 
-App::App() { 
+// frames before each benchmark phase, the GPU times lag behind by a few frames
+static constexpr int BENCHMARK_WARMUP_FRAMES = 60;
+static constexpr int BENCHMARK_FRAMES = 300;
+
+App::App(Scene scene, MipGenerator::Method mipMethod, bool gpuDriven, bool occlusionCulling, bool clusterCulling)
+    : scene{ scene }, gpuDriven{ gpuDriven }, occlusionCulling{ occlusionCulling }, clusterCulling{ clusterCulling } { 
+    device.getMipGenerator().setMethod(mipMethod);
+
     globalPool = DescriptorPool::Builder(device)
         .setMaxSets(Swap_chain::MAX_FRAMES_IN_FLIGHT * 12)
         .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, Swap_chain::MAX_FRAMES_IN_FLIGHT)
         .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, Swap_chain::MAX_FRAMES_IN_FLIGHT*8)
         .build();
 
-    loadGameObjects(); 
+    if (scene == Scene::LodBenchmark) loadLodBenchmark();
+    else loadGameObjects();
 
     frameTimeVector = std::vector<float>(300);
 }
@@ -74,19 +84,35 @@ void App::run()
             .build(globalDescriptorSet[i]);
     }
 
-    for (auto& kv : gameObjects)
-    {
-        auto& obj = kv.second;
-        if (obj.model == nullptr) continue;
-        obj.createDescriptorSet(*globalPool, device);
-    }
-
     PointLightSystem pointLightSystem{ device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
-	RenderSystem renderSystem{ device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
+	RenderSystem renderSystem{ device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(), textureRegistry };
+
+    GpuTimer gpuTimer{ device };
 
     TextOverlay textOverlay{ device, renderer.getSwapChainRenderPass() };
     textOverlay.prepareResources(*globalPool);
 
+    // the scene uploads have to be on the graphics queue before the first frame, later uploads are polled with flush
+    device.getUploadContext().waitIdle();
+
+    if (gpuDriven && !renderSystem.setGpuDriven(true)) {
+        std::cout << "gpu driven mode needs VK_KHR_draw_indirect_count, multiDrawIndirect and drawIndirectFirstInstance and its shader, drawing from the CPU\n";
+    }
+    if (occlusionCulling && (!renderer.isDepthSampled() || !renderSystem.setOcclusionCulling(true))) {
+        std::cout << "occlusion culling needs the gpu driven mode, its shaders and a depth format that can be sampled, drawing without it\n";
+    }
+    if (clusterCulling && !renderSystem.setClusterCulling(true)) {
+        std::cout << "cluster culling needs drawIndirectFirstInstance and its shader, drawing whole meshes\n";
+    }
+
+    // the objects whose model is still loading are the only ones looked at every frame, the others are
+    // given to the render system once. the scene objects do not move afterwards
+    std::vector<GameObject::id_t> loadingObjects;
+    for (auto& kv : gameObjects) {
+        if (kv.second.pendingModel.isLoading() || kv.second.pendingModel.isLoaded()) loadingObjects.push_back(kv.first);
+        else renderSystem.updateObject(kv.second);
+    }
+
 
     // camera setting
     Camera camera{};
@@ -94,6 +120,21 @@ void App::run()
     viewerObject.transform.translation = { 2.0f, -1.0f, 2.5f };
     //viewerObject.transform.rotation.y = 180;
 
+    // looking down the diagonal of the grid
+    if (scene == Scene::LodBenchmark) {
+        viewerObject.transform.translation = { -3.f, -1.5f, -3.f };
+        viewerObject.transform.rotation = { -0.15f, pi<float> / 4, 0.f };
+    }
+
+    struct BenchmarkPhase {
+        float gpuTime = 0.f;
+        uint64_t triangles = 0;
+        uint64_t drawCalls = 0;
+        int frames = 0;
+    };
+    BenchmarkPhase benchmarkPhases[2]{};
+    int benchmarkFrame = 0;
+
     float aspec = renderer.getAspectRatio();
     camera.setPerspectiveProjection(glm::radians(50.f), aspec, .1f, 100.0f);
 
@@ -119,19 +160,115 @@ void App::run()
         std::stringstream ss("");
         ss << std::fixed << std::setprecision(2) << frameTimeSum << " fps";
 
+        std::stringstream stats("");
+        stats << renderSystem.getTriangleCount() << " triangles, " << renderSystem.getDrawCallCount() << " draws, "
+            << std::fixed << std::setprecision(2) << gpuTimer.getTime("objects") << " ms";
+        if (renderSystem.isFrustumCullingEnabled()) {
+            stats << ", " << renderSystem.getVisibleObjectCount() << " visible / "
+                << renderSystem.getTestedObjectCount() - renderSystem.getVisibleObjectCount() << " culled objects";
+        }
+        if (auto gpuScene = renderSystem.getGpuScene()) {
+            stats << ", gpu driven: " << gpuScene->getStats().meshCount << " meshes, " << gpuScene->getStats().writtenCount
+                << " objects written, cull " << gpuTimer.getTime("cull") << " ms";
+            if (renderSystem.isOcclusionCullingEnabled()) {
+                stats << ", " << renderSystem.getOccludedObjectCount() << " occluded / " << gpuScene->getStats().lateVisibleCount
+                    << " late objects, occlusion " << gpuTimer.getTime("occlusion") << " ms";
+            }
+        }
+        else if (renderSystem.isClusterCullingEnabled()) {
+            stats << ", " << renderSystem.getVisibleMeshletCount() << " / " << renderSystem.getTestedMeshletCount() << " meshlets, cull "
+                << gpuTimer.getTime("cull") << " ms";
+        }
+
+        auto textureStats = textureRegistry.getStats();
+        std::stringstream textures("");
+        textures << "textures: " << textureStats.residentCount << " resident (" << std::fixed << std::setprecision(1)
+            << textureStats.residentBytes / (1024.f * 1024.f) << " MB), " << textureStats.evictedCount << " evicted ("
+            << textureStats.evictedBytes / (1024.f * 1024.f) << " MB)";
+        if (textureRegistry.isStreaming()) {
+            textures << ", " << textureStats.streamingCount << " streaming, " << textureStats.streamedLevelCount << " levels in / "
+                << textureStats.droppedLevelCount << " out";
+        }
+        if (assetLoader.getPendingCount() > 0) {
+            textures << ", " << assetLoader.getPendingCount() << " asset(s) loading";
+        }
+
         textOverlay.beginTextUpdate();
         textOverlay.addText(ss.str(), 10, 10, TextOverlay::alignLeft, renderer.getWidth(), renderer.getHeight());
+        textOverlay.addText(stats.str(), 10, 40, TextOverlay::alignLeft, renderer.getWidth(), renderer.getHeight());
+        textOverlay.addText(textures.str(), 10, 70, TextOverlay::alignLeft, renderer.getWidth(), renderer.getHeight());
         textOverlay.endTextUpdate();
 
-        // move camera on event 
-        cameraController.moveInPlaneXZ(window.getGLFWwindow(), frameTime, viewerObject);
+        // move camera on event, the benchmark keeps it still
+        if (scene != Scene::LodBenchmark) {
+            cameraController.moveInPlaneXZ(window.getGLFWwindow(), frameTime, viewerObject);
+        }
         camera.setViewYXZ(viewerObject.transform.translation, viewerObject.transform.rotation);
 
+        // first phase without levels of detail, second one with them
+        if (scene == Scene::LodBenchmark) {
+            int phaseLength = BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES;
+            int phase = benchmarkFrame / phaseLength;
+
+            if (phase == 2) {
+                for (int i = 0; i < 2; i++) {
+                    const auto& result = benchmarkPhases[i];
+                    int frames = std::max(result.frames, 1);
+                    std::cout << (i == 0 ? "lod off: " : "lod on:  ")
+                        << result.gpuTime / frames << " ms gpu, "
+                        << result.triangles / frames << " triangles, "
+                        << result.drawCalls / frames << " draws\n";
+                }
+                glfwSetWindowShouldClose(window.getGLFWwindow(), GLFW_TRUE);
+                continue;
+            }
+
+            renderSystem.setLodEnabled(phase == 1);
+
+            if (benchmarkFrame % phaseLength >= BENCHMARK_WARMUP_FRAMES) {
+                auto& result = benchmarkPhases[phase];
+                // the occlusion scopes are 0 without occlusion culling
+                result.gpuTime += gpuTimer.getTime("objects") + gpuTimer.getTime("occlusion") + gpuTimer.getTime("late objects");
+                result.triangles += renderSystem.getTriangleCount();
+                result.drawCalls += renderSystem.getDrawCallCount();
+                result.frames++;
+            }
+            benchmarkFrame++;
+        }
+
+        renderSystem.setLodErrorThreshold(1.f, renderer.getHeight());
+
         
 
+        // assets read by the workers are created here, their uploads go out with the flush below
+        assetLoader.update();
+        for (size_t i = 0; i < loadingObjects.size();) {
+            auto& obj = gameObjects.at(loadingObjects[i]);
+            if (obj.pendingModel.isReady()) {
+                obj.model = obj.pendingModel.get();
+                obj.pendingModel = {};
+                renderSystem.updateObject(obj);
+            }
+            else if (obj.pendingModel.isFailed()) {
+                obj.pendingModel = {};
+            }
+            else {
+                i++;
+                continue;
+            }
+            loadingObjects[i] = loadingObjects.back();
+            loadingObjects.pop_back();
+        }
+
+        // submit the uploads recorded since the last frame and hand the finished ones to the graphics queue
+        device.getUploadContext().flush();
+
 		if (auto commandBuffer = renderer.beginFrame()) {
             int frameIndex = renderer.getFrameIndex();
 
+            // the fence of the frame is signaled, textures no frame in flight uses can be released
+            textureRegistry.beginFrame();
+
             FrameInfo frameInfo{
                 frameIndex,
                 frameTime,
@@ -153,9 +290,40 @@ void App::run()
             uboBuffers[frameIndex]->flush();
 
             // render
-			renderer.beginSwapChainRenderPass(commandBuffer);
+            gpuTimer.beginFrame(commandBuffer, frameIndex);
+
+            gpuTimer.begin(commandBuffer, "cull");
+            renderSystem.prepareFrame(frameInfo);
+            gpuTimer.end(commandBuffer, "cull");
 
+            // with occlusion culling the objects visible last frame are drawn first, the pass is ended for
+            // the depth pyramid and the culling against it, then the objects it found visible are drawn
+            bool occlusionPass = renderSystem.isOcclusionCullingEnabled();
+			renderer.beginSwapChainRenderPass(commandBuffer, occlusionPass ? Swap_chain::RenderPassPart::First : Swap_chain::RenderPassPart::Whole);
+
+            gpuTimer.begin(commandBuffer, "objects");
             renderSystem.renderGameObjects(frameInfo);
+            gpuTimer.end(commandBuffer, "objects");
+
+            if (occlusionPass) {
+                renderer.endSwapChainRenderPass(commandBuffer);
+
+                DepthPyramid::Source depth{};
+                depth.image = renderer.getDepthImage();
+                depth.view = renderer.getDepthImageView();
+                depth.format = renderer.getDepthFormat();
+                depth.extent = renderer.getExtent();
+
+                gpuTimer.begin(commandBuffer, "occlusion");
+                renderSystem.prepareLatePass(frameInfo, depth);
+                gpuTimer.end(commandBuffer, "occlusion");
+
+                renderer.beginSwapChainRenderPass(commandBuffer, Swap_chain::RenderPassPart::Second);
+                gpuTimer.begin(commandBuffer, "late objects");
+                renderSystem.renderLatePass(frameInfo);
+                gpuTimer.end(commandBuffer, "late objects");
+            }
+
             pointLightSystem.render(frameInfo);
             textOverlay.renderText(frameInfo);
 
@@ -171,28 +339,41 @@ void App::run()
 }
 
 void App::loadGameObjects() {
-    
-    std::shared_ptr<Model> model_city = Model::createModelFromFile(device, "model/viking_room.obj.txt", "textures/viking_room.png");
+    // the textures of the scene are decoded together on the asset loader and uploaded in one submission
+    auto batchStart = std::chrono::high_resolution_clock::now();
+    uint32_t submitCount = device.getUploadContext().getSubmitCount();
+    auto textures = textureRegistry.loadBatch({ "textures/viking_room.png", "textures/Palette.jpg", "textures/floor.jpg" });
+    float batchTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - batchStart).count();
+
+    std::cout << "texture batch: " << textures.size() << " file(s) decoded in " << batchTime << " ms on " << assetLoader.getThreadCount() + 1
+        << " thread(s), " << device.getUploadContext().getSubmitCount() - submitCount << " submission(s)\n";
+
+    // the models are read on the asset loader, objects are drawn once their model is ready
+    AssetFuture<Model> model_city = meshRegistry.loadAsync("model/viking_room.obj.txt", Model::VertexFormat::Packed);
     auto Lowpoly_City = GameObject::createGameObject(device);
     Lowpoly_City.transform.rotation.x = pi<float> / 2;
     Lowpoly_City.transform.rotation.y = pi<float> ;
     Lowpoly_City.transform.translation = { 7, 0, 7 };
-    Lowpoly_City.model = model_city;
+    Lowpoly_City.pendingModel = model_city;
+    Lowpoly_City.texture = textures[0];
     gameObjects.emplace(Lowpoly_City.getId(), std::move(Lowpoly_City));
 
 
-    std::shared_ptr<Model> model_city1 = Model::createModelFromFile(device, "model/viking_room.obj.txt", "textures/Palette.jpg");
+    // same mesh with another texture, the registry shares the read started above
+    AssetFuture<Model> model_city1 = meshRegistry.loadAsync("model/viking_room.obj.txt", Model::VertexFormat::Packed);
     auto Lowpoly_City1= GameObject::createGameObject(device);
     Lowpoly_City1.transform.rotation.x = pi<float> / 2;
-    Lowpoly_City1.model = model_city1;
+    Lowpoly_City1.pendingModel = model_city1;
+    Lowpoly_City1.texture = textures[1];
     Lowpoly_City1.transform.translation.z = 2;
     gameObjects.emplace(Lowpoly_City1.getId(), std::move(Lowpoly_City1));
 
 
-    /*std::shared_ptr<Model> cube = Model::createModelFromFile(device, "models/cube.obj", "textures/emptyTexture.jpg");
+    /*std::shared_ptr<Model> cube = meshRegistry.load("models/cube.obj");
     auto cube1 = GameObject::createGameObject(device);
     cube1.transform.rotation.x = pi<float> / 2;
     cube1.model = cube;
+    cube1.texture = textureRegistry.load("textures/emptyTexture.jpg");
     cube1.transform.scale = { 0.5f, 0.5f, 0.5f };
 
     cube1.transform.translation = { 2, -0.4f, 6 };
@@ -202,6 +383,7 @@ void App::loadGameObjects() {
 
     auto plane1 = GameObject::createGameObject(device);
     plane1.model = plane;
+    plane1.texture = textures[2];
     plane1.transform.translation.y = 0.1f;
     gameObjects.emplace(plane1.getId(), std::move(plane1));
 
@@ -220,6 +402,42 @@ void App::loadGameObjects() {
         pointLight.transform.translation = glm::vec3(rotateLight * glm::vec4(-1.f, -1.f, -1.f, 4.f)) + glm::vec3{ 7, 0, 7 };
         gameObjects.emplace(pointLight.getId(), std::move(pointLight));
     }
+
+    std::cout << "asset loader: " << assetLoader.getPendingCount() << " load(s) on " << assetLoader.getThreadCount() << " thread(s), "
+        << meshRegistry.getSharedCount() << " shared mesh load(s)\n";
+    device.getAllocator().printStats();
+}
+
+void App::loadLodBenchmark() {
+
+    // stands in for the blocks of a city, most of them far enough to use a coarse level
+    std::shared_ptr<Model> room = meshRegistry.load("model/viking_room.obj.txt", Model::VertexFormat::Packed);
+    auto roomTexture = textureRegistry.load("textures/viking_room.png");
+
+    // every phase of the benchmark measures the whole scene
+    assetLoader.waitIdle();
+
+    const int gridSize = 20;
+    const float spacing = 4.f;
+    for (int x = 0; x < gridSize; x++) {
+        for (int z = 0; z < gridSize; z++) {
+            auto block = GameObject::createGameObject(device);
+            block.transform.rotation.x = pi<float> / 2;
+            block.transform.rotation.y = pi<float> * ((x + z) % 4) / 2;
+            block.transform.translation = { x * spacing, 0.f, z * spacing };
+            block.transform.scale = glm::vec3{ 1.5f };
+            block.model = room;
+            block.texture = roomTexture;
+            gameObjects.emplace(block.getId(), std::move(block));
+        }
+    }
+
+    std::cout << "lod benchmark: " << gridSize * gridSize << " objects, " << room->getLodCount() << " level(s) of detail\n";
+    for (uint32_t lod = 0; lod < room->getLodCount(); lod++) {
+        std::cout << "  lod " << lod << ": " << room->getTriangleCount(lod) << " triangles, error " << room->getLod(lod).error << "\n";
+    }
+
+    device.getAllocator().printStats();
 }
 
 void App::getFrameRate(float lastFrameTime)
@@ -6,6 +6,10 @@
 #include "Renderer.h"
 #include "descriptors.h"
 #include "TextOverlay.h"
+#include "AssetLoader.h"
+#include "MeshRegistry.h"
+#include "MipGenerator.h"
+#include "TextureRegistry.h"
 
 #include <memory>
 #include <vector>
@@ -17,7 +21,18 @@ public:
 	static constexpr int WIDTH = 1600;
 	static constexpr int HEIGHT = 1200;
 
-	App();
+	enum class Scene {
+		Default,
+		// a grid of a few hundred models seen from one end, rendered with and without levels of detail
+		LodBenchmark,
+	};
+
+	// mipMethod picks how the texture mip chains are made, to compare their load times.
+	// gpuDriven culls and draws the objects from a GpuScene when the device supports it,
+	// occlusionCulling adds the depth pyramid pass to it. clusterCulling culls the meshlets of the models
+	// drawn from the CPU, back faces included
+	App(Scene scene = Scene::Default, MipGenerator::Method mipMethod = MipGenerator::Method::Compute, bool gpuDriven = false, bool occlusionCulling = false,
+		bool clusterCulling = false);
 	~App();
 
 	App(const App&) = delete;
@@ -27,11 +42,21 @@ public:
 
 private:
 	void loadGameObjects();
+	void loadLodBenchmark();
 	void getFrameRate(float lastFrameTime);
 
 	Window window{ WIDTH, HEIGHT, "hello" };
 	Device device{ window };
 	Renderer renderer{ window, device };
+	// before the registries, its create steps refer to them and it is destroyed after them
+	AssetLoader assetLoader{ device };
+	MeshRegistry meshRegistry{ device, assetLoader };
+	TextureRegistry textureRegistry{ device, assetLoader };
+
+	Scene scene;
+	bool gpuDriven;
+	bool occlusionCulling;
+	bool clusterCulling;
 
 	std::unique_ptr<DescriptorPool> globalPool{};
 	GameObject::Map gameObjects;
@@ -0,0 +1,173 @@
+#include "AssetLoader.h"
+
+// std
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+AssetLoader::AssetLoader(Device& device, unsigned int threadCount) : device{ device }
+{
+	// the main thread keeps its core for rendering
+	if (threadCount == 0) {
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < threadCount; i++) {
+		workers.emplace_back(&AssetLoader::workerLoop, this);
+	}
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		stopping = true;
+	}
+	workAvailable.notify_all();
+
+	// reads still queued are dropped, their futures stay loading
+	for (auto& worker : workers) worker.join();
+}
+
+void AssetLoader::submit(std::function<void()> read, std::function<void(std::exception_ptr)> create)
+{
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		queued.push_back(Job{ std::move(read), std::move(create), nullptr });
+	}
+	pendingCount++;
+	workAvailable.notify_one();
+}
+
+void AssetLoader::workerLoop()
+{
+	for (;;) {
+		Job job{};
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock{ mutex };
+			workAvailable.wait(lock, [this]() { return stopping || !tasks.empty() || !queued.empty(); });
+			if (stopping) return;
+
+			// a parallelFor has its caller waiting on it
+			if (!tasks.empty()) {
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			else {
+				job = std::move(queued.front());
+				queued.pop_front();
+			}
+		}
+
+		if (task) {
+			task();
+			continue;
+		}
+
+		try {
+			job.read();
+		}
+		catch (...) {
+			job.error = std::current_exception();
+		}
+
+		// the read data is owned by the create step, the function is released here on the worker
+		job.read = nullptr;
+
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			finished.push_back(std::move(job));
+		}
+		workFinished.notify_all();
+	}
+}
+
+void AssetLoader::update()
+{
+	std::deque<Job> done;
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		done.swap(finished);
+	}
+
+	// a create step can submit new loads, they are picked up by the next update
+	for (auto& job : done) {
+		job.create(job.error);
+		pendingCount--;
+	}
+}
+
+void AssetLoader::waitIdle()
+{
+	while (pendingCount > 0) {
+		{
+			std::unique_lock<std::mutex> lock{ mutex };
+			workFinished.wait(lock, [this]() { return !finished.empty(); });
+		}
+		update();
+	}
+}
+
+void AssetLoader::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+	if (count == 0) return;
+
+	struct Shared {
+		std::atomic<size_t> next{ 0 };
+		size_t done = 0;
+		std::exception_ptr error;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	auto shared = std::make_shared<Shared>();
+
+	// every thread takes the next index until none is left. a worker that starts once they are all taken
+	// returns without touching body, the caller may have returned already
+	auto run = [shared, &body, count]() {
+		size_t done = 0;
+		std::exception_ptr error;
+		for (size_t i = shared->next++; i < count; i = shared->next++) {
+			try {
+				body(i);
+			}
+			catch (...) {
+				if (!error) error = std::current_exception();
+			}
+			done++;
+		}
+		if (done == 0) return;
+
+		std::lock_guard<std::mutex> lock{ shared->mutex };
+		shared->done += done;
+		if (error && !shared->error) shared->error = error;
+		shared->finished.notify_all();
+	};
+
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		size_t helpers = std::min(workers.size(), count - 1);
+		for (size_t i = 0; i < helpers; i++) tasks.push_back(run);
+	}
+	workAvailable.notify_all();
+
+	run();
+
+	std::unique_lock<std::mutex> lock{ shared->mutex };
+	shared->finished.wait(lock, [&shared, count]() { return shared->done == count; });
+	if (shared->error) std::rethrow_exception(shared->error);
+}
+
+void AssetLoader::report(std::exception_ptr error)
+{
+	try {
+		std::rethrow_exception(error);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "asset load failed: " << e.what() << "\n";
+	}
+	catch (...) {
+		std::cerr << "asset load failed\n";
+	}
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "Device.h"
+
+// std lib headers
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+
+	result of an asynchronous load. it is only touched on the main thread: the loader fills it in
+	AssetLoader::update, the asset can then be drawn once the upload batch it was recorded in is on
+	the graphics queue. copies share the same state
+
+*/
+template<class T>
+class AssetFuture
+{
+public:
+	AssetFuture() = default;
+
+	// an asset loaded before, usable once its upload batch is ready
+	static AssetFuture loaded(std::shared_ptr<T> value, const UploadContext& uploadContext, uint64_t uploadBatch) {
+		AssetFuture future = create();
+		future.state->value = std::move(value);
+		future.state->uploadContext = &uploadContext;
+		future.state->uploadBatch = uploadBatch;
+		return future;
+	}
+
+	bool valid() const { return state != nullptr; }
+
+	// still reading on a worker or waiting for its main thread step
+	bool isLoading() const { return state && !state->value && !state->failed; }
+	bool isFailed() const { return state && state->failed; }
+
+	// created, the upload may still be in flight
+	bool isLoaded() const { return state && state->value; }
+	bool isReady() const { return isLoaded() && state->uploadContext->isBatchReady(state->uploadBatch); }
+
+	// nullptr until the asset is ready
+	std::shared_ptr<T> get() const { return isReady() ? state->value : nullptr; }
+
+	uint64_t getUploadBatch() const { return state ? state->uploadBatch : 0; }
+
+private:
+	friend class AssetLoader;
+
+	struct State {
+		std::shared_ptr<T> value;
+		const UploadContext* uploadContext = nullptr;
+		uint64_t uploadBatch = 0;
+		bool failed = false;
+	};
+
+	static AssetFuture create() {
+		AssetFuture future{};
+		future.state = std::make_shared<State>();
+		return future;
+	}
+
+	std::shared_ptr<State> state;
+};
+
+/*
+
+	worker threads for the part of a load that does not need the device: reading, parsing,
+	decoding. every load is split in a read step, run on a worker, and a create step, run by
+	update on the main thread, which records the uploads in the current batch of the UploadContext.
+	the workers never touch Vulkan, so nothing but the UploadContext has to be synchronized
+
+	update is called once per frame before UploadContext::flush so the uploads of the assets
+	created that frame are submitted right away
+
+*/
+class AssetLoader
+{
+public:
+	// threadCount 0 = one per core, the main thread excepted
+	AssetLoader(Device& device, unsigned int threadCount = 0);
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	// read() runs on a worker and returns the data create(data) turns into the asset on the main thread,
+	// an exception thrown by either fails the future. the read result has to be default constructible
+	template<class T, class Read, class Create>
+	AssetFuture<T> load(Read read, Create create) {
+		using Data = decltype(read());
+
+		AssetFuture<T> future = AssetFuture<T>::create();
+		auto data = std::make_shared<Data>();
+
+		submit(
+			[data, read]() { *data = read(); },
+			[this, future, data, create](std::exception_ptr error) {
+				if (!error) {
+					try {
+						future.state->value = create(*data);
+						// after create, a full staging ring flushes and moves the last copies of the asset to a later batch
+						future.state->uploadContext = &device.getUploadContext();
+						future.state->uploadBatch = device.getUploadContext().getBatchId();
+					}
+					catch (...) {
+						error = std::current_exception();
+					}
+				}
+
+				if (error) {
+					future.state->value.reset();
+					future.state->failed = true;
+					report(error);
+				}
+			});
+
+		return future;
+	}
+
+	// runs the create steps of the reads finished since the last call
+	void update();
+
+	// blocks until every load submitted so far is created
+	void waitIdle();
+
+	// runs body(0) to body(count - 1) on the workers and the calling thread and returns once every index is
+	// done. it goes before the queued loads, the first exception thrown by body is rethrown at the end
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+	// loads submitted and not created yet
+	uint32_t getPendingCount() const { return pendingCount; }
+	unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+	struct Job {
+		std::function<void()> read;
+		std::function<void(std::exception_ptr)> create;
+		std::exception_ptr error;
+	};
+
+	void submit(std::function<void()> read, std::function<void(std::exception_ptr)> create);
+	void workerLoop();
+	static void report(std::exception_ptr error);
+
+	Device& device;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workFinished;
+	std::deque<Job> queued;
+	std::deque<Job> finished;
+	// shares of a parallelFor, picked before the queued loads
+	std::deque<std::function<void()>> tasks;
+	bool stopping = false;
+
+	// main thread only
+	uint32_t pendingCount = 0;
+};
@@ -9,8 +9,11 @@
  */
 
  // std
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <stdexcept>
 
 
 /**
@@ -37,15 +40,98 @@ Buffer::Buffer(Device& device, VkDeviceSize instanceSize, uint32_t instanceCount
     device.createBuffer(bufferSize, usageFlags, memoryPropertyFlags, buffer, memory);
 }
 
+/**
+    * Imports host memory as the memory of the buffer, through VK_EXT_external_memory_host
+    *
+    * @note The range is widened to the import alignment on both ends, it has to stay inside the
+    * allocation (eg the pages of a mapped file)
+    *
+    * @param hostPointer Start of the data, it is at getImportOffset() in the buffer
+    * @param size Size of the data
+    * @param usageFlags Usage of the buffer, usually VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    */
+Buffer::Buffer(Device& device, const void* hostPointer, VkDeviceSize size, VkBufferUsageFlags usageFlags)
+    : device{ device }, instanceSize{ size }, instanceCount{ 1 }, usageFlags{ usageFlags }, memoryPropertyFlags{ 0 }
+{
+    if (!device.hasExternalMemoryHost()) {
+        throw std::runtime_error("host memory import is not supported!");
+    }
+
+    VkDeviceSize importAlignment = device.getHostPointerAlignment();
+    uintptr_t address = reinterpret_cast<uintptr_t>(hostPointer);
+    uintptr_t alignedAddress = address & ~static_cast<uintptr_t>(importAlignment - 1);
+    void* alignedPointer = reinterpret_cast<void*>(alignedAddress);
+
+    importOffset = static_cast<VkDeviceSize>(address - alignedAddress);
+    alignmentSize = size;
+    bufferSize = getAlignment(importOffset + size, importAlignment);
+
+    uint32_t memoryTypes = device.getHostPointerMemoryTypes(alignedPointer);
+    if (memoryTypes == 0) {
+        throw std::runtime_error("failed to import host pointer!");
+    }
+
+    VkExternalMemoryBufferCreateInfo externalInfo{};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = &externalInfo;
+    bufferInfo.size = bufferSize;
+    bufferInfo.usage = usageFlags;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device.device(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create imported buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device.device(), buffer, &memRequirements);
+
+    // the imported range is all the memory there is, the buffer can't need more
+    uint32_t typeFilter = memRequirements.memoryTypeBits & memoryTypes;
+    if (typeFilter == 0 || memRequirements.size > bufferSize) {
+        vkDestroyBuffer(device.device(), buffer, nullptr);
+        throw std::runtime_error("failed to find memory type for imported buffer!");
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = alignedPointer;
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = bufferSize;
+    allocInfo.memoryTypeIndex = device.findMemoryType(typeFilter, 0);
+
+    if (vkAllocateMemory(device.device(), &allocInfo, nullptr, &importedMemory) != VK_SUCCESS) {
+        vkDestroyBuffer(device.device(), buffer, nullptr);
+        throw std::runtime_error("failed to import host memory!");
+    }
+
+    vkBindBufferMemory(device.device(), buffer, importedMemory, 0);
+}
+
 Buffer::~Buffer() {
     unmap();
-    vkDestroyBuffer(device.device(), buffer, nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+
+    if (importedMemory != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device.device(), buffer, nullptr);
+        vkFreeMemory(device.device(), importedMemory, nullptr);
+        return;
+    }
+
+    device.destroyBuffer(buffer, memory);
 }
 
 /**
     * Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
     *
+    * @note Host visible memory blocks stay mapped by the allocator, this only points mapped inside the block
+    *
     * @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete
     * buffer range.
     * @param offset (Optional) Byte offset from beginning
@@ -53,28 +139,33 @@ Buffer::~Buffer() {
     * @return VkResult of the buffer mapping call
     */
 VkResult Buffer::map(VkDeviceSize size, VkDeviceSize offset) {
-    assert(buffer && memory && "Called map on buffer before create");
-    return vkMapMemory(device.device(), memory, offset, size, 0, &mapped);
+    assert(buffer && memory.memory && "Called map on buffer before create");
+    if (memory.mapped == nullptr) {
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+    // the range has to be inside the buffer, like vkMapMemory inside the memory
+    if (offset >= bufferSize || (size != VK_WHOLE_SIZE && size > bufferSize - offset)) {
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+
+    mapped = static_cast<char*>(memory.mapped) + offset;
+    return VK_SUCCESS;
 }
 
 /**
     * Unmap a mapped memory range
     *
-    * @note Does not return a result as vkUnmapMemory can't fail
+    * @note The allocator keeps the memory block mapped, only the pointer of this buffer is cleared
     */
 void Buffer::unmap() {
-    if (mapped) {
-        vkUnmapMemory(device.device(), memory);
-        mapped = nullptr;
-    }
+    mapped = nullptr;
 }
 
 /**
     * Copies the specified data to the mapped buffer. Default value writes whole buffer range
     *
     * @param data Pointer to the data to copy
-    * @param size (Optional) Size of the data to copy. Pass VK_WHOLE_SIZE to flush the complete buffer
-    * range.
+    * @param size (Optional) Size of the data to copy. Pass VK_WHOLE_SIZE to copy the whole buffer.
     * @param offset (Optional) Byte offset from beginning of mapped region
     *
     */
@@ -91,43 +182,71 @@ void Buffer::writeToBuffer(void* data, VkDeviceSize size, VkDeviceSize offset) {
     }
 }
 
+/**
+    * Returns the memory range of a part of the buffer, widened to nonCoherentAtomSize
+    *
+    * @note The memory block is shared with other buffers, the range never leaves the allocation of this one
+    *
+    * @param size Size of the part. VK_WHOLE_SIZE is the rest of the buffer from offset
+    * @param offset Byte offset from beginning
+    *
+    * @return VkMappedMemoryRange for vkFlushMappedMemoryRanges or vkInvalidateMappedMemoryRanges
+    */
+VkMappedMemoryRange Buffer::getMappedRange(VkDeviceSize size, VkDeviceSize offset) const {
+    if (size == VK_WHOLE_SIZE) {
+        size = bufferSize - offset;
+    }
+
+    // the allocation starts and ends on a multiple of the atom
+    VkDeviceSize atomSize = device.properties.limits.nonCoherentAtomSize;
+    VkDeviceSize start = offset / atomSize * atomSize;
+    VkDeviceSize end = std::min((offset + size + atomSize - 1) / atomSize * atomSize, memory.size);
+
+    VkMappedMemoryRange mappedRange = {};
+    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    mappedRange.memory = memory.memory;
+    mappedRange.offset = memory.offset + start;
+    mappedRange.size = end - start;
+    return mappedRange;
+}
+
 /**
     * Flush a memory range of the buffer to make it visible to the device
     *
-    * @note Only required for non-coherent memory
+    * @note Only required for non-coherent memory, does nothing otherwise
     *
     * @param size (Optional) Size of the memory range to flush. Pass VK_WHOLE_SIZE to flush the
-    * complete buffer range.
+    * rest of the buffer from offset. The range is rounded out to nonCoherentAtomSize.
     * @param offset (Optional) Byte offset from beginning
     *
     * @return VkResult of the flush call
     */
 VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset) {
-    VkMappedMemoryRange mappedRange = {};
-    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    mappedRange.memory = memory;
-    mappedRange.offset = offset;
-    mappedRange.size = size;
+    if (!memory.nonCoherent) {
+        return VK_SUCCESS;
+    }
+
+    VkMappedMemoryRange mappedRange = getMappedRange(size, offset);
     return vkFlushMappedMemoryRanges(device.device(), 1, &mappedRange);
 }
 
 /**
     * Invalidate a memory range of the buffer to make it visible to the host
     *
-    * @note Only required for non-coherent memory
+    * @note Only required for non-coherent memory, does nothing otherwise
     *
     * @param size (Optional) Size of the memory range to invalidate. Pass VK_WHOLE_SIZE to invalidate
-    * the complete buffer range.
+    * the rest of the buffer from offset. The range is rounded out to nonCoherentAtomSize.
     * @param offset (Optional) Byte offset from beginning
     *
     * @return VkResult of the invalidate call
     */
 VkResult Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset) {
-    VkMappedMemoryRange mappedRange = {};
-    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    mappedRange.memory = memory;
-    mappedRange.offset = offset;
-    mappedRange.size = size;
+    if (!memory.nonCoherent) {
+        return VK_SUCCESS;
+    }
+
+    VkMappedMemoryRange mappedRange = getMappedRange(size, offset);
     return vkInvalidateMappedMemoryRanges(device.device(), 1, &mappedRange);
 }
 
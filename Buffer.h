@@ -12,6 +12,14 @@ public:
         VkBufferUsageFlags usageFlags,
         VkMemoryPropertyFlags memoryPropertyFlags,
         VkDeviceSize minOffsetAlignment = 1);
+
+    // imports host memory through VK_EXT_external_memory_host, throws when the device can't import it.
+    // the memory has to stay valid until the buffer is destroyed
+    Buffer(
+        Device& device,
+        const void* hostPointer,
+        VkDeviceSize size,
+        VkBufferUsageFlags usageFlags);
     ~Buffer();
 
     Buffer(const Buffer&) = delete;
@@ -39,13 +47,21 @@ public:
     VkMemoryPropertyFlags getMemoryPropertyFlags() const { return memoryPropertyFlags; }
     VkDeviceSize getBufferSize() const { return bufferSize; }
 
+    // where hostPointer is in an imported buffer, its start is rounded down to the import alignment
+    VkDeviceSize getImportOffset() const { return importOffset; }
+
 private:
     static VkDeviceSize getAlignment(VkDeviceSize instanceSize, VkDeviceSize minOffsetAlignment);
+    VkMappedMemoryRange getMappedRange(VkDeviceSize size, VkDeviceSize offset) const;
 
     Device& device;
     void* mapped = nullptr;
     VkBuffer buffer = VK_NULL_HANDLE;
-    VkDeviceMemory memory = VK_NULL_HANDLE;
+    MemoryAllocation memory{};
+
+    // imported memory is not from the allocator
+    VkDeviceMemory importedMemory = VK_NULL_HANDLE;
+    VkDeviceSize importOffset = 0;
 
     VkDeviceSize bufferSize;
     uint32_t instanceCount;
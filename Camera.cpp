@@ -101,3 +101,26 @@ void Camera::setViewYXZ(glm::vec3 position, glm::vec3 rotation) {
     inverseViewMatrix[3][1] = position.y;
     inverseViewMatrix[3][2] = position.z;
 }
+
+std::array<glm::vec4, 6> Camera::getFrustumPlanes() const {
+    // rows of projection * view (Gribb / Hartmann), the depth range is [0, 1] so near is the third row alone
+    glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    std::array<glm::vec4, 6> planes{
+        rows[3] + rows[0],
+        rows[3] - rows[0],
+        rows[3] + rows[1],
+        rows[3] - rows[1],
+        rows[2],
+        rows[3] - rows[2],
+    };
+
+    for (auto& plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return planes;
+}
@@ -5,6 +5,8 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 
+#include <array>
+
 class Camera
 {
 public:
@@ -20,6 +22,10 @@ public:
 	const glm::mat4& getInverseView() const { return inverseViewMatrix; }
 	const glm::vec3 getPosition() const { return glm::vec3(inverseViewMatrix[3]); }
 
+	// world space planes left, right, top, bottom, near, far with normalized normals pointing inside:
+	// a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+	std::array<glm::vec4, 6> getFrustumPlanes() const;
+
 
 private:
 	glm::mat4 projectionMatrix{ 1.f };
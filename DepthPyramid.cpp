@@ -0,0 +1,255 @@
+#include "DepthPyramid.h"
+
+#include "Device.h"
+
+// std
+#include <algorithm>
+#include <stdexcept>
+
+DepthPyramid::DepthPyramid(Device& device) : device{ device }
+{
+	createResources();
+}
+
+DepthPyramid::~DepthPyramid()
+{
+	for (auto& frame : frames) destroy(frame);
+
+	if (sampler != VK_NULL_HANDLE) vkDestroySampler(device.device(), sampler, nullptr);
+
+	pipeline = nullptr;
+	if (pipelineLayout != VK_NULL_HANDLE) vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr);
+}
+
+void DepthPyramid::createResources()
+{
+	levelSetLayout = DescriptorSetLayout::Builder(device)
+		.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build();
+
+	readSetLayout = DescriptorSetLayout::Builder(device)
+		.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build();
+
+	// a set per level and the one of the whole pyramid
+	for (auto& frame : frames) {
+		frame.descriptorPool = DescriptorPool::Builder(device)
+			.setMaxSets(MAX_LEVELS + 1)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_LEVELS + 1)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS)
+			.build();
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PushConstants);
+
+	VkDescriptorSetLayout descriptorSetLayout = levelSetLayout->getDescriptorSetLayout();
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid pipeline layout");
+	}
+
+	// texelFetch ignores the filter, the sampler is only there for the descriptors
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(device.device(), &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid sampler");
+	}
+
+	pipeline = std::make_unique<ComputePipeline>(device, "depth_pyramid.comp.spv", pipelineLayout);
+}
+
+void DepthPyramid::create(FrameResources& frame, VkExtent2D size)
+{
+	uint32_t levelCount = 1;
+	while (levelCount < MAX_LEVELS && (std::max(size.width, size.height) >> levelCount) > 0) levelCount++;
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = size.width;
+	imageInfo.extent.height = size.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = levelCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.image, frame.memory);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = frame.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+
+	if (vkCreateImageView(device.device(), &viewInfo, nullptr, &frame.view) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid view");
+	}
+
+	frame.levelViews.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		if (vkCreateImageView(device.device(), &viewInfo, nullptr, &frame.levelViews[level]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create depth pyramid level view");
+		}
+	}
+
+	frame.size = size;
+
+	// level 0 reads the depth attachment, its source is written by build
+	frame.descriptorPool->resetPool();
+	frame.levelSets.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkDescriptorImageInfo sourceInfo{ sampler, frame.levelViews[level > 0 ? level - 1 : 0], VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo levelInfo{ VK_NULL_HANDLE, frame.levelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+
+		DescriptorWriter(*levelSetLayout, *frame.descriptorPool)
+			.writeImage(0, &sourceInfo)
+			.writeImage(1, &levelInfo)
+			.build(frame.levelSets[level]);
+	}
+
+	VkDescriptorImageInfo pyramidInfo{ sampler, frame.view, VK_IMAGE_LAYOUT_GENERAL };
+	DescriptorWriter(*readSetLayout, *frame.descriptorPool)
+		.writeImage(0, &pyramidInfo)
+		.build(frame.readSet);
+}
+
+void DepthPyramid::destroy(FrameResources& frame)
+{
+	for (auto levelView : frame.levelViews) vkDestroyImageView(device.device(), levelView, nullptr);
+	frame.levelViews.clear();
+
+	if (frame.view != VK_NULL_HANDLE) vkDestroyImageView(device.device(), frame.view, nullptr);
+	frame.view = VK_NULL_HANDLE;
+
+	if (frame.image != VK_NULL_HANDLE) device.destroyImage(frame.image, frame.memory);
+	frame.image = VK_NULL_HANDLE;
+}
+
+void DepthPyramid::build(VkCommandBuffer commandBuffer, int frameIndex, const Source& depth)
+{
+	FrameResources& frame = frames[frameIndex];
+
+	// the frame in flight that used this pyramid is done, a resize went through vkDeviceWaitIdle
+	VkExtent2D size{ std::max(1u, (depth.extent.width + 1) / 2), std::max(1u, (depth.extent.height + 1) / 2) };
+	if (frame.image == VK_NULL_HANDLE || frame.size.width != size.width || frame.size.height != size.height) {
+		destroy(frame);
+		create(frame, size);
+	}
+	uint32_t levelCount = static_cast<uint32_t>(frame.levelViews.size());
+
+	// the depth attachment can change with the swap chain image
+	VkDescriptorImageInfo depthInfo{ sampler, depth.view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+	VkDescriptorImageInfo firstLevelInfo{ VK_NULL_HANDLE, frame.levelViews[0], VK_IMAGE_LAYOUT_GENERAL };
+	DescriptorWriter(*levelSetLayout, *frame.descriptorPool)
+		.writeImage(0, &depthInfo)
+		.writeImage(1, &firstLevelInfo)
+		.overwrite(frame.levelSets[0]);
+
+	bool stencil = depth.format == VK_FORMAT_D32_SFLOAT_S8_UINT || depth.format == VK_FORMAT_D24_UNORM_S8_UINT;
+	VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | (stencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+
+	// the depth written by the first render pass is sampled, the previous content of the pyramid is dropped
+	VkImageMemoryBarrier barriers[2]{};
+	barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[0].image = depth.image;
+	barriers[0].subresourceRange = { depthAspect, 0, 1, 0, 1 };
+
+	barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[1].srcAccessMask = 0;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barriers[1].image = frame.image;
+	barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		2, barriers);
+
+	pipeline->bind(commandBuffer);
+
+	VkImageMemoryBarrier levelBarrier{};
+	levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	levelBarrier.image = frame.image;
+
+	// each level is read by the next dispatch and by the culling after the last one
+	VkExtent2D sourceSize = depth.extent;
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkExtent2D levelSize{ std::max(1u, size.width >> level), std::max(1u, size.height >> level) };
+
+		PushConstants push{};
+		push.sourceSize[0] = static_cast<int32_t>(sourceSize.width);
+		push.sourceSize[1] = static_cast<int32_t>(sourceSize.height);
+		push.size[0] = static_cast<int32_t>(levelSize.width);
+		push.size[1] = static_cast<int32_t>(levelSize.height);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.levelSets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+		vkCmdDispatch(commandBuffer, (levelSize.width + 7) / 8, (levelSize.height + 7) / 8, 1);
+
+		levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+
+		sourceSize = levelSize;
+	}
+
+	// back to the attachment layout for the second render pass
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	barriers[0].srcAccessMask = 0;
+	barriers[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barriers[0]);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+#include "Pipeline.h"
+#include "Swap_chain.h"
+#include "descriptors.h"
+
+#include <vulkan/vulkan.h>
+
+// std lib headers
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Device;
+
+/*
+
+	the hierarchical depth of a frame for the occlusion culling: level 0 is half the size of the depth
+	attachment, rounded up, and every texel holds the farthest depth of the texels it covers. each level
+	after it halves the one above the same way (depth_pyramid.comp, one dispatch per level), the last
+	texel of a row or column also takes the one left over by an odd size. so texel t of level l holds the
+	pixels [2^(l+1) * t, 2^(l+1) * (t + 1)), and the last texel everything after them
+
+	one pyramid per frame in flight, made again when the size of the depth attachment changes. it stays
+	in VK_IMAGE_LAYOUT_GENERAL and is read with texelFetch
+
+*/
+class DepthPyramid
+{
+public:
+	static constexpr uint32_t MAX_LEVELS = 16;
+
+	struct Source {
+		VkImage image = VK_NULL_HANDLE;
+		// depth aspect only
+		VkImageView view = VK_NULL_HANDLE;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+	};
+
+	DepthPyramid(Device& device);
+	~DepthPyramid();
+
+	DepthPyramid(const DepthPyramid&) = delete;
+	DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+	// outside of a render pass, the depth attachment is in DEPTH_STENCIL_ATTACHMENT_OPTIMAL before and after.
+	// the levels are ready for the compute shaders recorded after it
+	void build(VkCommandBuffer commandBuffer, int frameIndex, const Source& depth);
+
+	// one combined image sampler at binding 0, the whole pyramid of the frame
+	DescriptorSetLayout& getSetLayout() { return *readSetLayout; }
+	VkDescriptorSet getDescriptorSet(int frameIndex) const { return frames[frameIndex].readSet; }
+
+private:
+	struct PushConstants {
+		int32_t sourceSize[2];
+		int32_t size[2];
+	};
+
+	struct FrameResources {
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation memory{};
+		VkImageView view = VK_NULL_HANDLE;
+		std::vector<VkImageView> levelViews;
+		VkExtent2D size{};
+
+		// the sets are written again when the pyramid is made again, the one of level 0 every build
+		std::unique_ptr<DescriptorPool> descriptorPool;
+		std::vector<VkDescriptorSet> levelSets;
+		VkDescriptorSet readSet = VK_NULL_HANDLE;
+	};
+
+	void createResources();
+	void create(FrameResources& frame, VkExtent2D size);
+	void destroy(FrameResources& frame);
+
+	Device& device;
+
+	std::unique_ptr<DescriptorSetLayout> levelSetLayout;
+	std::unique_ptr<DescriptorSetLayout> readSetLayout;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> pipeline;
+	VkSampler sampler = VK_NULL_HANDLE;
+
+	std::vector<FrameResources> frames{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+};
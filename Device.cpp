@@ -1,7 +1,11 @@
 #include "Device.h"
 
+#include "MipGenerator.h"
+
 // std headers
+#include <algorithm>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <set>
 #include <unordered_set>
@@ -53,11 +57,26 @@ Device::Device(Window& window) : window{ window } {
     createSurface();
     pickPhysicalDevice();
     createLogicalDevice();
+    allocator = std::make_unique<MemoryAllocator>(device_, physicalDevice);
     createCommandPool();
+    createPipelineCache();
+    uploadContext = std::make_unique<UploadContext>(*this);
 }
 
 Device::~Device() {
+    // the upload context waits for its batches, the mip generator releases what they used after that
+    uploadContext = nullptr;
+    mipGenerator = nullptr;
+
+    savePipelineCache();
+    vkDestroyPipelineCache(device_, pipelineCache, nullptr);
+
     vkDestroyCommandPool(device_, commandPool, nullptr);
+    vkDestroyCommandPool(device_, transferCommandPool, nullptr);
+
+    allocator->printStats();
+    allocator = nullptr;
+
     vkDestroyDevice(device_, nullptr);
 
     if (enableValidationLayers) {
@@ -79,7 +98,8 @@ void Device::createInstance() {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // 1.1 for the features2 / properties2 queries of the optional device extensions
+    appInfo.apiVersion = VK_API_VERSION_1_1;
 
     VkInstanceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -139,6 +159,9 @@ void Device::createLogicalDevice() {
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+    if (indices.hasDedicatedTransfer()) {
+        uniqueQueueFamilies.insert(indices.transferFamily);
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -150,18 +173,67 @@ void Device::createLogicalDevice() {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+    // indirect draws of the culled clusters: many draws per call, each with its own first instance
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+
+    // block compressed formats the .basis / .ktx2 textures are transcoded to
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+    deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+
+    std::vector<const char*> extensions = deviceExtensions;
+
+    // host image copy, with the two extensions it depends on
+    VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures{};
+    hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+
+    if (properties.apiVersion >= VK_API_VERSION_1_1 &&
+        isDeviceExtensionSupported(physicalDevice, VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) &&
+        isDeviceExtensionSupported(physicalDevice, VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME) &&
+        isDeviceExtensionSupported(physicalDevice, VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &hostImageCopyFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+        hostImageCopy = hostImageCopyFeatures.hostImageCopy == VK_TRUE;
+    }
+    if (hostImageCopy) {
+        extensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME);
+    }
+
+    // importing host memory, VK_KHR_external_memory it builds on is core in 1.1
+    externalMemoryHost = properties.apiVersion >= VK_API_VERSION_1_1 &&
+        isDeviceExtensionSupported(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    if (externalMemoryHost) {
+        extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+
+    // draws whose count is written by a compute pass, core in 1.2
+    drawIndirectCount = isDeviceExtensionSupported(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawIndirectCount) {
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = hostImageCopy ? &hostImageCopyFeatures : nullptr;
 
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
     createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     // might not really be necessary anymore because device specific validation layers
     // have been deprecated
@@ -176,9 +248,60 @@ void Device::createLogicalDevice() {
     if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device_) != VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
     }
+    enabledFeatures = deviceFeatures;
+
+    if (hostImageCopy) {
+        copyMemoryToImageEXT = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(device_, "vkCopyMemoryToImageEXT");
+        transitionImageLayoutEXT = (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(device_, "vkTransitionImageLayoutEXT");
+
+        // the layouts an image can be in while the host copies to it, counted first
+        VkPhysicalDeviceHostImageCopyPropertiesEXT hostImageCopyProperties{};
+        hostImageCopyProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &hostImageCopyProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        hostCopyDstLayouts.resize(hostImageCopyProperties.copyDstLayoutCount);
+        hostImageCopyProperties.pCopyDstLayouts = hostCopyDstLayouts.data();
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        hostImageCopy = copyMemoryToImageEXT != nullptr && transitionImageLayoutEXT != nullptr;
+    }
+    std::cout << "host image copy: " << (hostImageCopy ? "enabled" : "not supported, textures use the staging ring") << std::endl;
+
+    if (externalMemoryHost) {
+        getMemoryHostPointerPropertiesEXT = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(device_, "vkGetMemoryHostPointerPropertiesEXT");
+
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT externalMemoryHostProperties{};
+        externalMemoryHostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &externalMemoryHostProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        hostPointerAlignment = externalMemoryHostProperties.minImportedHostPointerAlignment;
+        externalMemoryHost = getMemoryHostPointerPropertiesEXT != nullptr && hostPointerAlignment > 0;
+    }
+    std::cout << "external memory host: " << (externalMemoryHost ? "enabled" : "not supported, meshes use the staging ring") << std::endl;
+
+    if (drawIndirectCount) {
+        drawIndexedIndirectCountKHR = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device_, "vkCmdDrawIndexedIndirectCountKHR");
+        drawIndirectCount = drawIndexedIndirectCountKHR != nullptr;
+    }
 
     vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
     vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+
+    dedicatedTransferQueue = indices.hasDedicatedTransfer();
+    if (dedicatedTransferQueue) {
+        vkGetDeviceQueue(device_, indices.transferFamily, 0, &transferQueue_);
+        std::cout << "transfer queue: dedicated family " << indices.transferFamily << std::endl;
+    }
+    else {
+        transferQueue_ = graphicsQueue_;
+        std::cout << "transfer queue: no dedicated family, uploads use the graphics queue" << std::endl;
+    }
 }
 
 void Device::createCommandPool() {
@@ -193,6 +316,91 @@ void Device::createCommandPool() {
     if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create command pool!");
     }
+
+    poolInfo.queueFamilyIndex = dedicatedTransferQueue ? queueFamilyIndices.transferFamily : queueFamilyIndices.graphicsFamily;
+
+    if (vkCreateCommandPool(device_, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transfer command pool!");
+    }
+}
+
+MipGenerator& Device::getMipGenerator() {
+    if (!mipGenerator) mipGenerator = std::make_unique<MipGenerator>(*this);
+    return *mipGenerator;
+}
+
+/*
+
+    load the pipeline cache saved by a previous run, the data is only kept if it was
+    produced by the same driver on the same physical device
+
+*/
+void Device::createPipelineCache() {
+    std::vector<char> cacheData;
+
+    std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        cacheData.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(cacheData.data(), cacheData.size());
+        file.close();
+    }
+
+    // header layout is defined by VkPipelineCacheHeaderVersionOne
+    bool valid = cacheData.size() >= sizeof(VkPipelineCacheHeaderVersionOne);
+    if (valid) {
+        VkPipelineCacheHeaderVersionOne header;
+        memcpy(&header, cacheData.data(), sizeof(header));
+
+        valid = header.headerSize >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+            header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == properties.vendorID &&
+            header.deviceID == properties.deviceID &&
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    if (valid) {
+        std::cout << "pipeline cache: loaded " << cacheData.size() << " bytes from " << PIPELINE_CACHE_PATH << std::endl;
+    }
+    else {
+        if (!cacheData.empty()) {
+            std::cout << "pipeline cache: " << PIPELINE_CACHE_PATH << " was created by another device or driver, discarded" << std::endl;
+        }
+        else {
+            std::cout << "pipeline cache: no cache found, cold start" << std::endl;
+        }
+        cacheData.clear();
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = cacheData.size();
+    cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+    if (vkCreatePipelineCache(device_, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+}
+
+void Device::savePipelineCache() {
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device_, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+        return;
+    }
+
+    std::vector<char> cacheData(dataSize);
+    if (vkGetPipelineCacheData(device_, pipelineCache, &dataSize, cacheData.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    std::ofstream file(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "pipeline cache: failed to write " << PIPELINE_CACHE_PATH << std::endl;
+        return;
+    }
+
+    file.write(cacheData.data(), dataSize);
+    file.close();
 }
 
 void Device::createSurface() { window.createWindowSurface(instance, &surface_); }
@@ -319,6 +527,19 @@ bool Device::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     return requiredExtensions.empty();
 }
 
+bool Device::isDeviceExtensionSupported(VkPhysicalDevice device, const char* extension) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& available : availableExtensions) {
+        if (strcmp(available.extensionName, extension) == 0) return true;
+    }
+    return false;
+}
+
 QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
     QueueFamilyIndices indices;
 
@@ -347,6 +568,22 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
         i++;
     }
 
+    // prefer a transfer only family (copy engine), then any family without graphics
+    i = 0;
+    for (const auto& queueFamily : queueFamilies) {
+        bool transfer = queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT);
+        bool graphics = queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+        bool compute = queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT;
+
+        if (transfer && !graphics && (!compute || !indices.transferFamilyHasValue)) {
+            indices.transferFamily = i;
+            indices.transferFamilyHasValue = true;
+            if (!compute) break;
+        }
+
+        i++;
+    }
+
     return indices;
 }
 
@@ -393,6 +630,66 @@ VkFormat Device::findSupportedFormat(
     throw std::runtime_error("failed to find supported format!");
 }
 
+bool Device::isHostImageCopySupported(VkFormat format, VkImageLayout layout)
+{
+    if (!hostImageCopy || std::find(hostCopyDstLayouts.begin(), hostCopyDstLayouts.end(), layout) == hostCopyDstLayouts.end()) {
+        return false;
+    }
+
+    VkPhysicalDeviceImageFormatInfo2 formatInfo{};
+    formatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+    formatInfo.format = format;
+    formatInfo.type = VK_IMAGE_TYPE_2D;
+    formatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    formatInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+
+    VkHostImageCopyDevicePerformanceQueryEXT performance{};
+    performance.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT;
+    VkImageFormatProperties2 formatProperties{};
+    formatProperties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+    formatProperties.pNext = &performance;
+
+    if (vkGetPhysicalDeviceImageFormatProperties2(physicalDevice, &formatInfo, &formatProperties) != VK_SUCCESS) {
+        return false;
+    }
+
+    // some devices drop the compression of images the host can write, sampling them would get slower
+    return performance.optimalDeviceAccess == VK_TRUE;
+}
+
+void Device::copyMemoryToImage(const VkCopyMemoryToImageInfoEXT& copyInfo)
+{
+    if (copyMemoryToImageEXT(device_, &copyInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to copy memory to image!");
+    }
+}
+
+void Device::transitionImageLayoutOnHost(const VkHostImageLayoutTransitionInfoEXT& transition)
+{
+    if (transitionImageLayoutEXT(device_, 1, &transition) != VK_SUCCESS) {
+        throw std::runtime_error("failed to transition image layout on the host!");
+    }
+}
+
+void Device::cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride)
+{
+    drawIndexedIndirectCountKHR(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+}
+
+uint32_t Device::getHostPointerMemoryTypes(const void* hostPointer)
+{
+    if (!externalMemoryHost) return 0;
+
+    VkMemoryHostPointerPropertiesEXT hostPointerProperties{};
+    hostPointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+
+    // some drivers refuse read only mappings, the caller then stages the data
+    if (getMemoryHostPointerPropertiesEXT(device_, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostPointer, &hostPointerProperties) != VK_SUCCESS) {
+        return 0;
+    }
+    return hostPointerProperties.memoryTypeBits;
+}
+
 bool Device::isFormatSupported(const VkFormat candidate)
 {
     VkFormatProperties formatProperties;
@@ -401,16 +698,7 @@ bool Device::isFormatSupported(const VkFormat candidate)
 }
 
 uint32_t Device::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
+    return allocator->findMemoryType(typeFilter, properties);
 }
 
 VkSampleCountFlagBits Device::getMaxUsableSampleCount(VkPhysicalDeviceProperties properties)
@@ -431,7 +719,7 @@ void Device::createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer& buffer,
-    VkDeviceMemory& bufferMemory) {
+    MemoryAllocation& bufferMemory) {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
@@ -445,16 +733,17 @@ void Device::createBuffer(
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    bufferMemory = allocator->allocate(memRequirements, properties, true);
 
-    if (vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate vertex buffer memory!");
+    if (vkBindBufferMemory(device_, buffer, bufferMemory.memory, bufferMemory.offset) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind vertex buffer memory!");
     }
+}
 
-    vkBindBufferMemory(device_, buffer, bufferMemory, 0);
+void Device::destroyBuffer(VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+    vkDestroyBuffer(device_, buffer, nullptr);
+    allocator->free(bufferMemory);
+    buffer = VK_NULL_HANDLE;
 }
 
 VkCommandBuffer Device::beginSingleTimeCommands() {
@@ -539,7 +828,7 @@ void Device::createImageWithInfo(
     const VkImageCreateInfo& imageInfo,
     VkMemoryPropertyFlags properties,
     VkImage& image,
-    VkDeviceMemory& imageMemory) 
+    MemoryAllocation& imageMemory) 
     {
 
     if (vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS) {
@@ -549,16 +838,15 @@ void Device::createImageWithInfo(
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device_, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    imageMemory = allocator->allocate(memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR);
 
-    if (vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    if (vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS) {
+    if (vkBindImageMemory(device_, image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS) {
         throw std::runtime_error("failed to bind image memory!");
     }
+}
+
+void Device::destroyImage(VkImage& image, MemoryAllocation& imageMemory) {
+    vkDestroyImage(device_, image, nullptr);
+    allocator->free(imageMemory);
+    image = VK_NULL_HANDLE;
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 
 #include "Window.h"
+#include "MemoryAllocator.h"
+#include "UploadContext.h"
 
 // std lib headers
+#include <memory>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
 
+class MipGenerator;
 
 struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -17,9 +21,14 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
     uint32_t graphicsFamily;
     uint32_t presentFamily;
+    uint32_t transferFamily;
     bool graphicsFamilyHasValue = false;
     bool presentFamilyHasValue = false;
+    bool transferFamilyHasValue = false;
     bool isComplete() const { return graphicsFamilyHasValue && presentFamilyHasValue; }
+
+    // transferFamily is a family without graphics support, so copies can run beside rendering
+    bool hasDedicatedTransfer() const { return transferFamilyHasValue && transferFamily != graphicsFamily; }
 };
 
 class Device {
@@ -42,11 +51,24 @@ public:
     Device& operator=(Device&&) = delete;
     
     VkCommandPool getCommandPool() const { return commandPool; }
+    VkCommandPool getTransferCommandPool() const { return transferCommandPool; }
+    VkPipelineCache getPipelineCache() const { return pipelineCache; }
+    // read when the device is created and written back when it is destroyed
+    static constexpr const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+    MemoryAllocator& getAllocator() { return *allocator; }
+    UploadContext& getUploadContext() { return *uploadContext; }
+
+    // created on first use, it loads its compute shader
+    MipGenerator& getMipGenerator();
     VkDevice device() const { return device_; }
     VkSurfaceKHR surface() const { return surface_; }
     VkQueue graphicsQueue() const { return graphicsQueue_; }
     VkQueue presentQueue() const { return presentQueue_; }
 
+    // falls back on the graphics queue when the device has no dedicated transfer family
+    VkQueue transferQueue() const { return transferQueue_; }
+    bool hasDedicatedTransferQueue() const { return dedicatedTransferQueue; }
+
     VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
     SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physicalDevice); }
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
@@ -54,15 +76,40 @@ public:
     QueueFamilyIndices findPhysicalQueueFamilies() { return findQueueFamilies(physicalDevice); }
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
     void getPhysicalFeatures(VkPhysicalDeviceFeatures* pFeatures) { vkGetPhysicalDeviceFeatures(physicalDevice, pFeatures); }
+
+    // optional features are enabled when the device has them
+    const VkPhysicalDeviceFeatures& getEnabledFeatures() const { return enabledFeatures; }
     bool isFormatSupported(const VkFormat candidate);
 
+    // VK_EXT_host_image_copy, enabled when the device has it: optimal tiled images are written straight
+    // from host memory, without staging buffer nor queue submission
+    bool hasHostImageCopy() const { return hostImageCopy; }
+    // a sampled image of the format can be host copied in that layout, at full device access speed
+    bool isHostImageCopySupported(VkFormat format, VkImageLayout layout);
+    void copyMemoryToImage(const VkCopyMemoryToImageInfoEXT& copyInfo);
+    void transitionImageLayoutOnHost(const VkHostImageLayoutTransitionInfoEXT& transition);
+
+    // VK_EXT_external_memory_host, enabled when the device has it: host memory such as a mapped file
+    // is imported as device memory and the GPU copies from it, without going through the staging ring
+    bool hasExternalMemoryHost() const { return externalMemoryHost; }
+    // imported pointers and sizes are a multiple of it
+    VkDeviceSize getHostPointerAlignment() const { return hostPointerAlignment; }
+    // memory types the pointer can be imported as, 0 when it cannot be imported
+    uint32_t getHostPointerMemoryTypes(const void* hostPointer);
+
+    // VK_KHR_draw_indirect_count, enabled when the device has it: the draw count is read from a buffer
+    bool hasDrawIndirectCount() const { return drawIndirectCount; }
+    void cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride);
+
     // Buffer Helper Functions
     void createBuffer(
         VkDeviceSize size,
         VkBufferUsageFlags usage,
         VkMemoryPropertyFlags properties,
         VkBuffer& buffer,
-        VkDeviceMemory& bufferMemory);
+        MemoryAllocation& bufferMemory);
+
+    void destroyBuffer(VkBuffer& buffer, MemoryAllocation& bufferMemory);
 
     VkCommandBuffer beginSingleTimeCommands();
 
@@ -75,7 +122,9 @@ public:
         const VkImageCreateInfo& imageInfo,
         VkMemoryPropertyFlags properties,
         VkImage& image,
-        VkDeviceMemory& imageMemory);
+        MemoryAllocation& imageMemory);
+
+    void destroyImage(VkImage& image, MemoryAllocation& imageMemory);
 
     VkPhysicalDeviceProperties properties;
 
@@ -86,6 +135,8 @@ private:
     void pickPhysicalDevice();
     void createLogicalDevice();
     void createCommandPool();
+    void createPipelineCache();
+    void savePipelineCache();
 
     // helper functions
     bool isDeviceSuitable(VkPhysicalDevice device);
@@ -95,6 +146,7 @@ private:
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
     void hasGflwRequiredInstanceExtensions();
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+    bool isDeviceExtensionSupported(VkPhysicalDevice device, const char* extension);
     SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 
     VkInstance instance;
@@ -102,11 +154,31 @@ private:
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     Window& window;
     VkCommandPool commandPool;
+    VkCommandPool transferCommandPool;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    std::unique_ptr<MemoryAllocator> allocator;
+    std::unique_ptr<UploadContext> uploadContext;
+    std::unique_ptr<MipGenerator> mipGenerator;
 
     VkDevice device_;
     VkSurfaceKHR surface_;
     VkQueue graphicsQueue_;
     VkQueue presentQueue_;
+    VkQueue transferQueue_;
+    bool dedicatedTransferQueue = false;
+    VkPhysicalDeviceFeatures enabledFeatures{};
+
+    bool hostImageCopy = false;
+    std::vector<VkImageLayout> hostCopyDstLayouts;
+    PFN_vkCopyMemoryToImageEXT copyMemoryToImageEXT = nullptr;
+    PFN_vkTransitionImageLayoutEXT transitionImageLayoutEXT = nullptr;
+
+    bool externalMemoryHost = false;
+    VkDeviceSize hostPointerAlignment = 0;
+    PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerPropertiesEXT = nullptr;
+
+    bool drawIndirectCount = false;
+    PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCountKHR = nullptr;
 
     const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
     const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
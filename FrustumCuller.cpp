@@ -0,0 +1,179 @@
+#include "FrustumCuller.h"
+
+#if defined(__AVX__)
+#define FRUSTUM_CULLER_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define FRUSTUM_CULLER_NEON
+#include <arm_neon.h>
+#endif
+
+void FrustumCuller::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	radii.clear();
+}
+
+void FrustumCuller::reserve(size_t count)
+{
+	centerX.reserve(count);
+	centerY.reserve(count);
+	centerZ.reserve(count);
+	radii.reserve(count);
+}
+
+uint32_t FrustumCuller::add(const glm::vec3& center, float radius)
+{
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	radii.push_back(radius);
+	return static_cast<uint32_t>(radii.size() - 1);
+}
+
+const char* FrustumCuller::getInstructionSet()
+{
+#if defined(FRUSTUM_CULLER_AVX)
+	return "AVX";
+#elif defined(FRUSTUM_CULLER_SSE2)
+	return "SSE2";
+#elif defined(FRUSTUM_CULLER_NEON)
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
+
+uint32_t FrustumCuller::cullRange(const std::array<glm::vec4, 6>& planes, uint8_t* visible, size_t begin, size_t end) const
+{
+	uint32_t visibleCount = 0;
+	for (size_t i = begin; i < end; i++) {
+		bool inside = true;
+		for (const auto& plane : planes) {
+			// fully behind one plane is enough to be outside
+			if (plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w < -radii[i]) {
+				inside = false;
+				break;
+			}
+		}
+		visible[i] = inside ? 1 : 0;
+		visibleCount += inside ? 1 : 0;
+	}
+	return visibleCount;
+}
+
+uint32_t FrustumCuller::cullScalar(const std::array<glm::vec4, 6>& planes, std::vector<uint8_t>& visible) const
+{
+	visible.resize(radii.size());
+	return cullRange(planes, visible.data(), 0, radii.size());
+}
+
+uint32_t FrustumCuller::cull(const std::array<glm::vec4, 6>& planes, std::vector<uint8_t>& visible) const
+{
+	size_t count = radii.size();
+	visible.resize(count);
+
+	uint32_t visibleCount = 0;
+	size_t i = 0;
+
+	// every plane is tested on every lane, there is no early out per sphere. the spheres left over
+	// after the last full register go through the scalar loop
+#if defined(FRUSTUM_CULLER_AVX)
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm256_set1_ps(planes[p].x);
+		planeY[p] = _mm256_set1_ps(planes[p].y);
+		planeZ[p] = _mm256_set1_ps(planes[p].z);
+		planeW[p] = _mm256_set1_ps(planes[p].w);
+	}
+	const __m256 zero = _mm256_setzero_ps();
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_loadu_ps(&centerX[i]);
+		__m256 y = _mm256_loadu_ps(&centerY[i]);
+		__m256 z = _mm256_loadu_ps(&centerZ[i]);
+		__m256 negativeRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(&radii[i]));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y)),
+				_mm256_add_ps(_mm256_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int k = 0; k < 8; k++) {
+			visible[i + k] = static_cast<uint8_t>((mask >> k) & 1);
+			visibleCount += (mask >> k) & 1;
+		}
+	}
+#elif defined(FRUSTUM_CULLER_SSE2)
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm_set1_ps(planes[p].x);
+		planeY[p] = _mm_set1_ps(planes[p].y);
+		planeZ[p] = _mm_set1_ps(planes[p].z);
+		planeW[p] = _mm_set1_ps(planes[p].w);
+	}
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(&centerX[i]);
+		__m128 y = _mm_loadu_ps(&centerY[i]);
+		__m128 z = _mm_loadu_ps(&centerZ[i]);
+		__m128 negativeRadius = _mm_sub_ps(zero, _mm_loadu_ps(&radii[i]));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+				_mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = static_cast<uint8_t>((mask >> k) & 1);
+			visibleCount += (mask >> k) & 1;
+		}
+	}
+#elif defined(FRUSTUM_CULLER_NEON)
+	float32x4_t planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = vdupq_n_f32(planes[p].x);
+		planeY[p] = vdupq_n_f32(planes[p].y);
+		planeZ[p] = vdupq_n_f32(planes[p].z);
+		planeW[p] = vdupq_n_f32(planes[p].w);
+	}
+
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t x = vld1q_f32(&centerX[i]);
+		float32x4_t y = vld1q_f32(&centerY[i]);
+		float32x4_t z = vld1q_f32(&centerZ[i]);
+		float32x4_t negativeRadius = vnegq_f32(vld1q_f32(&radii[i]));
+
+		uint32x4_t inside = vdupq_n_u32(0xFFFFFFFFu);
+		for (int p = 0; p < 6; p++) {
+			float32x4_t distance = vaddq_f32(
+				vaddq_f32(vmulq_f32(planeX[p], x), vmulq_f32(planeY[p], y)),
+				vaddq_f32(vmulq_f32(planeZ[p], z), planeW[p]));
+			inside = vandq_u32(inside, vcgeq_f32(distance, negativeRadius));
+		}
+
+		uint32_t lanes[4];
+		vst1q_u32(lanes, inside);
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = static_cast<uint8_t>(lanes[k] & 1);
+			visibleCount += lanes[k] & 1;
+		}
+	}
+#endif
+
+	return visibleCount + cullRange(planes, visible.data(), i, count);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std lib headers
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/*
+
+	tests world space bounding spheres against the six planes of the camera frustum, before the draws
+	are recorded. the spheres are kept as a structure of arrays so one register holds the same
+	coordinate of 8 spheres with AVX, 4 with SSE2 or NEON, and a plane is tested on all of them at once.
+	the instruction set is the one the file is compiled for, the loop is scalar without any of them
+
+	the test is conservative: a sphere near a corner of the frustum can be kept while it is outside
+
+*/
+class FrustumCuller
+{
+public:
+	void clear();
+	void reserve(size_t count);
+
+	// returns the index of the sphere, the flags of cull are in the same order
+	uint32_t add(const glm::vec3& center, float radius);
+	size_t size() const { return radii.size(); }
+
+	// visible[i] is 1 when sphere i intersects the frustum, 0 when it is fully outside. returns the visible count
+	uint32_t cull(const std::array<glm::vec4, 6>& planes, std::vector<uint8_t>& visible) const;
+
+	// same result one sphere at a time, the reference of the benchmark
+	uint32_t cullScalar(const std::array<glm::vec4, 6>& planes, std::vector<uint8_t>& visible) const;
+
+	static const char* getInstructionSet();
+
+private:
+	uint32_t cullRange(const std::array<glm::vec4, 6>& planes, uint8_t* visible, size_t begin, size_t end) const;
+
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radii;
+};
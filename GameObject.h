@@ -4,7 +4,7 @@
 #include "Swap_chain.h"
 #include "descriptors.h"
 #include "Device.h"
-#include "Texture.h"
+#include "TextureRegistry.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -51,12 +51,14 @@ public:
 	glm::vec3 color{};
 
 	std::shared_ptr<Model> model{};
+	// model still loading on the AssetLoader, moved to model by App once it is ready
+	AssetFuture<Model> pendingModel{};
+	// sampled by the fragment shader, kept apart from the model so objects can share a mesh with different textures
+	TextureRegistry::Handle texture{};
+	// level of detail drawn last frame, picked by RenderSystem
+	uint32_t lodLevel = 0;
 	std::unique_ptr<PointLightComponent> pointLight = nullptr;
 
-	std::vector<VkDescriptorSet> descriptorSet{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
-
-	void createDescriptorSet(DescriptorPool& pool, Device& device);
-
 
 private:
 
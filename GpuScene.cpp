@@ -0,0 +1,852 @@
+#include "GpuScene.h"
+
+#include "Device.h"
+#include "UploadContext.h"
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+static constexpr uint32_t INITIAL_CAPACITY = 256;
+
+// scene_cull.comp
+struct SceneCullUbo {
+	glm::mat4 viewProjection;
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 cameraPosition;
+	float projectionScale;
+	float lodThreshold;
+	uint32_t objectCount;
+	uint32_t occlusionCulling;
+};
+
+struct SceneCullStats {
+	uint32_t visibleObjects;
+	uint32_t visibleTriangles;
+	uint32_t occludedObjects;
+	uint32_t lateObjects;
+};
+
+// scene_cull_late.comp
+struct LateCullPushConstants {
+	glm::vec2 viewportSize;
+};
+
+void GpuScene::RangeAllocator::reset(uint64_t capacity)
+{
+	this->capacity = capacity;
+	freeRanges.clear();
+	freeRanges[0] = capacity;
+}
+
+bool GpuScene::RangeAllocator::allocate(uint64_t size, uint64_t& offset)
+{
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+		if (it->second < size) continue;
+
+		offset = it->first;
+		uint64_t rest = it->second - size;
+		freeRanges.erase(it);
+		if (rest > 0) freeRanges[offset + size] = rest;
+		return true;
+	}
+	return false;
+}
+
+void GpuScene::RangeAllocator::free(uint64_t offset, uint64_t size)
+{
+	// merged with the free ranges right after and right before it
+	auto next = freeRanges.find(offset + size);
+	if (next != freeRanges.end()) {
+		size += next->second;
+		freeRanges.erase(next);
+	}
+
+	auto it = freeRanges.emplace(offset, size).first;
+	if (it != freeRanges.begin()) {
+		auto previous = std::prev(it);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			freeRanges.erase(it);
+		}
+	}
+}
+
+GpuScene::GpuScene(Device& device, TextureRegistry& textureRegistry, VkDeviceSize vertexPoolSize, VkDeviceSize indexPoolSize)
+	: device{ device }, textureRegistry{ textureRegistry }, vertexPoolSize{ vertexPoolSize }, indexPoolSize{ indexPoolSize }
+{
+	try {
+		createCullResources();
+	}
+	catch (...) {
+		// the destructor does not run when the constructor throws
+		if (cullPipelineLayout != VK_NULL_HANDLE) vkDestroyPipelineLayout(device.device(), cullPipelineLayout, nullptr);
+		throw;
+	}
+}
+
+GpuScene::~GpuScene()
+{
+	if (latePipelineLayout != VK_NULL_HANDLE) vkDestroyPipelineLayout(device.device(), latePipelineLayout, nullptr);
+	vkDestroyPipelineLayout(device.device(), cullPipelineLayout, nullptr);
+}
+
+void GpuScene::createCullResources()
+{
+	cullSetLayout = DescriptorSetLayout::Builder(device)
+		.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build();
+
+	VkDescriptorSetLayout setLayout = cullSetLayout->getDescriptorSetLayout();
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+	if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("fail to create scene culling pipeline layout");
+	}
+
+	cullPipeline = std::make_unique<ComputePipeline>(device, "scene_cull.comp.spv", cullPipelineLayout);
+
+	for (auto& frame : frames) {
+		// the sets of the two passes, they differ by their commands and counts
+		frame.descriptorPool = DescriptorPool::Builder(device)
+			.setMaxSets(2)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 14)
+			.build();
+
+		frame.uboBuffer = std::make_unique<Buffer>(
+			device,
+			sizeof(SceneCullUbo),
+			1,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		frame.uboBuffer->map();
+
+		// read and cleared on the CPU when the frame comes back
+		frame.statsBuffer = std::make_unique<Buffer>(
+			device,
+			sizeof(SceneCullStats),
+			1,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		frame.statsBuffer->map();
+		*static_cast<SceneCullStats*>(frame.statsBuffer->getMappedMemory()) = {};
+	}
+}
+
+void GpuScene::createOcclusionResources()
+{
+	if (depthPyramid == nullptr) depthPyramid = std::make_unique<DepthPyramid>(device);
+	if (latePipelineLayout != VK_NULL_HANDLE) {
+		latePipeline = std::make_unique<ComputePipeline>(device, "scene_cull_late.comp.spv", latePipelineLayout);
+		return;
+	}
+
+	VkDescriptorSetLayout setLayouts[] = { cullSetLayout->getDescriptorSetLayout(), depthPyramid->getSetLayout().getDescriptorSetLayout() };
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(LateCullPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &latePipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("fail to create occlusion culling pipeline layout");
+	}
+
+	// scene_cull.comp compiled with OCCLUSION_PASS
+	latePipeline = std::make_unique<ComputePipeline>(device, "scene_cull_late.comp.spv", latePipelineLayout);
+}
+
+bool GpuScene::setOcclusionCulling(bool enabled)
+{
+	if (enabled && latePipeline == nullptr) {
+		try {
+			createOcclusionResources();
+		}
+		catch (const std::exception& e) {
+			std::cerr << "occlusion culling: " << e.what() << "\n";
+			return false;
+		}
+	}
+
+	occlusionCulling = enabled;
+	return true;
+}
+
+bool GpuScene::createPool(Pool& pool, VkDeviceSize size, VkDeviceSize stride, VkBufferUsageFlags usage)
+{
+	if (pool.buffer != nullptr) return true;
+
+	try {
+		pool.buffer = std::make_unique<Buffer>(
+			device,
+			stride,
+			static_cast<uint32_t>(size / stride),
+			usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "gpu scene pool: " << e.what() << "\n";
+		return false;
+	}
+
+	pool.stride = stride;
+	pool.ranges.reset(size / stride);
+	return true;
+}
+
+uint32_t GpuScene::acquireMesh(const std::shared_ptr<Model>& model)
+{
+	auto it = meshIndices.find(model.get());
+	if (it != meshIndices.end()) {
+		meshes[it->second].objectCount++;
+		return it->second;
+	}
+
+	Mesh mesh{};
+	mesh.model = model;
+	mesh.vertexPool = model->isPacked() ? 1 : 0;
+	mesh.indexPool = model->getIndexType() == VK_INDEX_TYPE_UINT16 ? 0 : 1;
+	mesh.vertexCount = model->getVertexCount();
+	mesh.indexCount = model->getIndexCount();
+
+	Pool& vertexPool = vertexPools[mesh.vertexPool];
+	Pool& indexPool = indexPools[mesh.indexPool];
+	VkDeviceSize vertexStride = model->isPacked() ? sizeof(Model::PackedVertex) : sizeof(Model::Vertex);
+	VkDeviceSize indexStride = mesh.indexPool == 0 ? sizeof(uint16_t) : sizeof(uint32_t);
+
+	if (!createPool(vertexPool, vertexPoolSize, vertexStride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) ||
+		!createPool(indexPool, indexPoolSize, indexStride, VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) {
+		return UINT32_MAX;
+	}
+
+	if (!vertexPool.ranges.allocate(mesh.vertexCount, mesh.vertexOffset)) {
+		std::cerr << "gpu scene: vertex pool full, the mesh is not drawn\n";
+		return UINT32_MAX;
+	}
+	if (!indexPool.ranges.allocate(mesh.indexCount, mesh.indexOffset)) {
+		vertexPool.ranges.free(mesh.vertexOffset, mesh.vertexCount);
+		std::cerr << "gpu scene: index pool full, the mesh is not drawn\n";
+		return UINT32_MAX;
+	}
+
+	// copied on the graphics queue, where the buffers of the model were acquired for the vertex input.
+	// the ranges of the pools may have been drawn from before they were freed.
+	// the model may have been uploaded in the batch being recorded, its acquire is only recorded when that
+	// batch is flushed. the graphics command buffer of the next batch is submitted after it
+	UploadContext& uploadContext = device.getUploadContext();
+	uploadContext.flush();
+	VkCommandBuffer commandBuffer = uploadContext.getGraphicsCommandBuffer();
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy vertexCopy{};
+	vertexCopy.dstOffset = mesh.vertexOffset * vertexStride;
+	vertexCopy.size = mesh.vertexCount * vertexStride;
+	vkCmdCopyBuffer(commandBuffer, model->getVertexBuffer()->getBuffer(), vertexPool.buffer->getBuffer(), 1, &vertexCopy);
+
+	VkBufferCopy indexCopy{};
+	indexCopy.dstOffset = mesh.indexOffset * indexStride;
+	indexCopy.size = mesh.indexCount * indexStride;
+	vkCmdCopyBuffer(commandBuffer, model->getIndexBuffer()->getBuffer(), indexPool.buffer->getBuffer(), 1, &indexCopy);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	mesh.uploadBatch = uploadContext.getBatchId();
+	uploadContext.releaseWithBatch(model);
+	mesh.objectCount = 1;
+
+	uint32_t index;
+	if (!freeMeshes.empty()) {
+		index = freeMeshes.back();
+		freeMeshes.pop_back();
+		meshes[index] = std::move(mesh);
+	}
+	else {
+		index = static_cast<uint32_t>(meshes.size());
+		meshes.push_back(std::move(mesh));
+	}
+
+	meshIndices[model.get()] = index;
+	pendingMeshes.push_back(index);
+	meshVersion++;
+	return index;
+}
+
+void GpuScene::releaseMesh(uint32_t index)
+{
+	Mesh& mesh = meshes[index];
+	if (--mesh.objectCount > 0) return;
+
+	// the frames in flight can still draw from the ranges
+	PendingFree pendingFree{};
+	pendingFree.frame = frameCount + Swap_chain::MAX_FRAMES_IN_FLIGHT;
+	pendingFree.vertexPool = mesh.vertexPool;
+	pendingFree.indexPool = mesh.indexPool;
+	pendingFree.vertexOffset = mesh.vertexOffset;
+	pendingFree.vertexCount = mesh.vertexCount;
+	pendingFree.indexOffset = mesh.indexOffset;
+	pendingFree.indexCount = mesh.indexCount;
+	pendingFrees.push_back(pendingFree);
+
+	meshIndices.erase(mesh.model.get());
+	mesh = Mesh{};
+	freeMeshes.push_back(index);
+	meshVersion++;
+}
+
+uint32_t GpuScene::acquireGroup(uint32_t poolClass, const TextureRegistry::Handle& texture)
+{
+	std::pair<uint32_t, TextureRegistry::Entry*> key{ poolClass, texture.get() };
+	auto it = groupIndices.find(key);
+	if (it != groupIndices.end()) {
+		groups[it->second].objectCount++;
+		return it->second;
+	}
+
+	Group group{};
+	group.poolClass = poolClass;
+	group.texture = texture;
+	group.objectCount = 1;
+
+	uint32_t index;
+	if (!freeGroups.empty()) {
+		index = freeGroups.back();
+		freeGroups.pop_back();
+		groups[index] = std::move(group);
+	}
+	else {
+		index = static_cast<uint32_t>(groups.size());
+		groups.push_back(std::move(group));
+	}
+
+	groupIndices[key] = index;
+	return index;
+}
+
+void GpuScene::releaseGroup(uint32_t index)
+{
+	Group& group = groups[index];
+	if (--group.objectCount > 0) return;
+
+	groupIndices.erase({ group.poolClass, group.texture.get() });
+	group = Group{};
+	freeGroups.push_back(index);
+}
+
+void GpuScene::markDirty(uint32_t slot)
+{
+	for (auto& frame : frames) frame.dirtySlots.push_back(slot);
+}
+
+void GpuScene::updateObject(GameObject& obj)
+{
+	auto it = slotIndices.find(obj.getId());
+
+	// only indexed meshes are drawn indirectly
+	if (obj.model == nullptr || obj.texture == nullptr || !obj.model->hasIndices()) {
+		if (it != slotIndices.end()) removeSlot(it->second);
+		return;
+	}
+
+	uint32_t slot;
+	if (it != slotIndices.end()) {
+		slot = it->second;
+	}
+	else {
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+			// the visibility is still the one of the last object in the slot
+			visibilityResets.push_back(slot);
+		}
+		else {
+			slot = static_cast<uint32_t>(slots.size());
+			slots.emplace_back();
+			objects.emplace_back();
+			instances.emplace_back();
+		}
+		slots[slot] = Slot{ obj.getId() };
+		slotIndices[obj.getId()] = slot;
+	}
+
+	// a new model or texture moves the object to another mesh or group
+	Slot& entry = slots[slot];
+	if (entry.mesh == UINT32_MAX || meshes[entry.mesh].model != obj.model) {
+		uint32_t mesh = acquireMesh(obj.model);
+		if (mesh == UINT32_MAX) {
+			removeSlot(slot);
+			return;
+		}
+		if (entry.mesh != UINT32_MAX) releaseMesh(entry.mesh);
+		entry.mesh = mesh;
+	}
+
+	const Mesh& mesh = meshes[entry.mesh];
+	uint32_t poolClass = mesh.vertexPool * INDEX_POOL_COUNT + mesh.indexPool;
+	if (entry.group == UINT32_MAX || groups[entry.group].texture != obj.texture || groups[entry.group].poolClass != poolClass) {
+		uint32_t group = acquireGroup(poolClass, obj.texture);
+		if (entry.group != UINT32_MAX) releaseGroup(entry.group);
+		entry.group = group;
+	}
+
+	writeSlot(slot, obj);
+}
+
+void GpuScene::removeObject(GameObject::id_t id)
+{
+	auto it = slotIndices.find(id);
+	if (it != slotIndices.end()) removeSlot(it->second);
+}
+
+void GpuScene::writeSlot(uint32_t slot, GameObject& obj)
+{
+	const Slot& entry = slots[slot];
+	Mesh& mesh = meshes[entry.mesh];
+	Model& model = *mesh.model;
+
+	glm::mat4 transform = obj.transform.mat4();
+	glm::vec3 scale = glm::abs(obj.transform.scale);
+	float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+	glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(model.getBoundingCenter(), 1.f));
+
+	GpuObject& object = objects[slot];
+	object.sphere = glm::vec4(worldCenter, model.getBoundingRadius() * maxScale);
+	object.group = entry.group;
+	object.maxScale = maxScale;
+
+	// the object is left out of the culling until the copy of its mesh is on the graphics queue
+	object.mesh = mesh.ready ? entry.mesh : UINT32_MAX;
+	if (!mesh.ready) mesh.waitingSlots.push_back(slot);
+
+	// packed positions are dequantized by the model matrix, like the instances of RenderSystem
+	instances[slot].modelMatrix = transform * model.getDequantizeMatrix();
+	instances[slot].normalMatrix = obj.transform.normalMatrix();
+
+	markDirty(slot);
+}
+
+void GpuScene::removeSlot(uint32_t slot)
+{
+	Slot& entry = slots[slot];
+	if (entry.group != UINT32_MAX) releaseGroup(entry.group);
+	if (entry.mesh != UINT32_MAX) releaseMesh(entry.mesh);
+
+	slotIndices.erase(entry.id);
+	entry = Slot{};
+	objects[slot] = GpuObject{};
+	freeSlots.push_back(slot);
+	markDirty(slot);
+}
+
+bool GpuScene::reserve(std::unique_ptr<Buffer>& buffer, VkDeviceSize instanceSize, uint32_t count, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties)
+{
+	if (buffer != nullptr && buffer->getInstanceCount() >= count) return false;
+
+	// grow by doubling, the buffers of this frame are not in use anymore once beginFrame returned
+	uint32_t capacity = buffer != nullptr ? buffer->getInstanceCount() : INITIAL_CAPACITY;
+	while (capacity < count) capacity *= 2;
+
+	buffer = std::make_unique<Buffer>(device, instanceSize, capacity, usage, memoryProperties);
+	if (memoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) buffer->map();
+	return true;
+}
+
+void GpuScene::updateFrameBuffers(FrameResources& frame)
+{
+	const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	uint32_t slotCount = static_cast<uint32_t>(slots.size());
+
+	// the instances are read by the vertex shader through the instance binding, with the slot as first instance
+	bool objectsLost = reserve(frame.objectBuffer, sizeof(GpuObject), slotCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible);
+	bool instancesLost = reserve(frame.instanceBuffer, sizeof(GpuInstance), slotCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, hostVisible);
+
+	GpuObject* mappedObjects = static_cast<GpuObject*>(frame.objectBuffer->getMappedMemory());
+	GpuInstance* mappedInstances = static_cast<GpuInstance*>(frame.instanceBuffer->getMappedMemory());
+
+	if (objectsLost || instancesLost) {
+		if (slotCount > 0) {
+			memcpy(mappedObjects, objects.data(), slotCount * sizeof(GpuObject));
+			memcpy(mappedInstances, instances.data(), slotCount * sizeof(GpuInstance));
+		}
+		stats.writtenCount = slotCount;
+	}
+	else {
+		for (uint32_t slot : frame.dirtySlots) {
+			mappedObjects[slot] = objects[slot];
+			mappedInstances[slot] = instances[slot];
+		}
+		stats.writtenCount = static_cast<uint32_t>(frame.dirtySlots.size());
+	}
+	frame.dirtySlots.clear();
+
+	uint32_t meshCount = static_cast<uint32_t>(meshes.size());
+	if (reserve(frame.meshBuffer, sizeof(GpuMesh), meshCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible) || frame.meshVersion != meshVersion) {
+		GpuMesh* mappedMeshes = static_cast<GpuMesh*>(frame.meshBuffer->getMappedMemory());
+		for (uint32_t i = 0; i < meshCount; i++) {
+			const Mesh& mesh = meshes[i];
+			GpuMesh gpuMesh{};
+			if (mesh.model != nullptr) {
+				gpuMesh.vertexOffset = static_cast<int32_t>(mesh.vertexOffset);
+				gpuMesh.lodCount = std::min(mesh.model->getLodCount(), MAX_LODS);
+				for (uint32_t lod = 0; lod < gpuMesh.lodCount; lod++) {
+					const Model::LodRange& range = mesh.model->getLod(lod);
+					gpuMesh.lods[lod] = { static_cast<uint32_t>(mesh.indexOffset) + range.firstIndex, range.indexCount, range.error };
+				}
+			}
+			mappedMeshes[i] = gpuMesh;
+		}
+		frame.meshVersion = meshVersion;
+	}
+
+	uint32_t groupCount = static_cast<uint32_t>(groups.size());
+	reserve(frame.groupBuffer, sizeof(uint32_t), groupCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible);
+	uint32_t* firstCommands = static_cast<uint32_t*>(frame.groupBuffer->getMappedMemory());
+	for (uint32_t i = 0; i < groupCount; i++) firstCommands[i] = groups[i].firstCommand;
+
+	reserve(frame.commandBuffer, sizeof(VkDrawIndexedIndirectCommand), commandCount,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	reserve(frame.countBuffer, sizeof(uint32_t), groupCount,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (occlusionCulling) {
+		reserve(frame.lateCommandBuffer, sizeof(VkDrawIndexedIndirectCommand), commandCount,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		reserve(frame.lateCountBuffer, sizeof(uint32_t), groupCount,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+}
+
+void GpuScene::reserveVisibility(VkCommandBuffer commandBuffer)
+{
+	uint32_t slotCount = static_cast<uint32_t>(slots.size());
+	if (visibilityBuffer != nullptr && visibilityBuffer->getInstanceCount() >= slotCount) return;
+
+	uint32_t capacity = visibilityBuffer != nullptr ? visibilityBuffer->getInstanceCount() : INITIAL_CAPACITY;
+	while (capacity < slotCount) capacity *= 2;
+
+	// the frames in flight can still read the previous one
+	if (visibilityBuffer != nullptr) {
+		retiredVisibilityBuffers.emplace_back(frameCount + Swap_chain::MAX_FRAMES_IN_FLIGHT, std::move(visibilityBuffer));
+	}
+
+	visibilityBuffer = std::make_unique<Buffer>(
+		device,
+		sizeof(uint32_t),
+		capacity,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	);
+
+	// every object counts as visible, the first pass draws them all once
+	vkCmdFillBuffer(commandBuffer, visibilityBuffer->getBuffer(), 0, VK_WHOLE_SIZE, 1);
+	visibilityResets.clear();
+}
+
+void GpuScene::resetVisibility(VkCommandBuffer commandBuffer)
+{
+	if (visibilityResets.empty()) return;
+
+	// the second pass of the frames before may have written them
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// a new object counts as visible like a new scene, one fill per run of consecutive slots
+	std::sort(visibilityResets.begin(), visibilityResets.end());
+	visibilityResets.erase(std::unique(visibilityResets.begin(), visibilityResets.end()), visibilityResets.end());
+
+	size_t first = 0;
+	for (size_t i = 1; i <= visibilityResets.size(); i++) {
+		if (i < visibilityResets.size() && visibilityResets[i] == visibilityResets[i - 1] + 1) continue;
+
+		VkDeviceSize offset = visibilityResets[first] * sizeof(uint32_t);
+		VkDeviceSize size = (visibilityResets[i - 1] - visibilityResets[first] + 1) * sizeof(uint32_t);
+		vkCmdFillBuffer(commandBuffer, visibilityBuffer->getBuffer(), offset, size, 1);
+		first = i;
+	}
+	visibilityResets.clear();
+}
+
+void GpuScene::writeDescriptorSet(FrameResources& frame, Buffer& commandBuffer, Buffer& countBuffer, VkDescriptorSet& set)
+{
+	auto uboInfo = frame.uboBuffer->descriptorInfo();
+	auto objectInfo = frame.objectBuffer->descriptorInfo();
+	auto meshInfo = frame.meshBuffer->descriptorInfo();
+	auto groupInfo = frame.groupBuffer->descriptorInfo();
+	auto commandInfo = commandBuffer.descriptorInfo();
+	auto countInfo = countBuffer.descriptorInfo();
+	auto statsInfo = frame.statsBuffer->descriptorInfo();
+	auto visibilityInfo = visibilityBuffer->descriptorInfo();
+
+	bool allocated = DescriptorWriter(*cullSetLayout, *frame.descriptorPool)
+		.writeBuffer(0, &uboInfo)
+		.writeBuffer(1, &objectInfo)
+		.writeBuffer(2, &meshInfo)
+		.writeBuffer(3, &groupInfo)
+		.writeBuffer(4, &commandInfo)
+		.writeBuffer(5, &countInfo)
+		.writeBuffer(6, &statsInfo)
+		.writeBuffer(7, &visibilityInfo)
+		.build(set);
+	if (!allocated) {
+		throw std::runtime_error("failed to allocate the scene culling descriptor set!");
+	}
+}
+
+void GpuScene::cull(FrameInfo& frameInfo, float lodThreshold)
+{
+	FrameResources& frame = frames[frameInfo.frameIndex];
+	frameCount++;
+	frame.recorded = false;
+
+	// the fence of this frame was waited, its stats are complete and the buffer is free to clear
+	SceneCullStats* cullStats = static_cast<SceneCullStats*>(frame.statsBuffer->getMappedMemory());
+	stats.visibleCount = cullStats->visibleObjects;
+	stats.visibleTriangles = cullStats->visibleTriangles;
+	stats.occludedCount = cullStats->occludedObjects;
+	stats.lateVisibleCount = cullStats->lateObjects;
+	*cullStats = {};
+
+	frame.lateRecorded = false;
+	for (size_t i = 0; i < retiredVisibilityBuffers.size();) {
+		if (retiredVisibilityBuffers[i].first > frameCount) {
+			i++;
+			continue;
+		}
+		retiredVisibilityBuffers[i] = std::move(retiredVisibilityBuffers.back());
+		retiredVisibilityBuffers.pop_back();
+	}
+
+	// ranges no frame in flight draws from anymore
+	for (size_t i = 0; i < pendingFrees.size();) {
+		const PendingFree& pendingFree = pendingFrees[i];
+		if (pendingFree.frame > frameCount) {
+			i++;
+			continue;
+		}
+		vertexPools[pendingFree.vertexPool].ranges.free(pendingFree.vertexOffset, pendingFree.vertexCount);
+		indexPools[pendingFree.indexPool].ranges.free(pendingFree.indexOffset, pendingFree.indexCount);
+		pendingFrees[i] = pendingFrees.back();
+		pendingFrees.pop_back();
+	}
+
+	// meshes whose copy is on the graphics queue, their objects are culled and drawn from now on
+	UploadContext& uploadContext = device.getUploadContext();
+	for (size_t i = 0; i < pendingMeshes.size();) {
+		uint32_t index = pendingMeshes[i];
+		Mesh& mesh = meshes[index];
+		if (mesh.model != nullptr && !mesh.ready) {
+			if (!uploadContext.isBatchReady(mesh.uploadBatch)) {
+				i++;
+				continue;
+			}
+
+			mesh.ready = true;
+			for (uint32_t slot : mesh.waitingSlots) {
+				if (slots[slot].mesh != index) continue;
+				objects[slot].mesh = index;
+				markDirty(slot);
+			}
+			mesh.waitingSlots.clear();
+		}
+		pendingMeshes[i] = pendingMeshes.back();
+		pendingMeshes.pop_back();
+	}
+
+	// every object of a group has room for its draw after the ones of the groups before
+	commandCount = 0;
+	for (auto& group : groups) {
+		group.firstCommand = commandCount;
+		commandCount += group.objectCount;
+		group.descriptorSet = group.objectCount > 0 ? textureRegistry.use(group.texture) : VK_NULL_HANDLE;
+	}
+
+	stats.objectCount = static_cast<uint32_t>(slotIndices.size());
+	stats.meshCount = static_cast<uint32_t>(meshIndices.size());
+	stats.groupCount = static_cast<uint32_t>(groupIndices.size());
+
+	updateFrameBuffers(frame);
+	if (commandCount == 0) return;
+
+	SceneCullUbo ubo{};
+	ubo.viewProjection = frameInfo.camera.getProjection() * frameInfo.camera.getView();
+	auto planes = frameInfo.camera.getFrustumPlanes();
+	for (int i = 0; i < 6; i++) ubo.frustumPlanes[i] = planes[i];
+	ubo.cameraPosition = glm::vec4(frameInfo.camera.getPosition(), 1.f);
+	ubo.projectionScale = std::abs(frameInfo.camera.getProjection()[1][1]);
+	ubo.lodThreshold = lodThreshold;
+	ubo.objectCount = static_cast<uint32_t>(slots.size());
+	ubo.occlusionCulling = occlusionCulling ? 1 : 0;
+	frame.uboBuffer->writeToBuffer(&ubo);
+
+	VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+
+	// the draws of every group are appended from 0
+	vkCmdFillBuffer(commandBuffer, frame.countBuffer->getBuffer(), 0, groups.size() * sizeof(uint32_t), 0);
+	reserveVisibility(commandBuffer);
+	resetVisibility(commandBuffer);
+
+	// also after the second pass of the last frame, which wrote the visibility
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	frame.descriptorPool->resetPool();
+	writeDescriptorSet(frame, *frame.commandBuffer, *frame.countBuffer, frame.descriptorSet);
+
+	cullPipeline->bind(commandBuffer);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+	vkCmdDispatch(commandBuffer, (ubo.objectCount + 63) / 64, 1, 1);
+
+	// the draws read the commands and counts, the CPU reads the stats once the frame is done
+	VkMemoryBarrier cullBarrier{};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+	frame.recorded = true;
+}
+
+void GpuScene::cullLate(FrameInfo& frameInfo, const DepthPyramid::Source& depth)
+{
+	FrameResources& frame = frames[frameInfo.frameIndex];
+	// the late buffers are reserved by cull, occlusion culling may have been turned on since
+	if (!occlusionCulling || !frame.recorded || frame.lateCommandBuffer == nullptr) return;
+
+	VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+	depthPyramid->build(commandBuffer, frameInfo.frameIndex, depth);
+
+	vkCmdFillBuffer(commandBuffer, frame.lateCountBuffer->getBuffer(), 0, groups.size() * sizeof(uint32_t), 0);
+
+	// the first pass read the visibility and added to the stats
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	writeDescriptorSet(frame, *frame.lateCommandBuffer, *frame.lateCountBuffer, frame.lateDescriptorSet);
+
+	LateCullPushConstants push{};
+	push.viewportSize = glm::vec2(static_cast<float>(depth.extent.width), static_cast<float>(depth.extent.height));
+
+	VkDescriptorSet descriptorSets[] = { frame.lateDescriptorSet, depthPyramid->getDescriptorSet(frameInfo.frameIndex) };
+
+	latePipeline->bind(commandBuffer);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, latePipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, latePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LateCullPushConstants), &push);
+	vkCmdDispatch(commandBuffer, (static_cast<uint32_t>(slots.size()) + 63) / 64, 1, 1);
+
+	VkMemoryBarrier cullBarrier{};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+	frame.lateRecorded = true;
+}
+
+void GpuScene::draw(FrameInfo& frameInfo, VkPipelineLayout pipelineLayout, Pipeline& pipeline, Pipeline& packedPipeline)
+{
+	drawCallCount = 0;
+
+	FrameResources& frame = frames[frameInfo.frameIndex];
+	if (frame.recorded) recordDraws(frameInfo, *frame.commandBuffer, *frame.countBuffer, pipelineLayout, pipeline, packedPipeline);
+}
+
+void GpuScene::drawLate(FrameInfo& frameInfo, VkPipelineLayout pipelineLayout, Pipeline& pipeline, Pipeline& packedPipeline)
+{
+	FrameResources& frame = frames[frameInfo.frameIndex];
+	if (frame.lateRecorded) recordDraws(frameInfo, *frame.lateCommandBuffer, *frame.lateCountBuffer, pipelineLayout, pipeline, packedPipeline);
+}
+
+void GpuScene::recordDraws(FrameInfo& frameInfo, Buffer& drawCommands, Buffer& drawCounts, VkPipelineLayout pipelineLayout, Pipeline& pipeline, Pipeline& packedPipeline)
+{
+	FrameResources& frame = frames[frameInfo.frameIndex];
+
+	VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+	uint32_t commandStride = sizeof(VkDrawIndexedIndirectCommand);
+	Pipeline* pipelines[VERTEX_POOL_COUNT] = { &pipeline, &packedPipeline };
+
+	// one pipeline and vertex pool at a time, then one index pool at a time, then one draw per group
+	for (uint32_t vertexPool = 0; vertexPool < VERTEX_POOL_COUNT; vertexPool++)
+	{
+		bool bound = false;
+
+		for (uint32_t indexPool = 0; indexPool < INDEX_POOL_COUNT; indexPool++)
+		{
+			bool indexBound = false;
+
+			for (uint32_t i = 0; i < groups.size(); i++)
+			{
+				const Group& group = groups[i];
+				if (group.objectCount == 0 || group.descriptorSet == VK_NULL_HANDLE) continue;
+				if (group.poolClass != vertexPool * INDEX_POOL_COUNT + indexPool) continue;
+
+				if (!bound) {
+					pipelines[vertexPool]->bind(commandBuffer);
+
+					VkBuffer buffers[] = { vertexPools[vertexPool].buffer->getBuffer(), frame.instanceBuffer->getBuffer() };
+					VkDeviceSize offsets[] = { 0, 0 };
+					vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+					bound = true;
+				}
+
+				if (!indexBound) {
+					vkCmdBindIndexBuffer(commandBuffer, indexPools[indexPool].buffer->getBuffer(), 0, indexPool == 0 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+					indexBound = true;
+				}
+
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &group.descriptorSet, 0, nullptr);
+
+				device.cmdDrawIndexedIndirectCount(
+					commandBuffer,
+					drawCommands.getBuffer(),
+					static_cast<VkDeviceSize>(group.firstCommand) * commandStride,
+					drawCounts.getBuffer(),
+					static_cast<VkDeviceSize>(i) * sizeof(uint32_t),
+					group.objectCount,
+					commandStride);
+				drawCallCount++;
+			}
+		}
+	}
+}
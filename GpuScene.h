@@ -0,0 +1,293 @@
+#pragma once
+
+#include "Buffer.h"
+#include "DepthPyramid.h"
+#include "Frame_info.h"
+#include "GameObject.h"
+#include "Pipeline.h"
+#include "Swap_chain.h"
+#include "TextureRegistry.h"
+#include "descriptors.h"
+
+#include <vulkan/vulkan.h>
+
+// std lib headers
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Device;
+
+/*
+
+	the objects drawn by the GPU driven mode of RenderSystem. their transforms, world bounding spheres
+	and meshes stay in buffers from one frame to the next, only the objects given to updateObject and
+	removeObject are written again. the meshes are copied once into shared vertex and index pools, one
+	per vertex format and index type
+
+	every frame scene_cull.comp tests each object against the frustum, picks its level of detail and
+	appends its draw to the range of its group, the objects using the same pools and texture. a group is
+	drawn with one vkCmdDrawIndexedIndirectCount whose count is the number of draws appended
+
+	the buffers read by a frame are host visible and there is one set per frame in flight, an update is
+	written to the set of each frame when that frame is prepared again
+
+	with occlusion culling the frame has two passes. the first one draws the objects that were visible at
+	the end of the last frame, a depth pyramid is built from the depth they wrote, then the second pass
+	(scene_cull_late.comp) tests every object in the frustum against it and draws the visible ones the first
+	pass did not. the visibility of each slot stays on the GPU for the next frame
+
+*/
+class GpuScene
+{
+public:
+	static constexpr uint32_t MAX_LODS = 8;
+	static constexpr VkDeviceSize DEFAULT_VERTEX_POOL_SIZE = 64ull * 1024 * 1024;
+	static constexpr VkDeviceSize DEFAULT_INDEX_POOL_SIZE = 32ull * 1024 * 1024;
+
+	struct Stats {
+		uint32_t objectCount = 0;
+		uint32_t meshCount = 0;
+		uint32_t groupCount = 0;
+
+		// kept by the culling pass, read back MAX_FRAMES_IN_FLIGHT frames late
+		uint32_t visibleCount = 0;
+		uint32_t visibleTriangles = 0;
+
+		// object slots written to the buffers of the last frame
+		uint32_t writtenCount = 0;
+
+		// occlusion culling: in the frustum but hidden, and drawn by the second pass. read back late too
+		uint32_t occludedCount = 0;
+		uint32_t lateVisibleCount = 0;
+	};
+
+	// vertexPoolSize and indexPoolSize are the size of each pool, a mesh that does not fit is not drawn
+	GpuScene(Device& device, TextureRegistry& textureRegistry, VkDeviceSize vertexPoolSize = DEFAULT_VERTEX_POOL_SIZE, VkDeviceSize indexPoolSize = DEFAULT_INDEX_POOL_SIZE);
+	~GpuScene();
+
+	GpuScene(const GpuScene&) = delete;
+	GpuScene& operator=(const GpuScene&) = delete;
+
+	// adds the object, or writes it again once its transform, model or texture changed. an object without
+	// model or texture is removed. it is drawn once the copy of its mesh into the pools is on the graphics queue
+	void updateObject(GameObject& obj);
+	void removeObject(GameObject::id_t id);
+
+	// outside of the render pass: the updates are written to the buffers of the frame and the culling recorded.
+	// lodThreshold is the largest projected error, 0 draws the full meshes
+	void cull(FrameInfo& frameInfo, float lodThreshold);
+
+	// the global descriptor set is bound, the pipelines are the ones of the full and packed vertex formats.
+	// with occlusion culling these are the draws of the first pass
+	void draw(FrameInfo& frameInfo, VkPipelineLayout pipelineLayout, Pipeline& pipeline, Pipeline& packedPipeline);
+
+	// false when the shaders of the second pass could not be loaded. takes effect with the next cull
+	bool setOcclusionCulling(bool enabled);
+	bool isOcclusionCullingEnabled() const { return occlusionCulling; }
+
+	// between the two render passes: the depth pyramid of the first pass, then the culling of the second
+	void cullLate(FrameInfo& frameInfo, const DepthPyramid::Source& depth);
+	void drawLate(FrameInfo& frameInfo, VkPipelineLayout pipelineLayout, Pipeline& pipeline, Pipeline& packedPipeline);
+
+	const Stats& getStats() const { return stats; }
+	uint32_t getDrawCallCount() const { return drawCallCount; }
+
+private:
+	// vertex format (full, packed) and index type (16, 32 bits), pool classes are vertexPool * 2 + indexPool
+	static constexpr uint32_t VERTEX_POOL_COUNT = 2;
+	static constexpr uint32_t INDEX_POOL_COUNT = 2;
+
+	// scene_cull.comp reads these as std430
+	struct GpuObject {
+		// world space bounding sphere
+		glm::vec4 sphere{};
+		// UINT32_MAX for free slots and meshes still uploading
+		uint32_t mesh = UINT32_MAX;
+		uint32_t group = 0;
+		float maxScale = 1.f;
+		uint32_t padding = 0;
+	};
+
+	struct GpuLod {
+		// in the index pool
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		float error = 0.f;
+		uint32_t padding = 0;
+	};
+
+	struct GpuMesh {
+		int32_t vertexOffset = 0;
+		uint32_t lodCount = 0;
+		uint32_t padding[2]{};
+		GpuLod lods[MAX_LODS]{};
+	};
+
+	// RenderSystem::InstanceData, read through the same vertex binding with the slot as instance
+	struct GpuInstance {
+		glm::mat4 modelMatrix{ 1.f };
+		glm::mat4 normalMatrix{ 1.f };
+	};
+
+	// first fit, offsets and sizes in elements of the pool
+	struct RangeAllocator {
+		uint64_t capacity = 0;
+		std::map<uint64_t, uint64_t> freeRanges{};
+
+		void reset(uint64_t capacity);
+		bool allocate(uint64_t size, uint64_t& offset);
+		void free(uint64_t offset, uint64_t size);
+	};
+
+	// created with the first mesh that uses it
+	struct Pool {
+		std::unique_ptr<Buffer> buffer;
+		VkDeviceSize stride = 0;
+		RangeAllocator ranges{};
+	};
+
+	struct Mesh {
+		std::shared_ptr<Model> model;
+		uint32_t vertexPool = 0;
+		uint32_t indexPool = 0;
+		uint64_t vertexOffset = 0;
+		uint64_t vertexCount = 0;
+		uint64_t indexOffset = 0;
+		uint64_t indexCount = 0;
+
+		// the copy into the pools is in this upload batch
+		uint64_t uploadBatch = 0;
+		bool ready = false;
+
+		uint32_t objectCount = 0;
+		// slots of the objects drawn once the mesh is ready
+		std::vector<uint32_t> waitingSlots{};
+	};
+
+	struct Group {
+		uint32_t poolClass = 0;
+		TextureRegistry::Handle texture{};
+		uint32_t objectCount = 0;
+
+		// set by cull for the frame being recorded
+		uint32_t firstCommand = 0;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	};
+
+	struct Slot {
+		GameObject::id_t id = 0;
+		uint32_t mesh = UINT32_MAX;
+		uint32_t group = UINT32_MAX;
+	};
+
+	// ranges of a released mesh, given back once the frames that could draw it are done
+	struct PendingFree {
+		uint64_t frame = 0;
+		uint32_t vertexPool = 0;
+		uint32_t indexPool = 0;
+		uint64_t vertexOffset = 0;
+		uint64_t vertexCount = 0;
+		uint64_t indexOffset = 0;
+		uint64_t indexCount = 0;
+	};
+
+	struct FrameResources {
+		std::unique_ptr<Buffer> uboBuffer;
+		std::unique_ptr<Buffer> objectBuffer;
+		std::unique_ptr<Buffer> instanceBuffer;
+		std::unique_ptr<Buffer> meshBuffer;
+		std::unique_ptr<Buffer> groupBuffer;
+		std::unique_ptr<Buffer> statsBuffer;
+		// only written and read by the GPU
+		std::unique_ptr<Buffer> commandBuffer;
+		std::unique_ptr<Buffer> countBuffer;
+		std::unique_ptr<DescriptorPool> descriptorPool;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+		// the draws of the second pass of the occlusion culling
+		std::unique_ptr<Buffer> lateCommandBuffer;
+		std::unique_ptr<Buffer> lateCountBuffer;
+		VkDescriptorSet lateDescriptorSet = VK_NULL_HANDLE;
+
+		// slots written since the buffers of this frame were last updated
+		std::vector<uint32_t> dirtySlots{};
+		uint64_t meshVersion = 0;
+		bool recorded = false;
+		bool lateRecorded = false;
+	};
+
+	void createCullResources();
+	void createOcclusionResources();
+
+	uint32_t acquireMesh(const std::shared_ptr<Model>& model);
+	void releaseMesh(uint32_t mesh);
+	uint32_t acquireGroup(uint32_t poolClass, const TextureRegistry::Handle& texture);
+	void releaseGroup(uint32_t group);
+	bool createPool(Pool& pool, VkDeviceSize size, VkDeviceSize stride, VkBufferUsageFlags usage);
+
+	void writeSlot(uint32_t slot, GameObject& obj);
+	void markDirty(uint32_t slot);
+	void removeSlot(uint32_t slot);
+
+	// grows a per frame buffer, returns true when it was created again (its content is lost)
+	bool reserve(std::unique_ptr<Buffer>& buffer, VkDeviceSize instanceSize, uint32_t count, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties);
+	void updateFrameBuffers(FrameResources& frame);
+	void reserveVisibility(VkCommandBuffer commandBuffer);
+	void resetVisibility(VkCommandBuffer commandBuffer);
+	void writeDescriptorSet(FrameResources& frame, Buffer& commandBuffer, Buffer& countBuffer, VkDescriptorSet& set);
+	void recordDraws(FrameInfo& frameInfo, Buffer& drawCommands, Buffer& drawCounts, VkPipelineLayout pipelineLayout, Pipeline& pipeline, Pipeline& packedPipeline);
+
+	Device& device;
+	TextureRegistry& textureRegistry;
+	VkDeviceSize vertexPoolSize;
+	VkDeviceSize indexPoolSize;
+
+	Pool vertexPools[VERTEX_POOL_COUNT]{};
+	Pool indexPools[INDEX_POOL_COUNT]{};
+
+	std::vector<Mesh> meshes;
+	std::vector<uint32_t> freeMeshes;
+	std::unordered_map<Model*, uint32_t> meshIndices;
+	std::vector<uint32_t> pendingMeshes;
+	// bumped when a mesh is added or released, the mesh table of a frame is written again then
+	uint64_t meshVersion = 1;
+
+	std::vector<Group> groups;
+	std::vector<uint32_t> freeGroups;
+	std::map<std::pair<uint32_t, TextureRegistry::Entry*>, uint32_t> groupIndices;
+
+	// the CPU copy of the object and instance buffers, indexed by slot
+	std::vector<Slot> slots;
+	std::vector<GpuObject> objects;
+	std::vector<GpuInstance> instances;
+	std::vector<uint32_t> freeSlots;
+	std::unordered_map<GameObject::id_t, uint32_t> slotIndices;
+
+	std::vector<PendingFree> pendingFrees;
+	uint64_t frameCount = 0;
+
+	std::unique_ptr<DescriptorSetLayout> cullSetLayout;
+	VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> cullPipeline;
+	std::vector<FrameResources> frames{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+
+	// written by the second pass, read by the first pass of the next frame. a smaller one is kept
+	// until the frames in flight are done with it
+	std::unique_ptr<Buffer> visibilityBuffer;
+	std::vector<std::pair<uint64_t, std::unique_ptr<Buffer>>> retiredVisibilityBuffers;
+	// slots given to a new object since the last cull, set visible before the first pass
+	std::vector<uint32_t> visibilityResets;
+
+	bool occlusionCulling = false;
+	std::unique_ptr<DepthPyramid> depthPyramid;
+	VkPipelineLayout latePipelineLayout = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> latePipeline;
+
+	Stats stats{};
+	uint32_t drawCallCount = 0;
+	uint32_t commandCount = 0;
+};
@@ -0,0 +1,95 @@
+#include "GpuTimer.h"
+
+// std
+#include <stdexcept>
+
+GpuTimer::GpuTimer(Device& device) : device{ device }
+{
+	// every graphics and compute queue supports timestamps when this is set
+	supported = device.properties.limits.timestampComputeAndGraphics == VK_TRUE;
+	timestampPeriod = device.properties.limits.timestampPeriod;
+	if (!supported) return;
+
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2 * MAX_SCOPES;
+
+	for (auto& frame : frames) {
+		if (vkCreateQueryPool(device.device(), &queryPoolInfo, nullptr, &frame.queryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timestamp query pool");
+		}
+	}
+}
+
+GpuTimer::~GpuTimer()
+{
+	for (auto& frame : frames) {
+		if (frame.queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device.device(), frame.queryPool, nullptr);
+	}
+}
+
+void GpuTimer::beginFrame(VkCommandBuffer commandBuffer, int frameIndex)
+{
+	if (!supported) return;
+
+	currentFrame = &frames[frameIndex];
+
+	// the fence of this frame was waited by Renderer::beginFrame, the queries are available
+	if (currentFrame->queryCount > 0) {
+		lastTimestamps.resize(currentFrame->queryCount);
+		VkResult result = vkGetQueryPoolResults(
+			device.device(),
+			currentFrame->queryPool,
+			0,
+			currentFrame->queryCount,
+			lastTimestamps.size() * sizeof(uint64_t),
+			lastTimestamps.data(),
+			sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT);
+
+		if (result == VK_SUCCESS) lastScopes = currentFrame->scopes;
+	}
+
+	vkCmdResetQueryPool(commandBuffer, currentFrame->queryPool, 0, 2 * MAX_SCOPES);
+	currentFrame->scopes.clear();
+	currentFrame->queryCount = 0;
+}
+
+GpuTimer::Scope* GpuTimer::findScope(const std::string& name)
+{
+	for (auto& scope : currentFrame->scopes) {
+		if (scope.name == name) return &scope;
+	}
+	return nullptr;
+}
+
+void GpuTimer::begin(VkCommandBuffer commandBuffer, const std::string& name)
+{
+	if (!supported || currentFrame == nullptr || currentFrame->queryCount + 2 > 2 * MAX_SCOPES) return;
+
+	currentFrame->scopes.push_back({ name, currentFrame->queryCount++ });
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, currentFrame->queryPool, currentFrame->scopes.back().beginQuery);
+}
+
+void GpuTimer::end(VkCommandBuffer commandBuffer, const std::string& name)
+{
+	if (!supported || currentFrame == nullptr) return;
+
+	Scope* scope = findScope(name);
+	if (scope == nullptr || scope->endQuery != UINT32_MAX) return;
+
+	scope->endQuery = currentFrame->queryCount++;
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, currentFrame->queryPool, scope->endQuery);
+}
+
+float GpuTimer::getTime(const std::string& name) const
+{
+	for (const auto& scope : lastScopes) {
+		if (scope.name != name || scope.endQuery == UINT32_MAX) continue;
+
+		uint64_t ticks = lastTimestamps[scope.endQuery] - lastTimestamps[scope.beginQuery];
+		return static_cast<float>(static_cast<double>(ticks) * timestampPeriod * 1e-6);
+	}
+	return 0.f;
+}
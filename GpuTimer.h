@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Device.h"
+#include "Swap_chain.h"
+
+// std lib headers
+#include <string>
+#include <vector>
+
+/*
+
+	timestamp queries around parts of a frame, one query pool per frame in flight.
+	the results of a frame are read when its pool is used again, the fence of that frame
+	has been waited by then, so reading never stalls. times are MAX_FRAMES_IN_FLIGHT frames late
+
+*/
+class GpuTimer
+{
+public:
+	static constexpr uint32_t MAX_SCOPES = 32;
+
+	GpuTimer(Device& device);
+	~GpuTimer();
+
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	// false when the graphics queue has no timestamps, every call is then a no-op
+	bool isSupported() const { return supported; }
+
+	// reads the results of the previous use of this frame, then resets the queries, outside of a render pass
+	void beginFrame(VkCommandBuffer commandBuffer, int frameIndex);
+
+	void begin(VkCommandBuffer commandBuffer, const std::string& name);
+	void end(VkCommandBuffer commandBuffer, const std::string& name);
+
+	// milliseconds of the scope in the last frame read back, 0 when it was not recorded
+	float getTime(const std::string& name) const;
+
+private:
+	struct Scope {
+		std::string name;
+		uint32_t beginQuery = UINT32_MAX;
+		uint32_t endQuery = UINT32_MAX;
+	};
+
+	struct FrameQueries {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		std::vector<Scope> scopes;
+		uint32_t queryCount = 0;
+	};
+
+	Scope* findScope(const std::string& name);
+
+	Device& device;
+	bool supported = false;
+	float timestampPeriod = 1.f;
+
+	std::vector<FrameQueries> frames{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+	FrameQueries* currentFrame = nullptr;
+
+	std::vector<Scope> lastScopes;
+	std::vector<uint64_t> lastTimestamps;
+};
@@ -0,0 +1,283 @@
+#include "MemoryAllocator.h"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+struct FreeRange {
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+struct MemoryBlock {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+
+	// kept sorted by offset so neighbours can be merged on free
+	std::vector<FreeRange> freeRanges{};
+
+	uint32_t allocationCount = 0;
+	VkDeviceSize bytesUsed = 0;
+	bool dedicated = false;
+
+	uint32_t memoryTypeIndex = 0;
+	bool linear = true;
+};
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+MemoryAllocator::MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize blockSize) : device{ device }, blockSize{ blockSize }
+{
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+	for (auto& pool : pools) {
+		for (auto& block : pool.blocks) {
+			if (block->allocationCount > 0) {
+				std::cerr << "memory allocator: " << block->allocationCount << " allocation(s) not freed\n";
+			}
+			destroyBlock(block.get());
+		}
+	}
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) &&
+			(memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+MemoryAllocator::Pool& MemoryAllocator::getPool(uint32_t memoryTypeIndex, bool linear)
+{
+	for (auto& pool : pools) {
+		if (pool.memoryTypeIndex == memoryTypeIndex && pool.linear == linear) return pool;
+	}
+
+	pools.push_back({ memoryTypeIndex, linear, {} });
+	return pools.back();
+}
+
+MemoryBlock* MemoryAllocator::createBlock(Pool& pool, VkDeviceSize size, bool dedicated)
+{
+	auto block = std::make_unique<MemoryBlock>();
+	block->size = size;
+	block->dedicated = dedicated;
+	block->memoryTypeIndex = pool.memoryTypeIndex;
+	block->linear = pool.linear;
+	block->freeRanges.push_back({ 0, size });
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = pool.memoryTypeIndex;
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate memory block!");
+	}
+
+	// host visible blocks are mapped once for their whole lifetime
+	if (memoryProperties.memoryTypes[pool.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS) {
+			throw std::runtime_error("failed to map memory block!");
+		}
+	}
+
+	pool.blocks.push_back(std::move(block));
+	return pool.blocks.back().get();
+}
+
+void MemoryAllocator::destroyBlock(MemoryBlock* block)
+{
+	if (block->mapped) {
+		vkUnmapMemory(device, block->memory);
+		block->mapped = nullptr;
+	}
+	vkFreeMemory(device, block->memory, nullptr);
+	block->memory = VK_NULL_HANDLE;
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+	uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+	Pool& pool = getPool(memoryTypeIndex, linear);
+
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+	VkDeviceSize size = requirements.size;
+
+	// flush and invalidate ranges have to start and end on a multiple of nonCoherentAtomSize
+	VkMemoryPropertyFlags typeFlags = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+	bool nonCoherent = (typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	if (nonCoherent) {
+		alignment = std::max(alignment, nonCoherentAtomSize);
+		size = alignUp(size, nonCoherentAtomSize);
+	}
+
+	MemoryBlock* bestBlock = nullptr;
+	size_t bestRange = 0;
+	VkDeviceSize bestLeftover = 0;
+
+	// resources bigger than half a block get a block of their own
+	if (size > blockSize / 2) {
+		bestBlock = createBlock(pool, size, true);
+		bestRange = 0;
+	}
+	else {
+		// best fit over every free range of the pool
+		for (auto& block : pool.blocks) {
+			if (block->dedicated) continue;
+
+			for (size_t i = 0; i < block->freeRanges.size(); i++) {
+				const FreeRange& range = block->freeRanges[i];
+				VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+				VkDeviceSize rangeEnd = range.offset + range.size;
+				if (alignedOffset >= rangeEnd || size > rangeEnd - alignedOffset) continue;
+
+				// the padding in front of the aligned offset is not part of the leftover
+				VkDeviceSize leftover = rangeEnd - (alignedOffset + size);
+				if (bestBlock == nullptr || leftover < bestLeftover) {
+					bestBlock = block.get();
+					bestRange = i;
+					bestLeftover = leftover;
+				}
+			}
+		}
+
+		if (bestBlock == nullptr) {
+			bestBlock = createBlock(pool, blockSize, false);
+			bestRange = 0;
+		}
+	}
+
+	// split the chosen range, the padding in front of the aligned offset stays free
+	FreeRange range = bestBlock->freeRanges[bestRange];
+	VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+	VkDeviceSize rangeEnd = range.offset + range.size;
+
+	bestBlock->freeRanges.erase(bestBlock->freeRanges.begin() + bestRange);
+
+	size_t insertAt = bestRange;
+	if (alignedOffset > range.offset) {
+		bestBlock->freeRanges.insert(bestBlock->freeRanges.begin() + insertAt, { range.offset, alignedOffset - range.offset });
+		insertAt++;
+	}
+	if (alignedOffset + size < rangeEnd) {
+		bestBlock->freeRanges.insert(bestBlock->freeRanges.begin() + insertAt, { alignedOffset + size, rangeEnd - (alignedOffset + size) });
+	}
+
+	bestBlock->allocationCount++;
+	bestBlock->bytesUsed += size;
+
+	MemoryAllocation allocation{};
+	allocation.memory = bestBlock->memory;
+	allocation.offset = alignedOffset;
+	allocation.size = size;
+	allocation.mapped = bestBlock->mapped ? static_cast<char*>(bestBlock->mapped) + alignedOffset : nullptr;
+	allocation.memoryTypeIndex = memoryTypeIndex;
+	allocation.block = bestBlock;
+	allocation.nonCoherent = nonCoherent;
+
+	return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+	MemoryBlock* block = allocation.block;
+	if (block == nullptr) return;
+
+	assert(block->allocationCount > 0 && "freeing an allocation from an empty block");
+
+	// insert the range back in offset order and merge it with its neighbours
+	auto& ranges = block->freeRanges;
+	auto it = std::lower_bound(ranges.begin(), ranges.end(), allocation.offset,
+		[](const FreeRange& range, VkDeviceSize offset) { return range.offset < offset; });
+	it = ranges.insert(it, { allocation.offset, allocation.size });
+
+	if (it + 1 != ranges.end() && it->offset + it->size == (it + 1)->offset) {
+		it->size += (it + 1)->size;
+		ranges.erase(it + 1);
+	}
+	if (it != ranges.begin() && (it - 1)->offset + (it - 1)->size == it->offset) {
+		(it - 1)->size += it->size;
+		ranges.erase(it);
+	}
+
+	block->allocationCount--;
+	block->bytesUsed -= allocation.size;
+
+	// give empty blocks back to the driver, one regular block per pool is kept to avoid thrashing
+	if (block->allocationCount == 0) {
+		Pool& pool = getPool(block->memoryTypeIndex, block->linear);
+
+		size_t emptyBlocks = 0;
+		for (auto& other : pool.blocks) {
+			if (other->allocationCount == 0 && !other->dedicated) emptyBlocks++;
+		}
+
+		if (block->dedicated || emptyBlocks > 1) {
+			destroyBlock(block);
+			pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(),
+				[block](const std::unique_ptr<MemoryBlock>& other) { return other.get() == block; }));
+		}
+	}
+
+	allocation = MemoryAllocation{};
+}
+
+MemoryStats MemoryAllocator::getStats() const
+{
+	MemoryStats stats{};
+	VkDeviceSize bytesFree = 0;
+	VkDeviceSize largestRangesSum = 0;
+
+	for (auto& pool : pools) {
+		for (auto& block : pool.blocks) {
+			stats.blockCount++;
+			stats.allocationCount += block->allocationCount;
+			stats.bytesReserved += block->size;
+			stats.bytesUsed += block->bytesUsed;
+
+			VkDeviceSize largestInBlock = 0;
+			for (auto& range : block->freeRanges) {
+				bytesFree += range.size;
+				largestInBlock = std::max(largestInBlock, range.size);
+			}
+
+			largestRangesSum += largestInBlock;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, largestInBlock);
+		}
+	}
+
+	// fragmentation is measured inside blocks, free memory spread over several blocks is not fragmented
+	if (bytesFree > 0) {
+		stats.fragmentation = 1.f - static_cast<float>(largestRangesSum) / static_cast<float>(bytesFree);
+	}
+
+	return stats;
+}
+
+void MemoryAllocator::printStats() const
+{
+	MemoryStats stats = getStats();
+	std::cout << "memory allocator: " << stats.blockCount << " block(s), "
+		<< stats.allocationCount << " allocation(s), "
+		<< stats.bytesUsed / 1024 << " KiB used / " << stats.bytesReserved / 1024 << " KiB reserved, "
+		<< "fragmentation " << stats.fragmentation << "\n";
+}
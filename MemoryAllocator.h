@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+// std lib headers
+#include <memory>
+#include <vector>
+
+struct MemoryBlock;
+
+/*
+
+	a sub range of a VkDeviceMemory block handed out by the MemoryAllocator
+
+*/
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+
+	// pointer to the first byte of the allocation when the memory is host visible, the block stays mapped
+	void* mapped = nullptr;
+
+	uint32_t memoryTypeIndex = 0;
+	MemoryBlock* block = nullptr;
+
+	// host visible without being coherent: writes are flushed and reads invalidated, the offset and
+	// size are multiples of nonCoherentAtomSize so the ranges rounded to it stay inside the allocation
+	bool nonCoherent = false;
+};
+
+struct MemoryStats {
+	uint32_t blockCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize bytesReserved = 0;
+	VkDeviceSize bytesUsed = 0;
+	VkDeviceSize largestFreeRange = 0;
+
+	// 0 when all the free memory is in one range, close to 1 when it is split in many small ranges
+	float fragmentation = 0.f;
+};
+
+/*
+
+	block based allocator: device memory is allocated in large blocks per memory type and
+	buffers / images are placed inside with a best fit free list
+
+*/
+class MemoryAllocator
+{
+public:
+	static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+	MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+	~MemoryAllocator();
+
+	MemoryAllocator(const MemoryAllocator&) = delete;
+	MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+	// linear is true for buffers and linear images, false for optimal tiling images
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+	void free(MemoryAllocation& allocation);
+
+	MemoryStats getStats() const;
+	void printStats() const;
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+private:
+	// linear and optimal resources never share a block, so bufferImageGranularity can not be violated
+	struct Pool {
+		uint32_t memoryTypeIndex;
+		bool linear;
+		std::vector<std::unique_ptr<MemoryBlock>> blocks;
+	};
+
+	MemoryBlock* createBlock(Pool& pool, VkDeviceSize size, bool dedicated);
+	void destroyBlock(MemoryBlock* block);
+	Pool& getPool(uint32_t memoryTypeIndex, bool linear);
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize nonCoherentAtomSize;
+	VkDeviceSize blockSize;
+
+	std::vector<Pool> pools;
+};
@@ -0,0 +1,316 @@
+#include "MeshCache.h"
+
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static_assert(std::is_trivially_copyable<Model::Vertex>::value, "Model::Vertex is written as raw bytes in the mesh cache");
+static_assert(std::is_trivially_copyable<Model::Meshlet>::value, "Model::Meshlet is written as raw bytes in the mesh cache");
+
+static const char MAGIC[4] = { 'M', 'E', 'S', 'H' };
+static const char* CACHE_DIRECTORY = "cache";
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// FNV-1a, only run when cooking or when the write time of the source changed
+static uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t hashFile(const std::string& path) {
+	MappedFile file{ path };
+	return file.isOpen() ? hashBytes(file.data(), file.size()) : 0;
+}
+
+static int64_t sourceTime(const fs::path& path) {
+	return static_cast<int64_t>(fs::last_write_time(path).time_since_epoch().count());
+}
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) return;
+	file = fileHandle;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) return;
+
+	HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr) return;
+	mapping = mappingHandle;
+
+	data_ = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (data_) size_ = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+		void* mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			data_ = static_cast<const uint8_t*>(mapped);
+			size_ = static_cast<size_t>(fileStat.st_size);
+		}
+	}
+
+	// the mapping keeps its own reference to the file
+	::close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (data_) UnmapViewOfFile(data_);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+#else
+	if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+size_t MappedFile::getPageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return static_cast<size_t>(systemInfo.dwPageSize);
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+CookedMesh::CookedMesh(std::unique_ptr<MappedFile> file) : file{ std::move(file) }
+{
+	header = reinterpret_cast<const MeshCacheHeader*>(this->file->data());
+}
+
+const Model::Vertex* CookedMesh::vertices() const
+{
+	return reinterpret_cast<const Model::Vertex*>(file->data() + header->vertexOffset);
+}
+
+const uint32_t* CookedMesh::indices() const
+{
+	return reinterpret_cast<const uint32_t*>(file->data() + header->indexOffset);
+}
+
+Model::LodRange CookedMesh::lod(uint32_t lod) const
+{
+	const MeshCacheLod& entry = reinterpret_cast<const MeshCacheLod*>(file->data() + header->lodOffset)[lod];
+	return { entry.firstIndex, entry.indexCount, entry.error };
+}
+
+const Model::Meshlet* CookedMesh::meshlets() const
+{
+	return reinterpret_cast<const Model::Meshlet*>(file->data() + header->meshletOffset);
+}
+
+std::string CookedMesh::getCachePath(const std::string& sourcePath)
+{
+	// the path is the key, the file name is kept to make the cache folder readable. the cache folder is in the
+	// working directory, the key is the path from it so a relative and an absolute path to the source agree
+	// and the cooked files still match when the folders are moved together
+	std::error_code error;
+	fs::path canonicalPath = fs::weakly_canonical(sourcePath, error);
+	if (error) canonicalPath = fs::absolute(sourcePath).lexically_normal();
+	fs::path root = fs::weakly_canonical(fs::current_path(), error);
+	std::string key = canonicalPath.lexically_proximate(root).generic_string();
+	uint64_t hash = hashBytes(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+
+	return (fs::path(CACHE_DIRECTORY) / (fs::path(sourcePath).filename().string() + "." + name + ".mesh")).string();
+}
+
+std::unique_ptr<CookedMesh> CookedMesh::open(const std::string& sourcePath)
+{
+	std::string cachePath = getCachePath(sourcePath);
+
+	std::error_code error;
+	if (!fs::exists(cachePath, error)) return nullptr;
+
+	auto file = std::make_unique<MappedFile>(cachePath);
+	if (!file->isOpen() || file->size() < sizeof(MeshCacheHeader)) return nullptr;
+
+	const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(file->data());
+
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		header->version != VERSION ||
+		header->vertexStride != sizeof(Model::Vertex) ||
+		header->indexStride != sizeof(uint32_t) ||
+		header->vertexOffset + header->vertexCount * header->vertexStride > file->size() ||
+		header->indexOffset + header->indexCount * header->indexStride > file->size() ||
+		header->lodStride != sizeof(MeshCacheLod) ||
+		header->lodOffset + header->lodCount * header->lodStride > file->size() ||
+		header->meshletStride != sizeof(Model::Meshlet) ||
+		header->meshletOffset + header->meshletCount * header->meshletStride > file->size()) {
+		std::cout << "mesh cache: " << cachePath << " has an old or invalid layout\n";
+		return nullptr;
+	}
+
+	// without the source the cache is used as is, so cooked files can be shipped alone
+	if (fs::exists(sourcePath, error)) {
+		uint64_t size = fs::file_size(sourcePath);
+		int64_t time = sourceTime(sourcePath);
+
+		if (header->sourceSize != size) return nullptr;
+
+		if (header->sourceTime != time) {
+			// touched but maybe not modified, the content decides
+			if (hashFile(sourcePath) != header->sourceHash) return nullptr;
+
+			file = nullptr;
+			std::fstream patch{ cachePath, std::ios::binary | std::ios::in | std::ios::out };
+			patch.seekp(offsetof(MeshCacheHeader, sourceTime));
+			patch.write(reinterpret_cast<const char*>(&time), sizeof(time));
+			patch.close();
+
+			file = std::make_unique<MappedFile>(cachePath);
+			if (!file->isOpen()) return nullptr;
+		}
+	}
+
+	return std::unique_ptr<CookedMesh>(new CookedMesh(std::move(file)));
+}
+
+void CookedMesh::write(const std::string& sourcePath, const Model::Builder& builder)
+{
+	std::string cachePath = getCachePath(sourcePath);
+	fs::create_directories(CACHE_DIRECTORY);
+
+	MeshCacheHeader header{};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.vertexStride = sizeof(Model::Vertex);
+	header.indexStride = sizeof(uint32_t);
+
+	// the full mesh is the first level of the table
+	std::vector<MeshCacheLod> lods{ { 0, static_cast<uint32_t>(builder.indices.size()), 0.f, 0 } };
+	uint64_t indexCount = builder.indices.size();
+	for (const auto& lod : builder.lods) {
+		lods.push_back({ static_cast<uint32_t>(indexCount), static_cast<uint32_t>(lod.indices.size()), lod.error, 0 });
+		indexCount += lod.indices.size();
+	}
+
+	header.vertexCount = builder.vertices.size();
+	header.indexCount = indexCount;
+	header.vertexOffset = alignUp(sizeof(MeshCacheHeader), 16);
+	header.indexOffset = alignUp(header.vertexOffset + header.vertexCount * header.vertexStride, 16);
+	header.lodOffset = alignUp(header.indexOffset + header.indexCount * header.indexStride, 16);
+	header.lodCount = static_cast<uint32_t>(lods.size());
+	header.lodStride = sizeof(MeshCacheLod);
+	header.meshletOffset = alignUp(header.lodOffset + header.lodCount * header.lodStride, 16);
+	header.meshletCount = static_cast<uint32_t>(builder.meshlets.size());
+	header.meshletStride = sizeof(Model::Meshlet);
+
+	header.sourceSize = fs::file_size(sourcePath);
+	header.sourceTime = sourceTime(sourcePath);
+	header.sourceHash = hashFile(sourcePath);
+
+	glm::vec3 boundsMin, boundsMax;
+	Model::computeBounds(builder.vertices.data(), builder.vertices.size(), boundsMin, boundsMax);
+	for (int i = 0; i < 3; i++) {
+		header.boundsMin[i] = boundsMin[i];
+		header.boundsMax[i] = boundsMax[i];
+	}
+
+	// written next to the cache and renamed, a crash never leaves a half written cache
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream out{ tempPath, std::ios::binary | std::ios::trunc };
+		if (!out.is_open()) {
+			throw std::runtime_error("failed to write mesh cache: " + tempPath);
+		}
+
+		const char padding[16] = {};
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(padding, header.vertexOffset - sizeof(header));
+		out.write(reinterpret_cast<const char*>(builder.vertices.data()), header.vertexCount * header.vertexStride);
+		out.write(padding, header.indexOffset - (header.vertexOffset + header.vertexCount * header.vertexStride));
+		out.write(reinterpret_cast<const char*>(builder.indices.data()), builder.indices.size() * header.indexStride);
+		for (const auto& lod : builder.lods) {
+			out.write(reinterpret_cast<const char*>(lod.indices.data()), lod.indices.size() * header.indexStride);
+		}
+		out.write(padding, header.lodOffset - (header.indexOffset + header.indexCount * header.indexStride));
+		out.write(reinterpret_cast<const char*>(lods.data()), lods.size() * sizeof(MeshCacheLod));
+		out.write(padding, header.meshletOffset - (header.lodOffset + header.lodCount * header.lodStride));
+		out.write(reinterpret_cast<const char*>(builder.meshlets.data()), builder.meshlets.size() * sizeof(Model::Meshlet));
+
+		if (!out) {
+			throw std::runtime_error("failed to write mesh cache: " + tempPath);
+		}
+	}
+
+	fs::rename(tempPath, cachePath);
+}
+
+size_t CookedMesh::cookDirectory(const std::string& directory, bool force)
+{
+	size_t cooked = 0;
+
+	for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+		if (!entry.is_regular_file()) continue;
+
+		// the sample assets are stored as .obj.txt
+		std::string name = entry.path().filename().string();
+		bool isObj = entry.path().extension() == ".obj" || (name.size() > 8 && name.compare(name.size() - 8, 8, ".obj.txt") == 0);
+		if (!isObj) continue;
+
+		std::string sourcePath = entry.path().generic_string();
+		if (!force && open(sourcePath)) {
+			std::cout << "up to date: " << sourcePath << "\n";
+			continue;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		Model::Builder builder{};
+		builder.loadModelParallel(sourcePath);
+		MeshOptimizer::optimize(builder);
+		MeshletBuilder::build(builder);
+		MeshOptimizer::optimizeVertexFetch(builder.vertices, builder.indices);
+		MeshSimplifier::generateLods(builder);
+		write(sourcePath, builder);
+
+		float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "cooked: " << sourcePath << " -> " << getCachePath(sourcePath) << " (" << builder.vertices.size() << " vertices, " << builder.lods.size() + 1 << " lods, " << builder.meshlets.size() << " meshlets, " << time << " ms)\n";
+		cooked++;
+	}
+
+	return cooked;
+}
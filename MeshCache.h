@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Model.h"
+
+// std lib headers
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+
+	read only mapping of a whole file, pages are loaded by the OS on first access
+
+*/
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const { return data_ != nullptr; }
+	const uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+
+	// the mapping starts on a page and covers the last one up to its end
+	static size_t getPageSize();
+
+private:
+	const uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
+
+/*
+
+	layout of a cooked mesh file: header, vertex blob in Model::Vertex layout, index blob (uint32), lod table, meshlets
+	the blobs are stored after MeshOptimizer so they are uploaded in the optimized order, the index blob
+	holds the full mesh followed by the levels of MeshSimplifier, the lod table gives their ranges
+	the source key (size, write time, content hash) tells if the cache is still up to date
+
+*/
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertexStride;
+	uint32_t indexStride;
+
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t lodOffset;
+	uint32_t lodCount;
+	uint32_t lodStride;
+	uint64_t meshletOffset;
+	uint32_t meshletCount;
+	uint32_t meshletStride;
+
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t sourceHash;
+
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct MeshCacheLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+	uint32_t padding;
+};
+
+/*
+
+	mesh loaded from a cooked cache file, the vertex and index pointers point in the mapped file
+
+*/
+class CookedMesh
+{
+public:
+	// bump when the file layout or Model::Vertex changes, older caches are then cooked again
+	static constexpr uint32_t VERSION = 6;
+
+	// nullptr when there is no cache for the source file or the cache is out of date
+	static std::unique_ptr<CookedMesh> open(const std::string& sourcePath);
+
+	static void write(const std::string& sourcePath, const Model::Builder& builder);
+
+	// cooks every .obj under directory, returns the number of meshes cooked
+	static size_t cookDirectory(const std::string& directory, bool force = false);
+
+	static std::string getCachePath(const std::string& sourcePath);
+
+	const Model::Vertex* vertices() const;
+	const uint32_t* indices() const;
+	uint32_t vertexCount() const { return static_cast<uint32_t>(header->vertexCount); }
+	uint32_t indexCount() const { return static_cast<uint32_t>(header->indexCount); }
+
+	// level 0 is the full mesh
+	uint32_t lodCount() const { return header->lodCount; }
+	Model::LodRange lod(uint32_t lod) const;
+
+	uint32_t meshletCount() const { return header->meshletCount; }
+	const Model::Meshlet* meshlets() const;
+
+	glm::vec3 boundsMin() const { return { header->boundsMin[0], header->boundsMin[1], header->boundsMin[2] }; }
+	glm::vec3 boundsMax() const { return { header->boundsMax[0], header->boundsMax[1], header->boundsMax[2] }; }
+
+	const MappedFile& getFile() const { return *file; }
+
+private:
+	CookedMesh(std::unique_ptr<MappedFile> file);
+
+	std::unique_ptr<MappedFile> file;
+	const MeshCacheHeader* header;
+};
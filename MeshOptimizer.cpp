@@ -0,0 +1,288 @@
+#include "MeshOptimizer.h"
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+	// triangles around every vertex, stored as one array with an offset per vertex
+	struct TriangleAdjacency {
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		TriangleAdjacency(const std::vector<uint32_t>& indices, size_t vertexCount) {
+			offsets.assign(vertexCount + 1, 0);
+			for (uint32_t index : indices) offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			triangles.resize(indices.size());
+			for (size_t i = 0; i < indices.size(); i++) {
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		uint32_t valence(uint32_t vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+	};
+
+	// FIFO simulation over a range of triangles, the cache starts empty
+	uint32_t countTransforms(const uint32_t* indices, size_t indexCount, std::vector<uint32_t>& timestamps, uint32_t& time, uint32_t cacheSize) {
+		uint32_t transforms = 0;
+		for (size_t i = 0; i < indexCount; i++) {
+			uint32_t& stamp = timestamps[indices[i]];
+			if (time - stamp >= cacheSize) {
+				stamp = time++;
+				transforms++;
+			}
+		}
+		return transforms;
+	}
+
+	// Tipsify, returns the triangle order and the positions where the walk hit a dead end
+	void tipsify(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>& order, std::vector<uint32_t>& deadEnds) {
+		size_t triangleCount = indices.size() / 3;
+		TriangleAdjacency adjacency{ indices, vertexCount };
+
+		std::vector<uint32_t> liveTriangles(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++) liveTriangles[v] = adjacency.valence(v);
+
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> deadEndStack;
+		std::vector<uint32_t> candidates;
+
+		order.clear();
+		order.reserve(triangleCount);
+		deadEnds.clear();
+
+		uint32_t time = cacheSize + 1;
+		uint32_t cursor = 0;
+		int64_t fanning = 0;
+
+		while (fanning >= 0) {
+			candidates.clear();
+
+			// emit every triangle left around the fanning vertex
+			uint32_t f = static_cast<uint32_t>(fanning);
+			for (uint32_t a = adjacency.offsets[f]; a < adjacency.offsets[f + 1]; a++) {
+				uint32_t triangle = adjacency.triangles[a];
+				if (emitted[triangle]) continue;
+
+				for (int k = 0; k < 3; k++) {
+					uint32_t v = indices[3 * triangle + k];
+					deadEndStack.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+					if (time - cacheTime[v] > cacheSize) cacheTime[v] = time++;
+				}
+
+				emitted[triangle] = true;
+				order.push_back(triangle);
+			}
+
+			// next fanning vertex: the one that stays in cache longest once its own triangles are emitted
+			fanning = -1;
+			uint32_t best = 0;
+			for (uint32_t v : candidates) {
+				if (liveTriangles[v] == 0) continue;
+
+				uint32_t priority = 0;
+				if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) priority = time - cacheTime[v];
+				if (priority > best) {
+					best = priority;
+					fanning = v;
+				}
+			}
+
+			if (fanning >= 0) continue;
+
+			// dead end, the recently used vertices first, then the first vertex with triangles left
+			if (order.size() < triangleCount) deadEnds.push_back(static_cast<uint32_t>(order.size()));
+
+			while (!deadEndStack.empty() && fanning < 0) {
+				uint32_t v = deadEndStack.back();
+				deadEndStack.pop_back();
+				if (liveTriangles[v] > 0) fanning = v;
+			}
+
+			while (fanning < 0 && cursor < vertexCount) {
+				if (liveTriangles[cursor] > 0) fanning = cursor;
+				else cursor++;
+			}
+		}
+	}
+}
+
+MeshOptimizer::VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats{};
+	if (indices.empty()) return stats;
+
+	std::vector<uint32_t> timestamps(vertexCount, 0);
+	uint32_t time = cacheSize + 1;
+	stats.transformCount = countTransforms(indices.data(), indices.size(), timestamps, time, cacheSize);
+
+	std::vector<bool> used(vertexCount, false);
+	size_t usedCount = 0;
+	for (uint32_t index : indices) {
+		if (!used[index]) {
+			used[index] = true;
+			usedCount++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(stats.transformCount) / static_cast<float>(indices.size() / 3);
+	stats.atvr = static_cast<float>(stats.transformCount) / static_cast<float>(usedCount);
+	return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	if (indices.size() < 6) return;
+
+	std::vector<uint32_t> order, deadEnds;
+	tipsify(indices, vertexCount, cacheSize, order, deadEnds);
+
+	std::vector<uint32_t> result(indices.size());
+	for (size_t t = 0; t < order.size(); t++) {
+		for (int k = 0; k < 3; k++) result[3 * t + k] = indices[3 * order[t] + k];
+	}
+	indices = std::move(result);
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Model::Vertex>& vertices, float threshold, uint32_t cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2) return;
+
+	// the dead ends of the Tipsify walk are where the cache is cold anyway,
+	// the order is cut there when the part before the cut keeps the ACMR under the threshold
+	std::vector<uint32_t> order, deadEnds;
+	tipsify(indices, vertices.size(), cacheSize, order, deadEnds);
+
+	std::vector<uint32_t> walked(indices.size());
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) walked[3 * t + k] = indices[3 * order[t] + k];
+	}
+
+	float targetAcmr = analyzeVertexCache(walked, vertices.size(), cacheSize).acmr * threshold;
+
+	std::vector<uint32_t> clusterStarts{ 0 };
+	std::vector<uint32_t> timestamps(vertices.size(), 0);
+	uint32_t time = cacheSize + 1;
+	uint32_t transforms = 0;
+	uint32_t simulated = 0;
+
+	// one simulation over the whole order, the cache is emptied at every cut
+	for (uint32_t deadEnd : deadEnds) {
+		uint32_t start = clusterStarts.back();
+
+		transforms += countTransforms(walked.data() + 3 * simulated, 3 * (deadEnd - simulated), timestamps, time, cacheSize);
+		simulated = deadEnd;
+
+		if (static_cast<float>(transforms) <= targetAcmr * static_cast<float>(deadEnd - start)) {
+			clusterStarts.push_back(deadEnd);
+			transforms = 0;
+			time += cacheSize + 1;
+		}
+	}
+	clusterStarts.push_back(static_cast<uint32_t>(triangleCount));
+
+	size_t clusterCount = clusterStarts.size() - 1;
+	if (clusterCount < 2) {
+		indices = std::move(walked);
+		return;
+	}
+
+	// clusters facing away from the center of the mesh are likely in front, they are drawn first
+	glm::vec3 meshCenter{ 0.f };
+	float meshArea = 0.f;
+
+	std::vector<glm::vec3> clusterCenters(clusterCount, glm::vec3{ 0.f });
+	std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3{ 0.f });
+
+	for (size_t c = 0; c < clusterCount; c++) {
+		float clusterArea = 0.f;
+
+		for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+			const glm::vec3& p0 = vertices[walked[3 * t + 0]].position;
+			const glm::vec3& p1 = vertices[walked[3 * t + 1]].position;
+			const glm::vec3& p2 = vertices[walked[3 * t + 2]].position;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 center = (p0 + p1 + p2) / 3.f;
+
+			clusterCenters[c] += center * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+		}
+
+		meshCenter += clusterCenters[c];
+		meshArea += clusterArea;
+		if (clusterArea > 0.f) clusterCenters[c] /= clusterArea;
+	}
+
+	if (meshArea > 0.f) meshCenter /= meshArea;
+
+	std::vector<float> sortKeys(clusterCount);
+	std::vector<uint32_t> clusterOrder(clusterCount);
+	for (uint32_t c = 0; c < clusterCount; c++) {
+		float length = glm::length(clusterNormals[c]);
+		glm::vec3 normal = length > 0.f ? clusterNormals[c] / length : glm::vec3{ 0.f };
+
+		sortKeys[c] = glm::dot(clusterCenters[c] - meshCenter, normal);
+		clusterOrder[c] = c;
+	}
+
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	size_t write = 0;
+	for (uint32_t c : clusterOrder) {
+		for (uint32_t i = 3 * clusterStarts[c]; i < 3 * clusterStarts[c + 1]; i++) indices[write++] = walked[i];
+	}
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<Model::Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Model::Vertex> result;
+	result.reserve(vertices.size());
+
+	for (uint32_t& index : indices) {
+		uint32_t& newIndex = remap[index];
+		if (newIndex == UINT32_MAX) {
+			newIndex = static_cast<uint32_t>(result.size());
+			result.push_back(vertices[index]);
+		}
+		index = newIndex;
+	}
+
+	vertices = std::move(result);
+}
+
+void MeshOptimizer::optimize(Model::Builder& builder, bool reduceOverdraw)
+{
+	if (builder.indices.size() < 6 || builder.indices.size() % 3 != 0) return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	VertexCacheStats before = analyzeVertexCache(builder.indices, builder.vertices.size());
+
+	// the overdraw pass walks the triangles with Tipsify itself
+	if (reduceOverdraw) {
+		optimizeOverdraw(builder.indices, builder.vertices);
+	}
+	else {
+		optimizeVertexCache(builder.indices, builder.vertices.size());
+	}
+	optimizeVertexFetch(builder.vertices, builder.indices);
+
+	VertexCacheStats after = analyzeVertexCache(builder.indices, builder.vertices.size());
+	float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "mesh optimizer: ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr
+		<< " (" << builder.indices.size() / 3 << " triangles, " << time << " ms)\n";
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Model.h"
+
+// std lib headers
+#include <cstdint>
+#include <vector>
+
+/*
+
+	reorders a triangle list before upload:
+	- triangle order for the post transform vertex cache (Tipsify, Sander et al. 2007)
+	- clusters of that order sorted so the outside of the mesh is drawn first, to reduce overdraw
+	- vertices renumbered in the order they are first used, for vertex fetch locality
+
+	the result renders the same triangles, only the order changes
+
+*/
+class MeshOptimizer
+{
+public:
+	// cache size the triangle order is tuned for, smaller than most hardware caches so it stays good on all of them
+	static constexpr uint32_t CACHE_SIZE = 16;
+
+	struct VertexCacheStats {
+		uint32_t transformCount = 0;
+
+		// average cache miss ratio, transformed vertices per triangle (0.5 at best, 3 at worst)
+		float acmr = 0.f;
+
+		// average transform to vertex ratio, 1 when every vertex is transformed once
+		float atvr = 0.f;
+	};
+
+	// FIFO cache simulation of the index buffer
+	static VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = CACHE_SIZE);
+
+	static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = CACHE_SIZE);
+
+	// Tipsify order cut in clusters and sorted, the ACMR stays within threshold times the one of the plain Tipsify order
+	static void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Model::Vertex>& vertices, float threshold = 1.05f, uint32_t cacheSize = CACHE_SIZE);
+
+	// drops the vertices no triangle uses
+	static void optimizeVertexFetch(std::vector<Model::Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	// every step on a builder, prints the ACMR / ATVR before and after
+	static void optimize(Model::Builder& builder, bool reduceOverdraw = true);
+};
@@ -0,0 +1,84 @@
+#include "MeshRegistry.h"
+
+// std
+#include <filesystem>
+
+MeshRegistry::MeshRegistry(Device& device, AssetLoader& assetLoader) : device{ device }, assetLoader{ assetLoader } {}
+
+std::string MeshRegistry::makeKey(const std::string& filePath, Model::VertexFormat vertexFormat)
+{
+	// "model/a.obj" and "model/../model/a.obj" are the same file
+	std::string key = std::filesystem::path(filePath).lexically_normal().generic_string();
+	key += '#';
+	key += std::to_string(static_cast<int>(vertexFormat));
+	return key;
+}
+
+std::shared_ptr<Model> MeshRegistry::load(const std::string& filePath, Model::VertexFormat vertexFormat)
+{
+	std::string key = makeKey(filePath, vertexFormat);
+
+	auto it = models.find(key);
+	if (it != models.end() && it->second.pending.isLoading()) {
+		assetLoader.waitIdle();
+		it = models.find(key);
+	}
+
+	if (it != models.end()) {
+		if (auto model = it->second.model.lock()) {
+			sharedCount++;
+			return model;
+		}
+	}
+
+	std::shared_ptr<Model> model = Model::createModelFromFile(device, filePath, vertexFormat);
+	loadCount++;
+
+	// entries of destroyed models are only replaced, a scene reuses the same few files
+	Entry& entry = models[key];
+	entry.model = model;
+	entry.uploadBatch = device.getUploadContext().getBatchId();
+	entry.pending = {};
+	return model;
+}
+
+AssetFuture<Model> MeshRegistry::loadAsync(const std::string& filePath, Model::VertexFormat vertexFormat)
+{
+	std::string key = makeKey(filePath, vertexFormat);
+	Entry& entry = models[key];
+
+	if (entry.pending.isLoading()) {
+		sharedCount++;
+		return entry.pending;
+	}
+
+	if (auto model = entry.model.lock()) {
+		sharedCount++;
+		return AssetFuture<Model>::loaded(model, device.getUploadContext(), entry.uploadBatch);
+	}
+
+	// the entry keeps the future only while loading, a loaded future would keep the model alive
+	entry.pending = assetLoader.load<Model>(
+		[filePath]() { return Model::readModelFile(filePath); },
+		[this, key, vertexFormat](const Model::FileData& data) {
+			std::shared_ptr<Model> model = Model::createModelFromData(device, data, vertexFormat);
+			loadCount++;
+
+			Entry& loaded = models[key];
+			loaded.model = model;
+			loaded.uploadBatch = device.getUploadContext().getBatchId();
+			loaded.pending = {};
+			return model;
+		});
+
+	return entry.pending;
+}
+
+uint32_t MeshRegistry::getModelCount() const
+{
+	uint32_t count = 0;
+	for (const auto& kv : models) {
+		if (!kv.second.model.expired()) count++;
+	}
+	return count;
+}
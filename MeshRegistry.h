@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Model.h"
+#include "AssetLoader.h"
+
+// std lib headers
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class Device;
+
+/*
+
+	models loaded from files, keyed by path and vertex format. the registry only keeps a weak
+	reference: every object using a file shares one Model, parsed and uploaded once, and the model
+	is destroyed with its last user. loading the file again after that parses it again
+
+	loadAsync reads the file on the workers of the AssetLoader, a request for a file and format
+	already being read shares that read
+
+*/
+class MeshRegistry
+{
+public:
+	MeshRegistry(Device& device, AssetLoader& assetLoader);
+
+	MeshRegistry(const MeshRegistry&) = delete;
+	MeshRegistry& operator=(const MeshRegistry&) = delete;
+
+	// the model already loaded from the file, or Model::createModelFromFile
+	// waits for the read when the file is already loading asynchronously
+	std::shared_ptr<Model> load(const std::string& filePath, Model::VertexFormat vertexFormat = Model::VertexFormat::Full);
+
+	// the model already loaded, the read in flight for the file, or a new read on the workers
+	AssetFuture<Model> loadAsync(const std::string& filePath, Model::VertexFormat vertexFormat = Model::VertexFormat::Full);
+
+	// models still alive
+	uint32_t getModelCount() const;
+
+	// files parsed (or read from the cooked cache) and uploaded, and loads answered with a model already there
+	uint32_t getLoadCount() const { return loadCount; }
+	uint32_t getSharedCount() const { return sharedCount; }
+
+private:
+	static std::string makeKey(const std::string& filePath, Model::VertexFormat vertexFormat);
+
+	struct Entry {
+		std::weak_ptr<Model> model;
+
+		// batch the model was uploaded in
+		uint64_t uploadBatch = 0;
+
+		// set while the file is read on a worker
+		AssetFuture<Model> pending{};
+	};
+
+	Device& device;
+	AssetLoader& assetLoader;
+
+	std::unordered_map<std::string, Entry> models;
+
+	uint32_t loadCount = 0;
+	uint32_t sharedCount = 0;
+};
@@ -0,0 +1,430 @@
+#include "MeshSimplifier.h"
+
+#include "MeshOptimizer.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+	// border edges weigh more than the triangles, the outline of an open mesh is what shows the most
+	const float BORDER_WEIGHT = 10.f;
+
+	// sum of squared distances to a set of planes, weighted by the area of the triangles they come from
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		void addPlane(double a, double b, double c, double d, double w) {
+			a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+			b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+			c2 += w * c * c; cd += w * c * d;
+			d2 += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& other) {
+			a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+			b2 += other.b2; bc += other.bc; bd += other.bd;
+			c2 += other.c2; cd += other.cd;
+			d2 += other.d2;
+			weight += other.weight;
+		}
+
+		// mean squared distance of p to the planes
+		double evaluate(const glm::vec3& p) const {
+			double x = p.x, y = p.y, z = p.z;
+			double r = a2 * x * x + b2 * y * y + c2 * z * z
+				+ 2 * (ab * x * y + ac * x * z + bc * y * z)
+				+ 2 * (ad * x + bd * y + cd * z)
+				+ d2;
+			return weight > 0 ? std::abs(r) / weight : 0;
+		}
+	};
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+
+	// triangles around every vertex
+	struct VertexTriangles {
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		void build(const std::vector<uint32_t>& indices, size_t vertexCount) {
+			offsets.assign(vertexCount + 1, 0);
+			for (uint32_t index : indices) offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			triangles.resize(indices.size());
+			for (size_t i = 0; i < indices.size(); i++) {
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+}
+
+float MeshSimplifier::distanceToTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	// closest point by the voronoi regions of the triangle (Ericson 2004)
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.f && d2 <= 0.f) return glm::length(p - a);
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.f && d4 <= d3) return glm::length(p - b);
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.f && d5 <= d6) return glm::length(p - c);
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f) return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+
+	float denominator = 1.f / (va + vb + vc);
+	return glm::length(p - (a + ab * (vb * denominator) + ac * (vc * denominator)));
+}
+
+std::vector<uint32_t> MeshSimplifier::simplify(const std::vector<Model::Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, float* resultError)
+{
+	std::vector<uint32_t> result = indices;
+	if (resultError) *resultError = 0.f;
+	if (indices.size() < 6 || targetIndexCount >= indices.size()) return result;
+
+	size_t vertexCount = vertices.size();
+
+	// positions scaled to the unit cube so the error does not depend on the size of the mesh
+	glm::vec3 boundsMin, boundsMax;
+	Model::computeBounds(vertices.data(), vertexCount, boundsMin, boundsMax);
+	glm::vec3 extent = boundsMax - boundsMin;
+	float size = std::max(extent.x, std::max(extent.y, extent.z));
+	float scale = size > 0.f ? 1.f / size : 1.f;
+
+	std::vector<glm::vec3> positions(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) positions[v] = (vertices[v].position - boundsMin) * scale;
+
+	// vertices sharing a position (uv or normal seams) get the same position id and are linked in a ring
+	std::vector<uint32_t> sorted(vertexCount);
+	std::iota(sorted.begin(), sorted.end(), 0);
+	std::sort(sorted.begin(), sorted.end(), [&positions](uint32_t a, uint32_t b) {
+		const glm::vec3& pa = positions[a];
+		const glm::vec3& pb = positions[b];
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		return pa.z < pb.z;
+	});
+
+	std::vector<uint32_t> positionIds(vertexCount);
+	std::vector<uint32_t> wedgeNext(vertexCount);
+	uint32_t positionCount = 0;
+
+	for (size_t i = 0; i < vertexCount;) {
+		size_t end = i + 1;
+		while (end < vertexCount && positions[sorted[end]] == positions[sorted[i]]) end++;
+
+		for (size_t j = i; j < end; j++) {
+			positionIds[sorted[j]] = positionCount;
+			wedgeNext[sorted[j]] = sorted[j + 1 < end ? j + 1 : i];
+		}
+
+		positionCount++;
+		i = end;
+	}
+
+	// an edge used by a single triangle is on a border, a border vertex only moves along its border.
+	// vertices on more than two border edges or on edges shared by more than two triangles are locked
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	edgeUses.reserve(result.size());
+
+	auto edgeKey = [](uint64_t a, uint64_t b) { return a < b ? (a << 32 | b) : (b << 32 | a); };
+
+	for (size_t i = 0; i < result.size(); i++) {
+		edgeUses[edgeKey(positionIds[result[i]], positionIds[result[i - i % 3 + (i + 1) % 3]])]++;
+	}
+
+	std::vector<uint8_t> borderEdgeCount(positionCount, 0);
+	std::vector<bool> locked(positionCount, false);
+	for (auto& edge : edgeUses) {
+		uint32_t a = static_cast<uint32_t>(edge.first >> 32);
+		uint32_t b = static_cast<uint32_t>(edge.first & 0xffffffffull);
+
+		if (edge.second == 1) {
+			borderEdgeCount[a] = static_cast<uint8_t>(std::min(borderEdgeCount[a] + 1, 255));
+			borderEdgeCount[b] = static_cast<uint8_t>(std::min(borderEdgeCount[b] + 1, 255));
+		}
+		else if (edge.second > 2) {
+			locked[a] = true;
+			locked[b] = true;
+		}
+	}
+
+	for (uint32_t p = 0; p < positionCount; p++) {
+		if (borderEdgeCount[p] != 0 && borderEdgeCount[p] != 2) locked[p] = true;
+	}
+
+	std::vector<Quadric> quadrics(positionCount);
+	for (size_t t = 0; t < result.size() / 3; t++) {
+		const glm::vec3& p0 = positions[result[3 * t + 0]];
+		const glm::vec3& p1 = positions[result[3 * t + 1]];
+		const glm::vec3& p2 = positions[result[3 * t + 2]];
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		if (area == 0.f) continue;
+
+		normal /= area;
+		float d = -glm::dot(normal, p0);
+		for (int k = 0; k < 3; k++) {
+			quadrics[positionIds[result[3 * t + k]]].addPlane(normal.x, normal.y, normal.z, d, area);
+		}
+
+		// a plane through every border edge, perpendicular to the triangle, keeps the outline of the border
+		for (int k = 0; k < 3; k++) {
+			uint32_t a = positionIds[result[3 * t + k]];
+			uint32_t b = positionIds[result[3 * t + (k + 1) % 3]];
+			if (edgeUses[edgeKey(a, b)] != 1) continue;
+
+			const glm::vec3& e0 = positions[result[3 * t + k]];
+			const glm::vec3& e1 = positions[result[3 * t + (k + 1) % 3]];
+			glm::vec3 edgeNormal = glm::cross(e1 - e0, normal);
+			float length = glm::length(edgeNormal);
+			if (length == 0.f) continue;
+
+			edgeNormal /= length;
+			float edgeD = -glm::dot(edgeNormal, e0);
+			quadrics[a].addPlane(edgeNormal.x, edgeNormal.y, edgeNormal.z, edgeD, BORDER_WEIGHT * length * length);
+			quadrics[b].addPlane(edgeNormal.x, edgeNormal.y, edgeNormal.z, edgeD, BORDER_WEIGHT * length * length);
+		}
+	}
+
+	size_t targetTriangleCount = targetIndexCount / 3;
+	size_t triangleCount = result.size() / 3;
+	double maxCost = static_cast<double>(maxError) * maxError;
+	double reachedCost = 0;
+
+	VertexTriangles adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint32_t> collapsedTo(vertexCount);
+	std::iota(collapsedTo.begin(), collapsedTo.end(), 0);
+	std::vector<bool> touched(positionCount);
+	std::vector<uint32_t> wedgeTargets;
+
+	// every pass collapses the cheapest edges whose ends were not touched by another collapse of the pass
+	while (triangleCount > targetTriangleCount) {
+		adjacency.build(result, vertexCount);
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i++) {
+			uint32_t a = result[i];
+			uint32_t b = result[i - i % 3 + (i + 1) % 3];
+
+			for (int direction = 0; direction < 2; direction++) {
+				uint32_t from = direction == 0 ? a : b;
+				uint32_t to = direction == 0 ? b : a;
+				uint32_t fromId = positionIds[from];
+				uint32_t toId = positionIds[to];
+				if (fromId == toId || locked[fromId]) continue;
+				if (borderEdgeCount[fromId] != 0 && edgeUses[edgeKey(fromId, toId)] != 1) continue;
+
+				Quadric quadric = quadrics[fromId];
+				quadric.add(quadrics[toId]);
+				collapses.push_back({ from, to, quadric.evaluate(positions[to]) });
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+		size_t removed = 0;
+		size_t collapseCount = 0;
+
+		for (const Collapse& collapse : collapses) {
+			if (collapse.cost > maxCost || triangleCount - removed <= targetTriangleCount) break;
+
+			uint32_t fromId = positionIds[collapse.from];
+			uint32_t toId = positionIds[collapse.to];
+			if (touched[fromId] || touched[toId]) continue;
+
+			// every wedge of the moved position needs a wedge of the target position on one of its own triangles,
+			// otherwise the collapse would tear a seam
+			bool valid = true;
+			wedgeTargets.clear();
+
+			uint32_t wedge = collapse.from;
+			do {
+				uint32_t target = UINT32_MAX;
+				if (wedgeNext[wedge] == wedge) {
+					target = collapse.to;
+				}
+				else {
+					for (uint32_t a = adjacency.offsets[wedge]; a < adjacency.offsets[wedge + 1] && target == UINT32_MAX; a++) {
+						uint32_t triangle = adjacency.triangles[a];
+						for (int k = 0; k < 3; k++) {
+							if (positionIds[result[3 * triangle + k]] == toId) target = result[3 * triangle + k];
+						}
+					}
+				}
+
+				if (target == UINT32_MAX && adjacency.offsets[wedge] != adjacency.offsets[wedge + 1]) {
+					valid = false;
+					break;
+				}
+
+				wedgeTargets.push_back(target);
+				wedge = wedgeNext[wedge];
+			} while (wedge != collapse.from);
+
+			// no triangle around the moved position may flip
+			size_t collapsedTriangles = 0;
+			wedge = collapse.from;
+			do {
+				for (uint32_t a = adjacency.offsets[wedge]; a < adjacency.offsets[wedge + 1] && valid; a++) {
+					uint32_t triangle = adjacency.triangles[a];
+
+					bool hasTarget = false;
+					glm::vec3 before[3], after[3];
+					for (int k = 0; k < 3; k++) {
+						uint32_t v = result[3 * triangle + k];
+						hasTarget |= positionIds[v] == toId;
+						before[k] = positions[v];
+						after[k] = positionIds[v] == fromId ? positions[collapse.to] : positions[v];
+					}
+
+					if (hasTarget) {
+						collapsedTriangles++;
+						continue;
+					}
+
+					glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+					glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+					if (glm::dot(normalBefore, normalAfter) <= 0.f) valid = false;
+				}
+				wedge = wedgeNext[wedge];
+			} while (wedge != collapse.from && valid);
+
+			if (!valid) continue;
+
+			size_t w = 0;
+			wedge = collapse.from;
+			do {
+				if (wedgeTargets[w] != UINT32_MAX) remap[wedge] = wedgeTargets[w];
+				w++;
+				wedge = wedgeNext[wedge];
+			} while (wedge != collapse.from);
+
+			// the neighbours are touched too, their flip test would read the old position
+			wedge = collapse.from;
+			do {
+				for (uint32_t a = adjacency.offsets[wedge]; a < adjacency.offsets[wedge + 1]; a++) {
+					uint32_t triangle = adjacency.triangles[a];
+					for (int k = 0; k < 3; k++) touched[positionIds[result[3 * triangle + k]]] = true;
+				}
+				wedge = wedgeNext[wedge];
+			} while (wedge != collapse.from);
+
+			quadrics[toId].add(quadrics[fromId]);
+			reachedCost = std::max(reachedCost, collapse.cost);
+			removed += collapsedTriangles;
+			collapseCount++;
+		}
+
+		if (collapseCount == 0) break;
+
+		// apply the pass and drop the triangles that lost an edge
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; t++) {
+			uint32_t a = remap[result[3 * t + 0]];
+			uint32_t b = remap[result[3 * t + 1]];
+			uint32_t c = remap[result[3 * t + 2]];
+			if (positionIds[a] == positionIds[b] || positionIds[b] == positionIds[c] || positionIds[a] == positionIds[c]) continue;
+
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+		triangleCount = write / 3;
+
+		for (auto& v : collapsedTo) v = remap[v];
+	}
+
+	if (!resultError) return result;
+
+	// the quadric cost is a mean over the planes, the farthest vertex can be further away. every vertex is measured
+	// against the triangles around the position it ended on, that is at least its distance to the result
+	double maxDistance = 0;
+	adjacency.build(result, vertexCount);
+	std::vector<bool> measured(vertexCount, false);
+
+	for (uint32_t v : indices) {
+		if (measured[v]) continue;
+		measured[v] = true;
+
+		uint32_t target = collapsedTo[v];
+		float closest = std::numeric_limits<float>::max();
+
+		uint32_t wedge = target;
+		do {
+			for (uint32_t a = adjacency.offsets[wedge]; a < adjacency.offsets[wedge + 1]; a++) {
+				uint32_t triangle = adjacency.triangles[a];
+				closest = std::min(closest, distanceToTriangle(positions[v],
+					positions[result[3 * triangle + 0]], positions[result[3 * triangle + 1]], positions[result[3 * triangle + 2]]));
+			}
+			wedge = wedgeNext[wedge];
+		} while (wedge != target && closest > 0.f);
+
+		if (closest != std::numeric_limits<float>::max()) maxDistance = std::max(maxDistance, static_cast<double>(closest));
+	}
+
+	*resultError = static_cast<float>(std::max(std::sqrt(reachedCost), maxDistance));
+	return result;
+}
+
+void MeshSimplifier::generateLods(Model::Builder& builder, const LodSettings& settings)
+{
+	builder.lods.clear();
+	if (builder.indices.size() < 6) return;
+
+	glm::vec3 boundsMin, boundsMax;
+	Model::computeBounds(builder.vertices.data(), builder.vertices.size(), boundsMin, boundsMax);
+	glm::vec3 extent = boundsMax - boundsMin;
+	float size = std::max(extent.x, std::max(extent.y, extent.z));
+
+	float error = 0.f;
+
+	for (uint32_t level = 0; level < settings.maxLodCount; level++) {
+		const std::vector<uint32_t>& previous = level == 0 ? builder.indices : builder.lods.back().indices;
+		size_t targetIndexCount = static_cast<size_t>(previous.size() / 3 * settings.reduction) * 3;
+
+		// every level starts from the previous one, the errors add up
+		float levelError = 0.f;
+		std::vector<uint32_t> indices = simplify(builder.vertices, previous, targetIndexCount, settings.maxError - error, &levelError);
+
+		// a level that only removes a few triangles is not worth the switch, the measured error can also go over the budget
+		if (indices.size() > previous.size() * (1.f + settings.reduction) / 2.f) break;
+		if (error + levelError > settings.maxError) break;
+
+		error += levelError;
+		MeshOptimizer::optimizeVertexCache(indices, builder.vertices.size());
+		builder.lods.push_back({ std::move(indices), error * size });
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Model.h"
+
+// std lib headers
+#include <cstdint>
+#include <vector>
+
+/*
+
+	quadric error edge collapse (Garland and Heckbert 1997) restricted to the existing vertices:
+	a vertex is only ever moved onto one of its neighbours, so every level of detail is an index
+	buffer over the same vertex buffer. uv and normal seams are kept by collapsing all the
+	vertices sharing a position together, vertices on open borders only slide along the border
+
+*/
+class MeshSimplifier
+{
+public:
+	struct LodSettings {
+		// most levels generated after the full mesh
+		uint32_t maxLodCount = 4;
+
+		// triangle count of a level relative to the previous one
+		float reduction = 0.5f;
+
+		// largest error allowed, relative to the size of the mesh
+		float maxError = 0.05f;
+	};
+
+	// simplifies until about targetIndexCount indices are left or the next collapse would exceed maxError,
+	// resultError is the error reached, relative to the size of the mesh: the largest of the quadric error and
+	// the distance from the vertices of indices to the result
+	static std::vector<uint32_t> simplify(
+		const std::vector<Model::Vertex>& vertices,
+		const std::vector<uint32_t>& indices,
+		size_t targetIndexCount,
+		float maxError,
+		float* resultError = nullptr);
+
+	// fills builder.lods from builder.indices, stops early when a level would not remove enough triangles
+	static void generateLods(Model::Builder& builder, const LodSettings& settings);
+	static void generateLods(Model::Builder& builder) { generateLods(builder, LodSettings{}); }
+
+	static float distanceToTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+};
@@ -0,0 +1,234 @@
+#include "MeshletBuilder.h"
+
+#include "MeshOptimizer.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+	// triangles around every vertex
+	struct VertexTriangles {
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		VertexTriangles(const std::vector<uint32_t>& indices, size_t vertexCount) {
+			offsets.assign(vertexCount + 1, 0);
+			for (uint32_t index : indices) offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			triangles.resize(indices.size());
+			for (size_t i = 0; i < indices.size(); i++) {
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+
+	// same id for the vertices sharing a position, the id is the first of these vertices
+	std::vector<uint32_t> findPositionIds(const std::vector<Model::Vertex>& vertices) {
+		std::vector<uint32_t> sorted(vertices.size());
+		for (uint32_t v = 0; v < sorted.size(); v++) sorted[v] = v;
+
+		std::sort(sorted.begin(), sorted.end(), [&vertices](uint32_t a, uint32_t b) {
+			const glm::vec3& pa = vertices[a].position;
+			const glm::vec3& pb = vertices[b].position;
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			if (pa.z != pb.z) return pa.z < pb.z;
+			return a < b;
+		});
+
+		std::vector<uint32_t> ids(vertices.size());
+		for (size_t i = 0; i < sorted.size(); i++) {
+			bool same = i > 0 && vertices[sorted[i]].position == vertices[sorted[i - 1]].position;
+			ids[sorted[i]] = same ? ids[sorted[i - 1]] : sorted[i];
+		}
+		return ids;
+	}
+}
+
+void MeshletBuilder::build(Model::Builder& builder)
+{
+	builder.meshlets.clear();
+
+	const std::vector<uint32_t>& indices = builder.indices;
+	size_t vertexCount = builder.vertices.size();
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < MIN_MESHLET_COUNT * MAX_TRIANGLES) return;
+
+	// the meshlet grows over uv and normal seams too, neighbours are found through the positions
+	std::vector<uint32_t> positionIds = findPositionIds(builder.vertices);
+	std::vector<uint32_t> positionIndices(indices.size());
+	for (size_t i = 0; i < indices.size(); i++) positionIndices[i] = positionIds[indices[i]];
+
+	VertexTriangles adjacency{ positionIndices, vertexCount };
+
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		centroids[t] = (builder.vertices[indices[3 * t]].position + builder.vertices[indices[3 * t + 1]].position + builder.vertices[indices[3 * t + 2]].position) / 3.f;
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+	// id of the last meshlet using the vertex, tells in O(1) if a triangle adds vertices to the current one
+	std::vector<uint32_t> vertexMeshlet(vertexCount, UINT32_MAX);
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> meshletTriangles;
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint32_t> meshletIndices;
+
+	uint32_t meshletId = 0;
+	size_t seedCursor = 0;
+	size_t emittedCount = 0;
+
+	while (emittedCount < triangleCount) {
+		// the seed is the first triangle left in the optimized order, it is close to the previous meshlet
+		while (emitted[seedCursor]) seedCursor++;
+
+		candidates.assign(1, static_cast<uint32_t>(seedCursor));
+		meshletTriangles.clear();
+		uint32_t meshletVertexCount = 0;
+		glm::vec3 centroidSum{ 0.f };
+
+		while (meshletTriangles.size() < MAX_TRIANGLES) {
+			// best candidate: fewest new vertices, then closest to the center of the meshlet
+			uint32_t best = UINT32_MAX;
+			uint32_t bestNewVertices = 4;
+			float bestDistance = 0.f;
+			glm::vec3 center = meshletTriangles.empty() ? glm::vec3{ 0.f } : centroidSum / static_cast<float>(meshletTriangles.size());
+
+			for (size_t c = 0; c < candidates.size();) {
+				uint32_t triangle = candidates[c];
+				if (emitted[triangle]) {
+					candidates[c] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+
+				uint32_t newVertices = 0;
+				for (int k = 0; k < 3; k++) newVertices += vertexMeshlet[indices[3 * triangle + k]] != meshletId;
+
+				glm::vec3 offset = centroids[triangle] - center;
+				float distance = glm::dot(offset, offset);
+				if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance)) {
+					best = triangle;
+					bestNewVertices = newVertices;
+					bestDistance = distance;
+				}
+				c++;
+			}
+
+			if (best == UINT32_MAX || meshletVertexCount + bestNewVertices > MAX_VERTICES) break;
+
+			emitted[best] = true;
+			emittedCount++;
+			meshletTriangles.push_back(best);
+			centroidSum += centroids[best];
+
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[3 * best + k];
+				if (vertexMeshlet[v] == meshletId) continue;
+
+				vertexMeshlet[v] = meshletId;
+				meshletVertexCount++;
+
+				// the triangles around a new vertex become candidates
+				uint32_t p = positionIds[v];
+				for (uint32_t a = adjacency.offsets[p]; a < adjacency.offsets[p + 1]; a++) {
+					if (!emitted[adjacency.triangles[a]]) candidates.push_back(adjacency.triangles[a]);
+				}
+			}
+		}
+
+		// the triangles of the meshlet in cache order, on local indices so the cost does not depend on the mesh size
+		meshletVertices.clear();
+		meshletIndices.clear();
+		for (uint32_t triangle : meshletTriangles) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[3 * triangle + k];
+				auto it = std::find(meshletVertices.begin(), meshletVertices.end(), v);
+				meshletIndices.push_back(static_cast<uint32_t>(it - meshletVertices.begin()));
+				if (it == meshletVertices.end()) meshletVertices.push_back(v);
+			}
+		}
+		MeshOptimizer::optimizeVertexCache(meshletIndices, meshletVertices.size());
+		for (uint32_t& index : meshletIndices) index = meshletVertices[index];
+
+		Model::Meshlet meshlet = computeBounds(builder.vertices, meshletIndices.data(), meshletIndices.size());
+		meshlet.firstIndex = static_cast<uint32_t>(result.size());
+		meshlet.indexCount = static_cast<uint32_t>(meshletIndices.size());
+		meshlet.vertexCount = meshletVertexCount;
+		builder.meshlets.push_back(meshlet);
+
+		result.insert(result.end(), meshletIndices.begin(), meshletIndices.end());
+		meshletId++;
+	}
+
+	builder.indices = std::move(result);
+}
+
+Model::Meshlet MeshletBuilder::computeBounds(const std::vector<Model::Vertex>& vertices, const uint32_t* indices, size_t indexCount)
+{
+	Model::Meshlet meshlet{};
+	if (indexCount < 3) return meshlet;
+
+	// sphere around the bounding box
+	glm::vec3 boundsMin = vertices[indices[0]].position;
+	glm::vec3 boundsMax = boundsMin;
+	for (size_t i = 1; i < indexCount; i++) {
+		boundsMin = glm::min(boundsMin, vertices[indices[i]].position);
+		boundsMax = glm::max(boundsMax, vertices[indices[i]].position);
+	}
+
+	meshlet.center = (boundsMin + boundsMax) * 0.5f;
+	for (size_t i = 0; i < indexCount; i++) {
+		meshlet.radius = std::max(meshlet.radius, glm::length(vertices[indices[i]].position - meshlet.center));
+	}
+
+	// the cone axis is the mean normal, its cutoff comes from the normal furthest from it
+	std::vector<glm::vec3> normals;
+	normals.reserve(indexCount / 3);
+	glm::vec3 normalSum{ 0.f };
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		const glm::vec3& p0 = vertices[indices[i + 0]].position;
+		const glm::vec3& p1 = vertices[indices[i + 1]].position;
+		const glm::vec3& p2 = vertices[indices[i + 2]].position;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		normals.push_back(area > 0.f ? normal / area : glm::vec3{ 0.f });
+		normalSum += normals.back();
+	}
+
+	float axisLength = glm::length(normalSum);
+	if (axisLength == 0.f) return meshlet;
+
+	glm::vec3 axis = normalSum / axisLength;
+	float minDot = 1.f;
+	for (const glm::vec3& normal : normals) {
+		if (normal != glm::vec3{ 0.f }) minDot = std::min(minDot, glm::dot(normal, axis));
+	}
+
+	meshlet.coneAxis = axis;
+
+	// the triangles face more than a half space, the meshlet is never back facing as a whole
+	if (minDot <= 0.1f) return meshlet;
+
+	// the apex is on the axis behind the plane of every triangle, so a camera in the cone is behind all of them
+	float maxT = 0.f;
+	for (size_t t = 0; t < normals.size(); t++) {
+		if (normals[t] == glm::vec3{ 0.f }) continue;
+
+		float distance = glm::dot(meshlet.center - vertices[indices[3 * t]].position, normals[t]);
+		maxT = std::max(maxT, distance / glm::dot(axis, normals[t]));
+	}
+
+	meshlet.coneApex = meshlet.center - axis * maxT;
+	meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+	return meshlet;
+}
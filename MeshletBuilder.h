@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Model.h"
+
+// std lib headers
+#include <cstdint>
+#include <vector>
+
+/*
+
+	splits the full mesh of a builder in meshlets for cluster culling.
+	a meshlet grows from a seed triangle by its neighbours, the ones adding the fewest vertices and
+	closest to the meshlet first, so the clusters stay compact and their cones narrow.
+	the index buffer is rewritten in meshlet order, every meshlet in Tipsify order
+
+*/
+class MeshletBuilder
+{
+public:
+	static constexpr uint32_t MAX_VERTICES = 64;
+	static constexpr uint32_t MAX_TRIANGLES = 124;
+
+	// smaller meshes are drawn whole, culling their clusters costs more than it saves
+	static constexpr uint32_t MIN_MESHLET_COUNT = 8;
+
+	// fills builder.meshlets and reorders builder.indices, does nothing on meshes below MIN_MESHLET_COUNT meshlets
+	static void build(Model::Builder& builder);
+
+	// bounding sphere and normal cone of a triangle list
+	static Model::Meshlet computeBounds(const std::vector<Model::Vertex>& vertices, const uint32_t* indices, size_t indexCount);
+};
@@ -0,0 +1,389 @@
+#include "MipGenerator.h"
+
+#include "Device.h"
+
+// std
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+MipGenerator::MipGenerator(Device& device) : device{ device }
+{
+	try {
+		createComputeResources();
+	}
+	catch (const std::exception& e) {
+		// the shader is compiled by compile.bat, without it every chain is blitted
+		std::cerr << "mip generator: " << e.what() << ", falling back on blits\n";
+		computePipeline = nullptr;
+	}
+
+	if (device.properties.limits.timestampComputeAndGraphics == VK_TRUE) {
+		timestampPeriod = device.properties.limits.timestampPeriod;
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2 * MAX_PENDING;
+
+		if (vkCreateQueryPool(device.device(), &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create mip timestamp query pool");
+		}
+	}
+}
+
+MipGenerator::~MipGenerator()
+{
+	// the upload context is destroyed first, it waited for every batch
+	retire(true);
+	printStats();
+
+	if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device.device(), queryPool, nullptr);
+	if (sampler != VK_NULL_HANDLE) vkDestroySampler(device.device(), sampler, nullptr);
+
+	computePipeline = nullptr;
+	if (pipelineLayout != VK_NULL_HANDLE) vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr);
+}
+
+void MipGenerator::createComputeResources()
+{
+	setLayout = DescriptorSetLayout::Builder(device)
+		.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build();
+
+	// a set per chain until its batch is complete
+	descriptorPool = DescriptorPool::Builder(device)
+		.setMaxSets(MAX_PENDING)
+		.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_PENDING)
+		.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_PENDING)
+		.setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)
+		.build();
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PushConstants);
+
+	VkDescriptorSetLayout descriptorSetLayout = setLayout->getDescriptorSetLayout();
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create mip generator pipeline layout");
+	}
+
+	// texelFetch ignores the filter, the sampler is only there for the descriptor
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 0.f;
+
+	if (vkCreateSampler(device.device(), &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create mip generator sampler");
+	}
+
+	computePipeline = std::make_unique<ComputePipeline>(device, "mip_downsample.comp.spv", pipelineLayout);
+}
+
+void MipGenerator::generate(VkImage image, VkImageView view, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	UploadContext& uploadContext = device.getUploadContext();
+	VkCommandBuffer commandBuffer = uploadContext.getGraphicsCommandBuffer();
+
+	retire(false);
+
+	Pending chain{};
+	chain.uploadBatch = uploadContext.getBatchId();
+	chain.levelCount = mipLevels;
+
+	// a query pair is free when no pending chain holds it
+	uint32_t query = nextQuery;
+	bool queryFree = queryPool != VK_NULL_HANDLE &&
+		std::none_of(pending.begin(), pending.end(), [query](const Pending& p) { return p.query == query; });
+
+	if (queryFree) {
+		chain.query = query;
+		nextQuery = (nextQuery + 1) % MAX_PENDING;
+
+		// bottom of pipe: the time starts once the copy of level 0 is done
+		vkCmdResetQueryPool(commandBuffer, queryPool, 2 * query, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * query);
+	}
+
+	bool useCompute = method == Method::Compute && isComputeAvailable() && mipLevels <= MAX_COMPUTE_LEVELS;
+	if (useCompute && recordCompute(commandBuffer, chain, image, view, width, height, mipLevels)) {
+		chain.method = Method::Compute;
+	}
+	else {
+		// said once, the stats at exit count the chains of each method
+		if (method == Method::Compute && !fallbackReported) {
+			const char* reason = !isComputeAvailable() ? "the compute pipeline is missing"
+				: mipLevels > MAX_COMPUTE_LEVELS ? "the texture has too many levels" : "the descriptor pool is full";
+			std::cerr << "mip generator: " << reason << ", blitting instead of the compute path\n";
+			fallbackReported = true;
+		}
+
+		recordBlit(commandBuffer, image, width, height, mipLevels);
+		chain.method = Method::Blit;
+	}
+
+	if (chain.query != UINT32_MAX) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * chain.query + 1);
+	}
+
+	Stats& methodStats = stats[static_cast<int>(chain.method)];
+	methodStats.chainCount++;
+	methodStats.levelCount += mipLevels;
+
+	if (chain.query != UINT32_MAX || chain.scratchBuffer != VK_NULL_HANDLE) {
+		pending.push_back(chain);
+	}
+}
+
+bool MipGenerator::recordCompute(VkCommandBuffer commandBuffer, Pending& chain, VkImage image, VkImageView view, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	// the counter of finished groups, then every level below level 0
+	VkDeviceSize scratchSize = 16;
+	std::vector<VkBufferImageCopy> regions;
+	for (uint32_t level = 1; level < mipLevels; level++) {
+		uint32_t levelWidth = std::max(1u, width >> level);
+		uint32_t levelHeight = std::max(1u, height >> level);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = scratchSize;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { levelWidth, levelHeight, 1 };
+		regions.push_back(region);
+
+		scratchSize += 4ull * levelWidth * levelHeight;
+	}
+
+	device.createBuffer(
+		scratchSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		chain.scratchBuffer,
+		chain.scratchMemory);
+
+	// the sets of complete batches are freed by retire, a full pool means too many chains in one batch
+	VkDescriptorImageInfo imageInfo{ sampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkDescriptorBufferInfo bufferInfo{ chain.scratchBuffer, 0, scratchSize };
+
+	bool allocated = DescriptorWriter(*setLayout, *descriptorPool)
+		.writeImage(0, &imageInfo)
+		.writeBuffer(1, &bufferInfo)
+		.build(chain.descriptorSet);
+
+	if (!allocated) {
+		device.destroyBuffer(chain.scratchBuffer, chain.scratchMemory);
+		chain.scratchBuffer = VK_NULL_HANDLE;
+		chain.descriptorSet = VK_NULL_HANDLE;
+		return false;
+	}
+
+	vkCmdFillBuffer(commandBuffer, chain.scratchBuffer, 0, 16, 0);
+
+	// level 0 is sampled, the levels below stay in TRANSFER_DST_OPTIMAL for the copy
+	VkImageMemoryBarrier sourceBarrier{};
+	sourceBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	sourceBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	sourceBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sourceBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	sourceBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	sourceBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	sourceBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	sourceBarrier.image = image;
+	sourceBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	VkBufferMemoryBarrier counterBarrier{};
+	counterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	counterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	counterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	counterBarrier.buffer = chain.scratchBuffer;
+	counterBarrier.offset = 0;
+	counterBarrier.size = 16;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0,
+		0, nullptr,
+		1, &counterBarrier,
+		1, &sourceBarrier);
+
+	uint32_t level1Width = std::max(1u, width >> 1);
+	uint32_t level1Height = std::max(1u, height >> 1);
+	uint32_t groupsX = (level1Width + 31) / 32;
+	uint32_t groupsY = (level1Height + 31) / 32;
+
+	PushConstants push{};
+	push.size[0] = static_cast<int32_t>(width);
+	push.size[1] = static_cast<int32_t>(height);
+	push.mipCount = mipLevels - 1;
+	push.groupCount = groupsX * groupsY;
+
+	computePipeline->bind(commandBuffer);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &chain.descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+	VkBufferMemoryBarrier levelsBarrier = counterBarrier;
+	levelsBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelsBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	levelsBarrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		1, &levelsBarrier,
+		0, nullptr);
+
+	// every level in one copy
+	vkCmdCopyBufferToImage(
+		commandBuffer,
+		chain.scratchBuffer,
+		image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(regions.size()),
+		regions.data());
+
+	device.getUploadContext().transitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, mipLevels - 1);
+	return true;
+}
+
+void MipGenerator::recordBlit(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	for (uint32_t i = 1; i < mipLevels; i++) {
+		barrier.subresourceRange.baseMipLevel = i - 1;
+
+		// the level above is the source of this blit
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageBlit imageBlit{};
+		imageBlit.srcOffsets[0] = { 0, 0, 0 };
+		imageBlit.srcOffsets[1] = { int32_t(std::max(1u, width >> (i - 1))), int32_t(std::max(1u, height >> (i - 1))), 1 };
+		imageBlit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i - 1, 0, 1 };
+
+		imageBlit.dstOffsets[0] = { 0, 0, 0 };
+		imageBlit.dstOffsets[1] = { int32_t(std::max(1u, width >> i)), int32_t(std::max(1u, height >> i)), 1 };
+		imageBlit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+
+		vkCmdBlitImage(
+			commandBuffer,
+			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &imageBlit,
+			VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	// the last level was only written
+	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void MipGenerator::retire(bool waitAll)
+{
+	while (!pending.empty()) {
+		Pending& chain = pending.front();
+		if (!waitAll && !device.getUploadContext().isBatchComplete(chain.uploadBatch)) break;
+
+		release(chain);
+		pending.pop_front();
+	}
+}
+
+void MipGenerator::release(Pending& chain)
+{
+	if (chain.query != UINT32_MAX) {
+		uint64_t timestamps[2]{};
+		VkResult result = vkGetQueryPoolResults(
+			device.device(),
+			queryPool,
+			2 * chain.query,
+			2,
+			sizeof(timestamps),
+			timestamps,
+			sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT);
+
+		if (result == VK_SUCCESS) {
+			Stats& methodStats = stats[static_cast<int>(chain.method)];
+			methodStats.gpuTime += static_cast<float>(timestamps[1] - timestamps[0]) * timestampPeriod / 1000000.f;
+			methodStats.timedCount++;
+		}
+	}
+
+	if (chain.descriptorSet != VK_NULL_HANDLE) {
+		std::vector<VkDescriptorSet> sets{ chain.descriptorSet };
+		descriptorPool->freeDescriptors(sets);
+	}
+	if (chain.scratchBuffer != VK_NULL_HANDLE) {
+		device.destroyBuffer(chain.scratchBuffer, chain.scratchMemory);
+	}
+}
+
+MipGenerator::Stats MipGenerator::getStats(Method method)
+{
+	retire(false);
+	return stats[static_cast<int>(method)];
+}
+
+void MipGenerator::printStats()
+{
+	const char* names[] = { "compute", "blit" };
+	for (int i = 0; i < 2; i++) {
+		const Stats& methodStats = stats[i];
+		if (methodStats.chainCount == 0) continue;
+
+		std::cout << "mip chains (" << names[i] << "): " << methodStats.chainCount << " textures, " << methodStats.levelCount << " levels";
+		if (methodStats.timedCount > 0) {
+			std::cout << ", " << methodStats.gpuTime << " ms gpu, " << methodStats.gpuTime / methodStats.timedCount << " ms per texture";
+		}
+		std::cout << "\n";
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Pipeline.h"
+#include "descriptors.h"
+
+#include <vulkan/vulkan.h>
+
+// std lib headers
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+class Device;
+
+/*
+
+	records the mip chain of a texture into the current upload batch. the compute path is a single
+	pass downsampler (mip_downsample.comp): one dispatch reduces level 0 to the last level through
+	shared memory, then one copy moves every level from the scratch buffer into the image. the blit
+	path does one vkCmdBlitImage and two barriers per level, it is used when the shader is missing,
+	for textures above 4096 texels and when asked for
+
+	both are timed with timestamps around the recorded commands, the results are read once the
+	batch is complete. the scratch buffer and descriptor set of a dispatch live until then too
+
+*/
+class MipGenerator
+{
+public:
+	enum class Method {
+		Compute,
+		Blit,
+	};
+
+	// level 0 and 12 levels below it
+	static constexpr uint32_t MAX_COMPUTE_LEVELS = 13;
+	static constexpr uint32_t MAX_PENDING = 64;
+
+	struct Stats {
+		uint32_t chainCount = 0;
+		uint32_t levelCount = 0;
+
+		// GPU time of the chains that were timed
+		float gpuTime = 0.f;
+		uint32_t timedCount = 0;
+	};
+
+	MipGenerator(Device& device);
+	~MipGenerator();
+
+	MipGenerator(const MipGenerator&) = delete;
+	MipGenerator& operator=(const MipGenerator&) = delete;
+
+	// level 0 in TRANSFER_DST_OPTIMAL, every level ends in SHADER_READ_ONLY_OPTIMAL.
+	// view is an sRGB view of the whole image, read by the compute path
+	void generate(VkImage image, VkImageView view, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	// the compute path falls back on blits when it is not available
+	void setMethod(Method method) { this->method = method; }
+	Method getMethod() const { return method; }
+	bool isComputeAvailable() const { return computePipeline != nullptr; }
+
+	// chains whose batch is complete
+	Stats getStats(Method method);
+	void printStats();
+
+private:
+	struct PushConstants {
+		int32_t size[2];
+		uint32_t mipCount;
+		uint32_t groupCount;
+	};
+
+	struct Pending {
+		uint64_t uploadBatch = 0;
+		Method method = Method::Blit;
+		uint32_t levelCount = 0;
+		uint32_t query = UINT32_MAX;
+
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkBuffer scratchBuffer = VK_NULL_HANDLE;
+		MemoryAllocation scratchMemory{};
+	};
+
+	void createComputeResources();
+	bool recordCompute(VkCommandBuffer commandBuffer, Pending& pending, VkImage image, VkImageView view, uint32_t width, uint32_t height, uint32_t mipLevels);
+	void recordBlit(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	// releases the chains of complete batches, all of them with waitAll (the batches have to be complete)
+	void retire(bool waitAll);
+	void release(Pending& pending);
+
+	Device& device;
+	Method method = Method::Compute;
+
+	std::unique_ptr<DescriptorSetLayout> setLayout;
+	std::unique_ptr<DescriptorPool> descriptorPool;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> computePipeline;
+	VkSampler sampler = VK_NULL_HANDLE;
+
+	// two queries per pending chain
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 1.f;
+	uint32_t nextQuery = 0;
+
+	std::deque<Pending> pending;
+	Stats stats[2]{};
+
+	// a compute chain was blitted and it was printed
+	bool fallbackReported = false;
+};
@@ -1,47 +1,135 @@
 #include "Model.h"
 
-#include "Texture.h"
-#include "Utils.h"
+#include "MeshCache.h"
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "VertexWeld.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <cassert>
+#include <fstream>
 #include <iostream>
-#include <unordered_map>
-
-namespace std {
-	template<>
-	struct hash<Model::Vertex>
-	{
-		size_t operator()(Model::Vertex const& vertex) const {
-			size_t seed = 0;
-			hashCombine(seed, vertex.position, vertex.normal, vertex.uv);
-			return seed;
-		}
-	};
+#include <mutex>
+#include <thread>
+
+Model::Model(Device& device, const Model::Builder& builder, VertexFormat vertexFormat) : device{ device }, vertexFormat{ vertexFormat } {
+	// the bounds are needed first, packed positions are quantized in them
+	computeBounds(builder.vertices.data(), builder.vertices.size(), boundsMin, boundsMax);
+	createVertexBuffers(builder.vertices.data(), static_cast<uint32_t>(builder.vertices.size()));
+	createIndexBuffers(builder);
+	createMeshletBuffer(builder.meshlets.data(), static_cast<uint32_t>(builder.meshlets.size()));
 }
 
-Model::Model(Device& device, const Model::Builder& builder, const char* filePathTexture) : device{ device } {
-	createVertexBuffers(builder.vertices);
-	createIndexBuffers(builder.indices);
+// the buffer is destroyed first, the mapping has to outlive the imported memory
+struct Model::ImportedFile {
+	std::shared_ptr<CookedMesh> mesh;
+	std::unique_ptr<Buffer> buffer;
+};
+
+Model::Model(Device& device, const std::shared_ptr<CookedMesh>& mesh, VertexFormat vertexFormat) : device{ device }, vertexFormat{ vertexFormat } {
+	boundsMin = mesh->boundsMin();
+	boundsMax = mesh->boundsMax();
+
+	// with the full format the blobs are copied from the mapped file as they are, by the GPU when the
+	// file is imported, else through the staging ring. packed vertices and 16 bit indices are staged
+	importedFile = importMappedFile(device, mesh);
+
+	createVertexBuffers(mesh->vertices(), mesh->vertexCount());
+	createIndexBuffers(mesh->indices(), mesh->indexCount());
+
+	// the index blob holds every level, the table says where they start
+	if (mesh->lodCount() > 0) {
+		lods.clear();
+		for (uint32_t lod = 0; lod < mesh->lodCount(); lod++) lods.push_back(mesh->lod(lod));
+	}
 
-	texture = std::make_unique<Texture>( device, filePathTexture );
+	createMeshletBuffer(mesh->meshlets(), mesh->meshletCount());
 
+	importedFile.reset();
 }
 
 Model::~Model() {}
 
-std::unique_ptr<Model> Model::createModelFromFile(Device& device, const std::string& filePath, const char* filePathTexture)
+Model::FileData Model::readModelFile(const std::string& filePath)
 {
-	Builder builder{};
-	builder.loadModel(filePath);
-	std::cout << "vertex count: " << builder.vertices.size() << "\n";
-	return std::make_unique<Model>(device, builder, filePathTexture);
+	auto start = std::chrono::high_resolution_clock::now();
+
+	FileData data{};
+	if (auto mesh = CookedMesh::open(filePath)) {
+		float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "vertex count: " << mesh->vertexCount() << " (cooked cache, " << time << " ms)\n";
+		data.cookedMesh = std::move(mesh);
+		return data;
+	}
+
+	Builder& builder = data.builder;
+	builder.loadModelParallel(filePath);
+	MeshOptimizer::optimize(builder);
+	MeshletBuilder::build(builder);
+	MeshOptimizer::optimizeVertexFetch(builder.vertices, builder.indices);
+	MeshSimplifier::generateLods(builder);
+
+	float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "vertex count: " << builder.vertices.size() << " (parsed, " << time << " ms)\n";
+
+	try {
+		CookedMesh::write(filePath, builder);
+	}
+	catch (const std::exception& e) {
+		// the model still loads, it is only parsed again next time
+		std::cerr << e.what() << "\n";
+	}
+
+	return data;
+}
+
+std::unique_ptr<Model> Model::createModelFromData(Device& device, const FileData& data, VertexFormat vertexFormat)
+{
+	if (data.cookedMesh) return std::make_unique<Model>(device, data.cookedMesh, vertexFormat);
+	return std::make_unique<Model>(device, data.builder, vertexFormat);
+}
+
+std::unique_ptr<Model> Model::createModelFromFile(Device& device, const std::string& filePath, VertexFormat vertexFormat)
+{
+	return createModelFromData(device, readModelFile(filePath), vertexFormat);
+}
+
+void Model::computeBounds(const Vertex* vertices, size_t vertexCount, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	if (vertexCount == 0) {
+		boundsMin = boundsMax = glm::vec3{ 0.f };
+		return;
+	}
+
+	boundsMin = boundsMax = vertices[0].position;
+	for (size_t i = 1; i < vertexCount; i++) {
+		boundsMin = glm::min(boundsMin, vertices[i].position);
+		boundsMax = glm::max(boundsMax, vertices[i].position);
+	}
+}
+
+glm::mat4 Model::getDequantizeMatrix() const
+{
+	glm::mat4 dequantize{ 1.f };
+	if (!isPacked()) return dequantize;
+
+	glm::vec3 extent = boundsMax - boundsMin;
+	dequantize[0][0] = extent.x;
+	dequantize[1][1] = extent.y;
+	dequantize[2][2] = extent.z;
+	dequantize[3] = glm::vec4(boundsMin, 1.f);
+	return dequantize;
 }
 
 void Model::bind(VkCommandBuffer commandBuffer)
@@ -50,18 +138,24 @@ void Model::bind(VkCommandBuffer commandBuffer)
 	VkDeviceSize offsets[] = { 0 };
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
 
+	if (colorBuffer) {
+		VkBuffer colorBuffers[] = { colorBuffer->getBuffer() };
+		vkCmdBindVertexBuffers(commandBuffer, COLOR_BINDING, 1, colorBuffers, offsets);
+	}
+
 	if (hasIndexBuffer) {
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, indexType);
 	}
 }
 
-void Model::draw(VkCommandBuffer commandBuffer)
+void Model::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance, uint32_t lod)
 {
 	if (hasIndexBuffer) {
-		vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+		const LodRange& range = lods[std::min(lod, getLodCount() - 1)];
+		vkCmdDrawIndexed(commandBuffer, range.indexCount, instanceCount, range.firstIndex, 0, firstInstance);
 	}
 	else {
-		vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+		vkCmdDraw(commandBuffer, vertexCount, instanceCount, 0, firstInstance);
 	}
 }
 
@@ -70,69 +164,142 @@ void Model::draw(VkCommandBuffer commandBuffer)
 //	return { textureSampler, textureImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
 //}
 
-void Model::createVertexBuffers(const std::vector<Vertex>& vertices)
+std::shared_ptr<Model::ImportedFile> Model::importMappedFile(Device& device, const std::shared_ptr<CookedMesh>& mesh)
 {
-	vertexCount = static_cast<uint32_t>(vertices.size());
+	if (!device.hasExternalMemoryHost()) return nullptr;
+
+	// the import is widened to the alignment, it has to stay in the pages of the mapping
+	const MappedFile& file = mesh->getFile();
+	VkDeviceSize alignment = device.getHostPointerAlignment();
+	if (alignment > MappedFile::getPageSize() || reinterpret_cast<uintptr_t>(file.data()) % alignment != 0) return nullptr;
+
+	try {
+		auto imported = std::make_shared<ImportedFile>();
+		imported->mesh = mesh;
+		imported->buffer = std::make_unique<Buffer>(device, file.data(), static_cast<VkDeviceSize>(file.size()), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+		return imported;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "mesh import failed, staged instead: " << e.what() << "\n";
+		return nullptr;
+	}
+}
 
-	assert(vertexCount >= 3 && "Vertex count must be at least 3");
+std::unique_ptr<Buffer> Model::createDeviceBuffer(const void* data, uint32_t instanceSize, uint32_t instanceCount, VkBufferUsageFlags usage, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	auto buffer = std::make_unique<Buffer>(
+		device,
+		instanceSize,
+		instanceCount,
+		// the source of the copies into the pools of GpuScene
+		usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	);
 
-	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount;
+	VkDeviceSize size = static_cast<VkDeviceSize>(instanceSize) * instanceCount;
+	UploadContext& uploadContext = device.getUploadContext();
+
+	// data still in the imported file is read by the copy itself
+	if (importedFile) {
+		const uint8_t* fileData = importedFile->mesh->getFile().data();
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+		if (bytes >= fileData && bytes + size <= fileData + importedFile->mesh->getFile().size()) {
+			uploadContext.copyBuffer(
+				importedFile->buffer->getBuffer(),
+				importedFile->buffer->getImportOffset() + static_cast<VkDeviceSize>(bytes - fileData),
+				buffer->getBuffer(),
+				size,
+				dstStage,
+				dstAccess);
+			uploadContext.releaseWithBatch(importedFile);
+			return buffer;
+		}
+	}
 
-	uint32_t vertexSize = sizeof(vertices[0]);
+	// staged in the upload ring, submitted with the rest of the batch
+	uploadContext.uploadBuffer(
+		buffer->getBuffer(),
+		data,
+		size,
+		dstStage,
+		dstAccess);
 
-	Buffer stagingBuffer{
-		device,
-		vertexSize,
-		vertexCount,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	};
+	return buffer;
+}
 
-	stagingBuffer.map();
-	stagingBuffer.writeToBuffer((void*)vertices.data());
+void Model::createVertexBuffers(const Vertex* vertices, uint32_t vertexCount)
+{
+	this->vertexCount = vertexCount;
 
-	vertexBuffer = std::make_unique<Buffer>(
-		device,
-		vertexSize,
-		vertexCount,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-	);
+	assert(vertexCount >= 3 && "Vertex count must be at least 3");
 
-	device.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer->getBuffer(), bufferSize);
+	if (vertexFormat == VertexFormat::Full) {
+		vertexBuffer = createDeviceBuffer(vertices, sizeof(Vertex), vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+		return;
+	}
+
+	std::vector<PackedVertex> packedVertices(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; i++) {
+		packedVertices[i] = PackedVertex::pack(vertices[i], boundsMin, boundsMax);
+	}
+	vertexBuffer = createDeviceBuffer(packedVertices.data(), sizeof(PackedVertex), vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+	if (vertexFormat == VertexFormat::PackedWithColor) {
+		std::vector<uint32_t> colors(vertexCount);
+		for (uint32_t i = 0; i < vertexCount; i++) {
+			colors[i] = PackedVertex::packColor(vertices[i].color);
+		}
+		colorBuffer = createDeviceBuffer(colors.data(), sizeof(uint32_t), vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	}
 }
 
-void Model::createIndexBuffers(const std::vector<uint32_t>& indices)
+void Model::createIndexBuffers(const uint32_t* indices, uint32_t indexCount)
 {
-	indexCount = static_cast<uint32_t>(indices.size());
+	this->indexCount = indexCount;
 	hasIndexBuffer = indexCount > 0;
 
 	if (!hasIndexBuffer) return;
 
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indexCount;
-	uint32_t indexSize = sizeof(indices[0]);
+	lods = { { 0, indexCount, 0.f } };
 
-	Buffer stagingBuffer{
-		device,
-		indexSize,
-		indexCount,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	};
+	// primitive restart is off, so 0xFFFF is a valid index too
+	if (vertexCount <= 65536) {
+		std::vector<uint16_t> shortIndices(indices, indices + indexCount);
+		indexType = VK_INDEX_TYPE_UINT16;
+		indexBuffer = createDeviceBuffer(shortIndices.data(), sizeof(uint16_t), indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+		return;
+	}
 
-	stagingBuffer.map();
-	stagingBuffer.writeToBuffer((void*)indices.data());
+	indexType = VK_INDEX_TYPE_UINT32;
+	indexBuffer = createDeviceBuffer(indices, sizeof(uint32_t), indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
 
-	indexBuffer = std::make_unique<Buffer>(
-		device,
-		indexSize,
-		indexCount,
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-	);
+void Model::createIndexBuffers(const Builder& builder)
+{
+	if (builder.lods.empty()) {
+		createIndexBuffers(builder.indices.data(), static_cast<uint32_t>(builder.indices.size()));
+		return;
+	}
+
+	std::vector<LodRange> ranges{ { 0, static_cast<uint32_t>(builder.indices.size()), 0.f } };
+	std::vector<uint32_t> indices = builder.indices;
+
+	for (const auto& lod : builder.lods) {
+		ranges.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lod.indices.size()), lod.error });
+		indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
+	}
+
+	createIndexBuffers(indices.data(), static_cast<uint32_t>(indices.size()));
+	lods = std::move(ranges);
+}
 
-	device.copyBuffer(stagingBuffer.getBuffer(), indexBuffer->getBuffer(), bufferSize);
+void Model::createMeshletBuffer(const Meshlet* meshlets, uint32_t meshletCount)
+{
+	this->meshlets.assign(meshlets, meshlets + meshletCount);
+	if (meshletCount == 0) return;
 
+	meshletBuffer = createDeviceBuffer(meshlets, sizeof(Meshlet), meshletCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
 }
 
 std::vector<VkVertexInputBindingDescription> Model::Vertex::getBindingDescriptions()
@@ -156,6 +323,68 @@ std::vector<VkVertexInputAttributeDescription> Model::Vertex::getAttributeDescri
 	return attributeDescriptions;
 }
 
+std::vector<VkVertexInputBindingDescription> Model::PackedVertex::getBindingDescriptions(bool colorStream)
+{
+	std::vector<VkVertexInputBindingDescription> bindingDescription(1);
+	bindingDescription[0].binding = 0;
+	bindingDescription[0].stride = sizeof(PackedVertex);
+	bindingDescription[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	if (colorStream) {
+		bindingDescription.push_back({ COLOR_BINDING, sizeof(uint32_t), VK_VERTEX_INPUT_RATE_VERTEX });
+	}
+	return bindingDescription;
+}
+
+std::vector<VkVertexInputAttributeDescription> Model::PackedVertex::getAttributeDescriptions(bool colorStream)
+{
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+
+	// same locations as Vertex, the shader decodes the normal
+	attributeDescriptions.push_back({ 0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(PackedVertex, position) });
+	attributeDescriptions.push_back({ 2, 0, VK_FORMAT_R16G16_SNORM, offsetof(PackedVertex, normal) });
+	attributeDescriptions.push_back({ 3, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, uv) });
+
+	if (colorStream) {
+		attributeDescriptions.push_back({ 1, COLOR_BINDING, VK_FORMAT_R8G8B8A8_UNORM, 0 });
+	}
+
+	return attributeDescriptions;
+}
+
+Model::PackedVertex Model::PackedVertex::pack(const Vertex& vertex, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	PackedVertex packed{};
+
+	glm::vec3 extent = boundsMax - boundsMin;
+	for (int i = 0; i < 3; i++) {
+		float t = extent[i] > 0.f ? (vertex.position[i] - boundsMin[i]) / extent[i] : 0.f;
+		packed.position[i] = glm::packUnorm1x16(t);
+	}
+
+	// octahedral: project on the octahedron |x| + |y| + |z| = 1, fold the lower half over the upper one
+	glm::vec3 n = vertex.normal;
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	glm::vec2 octahedral = sum > 0.f ? glm::vec2(n.x, n.y) / sum : glm::vec2(0.f);
+	if (n.z < 0.f) {
+		octahedral = glm::vec2(
+			(1.f - std::abs(octahedral.y)) * (octahedral.x >= 0.f ? 1.f : -1.f),
+			(1.f - std::abs(octahedral.x)) * (octahedral.y >= 0.f ? 1.f : -1.f));
+	}
+	packed.normal[0] = glm::packSnorm1x16(octahedral.x);
+	packed.normal[1] = glm::packSnorm1x16(octahedral.y);
+
+	packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+	packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+
+	return packed;
+}
+
+uint32_t Model::PackedVertex::packColor(glm::vec3 color)
+{
+	return glm::packUnorm4x8(glm::vec4(color, 1.f));
+}
+
 void Model::Builder::loadModel(const std::string& filepath)
 {
 	tinyobj::attrib_t attrib;
@@ -171,7 +400,11 @@ void Model::Builder::loadModel(const std::string& filepath)
 	vertices.clear();
 	indices.clear();
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+	size_t indexCount = 0;
+	for (const auto& shape : shapes) indexCount += shape.mesh.indices.size();
+	indices.reserve(indexCount);
+
+	VertexWeldTable uniqueVertices{ vertices, indexCount };
 
 	for (const auto& shape : shapes) {
 		for (const auto& index : shape.mesh.indices)
@@ -206,11 +439,7 @@ void Model::Builder::loadModel(const std::string& filepath)
 				};
 			}
 
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-				vertices.push_back(vertex);
-			}
-			indices.push_back(uniqueVertices[vertex]);
+			indices.push_back(uniqueVertices.insert(vertex));
 		}
 	}
 }
@@ -229,7 +458,11 @@ void Model::Builder::loadOBJModel(const std::string& filepath)
 	vertices.clear();
 	indices.clear();
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+	size_t indexCount = 0;
+	for (const auto& shape : shapes) indexCount += shape.mesh.indices.size();
+	indices.reserve(indexCount);
+
+	VertexWeldTable uniqueVertices{ vertices, indexCount };
 
 	for (const auto& shape : shapes) {
 		for (const auto& index : shape.mesh.indices)
@@ -264,11 +497,324 @@ void Model::Builder::loadOBJModel(const std::string& filepath)
 				};
 			}
 
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-				vertices.push_back(vertex);
+			indices.push_back(uniqueVertices.insert(vertex));
+		}
+	}
+}
+
+void Model::Builder::weldVertices()
+{
+	std::vector<Vertex> source = std::move(vertices);
+	vertices = {};
+
+	if (indices.empty()) {
+		indices.resize(source.size());
+		for (uint32_t i = 0; i < source.size(); i++) indices[i] = i;
+	}
+
+	VertexWeldTable uniqueVertices{ vertices, indices.size() };
+	for (auto& index : indices) {
+		index = uniqueVertices.insert(source[index]);
+	}
+}
+
+
+/*
+
+	parallel OBJ loader: the file is cut in one chunk per thread on line boundaries.
+	a first pass counts the v / vt / vn lines of every chunk so each chunk knows the global
+	index of its first attribute, the second pass parses the chunks in parallel directly in
+	the shared attribute arrays and dedups the faces of the chunk in a local vertex table.
+	the local tables are merged in chunk order, which gives the same first occurrence order
+	as the single threaded loader
+
+*/
+
+namespace {
+
+	struct ObjIndex {
+		int position;
+		int texcoord;
+		int normal;
+	};
+
+	struct ObjChunk {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		size_t positionBase = 0;
+		size_t texcoordBase = 0;
+		size_t normalBase = 0;
+
+		size_t positionCount = 0;
+		size_t texcoordCount = 0;
+		size_t normalCount = 0;
+
+		// triangulated face stream of the chunk, then its local vertex table
+		std::vector<ObjIndex> faces;
+		std::vector<Model::Vertex> vertices;
+		std::vector<uint32_t> indices;
+	};
+
+	const char* skipSpaces(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		return p;
+	}
+
+	const char* lineEnd(const char* p, const char* end) {
+		const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+		return newline ? newline : end;
+	}
+
+	bool parseFloat(const char*& p, const char* end, float& value) {
+		p = skipSpaces(p, end);
+		if (p < end && *p == '+') p++;
+
+		auto result = std::from_chars(p, end, value);
+		if (result.ec != std::errc()) return false;
+
+		p = result.ptr;
+		return true;
+	}
+
+	// OBJ indices are 1 based, negative ones are relative to the attributes read so far
+	bool parseIndex(const char*& p, const char* end, size_t countSoFar, int& index) {
+		int value = 0;
+		auto result = std::from_chars(p, end, value);
+		if (result.ec != std::errc() || value == 0) return false;
+
+		p = result.ptr;
+		index = value > 0 ? value - 1 : static_cast<int>(countSoFar) + value;
+		return true;
+	}
+
+	void countAttributes(ObjChunk& chunk) {
+		for (const char* line = chunk.begin; line < chunk.end; line = lineEnd(line, chunk.end) + 1) {
+			const char* p = skipSpaces(line, chunk.end);
+			if (chunk.end - p < 2 || p[0] != 'v') continue;
+
+			if (p[1] == ' ' || p[1] == '\t') chunk.positionCount++;
+			else if (p[1] == 't') chunk.texcoordCount++;
+			else if (p[1] == 'n') chunk.normalCount++;
+		}
+	}
+
+	void parseChunk(ObjChunk& chunk, std::vector<float>& positions, std::vector<float>& colors, std::vector<float>& texcoords, std::vector<float>& normals) {
+		size_t positionIndex = chunk.positionBase;
+		size_t texcoordIndex = chunk.texcoordBase;
+		size_t normalIndex = chunk.normalBase;
+
+		std::vector<ObjIndex> faces{};
+		std::vector<ObjIndex> polygon{};
+
+		for (const char* line = chunk.begin; line < chunk.end; line = lineEnd(line, chunk.end) + 1) {
+			const char* end = lineEnd(line, chunk.end);
+			if (end > line && end[-1] == '\r') end--;
+
+			const char* p = skipSpaces(line, end);
+			if (end - p < 2) continue;
+
+			if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+				p += 2;
+				float* position = &positions[3 * positionIndex];
+				float* color = &colors[3 * positionIndex];
+				parseFloat(p, end, position[0]);
+				parseFloat(p, end, position[1]);
+				parseFloat(p, end, position[2]);
+
+				// same default as tinyobj when the line has no vertex color
+				for (int i = 0; i < 3; i++) {
+					if (!parseFloat(p, end, color[i])) color[i] = 1.f;
+				}
+				positionIndex++;
+			}
+			else if (p[0] == 'v' && p[1] == 't') {
+				p += 2;
+				parseFloat(p, end, texcoords[2 * texcoordIndex + 0]);
+				parseFloat(p, end, texcoords[2 * texcoordIndex + 1]);
+				texcoordIndex++;
+			}
+			else if (p[0] == 'v' && p[1] == 'n') {
+				p += 2;
+				parseFloat(p, end, normals[3 * normalIndex + 0]);
+				parseFloat(p, end, normals[3 * normalIndex + 1]);
+				parseFloat(p, end, normals[3 * normalIndex + 2]);
+				normalIndex++;
+			}
+			else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+				p += 2;
+				polygon.clear();
+
+				while ((p = skipSpaces(p, end)) < end) {
+					ObjIndex index{ -1, -1, -1 };
+					if (!parseIndex(p, end, positionIndex, index.position)) {
+						throw std::runtime_error("invalid face in obj file");
+					}
+
+					// v, v/vt, v//vn or v/vt/vn
+					if (p < end && *p == '/') {
+						p++;
+						if (p < end && *p != '/') parseIndex(p, end, texcoordIndex, index.texcoord);
+						if (p < end && *p == '/') {
+							p++;
+							parseIndex(p, end, normalIndex, index.normal);
+						}
+					}
+
+					polygon.push_back(index);
+					while (p < end && *p != ' ' && *p != '\t') p++;
+				}
+
+				// fan triangulation, same as tinyobj for convex polygons
+				for (size_t i = 2; i < polygon.size(); i++) {
+					faces.push_back(polygon[0]);
+					faces.push_back(polygon[i - 1]);
+					faces.push_back(polygon[i]);
+				}
 			}
-			indices.push_back(uniqueVertices[vertex]);
 		}
+
+		chunk.faces = std::move(faces);
 	}
 }
+
+void Model::Builder::loadModelParallel(const std::string& filepath, unsigned int threadCount)
+{
+	std::ifstream file{ filepath, std::ios::binary | std::ios::ate };
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open file: " + filepath);
+	}
+
+	std::string data(static_cast<size_t>(file.tellg()), '\0');
+	file.seekg(0);
+	file.read(data.data(), data.size());
+
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// cut the file in chunks of about the same size, each one ends after a newline
+	const char* begin = data.data();
+	const char* end = begin + data.size();
+
+	std::vector<ObjChunk> chunks(threadCount);
+	const char* chunkBegin = begin;
+	for (unsigned int i = 0; i < threadCount; i++) {
+		const char* chunkEnd = i + 1 == threadCount ? end : std::max(chunkBegin, begin + data.size() * (i + 1) / threadCount);
+		if (chunkEnd < end) chunkEnd = lineEnd(chunkEnd, end) + 1;
+		chunkEnd = std::min(chunkEnd, end);
+
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	auto parallelFor = [&chunks](auto&& function) {
+		std::vector<std::thread> workers{};
+		for (size_t i = 1; i < chunks.size(); i++) {
+			workers.emplace_back([&function, &chunks, i]() { function(chunks[i]); });
+		}
+		function(chunks[0]);
+
+		for (auto& worker : workers) worker.join();
+	};
+
+	// pass 1: count attributes to know where every chunk writes
+	parallelFor([](ObjChunk& chunk) { countAttributes(chunk); });
+
+	size_t positionCount = 0, texcoordCount = 0, normalCount = 0;
+	for (auto& chunk : chunks) {
+		chunk.positionBase = positionCount;
+		chunk.texcoordBase = texcoordCount;
+		chunk.normalBase = normalCount;
+
+		positionCount += chunk.positionCount;
+		texcoordCount += chunk.texcoordCount;
+		normalCount += chunk.normalCount;
+	}
+
+	std::vector<float> positions(3 * positionCount);
+	std::vector<float> colors(3 * positionCount);
+	std::vector<float> texcoords(2 * texcoordCount);
+	std::vector<float> normals(3 * normalCount);
+
+	// pass 2: parse, faces can point to attributes of any chunk so the dedup waits for every chunk
+	std::exception_ptr error = nullptr;
+	std::mutex errorMutex;
+
+	parallelFor([&](ObjChunk& chunk) {
+		try {
+			parseChunk(chunk, positions, colors, texcoords, normals);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock{ errorMutex };
+			error = std::current_exception();
+		}
+	});
+
+	if (error) std::rethrow_exception(error);
+
+	// pass 3: local dedup of every chunk
+	parallelFor([&](ObjChunk& chunk) {
+		VertexWeldTable uniqueVertices{ chunk.vertices, chunk.faces.size() };
+		chunk.indices.reserve(chunk.faces.size());
+
+		for (const auto& index : chunk.faces) {
+			Vertex vertex{};
+			if (index.position >= 0 && static_cast<size_t>(index.position) < positionCount) {
+				vertex.position = { positions[3 * index.position + 0], positions[3 * index.position + 1], positions[3 * index.position + 2] };
+				vertex.color = { colors[3 * index.position + 0], colors[3 * index.position + 1], colors[3 * index.position + 2] };
+			}
+
+			if (index.normal >= 0 && static_cast<size_t>(index.normal) < normalCount) {
+				vertex.normal = { normals[3 * index.normal + 0], normals[3 * index.normal + 1], normals[3 * index.normal + 2] };
+			}
+
+			if (index.texcoord >= 0 && static_cast<size_t>(index.texcoord) < texcoordCount) {
+				vertex.uv = { texcoords[2 * index.texcoord + 0], 1.0f - texcoords[2 * index.texcoord + 1] };
+			}
+
+			chunk.indices.push_back(uniqueVertices.insert(vertex));
+		}
+
+		chunk.faces = {};
+	});
+
+	// merge in chunk order, a vertex keeps the index of its first occurrence in the file
+	if (chunks.size() == 1) {
+		vertices = std::move(chunks[0].vertices);
+		indices = std::move(chunks[0].indices);
+		return;
+	}
+
+	vertices.clear();
+	indices.clear();
+
+	size_t localVertexCount = 0;
+	for (auto& chunk : chunks) localVertexCount += chunk.vertices.size();
+
+	VertexWeldTable uniqueVertices{ vertices, localVertexCount };
+	std::vector<std::vector<uint32_t>> remaps(chunks.size());
+	std::vector<size_t> indexBases(chunks.size());
+	size_t indexCount = 0;
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		auto& chunk = chunks[c];
+		remaps[c].resize(chunk.vertices.size());
+
+		for (size_t i = 0; i < chunk.vertices.size(); i++) {
+			remaps[c][i] = uniqueVertices.insert(chunk.vertices[i]);
+		}
+
+		indexBases[c] = indexCount;
+		indexCount += chunk.indices.size();
+	}
+
+	indices.resize(indexCount);
+	parallelFor([&](ObjChunk& chunk) {
+		size_t c = &chunk - chunks.data();
+		for (size_t i = 0; i < chunk.indices.size(); i++) {
+			indices[indexBases[c] + i] = remaps[c][chunk.indices[i]];
+		}
+	});
+}
@@ -3,7 +3,6 @@
 #include <vulkan/vulkan.h>
 #include "Device.h"
 #include "Buffer.h"
-#include "Texture.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -11,11 +10,26 @@
 
 #include <vector>
 #include <memory>
+#include <string>
+
+class CookedMesh;
 
 class Model
 {
 public:
 
+	enum class VertexFormat {
+		// Vertex, 44 bytes
+		Full,
+		// PackedVertex, 16 bytes
+		Packed,
+		// PackedVertex and a second stream with the colors, 20 bytes
+		PackedWithColor,
+	};
+
+	// binding of the color stream of the packed formats, binding 1 is the instance data
+	static constexpr uint32_t COLOR_BINDING = 2;
+
 	struct Vertex {
 		glm::vec3 position{};
 		glm::vec3 color{};
@@ -26,46 +40,185 @@ public:
 		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
 
 		bool operator==(const Vertex& other) const {
-			return position == other.position && color == other.color && uv == other.uv;
+			return position == other.position && color == other.color && normal == other.normal && uv == other.uv;
 		}
 	};
 
+	/*
+
+		compact vertex for large meshes: the position is quantized in the bounding box of the mesh
+		(the instance model matrix is multiplied by getDequantizeMatrix), the normal is octahedral
+		encoded and the uv is a half float, which is only exact up to a few repeats of the texture
+
+	*/
+	struct PackedVertex {
+		uint16_t position[4];	// unorm, w unused
+		uint16_t normal[2];		// octahedral, snorm
+		uint16_t uv[2];			// half float
+
+		static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(bool colorStream = false);
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool colorStream = false);
+
+		static PackedVertex pack(const Vertex& vertex, glm::vec3 boundsMin, glm::vec3 boundsMax);
+		static uint32_t packColor(glm::vec3 color);
+	};
+
+	// range of the index buffer drawn for a level of detail, level 0 is the full mesh
+	struct LodRange {
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+
+		// largest distance to the full mesh in object space
+		float error = 0.f;
+	};
+
+	/*
+
+		cluster of at most 64 vertices and 124 triangles of the full mesh, its triangles are a range of the index buffer.
+		the cone holds the triangle normals cross(p1 - p0, p2 - p0): the cluster is back facing for every
+		camera where dot(normalize(coneApex - camera), coneAxis) >= coneCutoff, a cutoff above 1 means never
+
+	*/
+	struct Meshlet {
+		// bounding sphere, object space
+		glm::vec3 center{};
+		float radius = 0.f;
+
+		glm::vec3 coneApex{};
+		float coneCutoff = 2.f;
+		glm::vec3 coneAxis{};
+		uint32_t vertexCount = 0;
+
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		uint32_t padding[2]{};
+	};
+
 	struct Builder {
+		// simplified index buffer over the same vertices, error is the largest distance to the full mesh in object space
+		struct Lod {
+			std::vector<uint32_t> indices{};
+			float error = 0.f;
+		};
+
 		std::vector<Vertex> vertices{};
 		std::vector<uint32_t> indices{};
 
+		// coarser levels of detail, filled by MeshSimplifier::generateLods
+		std::vector<Lod> lods{};
+
+		// clusters of indices, filled by MeshletBuilder::build
+		std::vector<Meshlet> meshlets{};
+
 		void loadModel(const std::string& filepath); 
 		void loadOBJModel(const std::string& filepath);
+
+		// same result as loadModel, parsing and dedup are split over threadCount threads (0 = one per core)
+		void loadModelParallel(const std::string& filepath, unsigned int threadCount = 0);
+
+		// merges identical vertices and rewrites the indices, without indices the vertices are taken as a triangle list
+		void weldVertices();
 	};
 
-	Model(Device& device, const Model::Builder &builder, const char* filePathTexture); 
+	// geometry only, the texture belongs to the objects drawing the model
+	Model(Device& device, const Model::Builder &builder, VertexFormat vertexFormat = VertexFormat::Full); 
+	// the GPU copies the blobs straight from the mapped file when the device can import it
+	Model(Device& device, const std::shared_ptr<CookedMesh>& mesh, VertexFormat vertexFormat = VertexFormat::Full);
 	~Model(); 
 
 	Model(const Model&) = delete;
 	Model& operator=(const Model&) = delete;
 
-	static std::unique_ptr<Model> createModelFromFile(Device &device, const std::string &filePath, const char* filePathTexture);
+	// a model file read without the device: the cooked cache when it is up to date, the parsed and cooked builder otherwise
+	struct FileData {
+		std::shared_ptr<CookedMesh> cookedMesh;
+		Builder builder{};
+	};
+
+	// does not use the device, so it can run on an AssetLoader worker
+	static FileData readModelFile(const std::string& filePath);
+	static std::unique_ptr<Model> createModelFromData(Device& device, const FileData& data, VertexFormat vertexFormat = VertexFormat::Full);
 
-	void bind(VkCommandBuffer commandBuffer);
-	void draw(VkCommandBuffer commandBuffer);
+	// readModelFile and createModelFromData on this thread,
+	// MeshRegistry::load shares the result between the objects using the same file
+	static std::unique_ptr<Model> createModelFromFile(Device &device, const std::string &filePath, VertexFormat vertexFormat = VertexFormat::Full);
+
+	static void computeBounds(const Vertex* vertices, size_t vertexCount, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+	glm::vec3 getBoundsMin() const { return boundsMin; }
+	glm::vec3 getBoundsMax() const { return boundsMax; }
+
+	VertexFormat getVertexFormat() const { return vertexFormat; }
+	bool isPacked() const { return vertexFormat != VertexFormat::Full; }
+
+	uint32_t getLodCount() const { return static_cast<uint32_t>(lods.size()); }
+	const LodRange& getLod(uint32_t lod) const { return lods[lod]; }
+	// the buffers of bind, GpuScene copies them into its pools
+	Buffer* getVertexBuffer() const { return vertexBuffer.get(); }
+	Buffer* getIndexBuffer() const { return indexBuffer.get(); }
+	VkIndexType getIndexType() const { return indexType; }
+	uint32_t getVertexCount() const { return vertexCount; }
+	uint32_t getIndexCount() const { return indexCount; }
+	bool hasIndices() const { return hasIndexBuffer; }
+
+	uint32_t getTriangleCount(uint32_t lod = 0) const { return hasIndexBuffer ? lods[lod].indexCount / 3 : vertexCount / 3; }
+
+	// clusters of the full mesh, empty for small meshes
+	uint32_t getMeshletCount() const { return static_cast<uint32_t>(meshlets.size()); }
+	const std::vector<Meshlet>& getMeshlets() const { return meshlets; }
+	Buffer* getMeshletBuffer() const { return meshletBuffer.get(); }
 
-	bool hasTexture = false;
-	//VkDescriptorImageInfo getImageInfo();
+	// sphere around the bounding box, in object space
+	glm::vec3 getBoundingCenter() const { return (boundsMin + boundsMax) * 0.5f; }
+	float getBoundingRadius() const { return glm::length(boundsMax - boundsMin) * 0.5f; }
+
+	// maps the quantized positions of a packed model back to object space, identity for the full format
+	glm::mat4 getDequantizeMatrix() const;
+
+	void bind(VkCommandBuffer commandBuffer);
+	void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0, uint32_t lod = 0);
 
-	std::unique_ptr<Texture> texture;
-	
 private:
-	void createVertexBuffers(const std::vector<Vertex>& vertices);
-	void createIndexBuffers(const std::vector<uint32_t>& indices);
+	struct ImportedFile;
+
+	// nullptr when the file can't be imported, the blobs are then staged
+	static std::shared_ptr<ImportedFile> importMappedFile(Device& device, const std::shared_ptr<CookedMesh>& mesh);
+
+	std::unique_ptr<Buffer> createDeviceBuffer(const void* data, uint32_t instanceSize, uint32_t instanceCount, VkBufferUsageFlags usage, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+	void createVertexBuffers(const Vertex* vertices, uint32_t vertexCount);
+	void createIndexBuffers(const uint32_t* indices, uint32_t indexCount);
+
+	// every level of detail in one index buffer, after the full mesh
+	void createIndexBuffers(const Builder& builder);
+
+	// read by the cluster culling compute pass
+	void createMeshletBuffer(const Meshlet* meshlets, uint32_t meshletCount);
 
 	Device& device;
+	VertexFormat vertexFormat;
+
+	// only while the cooked constructor runs, the upload batch keeps it until the copies are done
+	std::shared_ptr<ImportedFile> importedFile;
+
+	// object space bounding box
+	glm::vec3 boundsMin{};
+	glm::vec3 boundsMax{};
 
 	std::unique_ptr<Buffer> vertexBuffer;
+	std::unique_ptr<Buffer> colorBuffer;
 	uint32_t vertexCount;
 
+	// 16 bit indices whenever the vertex count fits
 	bool hasIndexBuffer = false;
 	std::unique_ptr<Buffer> indexBuffer;
 	uint32_t indexCount;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+	// at least the full mesh when there is an index buffer
+	std::vector<LodRange> lods;
+
+	std::vector<Meshlet> meshlets;
+	std::unique_ptr<Buffer> meshletBuffer;
 
 };
 
@@ -0,0 +1,660 @@
+#include "ModelGLTF.h"
+
+#include "MeshCache.h"
+#include "external/json.hpp"
+
+#include <stb_image.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+using json = nlohmann::json;
+
+namespace {
+
+	constexpr uint32_t GLB_MAGIC = 0x46546C67;	// "glTF"
+	constexpr uint32_t GLB_VERSION = 2;
+	constexpr uint32_t CHUNK_JSON = 0x4E4F534A;
+	constexpr uint32_t CHUNK_BIN = 0x004E4942;
+
+	constexpr uint32_t COMPONENT_BYTE = 5120;
+	constexpr uint32_t COMPONENT_UNSIGNED_BYTE = 5121;
+	constexpr uint32_t COMPONENT_SHORT = 5122;
+	constexpr uint32_t COMPONENT_UNSIGNED_SHORT = 5123;
+	constexpr uint32_t COMPONENT_UNSIGNED_INT = 5125;
+	constexpr uint32_t COMPONENT_FLOAT = 5126;
+
+	constexpr uint32_t MODE_TRIANGLES = 4;
+
+	// element i of an accessor is at data + i * stride, data is nullptr for an accessor without buffer view (all zeros)
+	struct AccessorView {
+		const uint8_t* data = nullptr;
+		size_t count = 0;
+		size_t stride = 0;
+		uint32_t componentType = 0;
+		uint32_t componentSize = 0;
+		uint32_t componentCount = 0;
+		bool normalized = false;
+
+		// every component read as a float, the missing ones are left as they are
+		void read(size_t i, float* out, uint32_t n) const {
+			n = std::min(n, componentCount);
+			if (data == nullptr) {
+				for (uint32_t c = 0; c < n; c++) out[c] = 0.f;
+				return;
+			}
+
+			const uint8_t* element = data + i * stride;
+			for (uint32_t c = 0; c < n; c++) {
+				const uint8_t* p = element + c * componentSize;
+				switch (componentType) {
+				case COMPONENT_FLOAT: { float v; memcpy(&v, p, sizeof(v)); out[c] = v; break; }
+				case COMPONENT_UNSIGNED_BYTE: out[c] = normalized ? p[0] / 255.f : p[0]; break;
+				case COMPONENT_BYTE: { int8_t v; memcpy(&v, p, sizeof(v)); out[c] = normalized ? std::max(v / 127.f, -1.f) : v; break; }
+				case COMPONENT_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, sizeof(v)); out[c] = normalized ? v / 65535.f : v; break; }
+				case COMPONENT_SHORT: { int16_t v; memcpy(&v, p, sizeof(v)); out[c] = normalized ? std::max(v / 32767.f, -1.f) : v; break; }
+				case COMPONENT_UNSIGNED_INT: { uint32_t v; memcpy(&v, p, sizeof(v)); out[c] = static_cast<float>(v); break; }
+				}
+			}
+		}
+
+		uint32_t readIndex(size_t i) const {
+			if (data == nullptr) return 0;
+
+			const uint8_t* p = data + i * stride;
+			switch (componentType) {
+			case COMPONENT_UNSIGNED_BYTE: return p[0];
+			case COMPONENT_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+			default: { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+			}
+		}
+
+		// stored as tightly packed values of the given type
+		bool isPacked(uint32_t type) const {
+			return data != nullptr && componentType == type && componentCount == 1 && stride == componentSize;
+		}
+	};
+
+	struct PrimitiveSource {
+		AccessorView position;
+		AccessorView color;
+		AccessorView normal;
+		AccessorView uv;
+		AccessorView indices;
+		bool hasColor = false;
+		bool hasNormal = false;
+		bool hasUv = false;
+		bool hasIndices = false;
+	};
+
+	// json chunk and BIN chunk of a .glb, the BIN chunk points in the mapped file
+	struct GlbDocument {
+		const std::string& path;
+		json root;
+		const uint8_t* bin = nullptr;
+		size_t binSize = 0;
+
+		[[noreturn]] void fail(const std::string& reason) const {
+			throw std::runtime_error("failed to load glTF file " + path + ": " + reason);
+		}
+
+		const json& element(const char* array, size_t index) const {
+			if (!root.contains(array) || index >= root[array].size()) fail(std::string(array) + " index out of range");
+			return root[array][index];
+		}
+
+		const uint8_t* bufferView(size_t index, size_t& byteLength, size_t& byteStride) const {
+			const json& view = element("bufferViews", index);
+			if (view.value("buffer", 0u) != 0 || bin == nullptr) fail("buffer view outside of the BIN chunk");
+
+			size_t offset = view.value("byteOffset", size_t{ 0 });
+			byteLength = view.at("byteLength").get<size_t>();
+			byteStride = view.value("byteStride", size_t{ 0 });
+
+			if (offset > binSize || byteLength > binSize - offset) fail("buffer view out of range");
+			return bin + offset;
+		}
+
+		AccessorView accessor(size_t index) const {
+			const json& accessor = element("accessors", index);
+			if (accessor.contains("sparse")) fail("sparse accessors are not supported");
+
+			AccessorView view{};
+			view.count = accessor.at("count").get<size_t>();
+			view.componentType = accessor.at("componentType").get<uint32_t>();
+			view.normalized = accessor.value("normalized", false);
+
+			switch (view.componentType) {
+			case COMPONENT_BYTE: case COMPONENT_UNSIGNED_BYTE: view.componentSize = 1; break;
+			case COMPONENT_SHORT: case COMPONENT_UNSIGNED_SHORT: view.componentSize = 2; break;
+			case COMPONENT_UNSIGNED_INT: case COMPONENT_FLOAT: view.componentSize = 4; break;
+			default: fail("unknown accessor component type");
+			}
+
+			std::string type = accessor.at("type").get<std::string>();
+			if (type == "SCALAR") view.componentCount = 1;
+			else if (type == "VEC2") view.componentCount = 2;
+			else if (type == "VEC3") view.componentCount = 3;
+			else if (type == "VEC4") view.componentCount = 4;
+			else fail("accessor type " + type + " is not a vertex attribute");
+
+			size_t elementSize = static_cast<size_t>(view.componentSize) * view.componentCount;
+			view.stride = elementSize;
+			if (!accessor.contains("bufferView")) return view;
+
+			size_t byteLength, byteStride;
+			const uint8_t* data = bufferView(accessor["bufferView"].get<size_t>(), byteLength, byteStride);
+			size_t offset = accessor.value("byteOffset", size_t{ 0 });
+			if (byteStride != 0) view.stride = byteStride;
+
+			if (view.count > 0 && (offset > byteLength || (view.count - 1) * view.stride + elementSize > byteLength - offset)) {
+				fail("accessor out of range");
+			}
+
+			view.data = data + offset;
+			return view;
+		}
+	};
+
+	// the primitive is stored as Model::Vertex, interleaved in one buffer view, and can be uploaded as it is
+	bool isVertexLayout(const PrimitiveSource& source) {
+		if (!source.hasColor || !source.hasNormal || !source.hasUv) return false;
+
+		const AccessorView* views[4] = { &source.position, &source.color, &source.normal, &source.uv };
+		const ptrdiff_t offsets[4] = { offsetof(Model::Vertex, position), offsetof(Model::Vertex, color), offsetof(Model::Vertex, normal), offsetof(Model::Vertex, uv) };
+		const uint32_t componentCounts[4] = { 3, 3, 3, 2 };
+
+		for (int i = 0; i < 4; i++) {
+			const AccessorView& view = *views[i];
+			if (view.data == nullptr || view.componentType != COMPONENT_FLOAT || view.componentCount != componentCounts[i]) return false;
+			if (view.stride != sizeof(Model::Vertex) || view.count != source.position.count) return false;
+			if (view.data - source.position.data != offsets[i]) return false;
+		}
+		return true;
+	}
+
+	glm::mat4 localMatrix(const json& node) {
+		if (node.contains("matrix")) {
+			float matrix[16];
+			for (int i = 0; i < 16; i++) matrix[i] = node["matrix"].at(i).get<float>();
+
+			// column major like glm
+			return glm::make_mat4(matrix);
+		}
+
+		glm::vec3 translation{ 0.f };
+		glm::quat rotation{ 1.f, 0.f, 0.f, 0.f };
+		glm::vec3 scale{ 1.f };
+
+		if (node.contains("translation")) {
+			const json& t = node["translation"];
+			translation = { t.at(0).get<float>(), t.at(1).get<float>(), t.at(2).get<float>() };
+		}
+		if (node.contains("rotation")) {
+			// stored x, y, z, w
+			const json& r = node["rotation"];
+			rotation = glm::quat{ r.at(3).get<float>(), r.at(0).get<float>(), r.at(1).get<float>(), r.at(2).get<float>() };
+		}
+		if (node.contains("scale")) {
+			const json& s = node["scale"];
+			scale = { s.at(0).get<float>(), s.at(1).get<float>(), s.at(2).get<float>() };
+		}
+
+		return glm::translate(glm::mat4{ 1.f }, translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4{ 1.f }, scale);
+	}
+
+	// an image of the file, either embedded in the BIN chunk or a file next to the .glb
+	struct ImageSource {
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+		std::string path;
+	};
+
+	struct DecodedImage {
+		// allocated with new[], Texture frees it
+		unsigned char* pixels = nullptr;
+		int width = 0;
+		int height = 0;
+	};
+
+	void decodeImage(const ImageSource& source, DecodedImage& image) {
+		int channels;
+		stbi_uc* pixels = source.data != nullptr
+			? stbi_load_from_memory(source.data, static_cast<int>(source.size), &image.width, &image.height, &channels, STBI_rgb_alpha)
+			: stbi_load(source.path.c_str(), &image.width, &image.height, &channels, STBI_rgb_alpha);
+
+		if (!pixels) return;
+
+		size_t size = static_cast<size_t>(image.width) * image.height * 4;
+		image.pixels = new unsigned char[size];
+		memcpy(image.pixels, pixels, size);
+		stbi_image_free(pixels);
+	}
+}
+
+struct ModelGLTF::Source {
+	Source() = default;
+	~Source() { for (auto& image : images) delete[] image.pixels; }
+
+	Source(const Source&) = delete;
+	Source& operator=(const Source&) = delete;
+
+	std::string filePath;
+
+	// the primitive sources point in the mapping
+	std::unique_ptr<MappedFile> file;
+	std::vector<PrimitiveSource> primitiveSources;
+
+	std::vector<Primitive> primitives;
+	std::vector<Mesh> meshes;
+	std::vector<Material> materials;
+	std::vector<Node> nodes;
+
+	glm::vec3 boundsMin{};
+	glm::vec3 boundsMax{};
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+
+	// pixels are taken by the textures of the model
+	std::vector<DecodedImage> images;
+
+	float readTime = 0.f;
+};
+
+std::shared_ptr<ModelGLTF::Source> ModelGLTF::read(const std::string& filePath, unsigned int threadCount)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	auto result = std::make_shared<Source>();
+	result->filePath = filePath;
+	result->file = std::make_unique<MappedFile>(filePath);
+	if (!result->file->isOpen()) {
+		throw std::runtime_error("failed to open file: " + filePath);
+	}
+
+	const MappedFile& file = *result->file;
+	std::vector<PrimitiveSource>& sources = result->primitiveSources;
+	std::vector<Primitive>& primitives = result->primitives;
+	std::vector<Mesh>& meshes = result->meshes;
+	std::vector<Material>& materials = result->materials;
+	std::vector<Node>& nodes = result->nodes;
+	glm::vec3& boundsMin = result->boundsMin;
+	glm::vec3& boundsMax = result->boundsMax;
+	uint32_t& vertexCount = result->vertexCount;
+	uint32_t& indexCount = result->indexCount;
+
+	GlbDocument document{ filePath };
+	std::vector<ImageSource> imageSources;
+
+	try {
+		const uint8_t* data = file.data();
+		uint32_t header[3];
+		if (file.size() < sizeof(header)) document.fail("not a binary glTF file");
+
+		memcpy(header, data, sizeof(header));
+		if (header[0] != GLB_MAGIC || header[1] != GLB_VERSION) document.fail("not a binary glTF 2.0 file");
+
+		size_t length = std::min(static_cast<size_t>(header[2]), file.size());
+		size_t offset = sizeof(header);
+		const char* jsonChunk = nullptr;
+		size_t jsonSize = 0;
+
+		while (offset + 8 <= length) {
+			uint32_t chunk[2];
+			memcpy(chunk, data + offset, sizeof(chunk));
+			offset += sizeof(chunk);
+
+			size_t chunkSize = chunk[0];
+			if (chunkSize > length - offset) document.fail("chunk out of range");
+
+			if (chunk[1] == CHUNK_JSON && jsonChunk == nullptr) {
+				jsonChunk = reinterpret_cast<const char*>(data + offset);
+				jsonSize = chunkSize;
+			}
+			else if (chunk[1] == CHUNK_BIN && document.bin == nullptr) {
+				document.bin = data + offset;
+				document.binSize = chunkSize;
+			}
+
+			// chunks are 4 byte aligned
+			offset += (chunkSize + 3) & ~size_t{ 3 };
+		}
+
+		if (jsonChunk == nullptr) document.fail("no JSON chunk");
+		document.root = json::parse(jsonChunk, jsonChunk + jsonSize);
+
+		const json& root = document.root;
+		if (root.contains("buffers")) {
+			for (const auto& buffer : root["buffers"]) {
+				if (buffer.contains("uri")) document.fail("external buffers are not supported");
+			}
+		}
+
+		// images, decoded later on the workers
+		std::string directory = filePath.substr(0, filePath.find_last_of("/\\") + 1);
+		if (root.contains("images")) {
+			for (const auto& image : root["images"]) {
+				ImageSource source{};
+				if (image.contains("bufferView")) {
+					size_t byteStride;
+					source.data = document.bufferView(image["bufferView"].get<size_t>(), source.size, byteStride);
+				}
+				else if (image.contains("uri") && image["uri"].get<std::string>().rfind("data:", 0) != 0) {
+					source.path = directory + image["uri"].get<std::string>();
+				}
+				imageSources.push_back(source);
+			}
+		}
+
+		if (root.contains("materials")) {
+			for (const auto& source : root["materials"]) {
+				Material material{};
+				if (source.contains("pbrMetallicRoughness")) {
+					const json& pbr = source["pbrMetallicRoughness"];
+					if (pbr.contains("baseColorFactor")) {
+						const json& f = pbr["baseColorFactor"];
+						material.baseColorFactor = { f.at(0).get<float>(), f.at(1).get<float>(), f.at(2).get<float>(), f.at(3).get<float>() };
+					}
+					if (pbr.contains("baseColorTexture")) {
+						const json& texture = document.element("textures", pbr["baseColorTexture"].at("index").get<size_t>());
+						material.baseColorImage = texture.value("source", -1);
+						if (material.baseColorImage >= static_cast<int32_t>(imageSources.size())) document.fail("image index out of range");
+					}
+				}
+				materials.push_back(material);
+			}
+		}
+
+		// every triangle primitive gets its range of the shared buffers
+		if (root.contains("meshes")) {
+			for (const auto& mesh : root["meshes"]) {
+				Mesh meshRange{ static_cast<uint32_t>(primitives.size()), 0 };
+
+				for (const auto& primitive : mesh.at("primitives")) {
+					if (primitive.value("mode", MODE_TRIANGLES) != MODE_TRIANGLES) continue;
+
+					const json& attributes = primitive.at("attributes");
+					if (!attributes.contains("POSITION")) continue;
+
+					PrimitiveSource source{};
+					source.position = document.accessor(attributes["POSITION"].get<size_t>());
+					if (source.position.componentType != COMPONENT_FLOAT || source.position.componentCount != 3) document.fail("POSITION is not a float vec3");
+
+					auto attribute = [&](const char* name, AccessorView& view, bool& has) {
+						if (!attributes.contains(name)) return;
+						view = document.accessor(attributes[name].get<size_t>());
+						if (view.count < source.position.count) document.fail(std::string(name) + " has fewer elements than POSITION");
+						has = true;
+					};
+					attribute("COLOR_0", source.color, source.hasColor);
+					attribute("NORMAL", source.normal, source.hasNormal);
+					attribute("TEXCOORD_0", source.uv, source.hasUv);
+
+					if (primitive.contains("indices")) {
+						source.indices = document.accessor(primitive["indices"].get<size_t>());
+						if (source.indices.componentCount != 1 || source.indices.componentType == COMPONENT_FLOAT) document.fail("indices are not integers");
+						source.hasIndices = true;
+					}
+
+					Primitive range{};
+					range.vertexOffset = static_cast<int32_t>(vertexCount);
+					range.vertexCount = static_cast<uint32_t>(source.position.count);
+					range.firstIndex = indexCount;
+					range.indexCount = static_cast<uint32_t>(source.hasIndices ? source.indices.count : source.position.count);
+					range.material = primitive.value("material", -1);
+					if (range.material >= static_cast<int32_t>(materials.size())) document.fail("material index out of range");
+
+					for (size_t i = 0; i < range.indexCount && source.hasIndices; i++) {
+						if (source.indices.readIndex(i) >= range.vertexCount) document.fail("index out of range");
+					}
+
+					// the position accessor has to give its bounds, computed here when an exporter left them out
+					const json& position = root["accessors"][attributes["POSITION"].get<size_t>()];
+					glm::vec3 primitiveMin{ 0.f }, primitiveMax{ 0.f };
+					if (position.contains("min") && position.contains("max")) {
+						for (int c = 0; c < 3; c++) {
+							primitiveMin[c] = position["min"].at(c).get<float>();
+							primitiveMax[c] = position["max"].at(c).get<float>();
+						}
+					}
+					else {
+						for (size_t i = 0; i < source.position.count; i++) {
+							glm::vec3 p{ 0.f };
+							source.position.read(i, &p.x, 3);
+							primitiveMin = i == 0 ? p : glm::min(primitiveMin, p);
+							primitiveMax = i == 0 ? p : glm::max(primitiveMax, p);
+						}
+					}
+
+					boundsMin = primitives.empty() ? primitiveMin : glm::min(boundsMin, primitiveMin);
+					boundsMax = primitives.empty() ? primitiveMax : glm::max(boundsMax, primitiveMax);
+
+					vertexCount += range.vertexCount;
+					indexCount += range.indexCount;
+					primitives.push_back(range);
+					sources.push_back(source);
+					meshRange.primitiveCount++;
+				}
+
+				meshes.push_back(meshRange);
+			}
+		}
+
+		// nodes from the roots of the default scene, every node without parent when there is no scene
+		std::vector<std::pair<size_t, glm::mat4>> stack;
+		if (root.contains("nodes")) {
+			const json& sceneNodes = root.contains("scenes") ? document.element("scenes", root.value("scene", size_t{ 0 })).value("nodes", json::array()) : json::array();
+			if (root.contains("scenes")) {
+				for (const auto& node : sceneNodes) stack.push_back({ node.get<size_t>(), glm::mat4{ 1.f } });
+			}
+			else {
+				std::vector<bool> isChild(root["nodes"].size(), false);
+				for (const auto& node : root["nodes"]) {
+					for (const auto& child : node.value("children", json::array())) {
+						if (child.get<size_t>() < isChild.size()) isChild[child.get<size_t>()] = true;
+					}
+				}
+				for (size_t node = 0; node < isChild.size(); node++) {
+					if (!isChild[node]) stack.push_back({ node, glm::mat4{ 1.f } });
+				}
+			}
+		}
+
+		// a valid file is a tree, the visit count stops a cycle
+		size_t visited = 0;
+		while (!stack.empty()) {
+			auto [index, parentMatrix] = stack.back();
+			stack.pop_back();
+
+			if (++visited > root["nodes"].size()) document.fail("the node hierarchy has a cycle");
+
+			const json& node = document.element("nodes", index);
+			glm::mat4 worldMatrix = parentMatrix * localMatrix(node);
+
+			if (node.contains("mesh")) {
+				uint32_t mesh = node["mesh"].get<uint32_t>();
+				if (mesh >= meshes.size()) document.fail("mesh index out of range");
+				nodes.push_back({ worldMatrix, mesh });
+			}
+
+			for (const auto& child : node.value("children", json::array())) {
+				stack.push_back({ child.get<size_t>(), worldMatrix });
+			}
+		}
+	}
+	catch (const json::exception& e) {
+		document.fail(e.what());
+	}
+
+	if (indexCount == 0) document.fail("no triangle primitive");
+
+	// every image on its own thread, up to threadCount
+	std::vector<DecodedImage>& images = result->images;
+	images.resize(imageSources.size());
+	std::atomic<size_t> nextImage{ 0 };
+
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threadCount = static_cast<unsigned int>(std::min<size_t>(threadCount, imageSources.size()));
+
+	std::vector<std::thread> workers{};
+	for (unsigned int i = 1; i < threadCount; i++) {
+		workers.emplace_back([&]() {
+			for (size_t image = nextImage++; image < imageSources.size(); image = nextImage++) {
+				decodeImage(imageSources[image], images[image]);
+			}
+		});
+	}
+	for (size_t image = nextImage++; image < imageSources.size(); image = nextImage++) {
+		decodeImage(imageSources[image], images[image]);
+	}
+	for (auto& worker : workers) worker.join();
+
+	result->readTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+	return result;
+}
+
+ModelGLTF::ModelGLTF(Device& device, const std::string& filePath, unsigned int threadCount) : ModelGLTF(device, *read(filePath, threadCount)) {}
+
+ModelGLTF::ModelGLTF(Device& device, Source& gltf) : device{ device }
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	primitives = gltf.primitives;
+	meshes = gltf.meshes;
+	materials = gltf.materials;
+	nodes = gltf.nodes;
+	boundsMin = gltf.boundsMin;
+	boundsMax = gltf.boundsMax;
+	vertexCount = gltf.vertexCount;
+	indexCount = gltf.indexCount;
+
+	const std::vector<PrimitiveSource>& sources = gltf.primitiveSources;
+
+	// 16 bit indices like Model, the vertex offset of the draw keeps the indices of a primitive local
+	uint32_t largestPrimitive = 0;
+	for (const auto& primitive : primitives) largestPrimitive = std::max(largestPrimitive, primitive.vertexCount);
+	indexType = largestPrimitive <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	uint32_t indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+
+	vertexBuffer = std::make_unique<Buffer>(device, sizeof(Model::Vertex), vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	indexBuffer = std::make_unique<Buffer>(device, indexSize, indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	UploadContext& uploadContext = device.getUploadContext();
+	std::vector<Model::Vertex> vertices;
+	std::vector<uint16_t> shortIndices;
+	std::vector<uint32_t> indices;
+
+	for (size_t p = 0; p < primitives.size(); p++) {
+		const PrimitiveSource& source = sources[p];
+		const Primitive& primitive = primitives[p];
+
+		VkDeviceSize vertexBytes = sizeof(Model::Vertex) * static_cast<VkDeviceSize>(primitive.vertexCount);
+		VkDeviceSize vertexOffset = sizeof(Model::Vertex) * static_cast<VkDeviceSize>(primitive.vertexOffset);
+
+		if (isVertexLayout(source)) {
+			uploadContext.uploadBuffer(vertexBuffer->getBuffer(), source.position.data, vertexBytes, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, vertexOffset);
+			bytesCopied += vertexBytes;
+		}
+		else {
+			vertices.assign(primitive.vertexCount, Model::Vertex{});
+			for (uint32_t i = 0; i < primitive.vertexCount; i++) {
+				Model::Vertex& vertex = vertices[i];
+				source.position.read(i, &vertex.position.x, 3);
+
+				// no COLOR_0 means white
+				vertex.color = glm::vec3{ 1.f };
+				if (source.hasColor) source.color.read(i, &vertex.color.x, 3);
+				if (source.hasNormal) source.normal.read(i, &vertex.normal.x, 3);
+				if (source.hasUv) source.uv.read(i, &vertex.uv.x, 2);
+			}
+			uploadContext.uploadBuffer(vertexBuffer->getBuffer(), vertices.data(), vertexBytes, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, vertexOffset);
+			bytesConverted += vertexBytes;
+		}
+
+		VkDeviceSize indexBytes = static_cast<VkDeviceSize>(indexSize) * primitive.indexCount;
+		VkDeviceSize indexOffset = static_cast<VkDeviceSize>(indexSize) * primitive.firstIndex;
+
+		if (source.hasIndices && source.indices.isPacked(indexType == VK_INDEX_TYPE_UINT16 ? COMPONENT_UNSIGNED_SHORT : COMPONENT_UNSIGNED_INT)) {
+			uploadContext.uploadBuffer(indexBuffer->getBuffer(), source.indices.data, indexBytes, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, indexOffset);
+			bytesCopied += indexBytes;
+			continue;
+		}
+
+		// 8 bit indices, the other index size or no indices at all
+		const void* data;
+		if (indexType == VK_INDEX_TYPE_UINT16) {
+			shortIndices.resize(primitive.indexCount);
+			for (uint32_t i = 0; i < primitive.indexCount; i++) shortIndices[i] = static_cast<uint16_t>(source.hasIndices ? source.indices.readIndex(i) : i);
+			data = shortIndices.data();
+		}
+		else {
+			indices.resize(primitive.indexCount);
+			for (uint32_t i = 0; i < primitive.indexCount; i++) indices[i] = source.hasIndices ? source.indices.readIndex(i) : i;
+			data = indices.data();
+		}
+		uploadContext.uploadBuffer(indexBuffer->getBuffer(), data, indexBytes, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, indexOffset);
+		bytesConverted += indexBytes;
+	}
+
+	std::vector<DecodedImage>& images = gltf.images;
+	textures.resize(images.size());
+	for (size_t i = 0; i < images.size(); i++) {
+		if (images[i].pixels == nullptr) {
+			std::cerr << "glTF: failed to decode image " << i << " of " << gltf.filePath << "\n";
+			continue;
+		}
+
+		// the texture frees the pixels
+		textures[i] = std::make_unique<Texture>(device, images[i].pixels, static_cast<uint32_t>(images[i].width), static_cast<uint32_t>(images[i].height));
+		images[i].pixels = nullptr;
+	}
+
+	float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "glTF: " << primitives.size() << " primitives, " << vertexCount << " vertices, " << images.size() << " images, "
+		<< bytesCopied << " of " << bytesCopied + bytesConverted << " bytes uploaded as stored (read " << gltf.readTime << " ms, upload " << time << " ms)\n";
+}
+
+ModelGLTF::~ModelGLTF() {}
+
+Texture* ModelGLTF::getTexture(int32_t material) const
+{
+	if (material < 0 || material >= static_cast<int32_t>(materials.size())) return nullptr;
+
+	int32_t image = materials[material].baseColorImage;
+	if (image < 0 || image >= static_cast<int32_t>(textures.size())) return nullptr;
+	return textures[image].get();
+}
+
+void ModelGLTF::bind(VkCommandBuffer commandBuffer)
+{
+	VkBuffer buffers[] = { vertexBuffer->getBuffer() };
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, indexType);
+}
+
+void ModelGLTF::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance)
+{
+	for (uint32_t primitive = 0; primitive < getPrimitiveCount(); primitive++) {
+		drawPrimitive(commandBuffer, primitive, instanceCount, firstInstance);
+	}
+}
+
+void ModelGLTF::drawPrimitive(VkCommandBuffer commandBuffer, uint32_t primitive, uint32_t instanceCount, uint32_t firstInstance)
+{
+	const Primitive& range = primitives[primitive];
+	vkCmdDrawIndexed(commandBuffer, range.indexCount, instanceCount, range.firstIndex, range.vertexOffset, firstInstance);
+}
@@ -1,41 +1,126 @@
 #pragma once
 
-#pragma once
-
-#include <iostream>
-#include <stdlib.h>
-#include <string>
-#include <fstream>
-#include <vector>
-
 #include "Device.h"
+#include "Buffer.h"
+#include "Model.h"
+#include "Texture.h"
+
+#include <vulkan/vulkan.h>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
-
 #include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
-#include <glm/gtx/string_cast.hpp>
 
-// ERROR is already defined in wingdi.h and collides with a define in the Draco headers
-#if defined(_WIN32) && defined(ERROR) && defined(TINYGLTF_ENABLE_DRACO) 
-#undef ERROR
-#pragma message ("ERROR constant already defined, undefining")
-#endif
+// std lib headers
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
-#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define MAX_NUM_JOINTS 128u
 
-#if defined(__ANDROID__)
-#define TINYGLTF_ANDROID_LOAD_FROM_ASSETS
-#include <android/asset_manager.h>
-#endif
+/*
 
-#define MAX_NUM_JOINTS 128u
+	binary glTF (.glb) mesh: every primitive of every mesh shares one vertex buffer in the Model::Vertex
+	layout and one index buffer, a primitive is a draw range with its own vertex offset and material.
+	the file is mapped only while loading, the accessors are read in place, when a primitive is already stored interleaved
+	as Model::Vertex (or its indices have the type of the index buffer) the bytes go from the mapping to the
+	staging ring as they are, other layouts are converted per vertex. the embedded images are decoded on
+	worker threads
 
+	loading is split in two: read parses the file and decodes the images without touching the device,
+	so it can run on an AssetLoader worker, the constructor taking its result uploads on the main thread
 
+	node transforms are not applied, getNodes gives the world matrix of every node that has a mesh
+
+*/
 class ModelGLTF
 {
+public:
+	struct Primitive {
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		int32_t vertexOffset = 0;
+		uint32_t vertexCount = 0;
 
-};
+		// -1 for the default material
+		int32_t material = -1;
+	};
+
+	struct Mesh {
+		uint32_t firstPrimitive = 0;
+		uint32_t primitiveCount = 0;
+	};
+
+	struct Material {
+		glm::vec4 baseColorFactor{ 1.f };
+
+		// index in the images of the file, -1 without a texture
+		int32_t baseColorImage = -1;
+	};
+
+	struct Node {
+		glm::mat4 worldMatrix{ 1.f };
+		uint32_t mesh = 0;
+	};
 
+	// the parsed file with its decoded images, keeps the file mapped until it is uploaded
+	struct Source;
+
+	// images are decoded on threadCount threads (0 = one per core)
+	static std::shared_ptr<Source> read(const std::string& filePath, unsigned int threadCount = 0);
+
+	ModelGLTF(Device& device, const std::string& filePath, unsigned int threadCount = 0);
+	ModelGLTF(Device& device, Source& source);
+	~ModelGLTF();
+
+	ModelGLTF(const ModelGLTF&) = delete;
+	ModelGLTF& operator=(const ModelGLTF&) = delete;
+
+	uint32_t getPrimitiveCount() const { return static_cast<uint32_t>(primitives.size()); }
+	const Primitive& getPrimitive(uint32_t primitive) const { return primitives[primitive]; }
+	const std::vector<Mesh>& getMeshes() const { return meshes; }
+	const std::vector<Material>& getMaterials() const { return materials; }
+	const std::vector<Node>& getNodes() const { return nodes; }
+
+	// base color texture of a material, nullptr when it has none
+	Texture* getTexture(int32_t material) const;
+
+	glm::vec3 getBoundsMin() const { return boundsMin; }
+	glm::vec3 getBoundsMax() const { return boundsMax; }
+
+	uint32_t getVertexCount() const { return vertexCount; }
+	uint32_t getTriangleCount() const { return indexCount / 3; }
+
+	// bytes uploaded straight from the mapped file and bytes that went through a conversion
+	VkDeviceSize getBytesCopied() const { return bytesCopied; }
+	VkDeviceSize getBytesConverted() const { return bytesConverted; }
+
+	void bind(VkCommandBuffer commandBuffer);
+
+	// every primitive, all with the same instances
+	void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
+	void drawPrimitive(VkCommandBuffer commandBuffer, uint32_t primitive, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
+
+private:
+	Device& device;
+	std::vector<Primitive> primitives;
+	std::vector<Mesh> meshes;
+	std::vector<Material> materials;
+	std::vector<Node> nodes;
+	std::vector<std::unique_ptr<Texture>> textures;
+
+	glm::vec3 boundsMin{};
+	glm::vec3 boundsMax{};
+
+	std::unique_ptr<Buffer> vertexBuffer;
+	uint32_t vertexCount = 0;
+
+	// 16 bit indices when every primitive has at most 65536 vertices
+	std::unique_ptr<Buffer> indexBuffer;
+	uint32_t indexCount = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+	VkDeviceSize bytesCopied = 0;
+	VkDeviceSize bytesConverted = 0;
+};
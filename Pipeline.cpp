@@ -4,9 +4,12 @@
 
 #include <fstream>
 #include <iostream>
+#include <chrono>
 #include <cassert>
 #include <stdexcept>
 
+uint32_t Pipeline::creationCount = 0;
+float Pipeline::creationTime = 0.f;
 
 Pipeline::Pipeline(
 	Device& device,
@@ -108,15 +111,20 @@ void Pipeline::createGraphicsPipeline(const std::string& vertFilepath,
 	pipelineInfo.basePipelineIndex = -1;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
+	auto startTime = std::chrono::high_resolution_clock::now();
+
 	if (vkCreateGraphicsPipelines(
 		device.device(),
-		VK_NULL_HANDLE,
+		device.getPipelineCache(),
 		1,
 		&pipelineInfo,
 		nullptr,
 		&graphicsPipeline) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create graphics pipeline");
 	}
+
+	creationCount++;
+	creationTime += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
 }
 
 
@@ -225,4 +233,47 @@ void Pipeline::enableAlphaBlending(PipelineConfigInfo& configInfo)
 	configInfo.colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
 	configInfo.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 	configInfo.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-}
\ No newline at end of file
+}
+
+ComputePipeline::ComputePipeline(Device& device, const std::string& compFilepath, VkPipelineLayout pipelineLayout) : device{ device } {
+	assert(pipelineLayout != VK_NULL_HANDLE && "Cannot create compute pipeline: no pipelineLayout provided");
+
+	auto compCode = Pipeline::readFile(compFilepath);
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = compCode.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(compCode.data());
+
+	if (vkCreateShaderModule(device.device(), &moduleInfo, nullptr, &compShaderModule) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create shader module");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = compShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.basePipelineIndex = -1;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	if (vkCreateComputePipelines(device.device(), device.getPipelineCache(), 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute pipeline");
+	}
+
+	Pipeline::creationCount++;
+	Pipeline::creationTime += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+ComputePipeline::~ComputePipeline() {
+	vkDestroyShaderModule(device.device(), compShaderModule, nullptr);
+	vkDestroyPipeline(device.device(), computePipeline, nullptr);
+}
+
+void ComputePipeline::bind(VkCommandBuffer commandBuffer) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+}
@@ -30,6 +30,8 @@ struct PipelineConfigInfo {
 
 class Pipeline
 {
+	friend class ComputePipeline;
+
 public:
 	Pipeline(
 		Device& device,
@@ -47,6 +49,11 @@ public:
 
 	static void enableAlphaBlending(PipelineConfigInfo& configInfo);
 
+	// graphics and compute pipelines created so far and the time spent in their creation, --bench-pipelines
+	// compares them without pipeline cache and with the one it left
+	static uint32_t getCreationCount() { return creationCount; }
+	static float getCreationTime() { return creationTime; }
+
 
 private:
 	static std::vector<char> readFile(const std::string& filepath);
@@ -58,9 +65,29 @@ private:
 
 	void createShaderModule(const std::vector<char>& code, VkShaderModule* shaderModule);
 
+	static uint32_t creationCount;
+	static float creationTime;
+
 	Device& device;
 	VkPipeline graphicsPipeline;
 	VkShaderModule vertShaderModule;
 	VkShaderModule fragShaderModule;
 };
 
+class ComputePipeline
+{
+public:
+	ComputePipeline(Device& device, const std::string& compFilepath, VkPipelineLayout pipelineLayout);
+	~ComputePipeline();
+
+	ComputePipeline(const ComputePipeline&) = delete;
+	ComputePipeline& operator=(const ComputePipeline&) = delete;
+
+	void bind(VkCommandBuffer commandBuffer);
+
+private:
+	Device& device;
+	VkPipeline computePipeline;
+	VkShaderModule compShaderModule;
+};
+
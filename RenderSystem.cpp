@@ -6,39 +6,77 @@
 #include <glm/glm.hpp>
 
 #include <stdexcept>
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <iostream>
 
 
-struct SimplePushConstantData {
-	glm::mat4 modelMatrix{ 1.f };
-	glm::mat4 normalMatrix{ 1.f };
+static constexpr uint32_t INITIAL_INSTANCE_CAPACITY = 256;
+
+static constexpr uint32_t INITIAL_DRAW_COMMAND_CAPACITY = 1024;
+
+// clustered batches culled per frame, a batch over this is drawn whole
+static constexpr uint32_t MAX_CULLED_BATCHES = 64;
+
+static_assert(sizeof(Model::Meshlet) == 64, "cluster_cull.comp reads Model::Meshlet as a 64 byte std430 struct");
+
+// cluster_cull.comp
+struct CullUbo {
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 cameraPosition;
 };
 
-RenderSystem::RenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout) : device{device}
-{
-	//auto textureLayout = ;
+struct CullPushConstants {
+	glm::vec4 boundsMin;
+	glm::vec4 boundsInverseExtent;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	uint32_t meshletCount;
+	uint32_t firstCommand;
+	uint32_t coneCulling;
+};
+
+struct CullStats {
+	uint32_t visibleMeshlets;
+	uint32_t visibleTriangles;
+};
 
-	createPipelineLayout({ globalSetLayout, (*DescriptorSetLayout::Builder(device)
-		.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-		.build())
-		.getDescriptorSetLayout() });
+// an object only changes level when the error is this far past the threshold, so it does not flicker at the boundary
+static constexpr float LOD_HYSTERESIS = 0.25f;
+
+RenderSystem::RenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout, TextureRegistry& textureRegistry) : device{device}, textureRegistry{textureRegistry}
+{
+	createPipelineLayout({ globalSetLayout, textureRegistry.getDescriptorSetLayout() });
 
 	createPipeline(renderPass);
+
+	for (int i = 0; i < instanceBuffers.size(); i++) {
+		reserveInstances(i, INITIAL_INSTANCE_CAPACITY);
+	}
+
+	// cluster culling stays off until setClusterCulling, the cone test culls back faces the models may need
+	clusterCullingSupported = device.getEnabledFeatures().drawIndirectFirstInstance == VK_TRUE;
+	if (clusterCullingSupported) {
+		try {
+			createCullResources();
+		}
+		catch (const std::exception& e) {
+			std::cerr << "cluster culling: " << e.what() << "\n";
+			clusterCullingSupported = false;
+		}
+	}
 }
 
 RenderSystem::~RenderSystem()
 {
+	if (cullPipelineLayout != VK_NULL_HANDLE) vkDestroyPipelineLayout(device.device(), cullPipelineLayout, nullptr);
 	vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr);
 }
 
 void RenderSystem::createPipelineLayout(std::vector<VkDescriptorSetLayout> descriptorSetLayout)
 {
-	VkPushConstantRange pushConstantRange{};
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(SimplePushConstantData);
-
 	VkDescriptorBindingFlags descriptorBindingFlags[] = {
 	0,  // For non-dynamic descriptor sets
 	VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT // For dynamic descriptor sets
@@ -55,8 +93,8 @@ void RenderSystem::createPipelineLayout(std::vector<VkDescriptorSetLayout> descr
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayout.size());
 	pipelineLayoutInfo.pSetLayouts = descriptorSetLayout.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 1;
-	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
 	pipelineLayoutInfo.pNext = &bindingFlagsInfo;
 
 	if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) !=
@@ -77,17 +115,356 @@ void RenderSystem::createPipeline(VkRenderPass renderPass)
 
 	pipelineConfig.pipelineLayout = pipelineLayout; 
 
+	// add the per instance binding after the per vertex one
+	auto instanceBindings = InstanceData::getBindingDescriptions();
+	auto instanceAttributes = InstanceData::getAttributeDescriptions();
+	pipelineConfig.bindingDescription.insert(pipelineConfig.bindingDescription.end(), instanceBindings.begin(), instanceBindings.end());
+	pipelineConfig.attributeDescription.insert(pipelineConfig.attributeDescription.end(), instanceAttributes.begin(), instanceAttributes.end());
+
 	pipeline = std::make_unique<Pipeline>(
 		device,
 		"simple_shader.vert.spv",
 		"simple_shader.frag.spv",
 		pipelineConfig
 	);
+
+	// same pipeline with the packed vertex layout, the color stream is not read by the shaders
+	pipelineConfig.bindingDescription = Model::PackedVertex::getBindingDescriptions();
+	pipelineConfig.attributeDescription = Model::PackedVertex::getAttributeDescriptions();
+	pipelineConfig.bindingDescription.insert(pipelineConfig.bindingDescription.end(), instanceBindings.begin(), instanceBindings.end());
+	pipelineConfig.attributeDescription.insert(pipelineConfig.attributeDescription.end(), instanceAttributes.begin(), instanceAttributes.end());
+
+	packedPipeline = std::make_unique<Pipeline>(
+		device,
+		"simple_shader_packed.vert.spv",
+		"simple_shader.frag.spv",
+		pipelineConfig
+	);
+
+	// meshes are counter clockwise seen from the front, like the meshlet cones assume
+	pipelineConfig.rasterizationInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+	pipelineConfig.rasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	backfaceCulledPackedPipeline = std::make_unique<Pipeline>(
+		device,
+		"simple_shader_packed.vert.spv",
+		"simple_shader.frag.spv",
+		pipelineConfig
+	);
+
+	pipelineConfig.bindingDescription = Model::Vertex::getBindingDescriptions();
+	pipelineConfig.attributeDescription = Model::Vertex::getAttributeDescriptions();
+	pipelineConfig.bindingDescription.insert(pipelineConfig.bindingDescription.end(), instanceBindings.begin(), instanceBindings.end());
+	pipelineConfig.attributeDescription.insert(pipelineConfig.attributeDescription.end(), instanceAttributes.begin(), instanceAttributes.end());
+
+	backfaceCulledPipeline = std::make_unique<Pipeline>(
+		device,
+		"simple_shader.vert.spv",
+		"simple_shader.frag.spv",
+		pipelineConfig
+	);
 }
 
-void RenderSystem::renderGameObjects(FrameInfo& frameInfo)
+void RenderSystem::createCullResources()
 {
-	pipeline->bind(frameInfo.commandBuffer);
+	cullSetLayout = DescriptorSetLayout::Builder(device)
+		.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.addBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build();
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullPushConstants);
+
+	VkDescriptorSetLayout setLayout = cullSetLayout->getDescriptorSetLayout();
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("fail to create cluster culling pipeline layout");
+	}
+
+	cullPipeline = std::make_unique<ComputePipeline>(device, "cluster_cull.comp.spv", cullPipelineLayout);
+
+	for (int i = 0; i < Swap_chain::MAX_FRAMES_IN_FLIGHT; i++) {
+		cullDescriptorPools[i] = DescriptorPool::Builder(device)
+			.setMaxSets(MAX_CULLED_BATCHES)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, MAX_CULLED_BATCHES)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * MAX_CULLED_BATCHES)
+			.build();
+
+		cullUboBuffers[i] = std::make_unique<Buffer>(
+			device,
+			sizeof(CullUbo),
+			1,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		cullUboBuffers[i]->map();
+
+		// read and cleared on the CPU when the frame comes back
+		cullStatsBuffers[i] = std::make_unique<Buffer>(
+			device,
+			sizeof(CullStats),
+			1,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		cullStatsBuffers[i]->map();
+		*static_cast<CullStats*>(cullStatsBuffers[i]->getMappedMemory()) = {};
+
+		reserveDrawCommands(i, INITIAL_DRAW_COMMAND_CAPACITY);
+	}
+}
+
+void RenderSystem::reserveDrawCommands(int frameIndex, uint32_t commandCount)
+{
+	auto& commandBuffer = drawCommandBuffers[frameIndex];
+	if (commandBuffer != nullptr && commandBuffer->getInstanceCount() >= commandCount) return;
+
+	uint32_t capacity = commandBuffer != nullptr ? commandBuffer->getInstanceCount() : INITIAL_DRAW_COMMAND_CAPACITY;
+	while (capacity < commandCount) capacity *= 2;
+
+	// only written and read by the GPU
+	commandBuffer = std::make_unique<Buffer>(
+		device,
+		sizeof(VkDrawIndexedIndirectCommand),
+		capacity,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	);
+}
+
+void RenderSystem::reserveInstances(int frameIndex, uint32_t instanceCount)
+{
+	auto& instanceBuffer = instanceBuffers[frameIndex];
+	if (instanceBuffer != nullptr && instanceBuffer->getInstanceCount() >= instanceCount) return;
+
+	// grow by doubling, the buffer of this frame is not in use anymore once beginFrame returned
+	uint32_t capacity = instanceBuffer != nullptr ? instanceBuffer->getInstanceCount() : INITIAL_INSTANCE_CAPACITY;
+	while (capacity < instanceCount) capacity *= 2;
+
+	instanceBuffer = std::make_unique<Buffer>(
+		device,
+		sizeof(InstanceData),
+		capacity,
+		// the culling pass reads the transforms too
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+	);
+
+	instanceBuffer->map();
+}
+
+void RenderSystem::cullObjects(FrameInfo& frameInfo)
+{
+	candidates.clear();
+	for (auto& kv : frameInfo.gameObjects)
+	{
+		auto& obj = kv.second;
+		// the descriptor set of the object samples its texture, there is nothing to draw without one
+		if (obj.model == nullptr || obj.texture == nullptr) continue;
+		candidates.push_back(&obj);
+	}
+
+	testedObjectCount = static_cast<uint32_t>(candidates.size());
+	if (!frustumCulling) {
+		candidateVisible.assign(candidates.size(), 1);
+		visibleObjectCount = testedObjectCount;
+		return;
+	}
+
+	// world space bounding spheres, the radius grows with the largest scale
+	frustumCuller.clear();
+	frustumCuller.reserve(candidates.size());
+	for (auto obj : candidates)
+	{
+		glm::vec3 scale = glm::abs(obj->transform.scale);
+		float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+		glm::vec3 worldCenter = glm::vec3(obj->transform.mat4() * glm::vec4(obj->model->getBoundingCenter(), 1.f));
+		frustumCuller.add(worldCenter, obj->model->getBoundingRadius() * maxScale);
+	}
+
+	visibleObjectCount = frustumCuller.cull(frameInfo.camera.getFrustumPlanes(), candidateVisible);
+}
+
+void RenderSystem::buildBatches(FrameInfo& frameInfo)
+{
+	// keep the allocations of the previous frame
+	for (auto& batch : batches) batch.objects.clear();
+
+	cullObjects(frameInfo);
+
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		if (!candidateVisible[i]) continue;
+		auto& obj = *candidates[i];
+
+		// an evicted texture is loaded again, the object is skipped until the upload is on the graphics queue
+		VkDescriptorSet descriptorSet = textureRegistry.use(obj.texture, textureScreenSize(frameInfo, obj));
+		if (descriptorSet == VK_NULL_HANDLE) continue;
+
+		std::pair<Model*, TextureRegistry::Entry*> key{ obj.model.get(), obj.texture.get() };
+		auto it = batchIndices.find(key);
+		if (it == batchIndices.end()) {
+			it = batchIndices.emplace(key, batches.size()).first;
+			batches.push_back({ key.first, key.second });
+		}
+
+		auto& batch = batches[it->second];
+		batch.descriptorSet = descriptorSet;
+		batch.objects.push_back(&obj);
+	}
+
+	// drop the batches of models that are not referenced anymore
+	for (size_t i = 0; i < batches.size();)
+	{
+		if (!batches[i].objects.empty()) {
+			i++;
+			continue;
+		}
+
+		batchIndices.erase({ batches[i].model, batches[i].texture });
+		if (i != batches.size() - 1) {
+			batches[i] = std::move(batches.back());
+			batchIndices[{ batches[i].model, batches[i].texture }] = i;
+		}
+		batches.pop_back();
+	}
+}
+
+void RenderSystem::setLodErrorThreshold(float pixels, uint32_t screenHeight)
+{
+	lodThreshold = 2.f * pixels / static_cast<float>(std::max(screenHeight, 1u));
+	this->screenHeight = screenHeight;
+}
+
+float RenderSystem::textureScreenSize(FrameInfo& frameInfo, GameObject& obj)
+{
+	glm::vec3 scale = glm::abs(obj.transform.scale);
+	float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+	float radius = obj.model->getBoundingRadius() * maxScale;
+
+	// the texture is taken as spread once over the bounding sphere, projected at its closest point
+	glm::vec3 worldCenter = glm::vec3(obj.transform.mat4() * glm::vec4(obj.model->getBoundingCenter(), 1.f));
+	float distance = std::max(glm::length(worldCenter - frameInfo.camera.getPosition()) - radius, 0.01f);
+	float projection = std::abs(frameInfo.camera.getProjection()[1][1]);
+
+	return radius * projection / distance * static_cast<float>(screenHeight);
+}
+
+void RenderSystem::selectLods(FrameInfo& frameInfo, InstanceBatch& batch)
+{
+	Model* model = batch.model;
+	uint32_t lodCount = model->getLodCount();
+
+	if (lodEnabled && lodCount > 1) {
+		glm::vec3 cameraPosition = frameInfo.camera.getPosition();
+		float projection = std::abs(frameInfo.camera.getProjection()[1][1]);
+		glm::vec3 center = model->getBoundingCenter();
+		float radius = model->getBoundingRadius();
+
+		for (auto obj : batch.objects)
+		{
+			glm::vec3 scale = glm::abs(obj->transform.scale);
+			float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+
+			// distance to the closest point of the bounding sphere, the error is projected there
+			glm::vec3 worldCenter = glm::vec3(obj->transform.mat4() * glm::vec4(center, 1.f));
+			float distance = std::max(glm::length(worldCenter - cameraPosition) - radius * maxScale, 0.01f);
+			float errorScale = maxScale * projection / distance;
+
+			uint32_t lod = std::min(obj->lodLevel, lodCount - 1);
+			while (lod > 0 && model->getLod(lod).error * errorScale > lodThreshold * (1.f + LOD_HYSTERESIS)) lod--;
+			while (lod + 1 < lodCount && model->getLod(lod + 1).error * errorScale < lodThreshold * (1.f - LOD_HYSTERESIS)) lod++;
+			obj->lodLevel = lod;
+		}
+
+		// objects drawing the same level next to each other in the instance buffer
+		std::sort(batch.objects.begin(), batch.objects.end(), [](const GameObject* a, const GameObject* b) { return a->lodLevel < b->lodLevel; });
+	}
+	else {
+		for (auto obj : batch.objects) obj->lodLevel = 0;
+	}
+
+	batch.runs.clear();
+	uint32_t instance = batch.firstInstance;
+	for (auto obj : batch.objects)
+	{
+		if (batch.runs.empty() || batch.runs.back().lod != obj->lodLevel) {
+			batch.runs.push_back({ obj->lodLevel, instance, 0 });
+		}
+		batch.runs.back().instanceCount++;
+		instance++;
+	}
+}
+
+bool RenderSystem::setClusterCulling(bool enabled)
+{
+	if (enabled && !clusterCullingSupported) return false;
+
+	clusterCulling = enabled;
+	return true;
+}
+
+bool RenderSystem::setGpuDriven(bool enabled)
+{
+	if (!enabled) {
+		// the frames in flight still read the buffers of the scene
+		if (gpuScene != nullptr) vkDeviceWaitIdle(device.device());
+		gpuScene.reset();
+		return true;
+	}
+	if (gpuScene != nullptr) return true;
+
+	const VkPhysicalDeviceFeatures& features = device.getEnabledFeatures();
+	if (!device.hasDrawIndirectCount() || features.multiDrawIndirect != VK_TRUE || features.drawIndirectFirstInstance != VK_TRUE) {
+		return false;
+	}
+
+	try {
+		gpuScene = std::make_unique<GpuScene>(device, textureRegistry);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "gpu driven mode: " << e.what() << "\n";
+		return false;
+	}
+	return true;
+}
+
+void RenderSystem::updateObject(GameObject& obj)
+{
+	if (gpuScene != nullptr) gpuScene->updateObject(obj);
+}
+
+void RenderSystem::removeObject(GameObject::id_t id)
+{
+	if (gpuScene != nullptr) gpuScene->removeObject(id);
+}
+
+bool RenderSystem::setOcclusionCulling(bool enabled)
+{
+	if (gpuScene == nullptr) return !enabled;
+	return gpuScene->setOcclusionCulling(enabled);
+}
+
+void RenderSystem::prepareLatePass(FrameInfo& frameInfo, const DepthPyramid::Source& depth)
+{
+	if (gpuScene != nullptr) gpuScene->cullLate(frameInfo, depth);
+}
+
+void RenderSystem::renderLatePass(FrameInfo& frameInfo)
+{
+	if (gpuScene == nullptr) return;
 
 	vkCmdBindDescriptorSets(
 		frameInfo.commandBuffer,
@@ -99,40 +476,305 @@ void RenderSystem::renderGameObjects(FrameInfo& frameInfo)
 		nullptr
 	);
 
-	
-	int i = 0;
-	for (auto& kv : frameInfo.gameObjects)
+	// the scene counts the draw calls of both passes
+	gpuScene->drawLate(frameInfo, pipelineLayout, *pipeline, *packedPipeline);
+	drawCallCount = gpuScene->getDrawCallCount();
+}
+
+void RenderSystem::prepareFrame(FrameInfo& frameInfo)
+{
+	// only the objects given to updateObject are looked at on the CPU
+	if (gpuScene != nullptr) {
+		batches.clear();
+		gpuScene->cull(frameInfo, lodEnabled ? lodThreshold : 0.f);
+
+		const GpuScene::Stats& stats = gpuScene->getStats();
+		testedObjectCount = stats.objectCount;
+		visibleObjectCount = stats.visibleCount;
+		return;
+	}
+
+	buildBatches(frameInfo);
+
+	uint32_t instanceCount = 0;
+	for (auto& batch : batches) instanceCount += static_cast<uint32_t>(batch.objects.size());
+
+	if (instanceCount == 0) return;
+
+	reserveInstances(frameInfo.frameIndex, instanceCount);
+	auto& instanceBuffer = instanceBuffers[frameInfo.frameIndex];
+
+	// write the transforms of every batch contiguously in the instance buffer of this frame
+	InstanceData* instances = static_cast<InstanceData*>(instanceBuffer->getMappedMemory());
+	uint32_t firstInstance = 0;
+	for (auto& batch : batches)
 	{
-		auto& obj = kv.second;
-		if (obj.model == nullptr) continue;	
+		batch.firstInstance = firstInstance;
+		firstInstance += static_cast<uint32_t>(batch.objects.size());
+
+		selectLods(frameInfo, batch);
+
+		// packed positions are dequantized by the model matrix, the normal matrix stays the one of the object
+		glm::mat4 dequantize = batch.model->getDequantizeMatrix();
+		for (auto obj : batch.objects)
+		{
+			instances->modelMatrix = obj->transform.mat4() * dequantize;
+			instances->normalMatrix = obj->transform.normalMatrix();
+			instances++;
+		}
+	}
+
+	if (clusterCulling) cullClusters(frameInfo);
+}
+
+void RenderSystem::cullClusters(FrameInfo& frameInfo)
+{
+	int frameIndex = frameInfo.frameIndex;
+
+	// the fence of this frame was waited, its stats are complete and the buffer is free to clear
+	CullStats* stats = static_cast<CullStats*>(cullStatsBuffers[frameIndex]->getMappedMemory());
+	testedMeshletCount = testedMeshletCounts[frameIndex];
+	visibleMeshletCount = stats->visibleMeshlets;
+	visibleClusterTriangleCount = stats->visibleTriangles;
+	*stats = {};
+
+	// the full mesh runs of the models with meshlets get one draw per meshlet and instance
+	uint32_t commandCount = 0;
+	uint32_t culledBatches = 0;
+	for (auto& batch : batches)
+	{
+		uint32_t meshletCount = batch.model->getMeshletCount();
+		for (auto& run : batch.runs)
+		{
+			run.firstCommand = UINT32_MAX;
+			if (meshletCount == 0 || run.lod != 0 || culledBatches == MAX_CULLED_BATCHES) continue;
+
+			run.firstCommand = commandCount;
+			run.commandCount = meshletCount * run.instanceCount;
+			commandCount += run.commandCount;
+			culledBatches++;
+		}
+	}
 
+	testedMeshletCounts[frameIndex] = commandCount;
+	if (commandCount == 0) return;
 
+	reserveDrawCommands(frameIndex, commandCount);
+	cullDescriptorPools[frameIndex]->resetPool();
+
+	CullUbo ubo{};
+	auto planes = frameInfo.camera.getFrustumPlanes();
+	for (int i = 0; i < 6; i++) ubo.frustumPlanes[i] = planes[i];
+	ubo.cameraPosition = glm::vec4(frameInfo.camera.getPosition(), 1.f);
+	cullUboBuffers[frameIndex]->writeToBuffer(&ubo);
+
+	VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+	cullPipeline->bind(commandBuffer);
+
+	auto uboInfo = cullUboBuffers[frameIndex]->descriptorInfo();
+	auto instanceInfo = instanceBuffers[frameIndex]->descriptorInfo();
+	auto commandInfo = drawCommandBuffers[frameIndex]->descriptorInfo();
+	auto statsInfo = cullStatsBuffers[frameIndex]->descriptorInfo();
+
+	for (auto& batch : batches)
+	{
+		Model* model = batch.model;
+		for (auto& run : batch.runs)
+		{
+			if (run.firstCommand == UINT32_MAX) continue;
+
+			auto meshletInfo = model->getMeshletBuffer()->descriptorInfo();
+			VkDescriptorSet descriptorSet;
+			bool allocated = DescriptorWriter(*cullSetLayout, *cullDescriptorPools[frameIndex])
+				.writeBuffer(0, &uboInfo)
+				.writeBuffer(1, &meshletInfo)
+				.writeBuffer(2, &instanceInfo)
+				.writeBuffer(3, &commandInfo)
+				.writeBuffer(4, &statsInfo)
+				.build(descriptorSet);
+
+			// the run is drawn whole
+			if (!allocated) {
+				run.firstCommand = UINT32_MAX;
+				continue;
+			}
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+			// bounds to undo the dequantization of packed models, identity for the full format
+			glm::vec3 boundsMin{ 0.f };
+			glm::vec3 boundsInverseExtent{ 1.f };
+			if (model->isPacked()) {
+				glm::vec3 extent = model->getBoundsMax() - model->getBoundsMin();
+				boundsMin = model->getBoundsMin();
+				boundsInverseExtent = glm::vec3(
+					extent.x > 0.f ? 1.f / extent.x : 0.f,
+					extent.y > 0.f ? 1.f / extent.y : 0.f,
+					extent.z > 0.f ? 1.f / extent.z : 0.f);
+			}
+
+			CullPushConstants push{};
+			push.boundsMin = glm::vec4(boundsMin, 0.f);
+			push.boundsInverseExtent = glm::vec4(boundsInverseExtent, 0.f);
+			push.firstInstance = run.firstInstance;
+			push.instanceCount = run.instanceCount;
+			push.meshletCount = model->getMeshletCount();
+			push.firstCommand = run.firstCommand;
+			push.coneCulling = clusterConeCulling ? 1 : 0;
+			vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &push);
+
+			vkCmdDispatch(commandBuffer, (run.commandCount + 63) / 64, 1, 1);
+		}
+	}
+
+	// the draws read the commands, the CPU reads the stats once the frame is done
+	VkMemoryBarrier cullBarrier{};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void RenderSystem::renderGameObjects(FrameInfo& frameInfo)
+{
+	drawCallCount = 0;
+	triangleCount = 0;
+
+	if (gpuScene != nullptr) {
 		vkCmdBindDescriptorSets(
 			frameInfo.commandBuffer,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
 			pipelineLayout,
-			1, 1,
-			&obj.descriptorSet[frameInfo.frameIndex],
+			0, 1,
+			&frameInfo.globalDescriptorSet[frameInfo.frameIndex],
 			0,
 			nullptr
 		);
 
-		SimplePushConstantData push{};
-		push.modelMatrix = obj.transform.mat4();
-		push.normalMatrix = obj.transform.normalMatrix();
+		gpuScene->draw(frameInfo, pipelineLayout, *pipeline, *packedPipeline);
+		drawCallCount = gpuScene->getDrawCallCount();
+		// read back MAX_FRAMES_IN_FLIGHT frames late, like the visible count
+		triangleCount = gpuScene->getStats().visibleTriangles;
+		return;
+	}
 
-		vkCmdPushConstants(
-			frameInfo.commandBuffer,
-			pipelineLayout,
-			VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-			0,
-			sizeof(SimplePushConstantData),
-			&push
-		);
+	if (batches.empty()) return;
+
+	auto& instanceBuffer = instanceBuffers[frameInfo.frameIndex];
+
+	vkCmdBindDescriptorSets(
+		frameInfo.commandBuffer,
+		VK_PIPELINE_BIND_POINT_GRAPHICS,
+		pipelineLayout,
+		0, 1,
+		&frameInfo.globalDescriptorSet[frameInfo.frameIndex],
+		0,
+		nullptr
+	);
+
+	VkBuffer buffers[] = { instanceBuffer->getBuffer() };
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(frameInfo.commandBuffer, 1, 1, buffers, offsets);
+
+	bool multiDraw = device.getEnabledFeatures().multiDrawIndirect == VK_TRUE;
+	VkDeviceSize commandStride = sizeof(VkDrawIndexedIndirectCommand);
+
+	struct PipelinePass {
+		Pipeline* pipeline;
+		bool packed;
+		bool backfaceCulled;
+	};
+
+	// one pass per pipeline, every pipeline is bound at most once
+	PipelinePass passes[] = {
+		{ pipeline.get(), false, false },
+		{ packedPipeline.get(), true, false },
+		{ backfaceCulledPipeline.get(), false, true },
+		{ backfaceCulledPackedPipeline.get(), true, true },
+	};
+
+	for (const auto& pass : passes)
+	{
+		bool bound = false;
+
+		for (auto& batch : batches)
+		{
+			if (batch.model->isPacked() != pass.packed) continue;
+
+			bool descriptorBound = false;
+			for (const auto& run : batch.runs)
+			{
+				bool culled = clusterCulling && run.firstCommand != UINT32_MAX;
+				if ((culled && clusterConeCulling) != pass.backfaceCulled) continue;
 
-		obj.model->bind(frameInfo.commandBuffer);
-		obj.model->draw(frameInfo.commandBuffer);
+				if (!bound) {
+					pass.pipeline->bind(frameInfo.commandBuffer);
+					bound = true;
+				}
 
-		i++;
+				if (!descriptorBound) {
+					vkCmdBindDescriptorSets(
+						frameInfo.commandBuffer,
+						VK_PIPELINE_BIND_POINT_GRAPHICS,
+						pipelineLayout,
+						1, 1,
+						&batch.descriptorSet,
+						0,
+						nullptr
+					);
+
+					batch.model->bind(frameInfo.commandBuffer);
+					descriptorBound = true;
+				}
+
+				if (!culled) {
+					batch.model->draw(frameInfo.commandBuffer, run.instanceCount, run.firstInstance, run.lod);
+					drawCallCount++;
+					triangleCount += run.instanceCount * batch.model->getTriangleCount(run.lod);
+					continue;
+				}
+
+				// the culled meshlets have an instance count of 0
+				VkBuffer commandBuffer = drawCommandBuffers[frameInfo.frameIndex]->getBuffer();
+				VkDeviceSize offset = run.firstCommand * commandStride;
+				if (multiDraw) {
+					vkCmdDrawIndexedIndirect(frameInfo.commandBuffer, commandBuffer, offset, run.commandCount, static_cast<uint32_t>(commandStride));
+					drawCallCount++;
+				}
+				else {
+					for (uint32_t c = 0; c < run.commandCount; c++) {
+						vkCmdDrawIndexedIndirect(frameInfo.commandBuffer, commandBuffer, offset + c * commandStride, 1, static_cast<uint32_t>(commandStride));
+					}
+					drawCallCount += run.commandCount;
+				}
+			}
+		}
+	}
+
+	// the triangles of the culled runs are only known once their frame is back
+	if (clusterCulling) triangleCount += visibleClusterTriangleCount;
+}
+
+std::vector<VkVertexInputBindingDescription> RenderSystem::InstanceData::getBindingDescriptions()
+{
+	std::vector<VkVertexInputBindingDescription> bindingDescription(1);
+	bindingDescription[0].binding = 1;
+	bindingDescription[0].stride = sizeof(InstanceData);
+	bindingDescription[0].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	return bindingDescription;
+}
+
+std::vector<VkVertexInputAttributeDescription> RenderSystem::InstanceData::getAttributeDescriptions()
+{
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+
+	// a mat4 takes one location per column
+	for (uint32_t i = 0; i < 4; i++) {
+		attributeDescriptions.push_back({ 4 + i, 1, VK_FORMAT_R32G32B32A32_SFLOAT, static_cast<uint32_t>(offsetof(InstanceData, modelMatrix) + i * sizeof(glm::vec4)) });
+	}
+	for (uint32_t i = 0; i < 4; i++) {
+		attributeDescriptions.push_back({ 8 + i, 1, VK_FORMAT_R32G32B32A32_SFLOAT, static_cast<uint32_t>(offsetof(InstanceData, normalMatrix) + i * sizeof(glm::vec4)) });
 	}
+
+	return attributeDescriptions;
 }
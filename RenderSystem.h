@@ -6,10 +6,16 @@
 #include "Camera.h"
 #include "Frame_info.h"
 #include "descriptors.h"
+#include "Buffer.h"
+#include "TextureRegistry.h"
+#include "FrustumCuller.h"
+#include "GpuScene.h"
 
 
+#include <map>
 #include <memory>
 #include <vector>
+#include <unordered_map>
 
 template<class T>
 constexpr T pi = T(3.1415926535897932385L);
@@ -17,21 +23,165 @@ constexpr T pi = T(3.1415926535897932385L);
 class RenderSystem
 {
 public:
-	RenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout);
+	// per instance data, fed to the vertex shader through a second vertex binding
+	struct InstanceData {
+		glm::mat4 modelMatrix{ 1.f };
+		glm::mat4 normalMatrix{ 1.f };
+
+		static std::vector<VkVertexInputBindingDescription> getBindingDescriptions();
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+	};
+
+	RenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout, TextureRegistry& textureRegistry);
 	~RenderSystem();
 
 	RenderSystem(const RenderSystem&) = delete;
 	RenderSystem& operator=(const RenderSystem&) = delete;
+
+	// outside of the render pass: batches, levels of detail, instance data and the cluster culling dispatch
+	void prepareFrame(FrameInfo& frameInfo);
 	void renderGameObjects(FrameInfo& frameInfo);
 
+	uint32_t getDrawCallCount() const { return drawCallCount; }
+
+	// objects whose bounding sphere is outside the view frustum are not drawn, nor their textures used
+	void setFrustumCulling(bool enabled) { frustumCulling = enabled; }
+	bool isFrustumCullingEnabled() const { return frustumCulling; }
+
+	// objects with a model and a texture tested by the frustum culling this frame, and the ones kept
+	uint32_t getTestedObjectCount() const { return testedObjectCount; }
+	uint32_t getVisibleObjectCount() const { return visibleObjectCount; }
+	uint32_t getTriangleCount() const { return triangleCount; }
+
+	// a level of detail is drawn when its error projects to less than pixels on a screen of screenHeight pixels
+	void setLodErrorThreshold(float pixels, uint32_t screenHeight);
+
+	// off: every object draws its full mesh
+	void setLodEnabled(bool enabled) { lodEnabled = enabled; }
+	bool isLodEnabled() const { return lodEnabled; }
+
+	// models with meshlets are drawn with indirect draws of the clusters that pass the frustum test,
+	// the cone test also drops back facing clusters and the pipeline then culls back faces. off by default,
+	// returns false when the device lacks drawIndirectFirstInstance or cluster_cull.comp could not be loaded
+	bool setClusterCulling(bool enabled);
+	void setClusterConeCulling(bool enabled) { clusterConeCulling = enabled; }
+	bool isClusterCullingEnabled() const { return clusterCulling; }
+
+	// meshlets tested and kept by the culling pass, read back MAX_FRAMES_IN_FLIGHT frames late,
+	// the triangle count includes the kept meshlets with the same delay
+	uint32_t getTestedMeshletCount() const { return testedMeshletCount; }
+	uint32_t getVisibleMeshletCount() const { return visibleMeshletCount; }
+
+	// the objects are kept in a GpuScene, culled and given their level of detail by a compute shader and drawn
+	// with one indirect count draw per pool and texture. returns false when the device lacks
+	// VK_KHR_draw_indirect_count, multiDrawIndirect or drawIndirectFirstInstance, or scene_cull.comp.spv is missing
+	bool setGpuDriven(bool enabled);
+	bool isGpuDriven() const { return gpuScene != nullptr; }
+
+	// GPU driven mode only: an object is written again once its transform, model or texture changed,
+	// the others keep what was written before
+	void updateObject(GameObject& obj);
+	void removeObject(GameObject::id_t id);
+	const GpuScene* getGpuScene() const { return gpuScene.get(); }
+
+	// GPU driven mode only, false otherwise or when its shaders could not be loaded. the render pass is split
+	// in two: renderGameObjects draws the objects visible last frame, prepareLatePass builds the depth pyramid
+	// from their depth and culls the rest against it, renderLatePass draws the ones found visible
+	bool setOcclusionCulling(bool enabled);
+	bool isOcclusionCullingEnabled() const { return gpuScene != nullptr && gpuScene->isOcclusionCullingEnabled(); }
+	void prepareLatePass(FrameInfo& frameInfo, const DepthPyramid::Source& depth);
+	void renderLatePass(FrameInfo& frameInfo);
+
+	// objects in the frustum hidden by the depth pyramid, read back MAX_FRAMES_IN_FLIGHT frames late
+	uint32_t getOccludedObjectCount() const { return gpuScene != nullptr ? gpuScene->getStats().occludedCount : 0; }
+
 
 private:
+	// objects of a batch drawing the same level of detail, one draw call
+	struct LodRun {
+		uint32_t lod = 0;
+		uint32_t firstInstance = 0;
+		uint32_t instanceCount = 0;
+
+		// indirect draws written by the culling pass, one per meshlet and instance, only for the full mesh
+		uint32_t firstCommand = UINT32_MAX;
+		uint32_t commandCount = 0;
+	};
+
+	// every object sharing the same model and texture is drawn with a single instanced draw call per level of detail
+	struct InstanceBatch {
+		Model* model = nullptr;
+		TextureRegistry::Entry* texture = nullptr;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		std::vector<GameObject*> objects{};
+		uint32_t firstInstance = 0;
+		std::vector<LodRun> runs{};
+	};
+
 	void createPipelineLayout(std::vector<VkDescriptorSetLayout> descriptorSetLayout);
 	void createPipeline(VkRenderPass renderPass);
+	void createCullResources();
+
+	void buildBatches(FrameInfo& frameInfo);
+	void cullObjects(FrameInfo& frameInfo);
+	void reserveInstances(int frameIndex, uint32_t instanceCount);
+	void selectLods(FrameInfo& frameInfo, InstanceBatch& batch);
+	// pixels covered by the texture of the object, for the texture streaming
+	float textureScreenSize(FrameInfo& frameInfo, GameObject& obj);
+	void reserveDrawCommands(int frameIndex, uint32_t commandCount);
+	void cullClusters(FrameInfo& frameInfo);
 
 	Device &device;
+	TextureRegistry& textureRegistry;
 
 	std::unique_ptr<Pipeline> pipeline;
+	// for the models using Model::PackedVertex
+	std::unique_ptr<Pipeline> packedPipeline;
+	// same two with back face culling, for the clusters left by the cone test
+	std::unique_ptr<Pipeline> backfaceCulledPipeline;
+	std::unique_ptr<Pipeline> backfaceCulledPackedPipeline;
 	VkPipelineLayout pipelineLayout;
+
+	std::unique_ptr<DescriptorSetLayout> cullSetLayout;
+	VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+	std::unique_ptr<ComputePipeline> cullPipeline;
+
+	// per frame in flight, the sets are allocated again every frame
+	std::vector<std::unique_ptr<DescriptorPool>> cullDescriptorPools{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+	std::vector<std::unique_ptr<Buffer>> cullUboBuffers{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+	std::vector<std::unique_ptr<Buffer>> cullStatsBuffers{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+	std::vector<std::unique_ptr<Buffer>> drawCommandBuffers{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+	std::vector<uint32_t> testedMeshletCounts = std::vector<uint32_t>(Swap_chain::MAX_FRAMES_IN_FLIGHT, 0);
+
+	std::vector<std::unique_ptr<Buffer>> instanceBuffers{ Swap_chain::MAX_FRAMES_IN_FLIGHT };
+
+	// objects that can be drawn, in the order of the spheres of the culler
+	std::vector<GameObject*> candidates;
+	std::vector<uint8_t> candidateVisible;
+	FrustumCuller frustumCuller;
+	bool frustumCulling = true;
+	uint32_t testedObjectCount = 0;
+	uint32_t visibleObjectCount = 0;
+
+	std::vector<InstanceBatch> batches;
+	std::map<std::pair<Model*, TextureRegistry::Entry*>, size_t> batchIndices;
+
+	uint32_t drawCallCount = 0;
+	uint32_t triangleCount = 0;
+
+	bool lodEnabled = true;
+	// largest projected error, in normalized device coordinates (the screen is 2 high)
+	float lodThreshold = 2.f / 1200.f;
+	uint32_t screenHeight = 1200;
+
+	// indirect draws carry the first instance, which needs drawIndirectFirstInstance
+	bool clusterCullingSupported = false;
+	bool clusterCulling = false;
+	bool clusterConeCulling = true;
+	uint32_t testedMeshletCount = 0;
+	uint32_t visibleMeshletCount = 0;
+	uint32_t visibleClusterTriangleCount = 0;
+
+	std::unique_ptr<GpuScene> gpuScene;
 };
 
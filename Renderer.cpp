@@ -97,14 +97,14 @@ void Renderer::endFrame()
 	currentFrameIndex = (currentFrameIndex + 1) % Swap_chain::MAX_FRAMES_IN_FLIGHT;
 }
 
-void Renderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer)
+void Renderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer, Swap_chain::RenderPassPart part)
 {
 	assert(isFrameStarted && "cant call beginSwapChainRenderPass while frame not in progress");
 	assert(commandBuffer == getCurrentCommandBuffer() && "cant begin render pass on command buffer from a different frame");
 
 	VkRenderPassBeginInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = swapChain->getRenderPass();
+	renderPassInfo.renderPass = swapChain->getRenderPass(part);
 	renderPassInfo.framebuffer = swapChain->getFrameBuffer(currentImageIndex);
 
 	renderPassInfo.renderArea.offset = { 0, 0 };
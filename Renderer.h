@@ -25,6 +25,13 @@ public:
 
 	uint32_t getWidth() const { return swapChain->width(); }
 	uint32_t getHeight() const { return swapChain->height(); }
+	VkExtent2D getExtent() const { return swapChain->getSwapChainExtent(); }
+
+	// depth attachment of the image being drawn, read between the two parts of a split frame
+	VkImage getDepthImage() const { return swapChain->getDepthImage(currentImageIndex); }
+	VkImageView getDepthImageView() const { return swapChain->getDepthImageView(currentImageIndex); }
+	VkFormat getDepthFormat() const { return swapChain->getDepthFormat(); }
+	bool isDepthSampled() const { return swapChain->isDepthSampled(); }
 
 	bool isFrameInProgress() const { return isFrameStarted;	}
 
@@ -41,7 +48,8 @@ public:
 	VkCommandBuffer beginFrame();
 	void endFrame();
 
-	void beginSwapChainRenderPass(VkCommandBuffer commandBuffer);
+	// a split frame begins and ends the render pass twice, once per part
+	void beginSwapChainRenderPass(VkCommandBuffer commandBuffer, Swap_chain::RenderPassPart part = Swap_chain::RenderPassPart::Whole);
 	void endSwapChainRenderPass(VkCommandBuffer commandBuffer);
 
 
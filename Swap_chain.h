@@ -14,6 +14,14 @@ class Swap_chain {
 public:
     static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
 
+    // a frame drawn in one render pass, or split in two around a compute pass that reads the depth:
+    // the first part clears and keeps both attachments, the second one loads them and presents
+    enum class RenderPassPart {
+        Whole,
+        First,
+        Second,
+    };
+
     Swap_chain(Device& deviceRef, VkExtent2D windowExtent);
     Swap_chain(Device& deviceRef, VkExtent2D windowExtent, std::shared_ptr<Swap_chain> previous);
     ~Swap_chain();
@@ -23,6 +31,10 @@ public:
 
     VkFramebuffer getFrameBuffer(int index) { return swapChainFramebuffers[index]; }
     VkRenderPass getRenderPass() { return renderPass; }
+    // compatible with getRenderPass, the pipelines and framebuffers are shared
+    VkRenderPass getRenderPass(RenderPassPart part) {
+        return part == RenderPassPart::First ? firstRenderPass : part == RenderPassPart::Second ? secondRenderPass : renderPass;
+    }
     VkImageView getImageView(int index) { return swapChainImageViews[index]; }
     size_t imageCount() { return swapChainImages.size(); }
     VkFormat getSwapChainImageFormat() { return swapChainImageFormat; }
@@ -34,6 +46,11 @@ public:
         return static_cast<float>(swapChainExtent.width) / static_cast<float>(swapChainExtent.height);
     }
     VkFormat findDepthFormat();
+    VkFormat getDepthFormat() { return swapChainDepthFormat; }
+    // the depth images can be read by a shader, which the occlusion culling needs
+    bool isDepthSampled() const { return depthSampled; }
+    VkImage getDepthImage(int index) { return depthImages[index]; }
+    VkImageView getDepthImageView(int index) { return depthImageViews[index]; }
 
     VkResult acquireNextImage(uint32_t* imageIndex);
     VkResult submitCommandBuffers(const VkCommandBuffer* buffers, uint32_t* imageIndex);
@@ -50,6 +67,7 @@ private:
     void createImageViews();
     void createDepthResources();
     void createRenderPass();
+    VkRenderPass createRenderPass(RenderPassPart part);
     void createFramebuffers();
     void createSyncObjects();
 
@@ -59,16 +77,20 @@ private:
     VkPresentModeKHR chooseSwapPresentMode(
         const std::vector<VkPresentModeKHR>& availablePresentModes);
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
+    bool isDepthFormatSampled(VkFormat format);
 
     VkFormat swapChainImageFormat;
     VkFormat swapChainDepthFormat;
+    bool depthSampled = false;
     VkExtent2D swapChainExtent;
 
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkRenderPass renderPass;
+    VkRenderPass firstRenderPass;
+    VkRenderPass secondRenderPass;
 
     std::vector<VkImage> depthImages;
-    std::vector<VkDeviceMemory> depthImageMemorys;
+    std::vector<MemoryAllocation> depthImageMemorys;
     std::vector<VkImageView> depthImageViews;
     std::vector<VkImage> swapChainImages;
     std::vector<VkImageView> swapChainImageViews;
@@ -3,19 +3,424 @@
 #include <stdexcept>
 
 #include "Buffer.h"
+#include "MipGenerator.h"
 #include "basisu_transcoder.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
 
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-Texture::Texture(Device& device, const char* filePathTexture) : device{device}
+Texture::Texture(Device& device, const char* filePathTexture, const SamplerSettings& samplerSettings) : Texture(device, loadImageData(filePathTexture, getTranscodeTargets(device)), samplerSettings) {}
+
+Texture::Texture(Device& device, const ImageData& image, const SamplerSettings& samplerSettings) : device{device}, samplerSettings{samplerSettings}
+{
+    create(image, nullptr);
+}
+
+Texture::Texture(Device& device, const EncodedImage& image, const UploadContext::StagingRegion& staging, const SamplerSettings& samplerSettings) : device{device}, samplerSettings{samplerSettings}
+{
+    create(image.layout, &staging);
+}
+
+void Texture::create(const ImageData& image, const UploadContext::StagingRegion* staged)
 {
-    uint32_t mipLevel = createTextureImage(filePathTexture);
-    std::cout << "miplevel fghjhgfd = " << mipLevel << "\n";
+    // rgba8 with a single level goes through the mip generator, block formats can only use the levels of the file
+    bool transcoded = image.format != VK_FORMAT_R8G8B8A8_SRGB || image.levelOffsets.size() > 1;
+
+    uint32_t mipLevel = transcoded ? createTranscodedImage(image, staged) : createTextureImage(image, staged);
     createTextureImageView(mipLevel);
     createTextureSampler(mipLevel);
+
+    // the compute downsampler reads level 0 through the view
+    if (mipLevel > 1 && !transcoded) {
+        generateMipChain(mipLevel, image.width, image.height);
+    }
+}
+
+Texture::ImageData::~ImageData()
+{
+    if (pixels) stbi_image_free(pixels);
+}
+
+Texture::ImageData::ImageData(ImageData&& other) noexcept : pixels{other.pixels}, width{other.width}, height{other.height},
+    sourceWidth{other.sourceWidth}, sourceHeight{other.sourceHeight}, format{other.format}, levelData{std::move(other.levelData)}, levelOffsets{std::move(other.levelOffsets)}
+{
+    other.pixels = nullptr;
+}
+
+Texture::ImageData& Texture::ImageData::operator=(ImageData&& other) noexcept
+{
+    if (this != &other) {
+        if (pixels) stbi_image_free(pixels);
+        pixels = other.pixels;
+        width = other.width;
+        height = other.height;
+        sourceWidth = other.sourceWidth;
+        sourceHeight = other.sourceHeight;
+        format = other.format;
+        levelData = std::move(other.levelData);
+        levelOffsets = std::move(other.levelOffsets);
+        other.pixels = nullptr;
+    }
+    return *this;
+}
+
+Texture::TranscodeTargets Texture::getTranscodeTargets(Device& device)
+{
+    // the formats also need their compression feature, enabled by the device when it has it
+    const VkPhysicalDeviceFeatures& features = device.getEnabledFeatures();
+
+    TranscodeTargets targets{};
+    targets.bc7 = features.textureCompressionBC && device.isFormatSupported(VK_FORMAT_BC7_SRGB_BLOCK);
+    targets.astc = features.textureCompressionASTC_LDR && device.isFormatSupported(VK_FORMAT_ASTC_4x4_SRGB_BLOCK);
+    targets.bc1bc3 = features.textureCompressionBC && device.isFormatSupported(VK_FORMAT_BC1_RGB_SRGB_BLOCK) && device.isFormatSupported(VK_FORMAT_BC3_SRGB_BLOCK);
+    targets.etc2 = features.textureCompressionETC2 && device.isFormatSupported(VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK) && device.isFormatSupported(VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK);
+    return targets;
+}
+
+struct TranscodeFormat {
+    basist::transcoder_texture_format transcoderFormat;
+    VkFormat format;
+};
+
+static TranscodeFormat chooseTranscodeFormat(const Texture::TranscodeTargets& targets, bool hasAlpha)
+{
+    using basist::transcoder_texture_format;
+
+    if (targets.bc7) return { transcoder_texture_format::cTFBC7_RGBA, VK_FORMAT_BC7_SRGB_BLOCK };
+    if (targets.astc) return { transcoder_texture_format::cTFASTC_4x4_RGBA, VK_FORMAT_ASTC_4x4_SRGB_BLOCK };
+
+    // without alpha the 8 byte blocks are enough
+    if (targets.bc1bc3) {
+        if (hasAlpha) return { transcoder_texture_format::cTFBC3_RGBA, VK_FORMAT_BC3_SRGB_BLOCK };
+        return { transcoder_texture_format::cTFBC1_RGB, VK_FORMAT_BC1_RGB_SRGB_BLOCK };
+    }
+    if (targets.etc2) {
+        if (hasAlpha) return { transcoder_texture_format::cTFETC2_RGBA, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK };
+        return { transcoder_texture_format::cTFETC1_RGB, VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK };
+    }
+
+    return { transcoder_texture_format::cTFRGBA32, VK_FORMAT_R8G8B8A8_SRGB };
+}
+
+static std::vector<uint8_t> readFile(const char* filePath)
+{
+    std::ifstream file{ filePath, std::ios::binary | std::ios::ate };
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string("failed to open texture file: ") + filePath);
+    }
+
+    std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return data;
+}
+
+// first level of the file whose largest side fits in maxSize, the last one if none does
+static uint32_t firstLevelBelow(uint32_t width, uint32_t height, uint32_t levelCount, uint32_t maxSize)
+{
+    uint32_t level = 0;
+    while (level + 1 < levelCount && std::max(width >> level, height >> level) > maxSize) level++;
+    return level;
+}
+
+// room for the next level in the decoded image, the size the transcoder takes as output (blocks, or pixels for rgba8)
+static void addLevel(Texture::EncodedImage& image, basist::transcoder_texture_format format, uint32_t level, uint32_t width, uint32_t height, uint32_t blockCount)
+{
+    // the image is created with the size of level 0, the levels of the file have to follow it
+    if (width != std::max(1u, image.layout.width >> level) || height != std::max(1u, image.layout.height >> level)) {
+        throw std::runtime_error("failed to transcode texture: unexpected mip level size");
+    }
+
+    bool uncompressed = basist::basis_transcoder_format_is_uncompressed(format);
+    uint32_t outputSize = uncompressed ? width * height : blockCount;
+
+    image.layout.levelOffsets.push_back(image.size);
+    image.size += static_cast<VkDeviceSize>(outputSize) * basist::basis_get_bytes_per_block_or_pixel(format);
+}
+
+static uint32_t levelOutputSize(const Texture::EncodedImage& image, size_t level)
+{
+    auto format = static_cast<basist::transcoder_texture_format>(image.transcoderFormat);
+    const std::vector<VkDeviceSize>& offsets = image.layout.levelOffsets;
+
+    VkDeviceSize end = level + 1 < offsets.size() ? offsets[level + 1] : image.size;
+    return static_cast<uint32_t>((end - offsets[level]) / basist::basis_get_bytes_per_block_or_pixel(format));
+}
+
+static void readKtx2(Texture::EncodedImage& image, const Texture::TranscodeTargets& targets, uint32_t maxSize)
+{
+    basist::ktx2_transcoder transcoder;
+    if (!transcoder.init(image.file.data(), static_cast<uint32_t>(image.file.size()))) {
+        throw std::runtime_error("failed to transcode texture: invalid ktx2 file");
+    }
+
+    TranscodeFormat format = chooseTranscodeFormat(targets, transcoder.get_has_alpha());
+
+    uint32_t levelCount = std::max(1u, transcoder.get_levels());
+    image.firstLevel = firstLevelBelow(transcoder.get_width(), transcoder.get_height(), levelCount, maxSize);
+    image.ktx2 = true;
+    image.transcoderFormat = static_cast<int>(format.transcoderFormat);
+
+    Texture::ImageData& layout = image.layout;
+    layout.sourceWidth = transcoder.get_width();
+    layout.sourceHeight = transcoder.get_height();
+    layout.width = std::max(1u, layout.sourceWidth >> image.firstLevel);
+    layout.height = std::max(1u, layout.sourceHeight >> image.firstLevel);
+    layout.format = format.format;
+
+    // the skipped levels are not transcoded at all
+    for (uint32_t level = image.firstLevel; level < levelCount; level++) {
+        basist::ktx2_image_level_info info;
+        if (!transcoder.get_image_level_info(info, level, 0, 0)) {
+            throw std::runtime_error("failed to transcode texture: invalid ktx2 level");
+        }
+        addLevel(image, format.transcoderFormat, level - image.firstLevel, info.m_orig_width, info.m_orig_height, info.m_total_blocks);
+    }
+}
+
+static void decodeKtx2(const Texture::EncodedImage& image, unsigned char* destination)
+{
+    basist::ktx2_transcoder transcoder;
+    if (!transcoder.init(image.file.data(), static_cast<uint32_t>(image.file.size())) || !transcoder.start_transcoding()) {
+        throw std::runtime_error("failed to transcode texture: invalid ktx2 file");
+    }
+
+    auto format = static_cast<basist::transcoder_texture_format>(image.transcoderFormat);
+    const std::vector<VkDeviceSize>& offsets = image.layout.levelOffsets;
+
+    for (uint32_t i = 0; i < offsets.size(); i++) {
+        if (!transcoder.transcode_image_level(image.firstLevel + i, 0, 0, destination + offsets[i], levelOutputSize(image, i), format)) {
+            throw std::runtime_error("failed to transcode texture level");
+        }
+    }
+}
+
+static void readBasis(Texture::EncodedImage& image, const Texture::TranscodeTargets& targets, uint32_t maxSize)
+{
+    const uint32_t fileSize = static_cast<uint32_t>(image.file.size());
+
+    basist::basisu_transcoder transcoder;
+    basist::basisu_image_info imageInfo;
+    if (!transcoder.validate_header(image.file.data(), fileSize) || !transcoder.get_image_info(image.file.data(), fileSize, imageInfo, 0)) {
+        throw std::runtime_error("failed to transcode texture: invalid basis file");
+    }
+
+    TranscodeFormat format = chooseTranscodeFormat(targets, imageInfo.m_alpha_flag);
+
+    image.firstLevel = firstLevelBelow(imageInfo.m_orig_width, imageInfo.m_orig_height, imageInfo.m_total_levels, maxSize);
+    image.basis = true;
+    image.transcoderFormat = static_cast<int>(format.transcoderFormat);
+
+    // only the first image of the file is used
+    Texture::ImageData& layout = image.layout;
+    layout.sourceWidth = imageInfo.m_orig_width;
+    layout.sourceHeight = imageInfo.m_orig_height;
+    layout.width = std::max(1u, layout.sourceWidth >> image.firstLevel);
+    layout.height = std::max(1u, layout.sourceHeight >> image.firstLevel);
+    layout.format = format.format;
+
+    for (uint32_t level = image.firstLevel; level < imageInfo.m_total_levels; level++) {
+        uint32_t width, height, blockCount;
+        if (!transcoder.get_image_level_desc(image.file.data(), fileSize, 0, level, width, height, blockCount)) {
+            throw std::runtime_error("failed to transcode texture: invalid basis level");
+        }
+        addLevel(image, format.transcoderFormat, level - image.firstLevel, width, height, blockCount);
+    }
+}
+
+static void decodeBasis(const Texture::EncodedImage& image, unsigned char* destination)
+{
+    const uint32_t fileSize = static_cast<uint32_t>(image.file.size());
+
+    basist::basisu_transcoder transcoder;
+    if (!transcoder.start_transcoding(image.file.data(), fileSize)) {
+        throw std::runtime_error("failed to transcode texture: invalid basis file");
+    }
+
+    auto format = static_cast<basist::transcoder_texture_format>(image.transcoderFormat);
+    const std::vector<VkDeviceSize>& offsets = image.layout.levelOffsets;
+
+    for (uint32_t i = 0; i < offsets.size(); i++) {
+        if (!transcoder.transcode_image_level(image.file.data(), fileSize, 0, image.firstLevel + i, destination + offsets[i], levelOutputSize(image, i), format)) {
+            throw std::runtime_error("failed to transcode texture level");
+        }
+    }
+}
+
+// level of an rgba8 image, every texel is the average of the square of 2^level texels above it, taken in linear space
+static void downsample(const unsigned char* pixels, uint32_t width, uint32_t height, uint32_t level, unsigned char* result)
+{
+    static const std::vector<float> toLinear = []() {
+        std::vector<float> table(256);
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.f;
+            table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+
+    uint32_t levelWidth = std::max(1u, width >> level);
+    uint32_t levelHeight = std::max(1u, height >> level);
+    uint32_t side = 1u << level;
+
+    for (uint32_t y = 0; y < levelHeight; y++) {
+        for (uint32_t x = 0; x < levelWidth; x++) {
+            // the texels past the last full square are dropped, like the rounding down of the level size
+            uint32_t x1 = std::min(width, (x + 1) * side);
+            uint32_t y1 = std::min(height, (y + 1) * side);
+
+            float sum[4]{};
+            for (uint32_t sy = y * side; sy < y1; sy++) {
+                const unsigned char* row = pixels + (static_cast<size_t>(sy) * width + x * side) * 4;
+                for (uint32_t sx = x * side; sx < x1; sx++, row += 4) {
+                    sum[0] += toLinear[row[0]];
+                    sum[1] += toLinear[row[1]];
+                    sum[2] += toLinear[row[2]];
+                    sum[3] += row[3];
+                }
+            }
+
+            float count = static_cast<float>((x1 - x * side) * (y1 - y * side));
+            unsigned char* out = result + (static_cast<size_t>(y) * levelWidth + x) * 4;
+            for (int c = 0; c < 3; c++) {
+                float l = sum[c] / count;
+                float v = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.f / 2.4f) - 0.055f;
+                out[c] = static_cast<unsigned char>(std::clamp(v, 0.f, 1.f) * 255.f + 0.5f);
+            }
+            out[3] = static_cast<unsigned char>(sum[3] / count + 0.5f);
+        }
+    }
+}
+
+static std::string lowerExtension(const char* filePath)
+{
+    std::string extension = std::filesystem::path(filePath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+}
+
+static uint32_t stbLevelCount(uint32_t width, uint32_t height)
+{
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+Texture::ImageData Texture::loadImageData(const char* filePathTexture, const TranscodeTargets& targets, uint32_t maxSize)
+{
+    std::string extension = lowerExtension(filePathTexture);
+
+    if (extension == ".ktx2" || extension == ".basis") {
+        EncodedImage encoded = readImage(filePathTexture, targets, maxSize);
+
+        std::vector<unsigned char> levelData(static_cast<size_t>(encoded.size));
+        decodeImage(encoded, levelData.data());
+
+        ImageData image = std::move(encoded.layout);
+        image.levelData = std::move(levelData);
+        return image;
+    }
+
+    int texWidth, texHeight, texChannels;
+    ImageData image{};
+    image.pixels = stbi_load(filePathTexture, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+    if (!image.pixels) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    image.width = static_cast<uint32_t>(texWidth);
+    image.height = static_cast<uint32_t>(texHeight);
+    image.sourceWidth = image.width;
+    image.sourceHeight = image.height;
+
+    uint32_t level = firstLevelBelow(image.width, image.height, stbLevelCount(image.width, image.height), maxSize);
+    if (level > 0) {
+        uint32_t width = std::max(1u, image.width >> level);
+        uint32_t height = std::max(1u, image.height >> level);
+
+        image.levelData.resize(static_cast<size_t>(width) * height * 4);
+        downsample(image.pixels, image.width, image.height, level, image.levelData.data());
+        image.levelOffsets = { 0 };
+        image.width = width;
+        image.height = height;
+
+        stbi_image_free(image.pixels);
+        image.pixels = nullptr;
+    }
+    return image;
+}
+
+Texture::EncodedImage Texture::readImage(const char* filePathTexture, const TranscodeTargets& targets, uint32_t maxSize)
+{
+    std::string extension = lowerExtension(filePathTexture);
+
+    EncodedImage image{};
+    image.file = readFile(filePathTexture);
+
+    if (extension == ".ktx2" || extension == ".basis") {
+        // the tables are built once, loads can run on several workers
+        static std::once_flag transcoderInit;
+        std::call_once(transcoderInit, basist::basisu_transcoder_init);
+
+        if (extension == ".ktx2") readKtx2(image, targets, maxSize);
+        else readBasis(image, targets, maxSize);
+        return image;
+    }
+
+    int texWidth, texHeight, texChannels;
+    if (!stbi_info_from_memory(image.file.data(), static_cast<int>(image.file.size()), &texWidth, &texHeight, &texChannels)) {
+        throw std::runtime_error(std::string("failed to load texture image: ") + filePathTexture);
+    }
+
+    ImageData& layout = image.layout;
+    layout.sourceWidth = static_cast<uint32_t>(texWidth);
+    layout.sourceHeight = static_cast<uint32_t>(texHeight);
+
+    image.firstLevel = firstLevelBelow(layout.sourceWidth, layout.sourceHeight, stbLevelCount(layout.sourceWidth, layout.sourceHeight), maxSize);
+    layout.width = std::max(1u, layout.sourceWidth >> image.firstLevel);
+    layout.height = std::max(1u, layout.sourceHeight >> image.firstLevel);
+    layout.levelOffsets = { 0 };
+    image.size = static_cast<VkDeviceSize>(layout.width) * layout.height * 4;
+    return image;
+}
+
+void Texture::decodeImage(const EncodedImage& image, unsigned char* destination)
+{
+    if (image.ktx2) {
+        decodeKtx2(image, destination);
+        return;
+    }
+    if (image.basis) {
+        decodeBasis(image, destination);
+        return;
+    }
+
+    // stb has no output parameter, its buffer is copied or box filtered into the destination on this thread
+    int texWidth, texHeight, texChannels;
+    stbi_uc* pixels = stbi_load_from_memory(image.file.data(), static_cast<int>(image.file.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+    const ImageData& layout = image.layout;
+    if (!pixels || static_cast<uint32_t>(texWidth) != layout.sourceWidth || static_cast<uint32_t>(texHeight) != layout.sourceHeight) {
+        stbi_image_free(pixels);
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    if (image.firstLevel > 0) {
+        downsample(pixels, layout.sourceWidth, layout.sourceHeight, image.firstLevel, destination);
+    }
+    else {
+        memcpy(destination, pixels, static_cast<size_t>(image.size));
+    }
+    stbi_image_free(pixels);
 }
 
 Texture::Texture(Device& device, unsigned char* rgbaPixels, const uint32_t fontWidth, const uint32_t fontHeight, VkDeviceSize imageSize, uint32_t mipLevel) : device{device}
@@ -25,6 +430,79 @@ Texture::Texture(Device& device, unsigned char* rgbaPixels, const uint32_t fontW
     createTextureSampler();
 }
 
+static void recordLayoutBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMipLevel, uint32_t levelCount,
+    VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = baseMipLevel;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+Texture::Texture(Device& device, const Texture& source, uint32_t firstMip) : device{device}, samplerSettings{source.samplerSettings}
+{
+    if (firstMip == 0 || firstMip >= source.mipLevels) {
+        throw std::runtime_error("failed to copy texture: no level to drop");
+    }
+
+    format = source.format;
+    uint32_t levelCount = source.mipLevels - firstMip;
+
+    createImage(
+        std::max(1u, source.extent.width >> firstMip),
+        std::max(1u, source.extent.height >> firstMip),
+        format,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        textureImage,
+        textureImageMemory,
+        levelCount);
+
+    // on the graphics queue, where the frames in flight may still sample the source
+    transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount);
+    VkCommandBuffer commandBuffer = device.getUploadContext().getGraphicsCommandBuffer();
+
+    recordLayoutBarrier(commandBuffer, source.textureImage, firstMip, levelCount,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+    std::vector<VkImageCopy> regions(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++) {
+        VkImageCopy& region = regions[level];
+        region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, firstMip + level, 0, 1 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        region.extent = { std::max(1u, extent.width >> level), std::max(1u, extent.height >> level), 1 };
+    }
+
+    vkCmdCopyImage(
+        commandBuffer,
+        source.textureImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        levelCount, regions.data());
+
+    recordLayoutBarrier(commandBuffer, source.textureImage, firstMip, levelCount,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, levelCount);
+
+    createTextureImageView(levelCount);
+    createTextureSampler(levelCount);
+}
+
 void Texture::createTextureImage(unsigned char* rgbaPixels, const uint32_t fontWidth, const uint32_t fontHeight, VkDeviceSize imageSize, uint32_t mipLevel) {
 
     int texWidth = fontWidth;
@@ -33,20 +511,6 @@ void Texture::createTextureImage(unsigned char* rgbaPixels, const uint32_t fontW
     if (imageSize == 0)
         imageSize = texWidth * texHeight * 4;
 
-    // create staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    device.createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    // transfer to device and copy from staging
-    void* data;
-    vkMapMemory(device.device(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, rgbaPixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device.device(), stagingBufferMemory);
-
-    // free local memory
-    delete[] rgbaPixels;
-
     createImage(
         texWidth,
         texHeight,
@@ -58,91 +522,112 @@ void Texture::createTextureImage(unsigned char* rgbaPixels, const uint32_t fontW
         textureImageMemory,
         mipLevel);
 
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevel);
-    device.copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, mipLevel - 1);
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
+    // the pixels are copied in the upload ring, so local memory can be freed right away
+    device.getUploadContext().uploadImage(textureImage, rgbaPixels, imageSize, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevel, mipLevel - 1);
+    delete[] rgbaPixels;
 
-    vkDestroyBuffer(device.device(), stagingBuffer, nullptr);
-    vkFreeMemory(device.device(), stagingBufferMemory, nullptr);
+    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
 }
 
 
-uint32_t Texture::createTextureImage(const char* path)
+uint32_t Texture::createTextureImage(const ImageData& image, const UploadContext::StagingRegion* staged)
 {
-    // create image from file
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    
-
-    if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
-    }
+    int texWidth = static_cast<int>(image.width);
+    int texHeight = static_cast<int>(image.height);
 
-    //uint32_t mipLevel = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
-    uint32_t mipLevel = 1;
+    uint32_t mipLevel = samplerSettings.mipmaps ? static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1 : 1;
     VkDeviceSize imageSize = texWidth * texHeight * 4;
 
-    // create staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    device.createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    // transfer to device and copy from staging
-    void* data;
-    vkMapMemory(device.device(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device.device(), stagingBufferMemory);
-
-    //// free local memory
-    stbi_image_free(pixels);
-
+    // the host writes level 0 itself when it can, the mip chain is still made on the GPU.
+    // staged pixels are already in write combined memory, reading them back on the host would be slow
+    UploadContext& uploadContext = device.getUploadContext();
+    VkImageLayout hostLayout = mipLevel == 1 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    bool hostCopy = !staged && uploadContext.canUploadOnHost(VK_FORMAT_R8G8B8A8_SRGB, hostLayout);
 
     createImage(
         texWidth,
         texHeight, 
         VK_FORMAT_R8G8B8A8_SRGB, 
         VK_IMAGE_TILING_OPTIMAL, 
-        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (hostCopy ? VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT : 0),
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
         textureImage, 
         textureImageMemory,
         mipLevel);
 
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevel);
-    
-    device.copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1, mipLevel-1);
-    
-    if (mipLevel > 1) {
-        generateMipChain(textureImage, mipLevel, texWidth, texHeight);
+    if (hostCopy) {
+        VkDeviceSize levelOffset = 0;
+        uploadContext.uploadImageOnHost(textureImage, image.getPixels(), imageSize, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevel, &levelOffset, 1, hostLayout);
+        return mipLevel;
+    }
+
+    // the pixels are copied in the upload ring, so local memory can be freed right away
+    if (staged) {
+        VkDeviceSize levelOffset = 0;
+        uploadContext.copyToImage(textureImage, *staged, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevel, &levelOffset, 1);
+    }
+    else {
+        uploadContext.uploadImage(textureImage, image.getPixels(), imageSize, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevel);
     }
-    else
-    {
-        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
-    }    
 
-    vkDestroyBuffer(device.device(), stagingBuffer, nullptr);
-    vkFreeMemory(device.device(), stagingBufferMemory, nullptr);
+    // with mips the levels are left in TRANSFER_DST_OPTIMAL for generateMipChain
+    if (mipLevel == 1) {
+        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
+    }
 
     return mipLevel;
 
 }
 
+uint32_t Texture::createTranscodedImage(const ImageData& image, const UploadContext::StagingRegion* staged)
+{
+    format = image.format;
+    uint32_t mipLevel = samplerSettings.mipmaps ? static_cast<uint32_t>(image.levelOffsets.size()) : 1;
+    VkDeviceSize size = mipLevel < image.levelOffsets.size() ? image.levelOffsets[mipLevel] : image.levelData.size();
+
+    UploadContext& uploadContext = device.getUploadContext();
+    bool hostCopy = !staged && uploadContext.canUploadOnHost(format, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    // the levels are copied as they are in the file, no blit or compute pass touches them
+    createImage(
+        image.width,
+        image.height,
+        format,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (hostCopy ? VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT : 0),
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        textureImage,
+        textureImageMemory,
+        mipLevel);
+
+    if (hostCopy) {
+        uploadContext.uploadImageOnHost(textureImage, image.levelData.data(), size, image.width, image.height, mipLevel, image.levelOffsets.data(), mipLevel,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return mipLevel;
+    }
+
+    if (staged) {
+        uploadContext.copyToImage(textureImage, *staged, image.width, image.height, mipLevel, image.levelOffsets.data(), mipLevel);
+    }
+    else {
+        uploadContext.uploadImageLevels(textureImage, image.levelData.data(), size, image.width, image.height, mipLevel, image.levelOffsets.data());
+    }
+
+    transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
+    return mipLevel;
+}
+
 
-void Texture::bind(VkImage& image, VkMemoryPropertyFlags properties, VkDeviceMemory& imageMemory)
+void Texture::bind(VkImage& image, VkMemoryPropertyFlags properties, MemoryAllocation& imageMemory)
 {
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device.device(), image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device.findMemoryType(memRequirements.memoryTypeBits, properties);
+    imageMemory = device.getAllocator().allocate(memRequirements, properties, false);
 
-    if (vkAllocateMemory(device.device(), &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
+    if (vkBindImageMemory(device.device(), image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind image memory!");
     }
-
-    vkBindImageMemory(device.device(), image, imageMemory, 0);
 }
 
 void Texture::createTextureSampler(uint32_t mipLevel)
@@ -150,12 +635,12 @@ void Texture::createTextureSampler(uint32_t mipLevel)
 
     VkSamplerCreateInfo samplerInfo{};
     samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
+    samplerInfo.magFilter = samplerSettings.filter;
+    samplerInfo.minFilter = samplerSettings.filter;
+    samplerInfo.addressModeU = samplerSettings.addressMode;
+    samplerInfo.addressModeV = samplerSettings.addressMode;
+    samplerInfo.addressModeW = samplerSettings.addressMode;
+    samplerInfo.anisotropyEnable = samplerSettings.anisotropy ? VK_TRUE : VK_FALSE;
     samplerInfo.maxAnisotropy = device.properties.limits.maxSamplerAnisotropy;
     samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
     samplerInfo.unnormalizedCoordinates = VK_FALSE;
@@ -179,7 +664,7 @@ void Texture::createTextureSampler(uint32_t mipLevel)
 void Texture::createImage(uint32_t width, uint32_t height,
     VkFormat format, VkImageTiling tiling, 
     VkImageUsageFlags usage, VkMemoryPropertyFlags properties, 
-    VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels) 
+    VkImage& image, MemoryAllocation& imageMemory, uint32_t mipLevels) 
 {
 
     std::cout << "create image -- width = " << width << " height = " << height << "\n";
@@ -208,6 +693,9 @@ void Texture::createImage(uint32_t width, uint32_t height,
         throw std::runtime_error("failed to create image!");
     }
 
+    extent = { width, height };
+    this->mipLevels = mipLevels;
+
     std::cout << imageInfo.extent.width << " " << imageInfo.extent.height << " " << imageInfo.extent.depth << "\n";
 
     bind(image, properties, imageMemory);
@@ -215,178 +703,14 @@ void Texture::createImage(uint32_t width, uint32_t height,
 
 void Texture::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevel)
 {
+    // recorded in the current upload batch, it is submitted with the copies
+    device.getUploadContext().transitionImageLayout(image, oldLayout, newLayout, 0, mipLevel);
+}
 
-    std::cout << "miplevel = " << mipLevel << "\n";
-    VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = mipLevel;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) 
-    {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }
-    else {
-        throw std::invalid_argument("unsupported layout transition!");
-    }
-
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        sourceStage, destinationStage,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
-
-    device.endSingleTimeCommands(commandBuffer);
-}
-
-void Texture::generateMipChain(VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height)
-{
-
-    // Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-    VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
-
-    int32_t mipWidth = width;
-    int32_t mipHeight = height;
-
-
-    for (uint32_t i = 1; i < mipLevels; i++) 
-    {
-       
-
-        VkImageSubresourceRange mipSubRange = {};
-        mipSubRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        mipSubRange.baseMipLevel = i - 1;
-        mipSubRange.levelCount = 1;
-        mipSubRange.layerCount = 1;
-        mipSubRange.baseArrayLayer = 0;
-        
-
-        {
-            VkImageMemoryBarrier imageMemoryBarrier{};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.image = image;
-            imageMemoryBarrier.subresourceRange = mipSubRange;
-
-            vkCmdPipelineBarrier(
-                commandBuffer, 
-                VK_PIPELINE_STAGE_TRANSFER_BIT, 
-                VK_PIPELINE_STAGE_TRANSFER_BIT, 
-                0, 
-                0, nullptr, 
-                0, nullptr, 
-                1, &imageMemoryBarrier
-            );
-        }
-
-        VkImageBlit imageBlit{};
-
-        imageBlit.srcOffsets[0] = { 0, 0, 0 };
-        imageBlit.srcOffsets[1] = { int32_t(width >> (i - 1)), int32_t(height >> (i - 1)), 1 };
-
-        imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageBlit.srcSubresource.layerCount = 1;
-        imageBlit.srcSubresource.mipLevel = i - 1;
-        imageBlit.srcSubresource.baseArrayLayer = 0;
-
-        imageBlit.dstOffsets[0] = { 0, 0, 0 };
-        imageBlit.dstOffsets[1] = { int32_t(width >> i), int32_t(height >> i), 1 };
-
-        imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageBlit.dstSubresource.layerCount = 1;
-        imageBlit.dstSubresource.mipLevel = i;
-        imageBlit.dstSubresource.baseArrayLayer = 0;
-
-        vkCmdBlitImage(
-            commandBuffer, 
-            image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
-            image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-            1, &imageBlit, 
-            VK_FILTER_LINEAR
-        );
-
-        {
-            VkImageMemoryBarrier imageMemoryBarrier{};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            imageMemoryBarrier.image = image;
-            imageMemoryBarrier.subresourceRange = mipSubRange;
-
-            vkCmdPipelineBarrier(
-                commandBuffer,
-                VK_PIPELINE_STAGE_TRANSFER_BIT, 
-                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 
-                0, 
-                0, nullptr, 
-                0, nullptr, 
-                1, &imageMemoryBarrier
-            );
-        }
-    }
-
-    VkImageSubresourceRange subresourceRange = {};
-    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    subresourceRange.layerCount = 1;
-    subresourceRange.baseMipLevel = mipLevels - 1;
-    subresourceRange.baseArrayLayer = 0;
-    subresourceRange.levelCount = 1;
-
-    {
-        VkImageMemoryBarrier imageMemoryBarrier{};
-        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        imageMemoryBarrier.image = image;
-        imageMemoryBarrier.subresourceRange = subresourceRange;
-
-        vkCmdPipelineBarrier(
-            commandBuffer, 
-            VK_PIPELINE_STAGE_TRANSFER_BIT, 
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 
-            0, 
-            0, nullptr, 
-            0, nullptr, 
-            1, &imageMemoryBarrier
-        );
-    }
-
-    device.endSingleTimeCommands(commandBuffer);
+void Texture::generateMipChain(uint32_t mipLevels, uint32_t width, uint32_t height)
+{
+    // glTF uses jpg and png, so the chain is made on the GPU
+    device.getMipGenerator().generate(textureImage, textureImageView, width, height, mipLevels);
 }
 
 VkDescriptorImageInfo Texture::getImageInfo()
@@ -396,7 +720,7 @@ VkDescriptorImageInfo Texture::getImageInfo()
 
 void Texture::createTextureImageView(uint32_t mipLevel)
 {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, mipLevel);
+    textureImageView = createImageView(textureImage, format, mipLevel);
 }
 
 
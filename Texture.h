@@ -5,14 +5,95 @@
 #include <vulkan/vulkan.h>
 #include <iostream>
 #include <string>
+#include <vector>
 
 
 
 class Texture
 {
 public:
-
-	Texture(Device& device, const char* filePathTexture);
+	struct SamplerSettings {
+		VkFilter filter = VK_FILTER_LINEAR;
+		VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		bool anisotropy = true;
+
+		// full mip chain, made by the MipGenerator of the device
+		bool mipmaps = true;
+
+		bool operator==(const SamplerSettings& other) const {
+			return filter == other.filter && addressMode == other.addressMode && anisotropy == other.anisotropy && mipmaps == other.mipmaps;
+		}
+	};
+
+	// block formats a .basis or .ktx2 file can be transcoded to, the first one supported is used:
+	// bc7, astc 4x4, bc1 / bc3, etc2, rgba8 when the device has none of them
+	struct TranscodeTargets {
+		bool bc7 = false;
+		bool astc = false;
+		bool bc1bc3 = false;
+		bool etc2 = false;
+	};
+
+	// queried on the main thread, the decode itself does not use the device
+	static TranscodeTargets getTranscodeTargets(Device& device);
+
+	// pixels decoded from an image file, decoding does not use the device so it can run on any thread.
+	// jpg / png are decoded to rgba8 by stb, .basis / .ktx2 are transcoded with every level of the file
+	struct ImageData {
+		ImageData() = default;
+		~ImageData();
+
+		ImageData(ImageData&& other) noexcept;
+		ImageData& operator=(ImageData&& other) noexcept;
+
+		// rgba8 level 0, decoded by stb or transcoded
+		const unsigned char* getPixels() const { return pixels ? pixels : levelData.data(); }
+
+		unsigned char* pixels = nullptr;
+		uint32_t width = 0;
+		uint32_t height = 0;
+
+		// size of the file, level 0 is smaller when it was loaded with a maxSize
+		uint32_t sourceWidth = 0;
+		uint32_t sourceHeight = 0;
+
+		// transcoded files: the levels one after the other, levelOffsets[i] is where level i starts
+		VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+		std::vector<unsigned char> levelData;
+		std::vector<VkDeviceSize> levelOffsets;
+	};
+
+	// maxSize skips the levels of the file whose largest side is above it, stb images are box filtered down to it
+	static ImageData loadImageData(const char* filePathTexture, const TranscodeTargets& targets = TranscodeTargets{}, uint32_t maxSize = UINT32_MAX);
+
+	// loadImageData in two steps, so the decoded levels can go to memory the caller gives, a mapped staging
+	// buffer for instance. readImage reads the file and only the header, decodeImage writes size bytes
+	struct EncodedImage {
+		std::vector<uint8_t> file;
+
+		// what decodeImage writes: size, format and levelOffsets, without pixels
+		ImageData layout;
+		VkDeviceSize size = 0;
+
+		// level of the file written first, and for .basis / .ktx2 the basist::transcoder_texture_format
+		uint32_t firstLevel = 0;
+		bool ktx2 = false;
+		bool basis = false;
+		int transcoderFormat = 0;
+	};
+	static EncodedImage readImage(const char* filePathTexture, const TranscodeTargets& targets = TranscodeTargets{}, uint32_t maxSize = UINT32_MAX);
+	static void decodeImage(const EncodedImage& image, unsigned char* destination);
+
+	Texture(Device& device, const char* filePathTexture) : Texture(device, filePathTexture, SamplerSettings{}) {}
+	Texture(Device& device, const char* filePathTexture, const SamplerSettings& samplerSettings);
+	Texture(Device& device, const ImageData& image, const SamplerSettings& samplerSettings);
+
+	// image decoded in place in the staging region, the copy is recorded in the current upload batch
+	Texture(Device& device, const EncodedImage& image, const UploadContext::StagingRegion& staging, const SamplerSettings& samplerSettings);
+
+	// source without its firstMip finest levels, copied on the GPU in the current upload batch.
+	// source has to stay alive until that batch is complete
+	Texture(Device& device, const Texture& source, uint32_t firstMip);
 	Texture(Device& device, unsigned char* rgbaPixels, const uint32_t fontWidth, const uint32_t fontHeight, VkDeviceSize imageSize = 0, uint32_t mipLevel = 1);
 	//Texture(Device& device, unsigned char* rgbaPixels, const uint32_t fontWidth, const uint32_t fontHeight, VkDeviceSize imageSize = 0, uint32_t mipLevel = 1);
 	
@@ -20,41 +101,55 @@ public:
 	~Texture() {
 		vkDestroySampler(device.device(), textureSampler, nullptr);
 		vkDestroyImageView(device.device(), textureImageView, nullptr);
-		vkDestroyImage(device.device(), textureImage, nullptr);
-		vkFreeMemory(device.device(), textureImageMemory, nullptr);
+		device.destroyImage(textureImage, textureImageMemory);
 	}
 
 	VkDescriptorImageInfo getImageInfo();
 
 	VkImageView getImageView() const { return textureImageView; }
 	VkSampler getSampler() const { return textureSampler; }
+
+	// device memory of the image, mip levels included
+	VkDeviceSize getMemorySize() const { return textureImageMemory.size; }
+
+	uint32_t getWidth() const { return extent.width; }
+	uint32_t getHeight() const { return extent.height; }
+	uint32_t getMipLevels() const { return mipLevels; }
 	
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayou, uint32_t mipLevel = 1);
 
-	void generateMipChain(VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height);
+	// level 0 uploaded and the image view created, every level ends in SHADER_READ_ONLY_OPTIMAL
+	void generateMipChain(uint32_t mipLevels, uint32_t width, uint32_t height);
 
 private:
 
-	uint32_t createTextureImage(const char* path);
+	// staged is the region the levels are already in, without it they are staged from the image
+	void create(const ImageData& image, const UploadContext::StagingRegion* staged);
+	uint32_t createTextureImage(const ImageData& image, const UploadContext::StagingRegion* staged);
+	uint32_t createTranscodedImage(const ImageData& image, const UploadContext::StagingRegion* staged);
 	void createTextureImage(unsigned char* rgbaPixels, const uint32_t fontWidth, const uint32_t fontHeight, VkDeviceSize imSize = 0, uint32_t mipLevel = 1);
 
 	void createTextureImageView(uint32_t mipLevel = 1);
 	void createTextureSampler(uint32_t mipLevel = 1);
 
-	void bind(VkImage& image, VkMemoryPropertyFlags properties, VkDeviceMemory& imageMemory);
+	void bind(VkImage& image, VkMemoryPropertyFlags properties, MemoryAllocation& imageMemory);
 	
 	VkImageView createImageView(VkImage image, VkFormat format, uint32_t mipLevel = 1);
 	
 	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, 
-		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels = 1);
+		VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, uint32_t mipLevels = 1);
 	
 	Device& device;
 
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	MemoryAllocation textureImageMemory{};
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+	VkExtent2D extent{};
+	uint32_t mipLevels = 1;
 
 	VkImageView textureImageView;
 	VkSampler textureSampler;	
+	SamplerSettings samplerSettings{};
 
 };
 
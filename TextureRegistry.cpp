@@ -0,0 +1,443 @@
+#include "TextureRegistry.h"
+
+// std
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+TextureRegistry::TextureRegistry(Device& device, AssetLoader& assetLoader, VkDeviceSize budget, uint32_t evictionDelay) : device{ device }, assetLoader{ assetLoader }, budget{ budget }
+{
+	setEvictionDelay(evictionDelay);
+	transcodeTargets = Texture::getTranscodeTargets(device);
+
+	setLayout = DescriptorSetLayout::Builder(device)
+		.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.build();
+
+	// the sets are freed one at a time with their entry, a resized texture gets a new set while
+	// the frames in flight still use the old one
+	descriptorPool = DescriptorPool::Builder(device)
+		.setMaxSets(2 * MAX_TEXTURES)
+		.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * MAX_TEXTURES)
+		.setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)
+		.build();
+}
+
+TextureRegistry::~TextureRegistry()
+{
+	// a handle still held somewhere only keeps an empty entry, the sets go with the pool
+	for (auto& kv : entries) {
+		kv.second->texture.reset();
+		kv.second->descriptorSet = VK_NULL_HANDLE;
+	}
+	retired.clear();
+}
+
+std::string TextureRegistry::makeKey(const std::string& filePath, const Texture::SamplerSettings& samplerSettings)
+{
+	std::string key = std::filesystem::path(filePath).lexically_normal().generic_string();
+	key += '#';
+	key += std::to_string(static_cast<int>(samplerSettings.filter));
+	key += ',';
+	key += std::to_string(static_cast<int>(samplerSettings.addressMode));
+	key += samplerSettings.anisotropy ? ",a" : "";
+	key += samplerSettings.mipmaps ? ",m" : "";
+	return key;
+}
+
+TextureRegistry::Handle TextureRegistry::createEntry(const std::string& filePath, const Texture::SamplerSettings& samplerSettings)
+{
+	if (entries.size() >= MAX_TEXTURES) {
+		throw std::runtime_error("failed to load texture " + filePath + ": more than " + std::to_string(MAX_TEXTURES) + " textures");
+	}
+
+	auto entry = std::make_shared<Entry>();
+	entry->path = filePath;
+	entry->samplerSettings = samplerSettings;
+	entry->lastUsedFrame = frame;
+	// without mipmaps there is no smaller level to start with
+	entry->streamed = streaming && samplerSettings.mipmaps;
+
+	entries.emplace(makeKey(filePath, samplerSettings), entry);
+	return entry;
+}
+
+TextureRegistry::Handle TextureRegistry::load(const std::string& filePath, const Texture::SamplerSettings& samplerSettings)
+{
+	auto it = entries.find(makeKey(filePath, samplerSettings));
+	if (it != entries.end()) return it->second;
+
+	Handle entry = createEntry(filePath, samplerSettings);
+	makeResident(entry);
+	return entry;
+}
+
+std::vector<TextureRegistry::Handle> TextureRegistry::loadBatch(const std::vector<std::string>& filePaths, const Texture::SamplerSettings& samplerSettings)
+{
+	std::vector<Handle> handles;
+	std::vector<Handle> created;
+
+	for (const auto& filePath : filePaths) {
+		auto it = entries.find(makeKey(filePath, samplerSettings));
+		if (it != entries.end()) {
+			handles.push_back(it->second);
+			continue;
+		}
+
+		handles.push_back(createEntry(filePath, samplerSettings));
+		created.push_back(handles.back());
+	}
+
+	// the headers first, the staging region is sized from all of them
+	std::vector<Texture::EncodedImage> images(created.size());
+	std::vector<std::exception_ptr> errors(created.size());
+
+	assetLoader.parallelFor(created.size(), [&](size_t i) {
+		try {
+			images[i] = Texture::readImage(created[i]->path.c_str(), transcodeTargets, residentMaxSize(*created[i]));
+		}
+		catch (...) {
+			errors[i] = std::current_exception();
+		}
+	});
+
+	UploadContext& uploadContext = device.getUploadContext();
+	VkDeviceSize alignment = uploadContext.getCopyAlignment();
+
+	std::vector<VkDeviceSize> offsets(created.size());
+	VkDeviceSize stagingSize = 0;
+	for (size_t i = 0; i < created.size(); i++) {
+		if (errors[i]) continue;
+
+		offsets[i] = (stagingSize + alignment - 1) / alignment * alignment;
+		stagingSize = offsets[i] + images[i].size;
+	}
+
+	// the workers write the pixels in the mapped memory, nothing is staged meanwhile
+	UploadContext::StagingRegion staging{};
+	if (stagingSize > 0) staging = uploadContext.reserveStaging(stagingSize);
+
+	assetLoader.parallelFor(created.size(), [&](size_t i) {
+		if (errors[i]) return;
+
+		try {
+			Texture::decodeImage(images[i], staging.mapped + offsets[i]);
+		}
+		catch (...) {
+			errors[i] = std::current_exception();
+		}
+	});
+
+	for (size_t i = 0; i < created.size(); i++) {
+		Entry& entry = *created[i];
+
+		if (errors[i]) {
+			try {
+				std::rethrow_exception(errors[i]);
+			}
+			catch (const std::exception& e) {
+				std::cerr << "failed to load texture " << entry.path << ": " << e.what() << "\n";
+			}
+			continue;
+		}
+
+		auto texture = std::make_shared<Texture>(device, images[i], staging.subregion(offsets[i], images[i].size), entry.samplerSettings);
+		setTexture(entry, std::move(texture), images[i].layout);
+	}
+
+	// a single submission for the whole batch
+	uploadContext.flush();
+	return handles;
+}
+
+uint32_t TextureRegistry::residentMaxSize(const Entry& entry)
+{
+	// streamed textures start with the tail, or with the levels the draws wanted before the eviction
+	return entry.streamed ? std::max(STREAM_TAIL_SIZE, entry.wantedSize) : UINT32_MAX;
+}
+
+void TextureRegistry::makeResident(const Handle& handle)
+{
+	// an entry freed while its file is decoded is not created
+	std::weak_ptr<Entry> weakEntry = handle;
+
+	handle->pending = assetLoader.load<Texture>(
+		[path = handle->path, targets = transcodeTargets, maxSize = residentMaxSize(*handle)]() { return Texture::loadImageData(path.c_str(), targets, maxSize); },
+		[this, weakEntry](const Texture::ImageData& image) -> std::shared_ptr<Texture> {
+			Handle handle = weakEntry.lock();
+			if (!handle) return nullptr;
+
+			Entry& entry = *handle;
+			setTexture(entry, std::make_shared<Texture>(device, image, entry.samplerSettings), image);
+			entry.pending = {};
+			return entry.texture;
+		});
+}
+
+void TextureRegistry::setTexture(Entry& entry, std::shared_ptr<Texture> texture, const Texture::ImageData& image)
+{
+	entry.texture = std::move(texture);
+	entry.memorySize = entry.texture->getMemorySize();
+	entry.uploadBatch = device.getUploadContext().getBatchId();
+	entry.uploadPending = true;
+	entry.sourceSize = std::max(image.sourceWidth, image.sourceHeight);
+	entry.residentSize = std::max(entry.texture->getWidth(), entry.texture->getHeight());
+	loadCount++;
+
+	auto imageInfo = entry.texture->getImageInfo();
+	DescriptorWriter writer{ *setLayout, *descriptorPool };
+	writer.writeImage(0, &imageInfo);
+
+	if (entry.descriptorSet == VK_NULL_HANDLE) {
+		if (!writer.build(entry.descriptorSet)) {
+			throw std::runtime_error("failed to allocate texture descriptor set!");
+		}
+		return;
+	}
+
+	// evicted textures are not used by any frame in flight, the set can be written in place
+	writer.overwrite(entry.descriptorSet);
+}
+
+void TextureRegistry::evict(Entry& entry)
+{
+	entry.texture.reset();
+	entry.residentSize = 0;
+	evictionCount++;
+}
+
+uint32_t TextureRegistry::levelSizeFor(const Entry& entry)
+{
+	if (!entry.streamed) return entry.sourceSize;
+
+	// the smallest level still covering the screen size, the levels of the file halve the source size
+	uint32_t size = entry.sourceSize;
+	while (size > STREAM_TAIL_SIZE && static_cast<float>(size >> 1) >= entry.demandSize) size >>= 1;
+	return size;
+}
+
+void TextureRegistry::streamLevels(const Handle& handle, uint32_t size)
+{
+	std::weak_ptr<Entry> weakEntry = handle;
+	handle->resizedSize = size;
+
+	// the file is decoded again from the wanted level down, the resident texture is drawn meanwhile
+	handle->resized = assetLoader.load<Texture>(
+		[path = handle->path, targets = transcodeTargets, size]() { return Texture::loadImageData(path.c_str(), targets, size); },
+		[this, weakEntry, size](const Texture::ImageData& image) -> std::shared_ptr<Texture> {
+			Handle handle = weakEntry.lock();
+			if (!handle || handle->resizedSize != size) return nullptr;
+
+			auto texture = std::make_shared<Texture>(device, image, handle->samplerSettings);
+			streamedBytes += texture->getMemorySize();
+			return texture;
+		});
+}
+
+VkDeviceSize TextureRegistry::dropLevels(Entry& entry, uint32_t size)
+{
+	uint32_t firstMip = 0;
+	while ((entry.residentSize >> (firstMip + 1)) >= size && firstMip + 1 < entry.texture->getMipLevels()) firstMip++;
+	if (firstMip == 0) return 0;
+
+	// the coarser levels are copied from the resident texture in the current upload batch
+	UploadContext& uploadContext = device.getUploadContext();
+	uint64_t uploadBatch = uploadContext.getBatchId();
+	auto texture = std::make_shared<Texture>(device, *entry.texture, firstMip);
+
+	entry.resized = AssetFuture<Texture>::loaded(texture, uploadContext, uploadBatch);
+	entry.resizedSize = entry.residentSize >> firstMip;
+	droppedLevelCount += firstMip;
+	return entry.memorySize - texture->getMemorySize();
+}
+
+void TextureRegistry::swapResized(Entry& entry)
+{
+	if (entry.resized.isFailed()) {
+		entry.resized = {};
+		return;
+	}
+	if (!entry.resized.isReady()) return;
+
+	std::shared_ptr<Texture> texture = entry.resized.get();
+	uint64_t uploadBatch = entry.resized.getUploadBatch();
+
+	auto imageInfo = texture->getImageInfo();
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	DescriptorWriter writer{ *setLayout, *descriptorPool };
+	writer.writeImage(0, &imageInfo);
+	if (!writer.build(descriptorSet)) return;
+
+	entry.resized = {};
+
+	// the frames in flight still sample the old texture, a level drop still copies from it
+	retired.push_back({ std::move(entry.texture), entry.descriptorSet, frame, uploadBatch });
+
+	uint32_t size = std::max(texture->getWidth(), texture->getHeight());
+	for (uint32_t level = 0; (size >> level) > entry.residentSize; level++) streamedLevelCount++;
+
+	entry.texture = std::move(texture);
+	entry.descriptorSet = descriptorSet;
+	entry.memorySize = entry.texture->getMemorySize();
+	entry.residentSize = size;
+}
+
+void TextureRegistry::releaseRetired()
+{
+	UploadContext& uploadContext = device.getUploadContext();
+
+	for (size_t i = 0; i < retired.size();) {
+		Retired& old = retired[i];
+		if (frame - old.frame < Swap_chain::MAX_FRAMES_IN_FLIGHT || !uploadContext.isBatchComplete(old.uploadBatch)) {
+			i++;
+			continue;
+		}
+
+		if (old.descriptorSet != VK_NULL_HANDLE) {
+			std::vector<VkDescriptorSet> sets{ old.descriptorSet };
+			descriptorPool->freeDescriptors(sets);
+		}
+		retired[i] = std::move(retired.back());
+		retired.pop_back();
+	}
+}
+
+VkDescriptorSet TextureRegistry::use(const Handle& texture, float screenSize)
+{
+	Entry& entry = *texture;
+	entry.demandSize = std::max(entry.demandSize, screenSize);
+
+	if (!entry.isResident()) {
+		if (!entry.isLoading() && !entry.isFailed()) makeResident(texture);
+		return VK_NULL_HANDLE;
+	}
+
+	if (entry.uploadPending) {
+		if (!device.getUploadContext().isBatchReady(entry.uploadBatch)) return VK_NULL_HANDLE;
+		entry.uploadPending = false;
+	}
+
+	entry.lastUsedFrame = frame;
+	return entry.descriptorSet;
+}
+
+void TextureRegistry::beginFrame()
+{
+	frame++;
+	releaseRetired();
+
+	UploadContext& uploadContext = device.getUploadContext();
+	std::vector<Entry*> candidates;
+	std::vector<Entry*> unneededLevels;
+	std::vector<Handle> missingLevels;
+	VkDeviceSize residentBytes = 0;
+
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		Entry& entry = *it->second;
+
+		// a texture uploaded but not drawn yet: the frames in flight after the upload are the ones that can still be copying
+		if (entry.uploadPending && uploadContext.isBatchReady(entry.uploadBatch)) {
+			entry.uploadPending = false;
+			entry.lastUsedFrame = frame;
+		}
+
+		// the draws of the last frame asked for this size, the next ones start from zero
+		if (entry.isResident()) swapResized(entry);
+		entry.wantedSize = levelSizeFor(entry);
+		entry.demandSize = 0.f;
+
+		uint64_t idleFrames = entry.uploadPending ? 0 : frame - entry.lastUsedFrame;
+
+		// the registry holds the last handle, a resized texture being created has to be swapped in first
+		if (it->second.use_count() == 1 && idleFrames >= Swap_chain::MAX_FRAMES_IN_FLIGHT && !entry.resized.valid()) {
+			if (entry.descriptorSet != VK_NULL_HANDLE) {
+				std::vector<VkDescriptorSet> sets{ entry.descriptorSet };
+				descriptorPool->freeDescriptors(sets);
+			}
+			it = entries.erase(it);
+			continue;
+		}
+
+		if (entry.isResident()) {
+			residentBytes += entry.memorySize;
+
+			if (!entry.resized.valid() && !entry.uploadPending) {
+				if (entry.residentSize < entry.wantedSize) missingLevels.push_back(it->second);
+				else if (entry.residentSize > entry.wantedSize && entry.texture->getMipLevels() > 1) unneededLevels.push_back(&entry);
+			}
+			if (idleFrames >= evictionDelay && !entry.resized.valid()) candidates.push_back(&entry);
+		}
+		++it;
+	}
+
+	// the textures missing the most levels first, until the upload budget of the frame is spent
+	std::sort(missingLevels.begin(), missingLevels.end(), [](const Handle& a, const Handle& b) {
+		return static_cast<float>(a->wantedSize) / a->residentSize > static_cast<float>(b->wantedSize) / b->residentSize;
+	});
+
+	VkDeviceSize streamBytes = 0;
+	for (const Handle& handle : missingLevels) {
+		float scale = static_cast<float>(handle->wantedSize) / handle->residentSize;
+		VkDeviceSize bytes = static_cast<VkDeviceSize>(handle->memorySize * scale * scale);
+		if (streamBytes > 0 && streamBytes + bytes > streamUploadBudget) break;
+
+		streamBytes += bytes;
+		streamLevels(handle, handle->wantedSize);
+	}
+
+	if (residentBytes <= budget) return;
+
+	// levels no draw asks for go first, the memory comes back once the copy replaced the texture
+	for (Entry* entry : unneededLevels) {
+		if (residentBytes <= budget) break;
+
+		residentBytes -= dropLevels(*entry, entry->wantedSize);
+	}
+
+	// least recently used first
+	std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) { return a->lastUsedFrame < b->lastUsedFrame; });
+
+	for (Entry* entry : candidates) {
+		if (residentBytes <= budget) break;
+		if (entry->resized.valid()) continue;
+
+		residentBytes -= entry->memorySize;
+		evict(*entry);
+	}
+}
+
+void TextureRegistry::setEvictionDelay(uint32_t frames)
+{
+	evictionDelay = std::max(frames, static_cast<uint32_t>(Swap_chain::MAX_FRAMES_IN_FLIGHT));
+}
+
+TextureRegistry::Stats TextureRegistry::getStats() const
+{
+	Stats stats{};
+	stats.loadCount = loadCount;
+	stats.evictionCount = evictionCount;
+	stats.streamedLevelCount = streamedLevelCount;
+	stats.droppedLevelCount = droppedLevelCount;
+	stats.streamedBytes = streamedBytes;
+
+	for (const auto& kv : entries) {
+		const Entry& entry = *kv.second;
+		if (entry.isResident()) {
+			stats.residentCount++;
+			stats.residentBytes += entry.memorySize;
+			if (entry.resized.valid() && entry.resizedSize > entry.residentSize) stats.streamingCount++;
+		}
+		else if (entry.isLoading()) {
+			stats.loadingCount++;
+		}
+		else {
+			stats.evictedCount++;
+			stats.evictedBytes += entry.memorySize;
+		}
+	}
+	return stats;
+}
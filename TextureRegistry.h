@@ -0,0 +1,203 @@
+#pragma once
+
+#include "AssetLoader.h"
+#include "Device.h"
+#include "Texture.h"
+#include "descriptors.h"
+#include "Swap_chain.h"
+
+#include <vulkan/vulkan.h>
+
+// std lib headers
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+	textures loaded from files, keyed by path and sampler settings, each with the descriptor set the
+	fragment shader samples it through. a handle keeps the entry alive, the texture itself can be
+	evicted: when the resident textures go over the budget the least recently used ones that were not
+	drawn for evictionDelay frames are destroyed, and the next use loads the file again.
+	an entry without handles is freed once the frames in flight are done with it
+
+	files are decoded on the workers of the AssetLoader, the texture is created and uploaded when the
+	decode is done. a texture that failed to load stays empty and is not tried again.
+	.basis and .ktx2 files are transcoded there too, to the block format the device supports
+
+	with streaming, a texture with mipmaps first loads the levels up to STREAM_TAIL_SIZE texels.
+	every draw tells use() how many pixels the texture covers on screen, the finer levels the
+	draws of the last frame asked for are loaded again from the file and swapped in once uploaded,
+	within a per frame upload budget. over the budget, the levels finer than what the draws asked
+	for are dropped first, with a copy of the coarser ones on the GPU, before whole textures are
+	evicted
+
+*/
+class TextureRegistry
+{
+public:
+	static constexpr VkDeviceSize DEFAULT_BUDGET = 256ull * 1024 * 1024;
+	static constexpr uint32_t DEFAULT_EVICTION_DELAY = 120;
+	static constexpr uint32_t MAX_TEXTURES = 256;
+
+	// largest side of the first levels loaded for a streamed texture
+	static constexpr uint32_t STREAM_TAIL_SIZE = 64;
+	static constexpr VkDeviceSize DEFAULT_STREAM_UPLOAD_BUDGET = 16ull * 1024 * 1024;
+
+	class Entry {
+	public:
+		const std::string& getPath() const { return path; }
+		bool isResident() const { return texture != nullptr; }
+		bool isLoading() const { return pending.isLoading(); }
+		bool isFailed() const { return pending.isFailed(); }
+
+		// device memory while resident, the size it had before it was evicted otherwise
+		VkDeviceSize getMemorySize() const { return memorySize; }
+
+	private:
+		friend class TextureRegistry;
+
+		std::string path;
+		Texture::SamplerSettings samplerSettings{};
+
+		std::shared_ptr<Texture> texture;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkDeviceSize memorySize = 0;
+
+		uint64_t lastUsedFrame = 0;
+
+		// the texture can be sampled once this upload batch is on the graphics queue,
+		// it is not evicted before that since the copy may still be pending
+		uint64_t uploadBatch = 0;
+		bool uploadPending = false;
+
+		// set while the file is decoded, and after a failed load
+		AssetFuture<Texture> pending{};
+
+		bool streamed = false;
+
+		// streaming, in texels of the largest side: the file, level 0 of the resident texture, the
+		// largest screen size the draws of this frame asked for and the level they want
+		uint32_t sourceSize = 0;
+		uint32_t residentSize = 0;
+		float demandSize = 0.f;
+		uint32_t wantedSize = 0;
+
+		// the texture with more or less levels, it replaces the resident one once its upload is ready
+		AssetFuture<Texture> resized{};
+		uint32_t resizedSize = 0;
+	};
+
+	using Handle = std::shared_ptr<Entry>;
+
+	struct Stats {
+		uint32_t residentCount = 0;
+		uint32_t evictedCount = 0;
+		uint32_t loadingCount = 0;
+		VkDeviceSize residentBytes = 0;
+		VkDeviceSize evictedBytes = 0;
+
+		// files decoded and uploaded, reloads included, and textures evicted since the start
+		uint32_t loadCount = 0;
+		uint32_t evictionCount = 0;
+
+		// streamed textures waiting for finer levels, and the levels loaded and dropped since the start
+		uint32_t streamingCount = 0;
+		uint32_t streamedLevelCount = 0;
+		uint32_t droppedLevelCount = 0;
+		VkDeviceSize streamedBytes = 0;
+	};
+
+	TextureRegistry(Device& device, AssetLoader& assetLoader, VkDeviceSize budget = DEFAULT_BUDGET, uint32_t evictionDelay = DEFAULT_EVICTION_DELAY);
+	~TextureRegistry();
+
+	TextureRegistry(const TextureRegistry&) = delete;
+	TextureRegistry& operator=(const TextureRegistry&) = delete;
+
+	// the entry already loaded with the same path and sampler settings, or a new one starting to load
+	Handle load(const std::string& filePath, const Texture::SamplerSettings& samplerSettings = Texture::SamplerSettings{});
+
+	// load for many files at once, blocking: the headers then the pixels are decoded in parallel on the asset
+	// loader, each image straight into its part of one staging region, and every upload goes out in a single
+	// submission. files already loaded are shared, a file that fails is left to the asynchronous load of use()
+	std::vector<Handle> loadBatch(const std::vector<std::string>& filePaths, const Texture::SamplerSettings& samplerSettings = Texture::SamplerSettings{});
+
+	// descriptor set of the texture for a draw recorded this frame, an evicted texture is loaded again.
+	// VK_NULL_HANDLE while the texture is loading or its upload has not reached the graphics queue.
+	// screenSize is the number of pixels the largest side of the texture covers, it drives the streaming
+	VkDescriptorSet use(const Handle& texture, float screenSize = std::numeric_limits<float>::max());
+
+	// once per frame, after the fence of the frame: frees the entries without handles and evicts down to the budget
+	void beginFrame();
+
+	// the budget can be exceeded by the textures drawn in the last evictionDelay frames, they are never evicted
+	void setBudget(VkDeviceSize budget) { this->budget = budget; }
+	VkDeviceSize getBudget() const { return budget; }
+
+	// frames a texture has to stay unused before it can be evicted, at least the frames in flight
+	void setEvictionDelay(uint32_t frames);
+
+	// textures loaded afterwards are streamed, or loaded with all their levels
+	void setStreaming(bool enabled) { streaming = enabled; }
+	bool isStreaming() const { return streaming; }
+
+	// bytes of finer levels started per frame, estimated before the decode, at least one texture per frame
+	void setStreamUploadBudget(VkDeviceSize bytes) { streamUploadBudget = bytes; }
+
+	Stats getStats() const;
+
+	VkDescriptorSetLayout getDescriptorSetLayout() const { return setLayout->getDescriptorSetLayout(); }
+
+private:
+	static std::string makeKey(const std::string& filePath, const Texture::SamplerSettings& samplerSettings);
+
+	// what a texture replaced by a resized one used, freed once no frame or upload uses it anymore
+	struct Retired {
+		std::shared_ptr<Texture> texture;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		uint64_t frame = 0;
+		uint64_t uploadBatch = 0;
+	};
+
+	Handle createEntry(const std::string& filePath, const Texture::SamplerSettings& samplerSettings);
+	void makeResident(const Handle& handle);
+	// the texture was just created in the current upload batch
+	void setTexture(Entry& entry, std::shared_ptr<Texture> texture, const Texture::ImageData& image);
+	// largest side of the first texture loaded for the entry
+	static uint32_t residentMaxSize(const Entry& entry);
+	void evict(Entry& entry);
+
+	// size of the level of the file the demand of the last frame asks for, the tail at least
+	static uint32_t levelSizeFor(const Entry& entry);
+	void streamLevels(const Handle& handle, uint32_t size);
+	// returns the bytes the resident texture will give back
+	VkDeviceSize dropLevels(Entry& entry, uint32_t size);
+	void swapResized(Entry& entry);
+	void releaseRetired();
+
+	Device& device;
+	AssetLoader& assetLoader;
+	Texture::TranscodeTargets transcodeTargets{};
+
+	std::unique_ptr<DescriptorSetLayout> setLayout;
+	std::unique_ptr<DescriptorPool> descriptorPool;
+
+	std::unordered_map<std::string, Handle> entries;
+
+	VkDeviceSize budget;
+	uint32_t evictionDelay;
+	uint64_t frame = 0;
+
+	uint32_t loadCount = 0;
+	uint32_t evictionCount = 0;
+
+	bool streaming = true;
+	VkDeviceSize streamUploadBudget = DEFAULT_STREAM_UPLOAD_BUDGET;
+	std::vector<Retired> retired;
+	uint32_t streamedLevelCount = 0;
+	uint32_t droppedLevelCount = 0;
+	VkDeviceSize streamedBytes = 0;
+};
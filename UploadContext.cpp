@@ -0,0 +1,619 @@
+#include "UploadContext.h"
+
+#include "Device.h"
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+UploadContext::UploadContext(Device& device, VkDeviceSize ringSize) : device{ device }, ringSize{ ringSize }
+{
+	QueueFamilyIndices queueFamilyIndices = device.findPhysicalQueueFamilies();
+
+	dedicatedTransfer = device.hasDedicatedTransferQueue();
+	graphicsFamily = queueFamilyIndices.graphicsFamily;
+	transferFamily = dedicatedTransfer ? queueFamilyIndices.transferFamily : queueFamilyIndices.graphicsFamily;
+
+	device.createBuffer(
+		ringSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		ringBuffer,
+		ringMemory);
+
+	// 16 covers the texel size of every format we upload
+	copyAlignment = std::max<VkDeviceSize>(16, device.properties.limits.optimalBufferCopyOffsetAlignment);
+
+	hostImageCopy = device.hasHostImageCopy();
+}
+
+UploadContext::~UploadContext()
+{
+	waitIdle();
+
+	for (auto& batch : freeBatches) {
+		vkFreeCommandBuffers(device.device(), device.getTransferCommandPool(), 1, &batch.transferCommandBuffer);
+		vkDestroyFence(device.device(), batch.fence, nullptr);
+
+		if (dedicatedTransfer) {
+			vkFreeCommandBuffers(device.device(), device.getCommandPool(), 1, &batch.graphicsCommandBuffer);
+			vkDestroyFence(device.device(), batch.transferFence, nullptr);
+			vkDestroySemaphore(device.device(), batch.transferSemaphore, nullptr);
+		}
+	}
+
+	device.destroyBuffer(ringBuffer, ringMemory);
+}
+
+void UploadContext::beginBatch()
+{
+	if (isRecording) return;
+
+	if (!freeBatches.empty()) {
+		recording = std::move(freeBatches.back());
+		freeBatches.pop_back();
+	}
+	else {
+		recording = Batch{};
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = device.getTransferCommandPool();
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device.device(), &allocInfo, &recording.transferCommandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer!");
+		}
+
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device.device(), &fenceInfo, nullptr, &recording.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload fence!");
+		}
+
+		if (dedicatedTransfer) {
+			allocInfo.commandPool = device.getCommandPool();
+
+			if (vkAllocateCommandBuffers(device.device(), &allocInfo, &recording.graphicsCommandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate upload command buffer!");
+			}
+
+			VkSemaphoreCreateInfo semaphoreInfo{};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+			if (vkCreateFence(device.device(), &fenceInfo, nullptr, &recording.transferFence) != VK_SUCCESS ||
+				vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr, &recording.transferSemaphore) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create upload synchronization objects!");
+			}
+		}
+		else {
+			recording.graphicsCommandBuffer = recording.transferCommandBuffer;
+		}
+	}
+
+	recording.id = nextBatchId;
+	recording.acquireSubmitted = false;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(recording.transferCommandBuffer, &beginInfo) != VK_SUCCESS ||
+		(dedicatedTransfer && vkBeginCommandBuffer(recording.graphicsCommandBuffer, &beginInfo) != VK_SUCCESS)) {
+		throw std::runtime_error("failed to begin upload command buffer!");
+	}
+
+	isRecording = true;
+}
+
+void UploadContext::flush()
+{
+	retireBatches(false);
+
+	if (!isRecording) {
+		// the id of the host uploads is closed without a submission, it is ready once the batches before it are
+		if (hostUploads) {
+			Batch batch{};
+			batch.id = nextBatchId++;
+			batch.hostOnly = true;
+			pendingBatches.push_back(std::move(batch));
+
+			hostUploads = false;
+			retireBatches(false);
+		}
+		return;
+	}
+
+	if (!bufferBarriers.empty()) {
+		if (dedicatedTransfer) {
+			// release on the transfer queue, the acquire half makes the data visible on the graphics queue
+			std::vector<VkBufferMemoryBarrier> releaseBarriers = bufferBarriers;
+			for (auto& barrier : releaseBarriers) {
+				barrier.dstAccessMask = 0;
+			}
+			for (auto& barrier : bufferBarriers) {
+				barrier.srcAccessMask = 0;
+			}
+
+			vkCmdPipelineBarrier(
+				recording.transferCommandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				0,
+				0, nullptr,
+				static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(),
+				0, nullptr);
+
+			vkCmdPipelineBarrier(
+				recording.graphicsCommandBuffer,
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, bufferBarrierStages,
+				0,
+				0, nullptr,
+				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+				0, nullptr);
+		}
+		else {
+			vkCmdPipelineBarrier(
+				recording.transferCommandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, bufferBarrierStages,
+				0,
+				0, nullptr,
+				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+				0, nullptr);
+		}
+
+		bufferBarriers.clear();
+		bufferBarrierStages = 0;
+	}
+
+	if (vkEndCommandBuffer(recording.transferCommandBuffer) != VK_SUCCESS ||
+		(dedicatedTransfer && vkEndCommandBuffer(recording.graphicsCommandBuffer) != VK_SUCCESS)) {
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &recording.transferCommandBuffer;
+
+	if (dedicatedTransfer) {
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &recording.transferSemaphore;
+
+		if (vkQueueSubmit(device.transferQueue(), 1, &submitInfo, recording.transferFence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+	}
+	else {
+		if (vkQueueSubmit(device.graphicsQueue(), 1, &submitInfo, recording.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+
+		recording.acquireSubmitted = true;
+		readyBatchCount = recording.id + 1;
+	}
+
+	pendingBatches.push_back(std::move(recording));
+	recording = Batch{};
+	isRecording = false;
+	hostUploads = false;
+	nextBatchId++;
+	submitCount++;
+}
+
+void UploadContext::submitAcquire(Batch& batch)
+{
+	// the copies are already done, the semaphore only orders the acquire after the release for the validation layers
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &batch.transferSemaphore;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.graphicsCommandBuffer;
+
+	if (vkQueueSubmit(device.graphicsQueue(), 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit upload acquire command buffer!");
+	}
+
+	batch.acquireSubmitted = true;
+	readyBatchCount = batch.id + 1;
+}
+
+void UploadContext::waitIdle()
+{
+	flush();
+
+	while (!pendingBatches.empty()) {
+		retireBatches(true);
+	}
+}
+
+void UploadContext::retireBatches(bool waitForOldest)
+{
+	// batches complete in submission order on each queue, finished transfers are handed over in that order
+	for (auto& batch : pendingBatches) {
+		if (batch.acquireSubmitted) continue;
+
+		if (batch.hostOnly) {
+			batch.acquireSubmitted = true;
+			readyBatchCount = batch.id + 1;
+			continue;
+		}
+
+		if (waitForOldest && &batch == &pendingBatches.front()) {
+			vkWaitForFences(device.device(), 1, &batch.transferFence, VK_TRUE, UINT64_MAX);
+		}
+		else if (vkGetFenceStatus(device.device(), batch.transferFence) != VK_SUCCESS) {
+			break;
+		}
+
+		submitAcquire(batch);
+	}
+
+	while (!pendingBatches.empty()) {
+		Batch& batch = pendingBatches.front();
+
+		// every batch before it is complete, it has nothing to wait for nor to give back
+		if (batch.hostOnly) {
+			if (!batch.acquireSubmitted) break;
+
+			completedBatchCount = batch.id + 1;
+			pendingBatches.pop_front();
+			continue;
+		}
+
+		if (waitForOldest) {
+			vkWaitForFences(device.device(), 1, &batch.fence, VK_TRUE, UINT64_MAX);
+			waitForOldest = false;
+		}
+		else if (vkGetFenceStatus(device.device(), batch.fence) != VK_SUCCESS) {
+			break;
+		}
+
+		ringUsed -= batch.ringBytes;
+		batch.ringBytes = 0;
+
+		for (auto& staging : batch.dedicatedStaging) {
+			device.destroyBuffer(staging.first, staging.second);
+		}
+		batch.dedicatedStaging.clear();
+		batch.retained.clear();
+
+		vkResetFences(device.device(), 1, &batch.fence);
+		vkResetCommandBuffer(batch.transferCommandBuffer, 0);
+
+		if (dedicatedTransfer) {
+			vkResetFences(device.device(), 1, &batch.transferFence);
+			vkResetCommandBuffer(batch.graphicsCommandBuffer, 0);
+		}
+
+		completedBatchCount = batch.id + 1;
+		freeBatches.push_back(std::move(batch));
+		pendingBatches.pop_front();
+	}
+}
+
+bool UploadContext::reserve(VkDeviceSize size, VkDeviceSize& offset, VkDeviceSize& consumed)
+{
+	if (ringUsed == 0) ringHead = 0;
+
+	// an upload never wraps around, the end of the ring is skipped instead
+	VkDeviceSize start = alignUp(ringHead, copyAlignment);
+	if (start + size > ringSize) start = 0;
+
+	VkDeviceSize end = start + size;
+	consumed = start >= ringHead ? end - ringHead : (ringSize - ringHead) + end;
+
+	if (consumed > ringSize - ringUsed) return false;
+
+	ringHead = end;
+	ringUsed += consumed;
+	offset = start;
+	return true;
+}
+
+UploadContext::StagingRegion UploadContext::reserveStaging(VkDeviceSize size)
+{
+	bytesStaged += size;
+
+	if (size > ringSize) {
+		beginBatch();
+
+		std::pair<VkBuffer, MemoryAllocation> staging{};
+		device.createBuffer(
+			size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			staging.first,
+			staging.second);
+
+		recording.dedicatedStaging.push_back(staging);
+		return { staging.first, 0, size, static_cast<unsigned char*>(staging.second.mapped) };
+	}
+
+	VkDeviceSize offset = 0;
+	VkDeviceSize consumed = 0;
+
+	// ring is full: submit what is recorded and wait for the oldest batch to give its space back
+	while (!reserve(size, offset, consumed)) {
+		if (pendingBatches.empty()) flush();
+		retireBatches(true);
+	}
+
+	beginBatch();
+	recording.ringBytes += consumed;
+
+	return { ringBuffer, offset, size, static_cast<unsigned char*>(ringMemory.mapped) + offset };
+}
+
+void UploadContext::stage(const void* data, VkDeviceSize size, VkBuffer& srcBuffer, VkDeviceSize& srcOffset)
+{
+	StagingRegion staging = reserveStaging(size);
+	memcpy(staging.mapped, data, static_cast<size_t>(size));
+
+	srcBuffer = staging.buffer;
+	srcOffset = staging.offset;
+}
+
+void UploadContext::uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset)
+{
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset;
+	stage(data, size, srcBuffer, srcOffset);
+
+	recordBufferCopy(srcBuffer, srcOffset, dstBuffer, size, dstStage, dstAccess, dstOffset);
+}
+
+void UploadContext::copyBuffer(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset)
+{
+	beginBatch();
+	bytesCopiedUnstaged += size;
+
+	recordBufferCopy(srcBuffer, srcOffset, dstBuffer, size, dstStage, dstAccess, dstOffset);
+}
+
+void UploadContext::releaseWithBatch(std::shared_ptr<void> resource)
+{
+	beginBatch();
+	recording.retained.push_back(std::move(resource));
+}
+
+void UploadContext::recordBufferCopy(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset)
+{
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(recording.transferCommandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = dedicatedTransfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = dedicatedTransfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = dstBuffer;
+	barrier.offset = dstOffset;
+	barrier.size = size;
+
+	bufferBarriers.push_back(barrier);
+	bufferBarrierStages |= dstStage;
+}
+
+void UploadContext::uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t copyMipLevel)
+{
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset;
+	stage(data, size, srcBuffer, srcOffset);
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = srcOffset;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = copyMipLevel;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { std::max(1u, width >> copyMipLevel), std::max(1u, height >> copyMipLevel), 1 };
+
+	recordImageCopy(image, srcBuffer, &region, 1, mipLevels);
+}
+
+void UploadContext::uploadImageLevels(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels, const VkDeviceSize* levelOffsets)
+{
+	StagingRegion staging = reserveStaging(size);
+	memcpy(staging.mapped, data, static_cast<size_t>(size));
+
+	copyToImage(image, staging, width, height, mipLevels, levelOffsets, mipLevels);
+}
+
+void UploadContext::copyToImage(VkImage image, const StagingRegion& staging, uint32_t width, uint32_t height, uint32_t mipLevels, const VkDeviceSize* levelOffsets, uint32_t levelCount)
+{
+	std::vector<VkBufferImageCopy> regions(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkBufferImageCopy& region = regions[level];
+		region.bufferOffset = staging.offset + levelOffsets[level];
+
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { std::max(1u, width >> level), std::max(1u, height >> level), 1 };
+	}
+
+	recordImageCopy(image, staging.buffer, regions.data(), levelCount, mipLevels);
+}
+
+void UploadContext::recordImageCopy(VkImage image, VkBuffer srcBuffer, const VkBufferImageCopy* regions, uint32_t regionCount, uint32_t mipLevels)
+{
+	recordImageBarrier(recording.transferCommandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, mipLevels);
+
+	vkCmdCopyBufferToImage(
+		recording.transferCommandBuffer,
+		srcBuffer,
+		image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		regionCount,
+		regions);
+
+	if (!dedicatedTransfer) return;
+
+	// ownership goes to the graphics queue in TRANSFER_DST_OPTIMAL, the final transition and the mip chain are recorded there
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = transferFamily;
+	barrier.dstQueueFamilyIndex = graphicsFamily;
+	barrier.image = image;
+
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+
+	vkCmdPipelineBarrier(
+		recording.transferCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(
+		recording.graphicsCommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+}
+
+void UploadContext::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMipLevel, uint32_t levelCount)
+{
+	beginBatch();
+	recordImageBarrier(recording.graphicsCommandBuffer, image, oldLayout, newLayout, baseMipLevel, levelCount);
+}
+
+void UploadContext::recordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMipLevel, uint32_t levelCount)
+{
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = baseMipLevel;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	VkPipelineStageFlags sourceStage;
+	VkPipelineStageFlags destinationStage;
+
+	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	else {
+		throw std::invalid_argument("unsupported layout transition!");
+	}
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		sourceStage, destinationStage,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+}
+
+bool UploadContext::canUploadOnHost(VkFormat format, VkImageLayout layout)
+{
+	return hostImageCopy && device.isHostImageCopySupported(format, layout);
+}
+
+void UploadContext::setHostImageCopy(bool enabled)
+{
+	hostImageCopy = enabled && device.hasHostImageCopy();
+}
+
+void UploadContext::uploadImageOnHost(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels,
+	const VkDeviceSize* levelOffsets, uint32_t levelCount, VkImageLayout layout)
+{
+	// the image is new, no queue uses it yet
+	VkHostImageLayoutTransitionInfoEXT transition{};
+	transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+	transition.image = image;
+	transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	transition.newLayout = layout;
+	transition.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+	device.transitionImageLayoutOnHost(transition);
+
+	std::vector<VkMemoryToImageCopyEXT> regions(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkMemoryToImageCopyEXT& region = regions[level];
+		region.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+		region.pHostPointer = static_cast<const unsigned char*>(data) + levelOffsets[level];
+
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { std::max(1u, width >> level), std::max(1u, height >> level), 1 };
+	}
+
+	VkCopyMemoryToImageInfoEXT copyInfo{};
+	copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+	copyInfo.dstImage = image;
+	copyInfo.dstImageLayout = layout;
+	copyInfo.regionCount = levelCount;
+	copyInfo.pRegions = regions.data();
+	device.copyMemoryToImage(copyInfo);
+
+	// the submissions after this call see the writes, the ones of the current batch included
+	bytesHostCopied += size;
+	hostUploads = true;
+}
+
+VkCommandBuffer UploadContext::getGraphicsCommandBuffer()
+{
+	beginBatch();
+	return recording.graphicsCommandBuffer;
+}
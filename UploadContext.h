@@ -0,0 +1,180 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+// std lib headers
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class Device;
+
+/*
+
+	records staging copies and layout transitions into one command buffer and submits them
+	together with a fence. the staging memory is a persistently mapped ring buffer, the space
+	written by a batch is reused once the fence of that batch has signaled
+
+	with a dedicated transfer queue the copies run there and end with a release barrier, the
+	matching acquire is submitted on the graphics queue only once the copies are done so the
+	frames rendered meanwhile never wait on the upload. without one, everything is recorded in
+	a single command buffer on the graphics queue
+
+*/
+class UploadContext
+{
+public:
+	static constexpr VkDeviceSize DEFAULT_RING_SIZE = 32ull * 1024 * 1024;
+
+	// mapped staging memory of the batch being recorded, the caller writes it directly, from any thread
+	struct StagingRegion {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		unsigned char* mapped = nullptr;
+
+		StagingRegion subregion(VkDeviceSize subOffset, VkDeviceSize subSize) const {
+			return { buffer, offset + subOffset, subSize, mapped + subOffset };
+		}
+	};
+
+	UploadContext(Device& device, VkDeviceSize ringSize = DEFAULT_RING_SIZE);
+	~UploadContext();
+
+	UploadContext(const UploadContext&) = delete;
+	UploadContext& operator=(const UploadContext&) = delete;
+
+	// dstStage / dstAccess describe the first use of the buffer, the barrier is recorded when the batch is flushed
+	void uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset = 0);
+
+	// the copy of uploadBuffer from a buffer the GPU can already read, such as host memory imported by Buffer,
+	// nothing is staged. the source has to be kept alive with releaseWithBatch
+	void copyBuffer(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset = 0);
+
+	// held until the batch being recorded is complete
+	void releaseWithBatch(std::shared_ptr<void> resource);
+
+	// the image is left in TRANSFER_DST_OPTIMAL so the caller can still record the mip chain before the last transition
+	void uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels = 1, uint32_t copyMipLevel = 0);
+
+	// every level of the image from one staging copy, levelOffsets[i] is where level i starts in data.
+	// the offsets have to be aligned on the texel block size of the format. left in TRANSFER_DST_OPTIMAL too
+	void uploadImageLevels(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels, const VkDeviceSize* levelOffsets);
+
+	// room in the ring, or in a buffer of its own when larger, for data written in place instead of copied by an upload.
+	// the copies from it have to be recorded before the batch is flushed, nothing else may stage meanwhile
+	StagingRegion reserveStaging(VkDeviceSize size);
+
+	// uploadImageLevels from a region of reserveStaging for the first levelCount levels, the offsets are relative
+	// to the region. all mipLevels are left in TRANSFER_DST_OPTIMAL
+	void copyToImage(VkImage image, const StagingRegion& staging, uint32_t width, uint32_t height, uint32_t mipLevels, const VkDeviceSize* levelOffsets, uint32_t levelCount);
+
+	// offsets inside a staging region that are a multiple of it can be copied to any image
+	VkDeviceSize getCopyAlignment() const { return copyAlignment; }
+
+	// with VK_EXT_host_image_copy the host writes the image itself: nothing is staged or recorded, the image
+	// is in layout when uploadImageOnHost returns. it needs VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT.
+	// the image still counts as uploaded in the current batch, for the order of isBatchReady
+	bool canUploadOnHost(VkFormat format, VkImageLayout layout);
+	void uploadImageOnHost(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels,
+		const VkDeviceSize* levelOffsets, uint32_t levelCount, VkImageLayout layout);
+
+	// on by default when the device has the extension, off everything goes through the staging ring
+	void setHostImageCopy(bool enabled);
+	bool isHostImageCopyEnabled() const { return hostImageCopy; }
+
+	void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMipLevel = 0, uint32_t levelCount = 1);
+
+	// graphics queue command buffer of the batch being recorded, executed after the uploads of the batch are acquired
+	VkCommandBuffer getGraphicsCommandBuffer();
+
+	// submits the recorded batch and hands finished transfers to the graphics queue, never waits
+	void flush();
+	void waitIdle();
+
+	// resources uploaded in a batch can be used by commands submitted to the graphics queue once the batch is ready
+	uint64_t getBatchId() const { return nextBatchId; }
+	bool isBatchReady(uint64_t batchId) const { return batchId < readyBatchCount; }
+
+	// the batch has finished on the GPU, what its commands read or write can be released
+	bool isBatchComplete(uint64_t batchId) const { return batchId < completedBatchCount; }
+
+	uint32_t getSubmitCount() const { return submitCount; }
+	VkDeviceSize getBytesStaged() const { return bytesStaged; }
+	VkDeviceSize getBytesHostCopied() const { return bytesHostCopied; }
+	VkDeviceSize getBytesCopiedUnstaged() const { return bytesCopiedUnstaged; }
+
+private:
+	struct Batch {
+		uint64_t id = 0;
+
+		// both are the same command buffer without a dedicated transfer queue
+		VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+
+		VkFence transferFence = VK_NULL_HANDLE;
+		VkSemaphore transferSemaphore = VK_NULL_HANDLE;
+		bool acquireSubmitted = false;
+
+		// signaled when the whole batch is done on the graphics queue
+		VkFence fence = VK_NULL_HANDLE;
+
+		// ring bytes written by the batch, alignment padding and skipped end of ring included
+		VkDeviceSize ringBytes = 0;
+
+		// uploads bigger than the whole ring get a staging buffer released with the batch
+		std::vector<std::pair<VkBuffer, MemoryAllocation>> dedicatedStaging{};
+
+		// sources of copyBuffer
+		std::vector<std::shared_ptr<void>> retained{};
+
+		// only host uploads used the id, nothing was submitted for it
+		bool hostOnly = false;
+	};
+
+	void beginBatch();
+	void submitAcquire(Batch& batch);
+	void retireBatches(bool waitForOldest);
+	void recordBufferCopy(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset);
+	void recordImageCopy(VkImage image, VkBuffer srcBuffer, const VkBufferImageCopy* regions, uint32_t regionCount, uint32_t mipLevels);
+	void recordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMipLevel, uint32_t levelCount);
+	void stage(const void* data, VkDeviceSize size, VkBuffer& srcBuffer, VkDeviceSize& srcOffset);
+	bool reserve(VkDeviceSize size, VkDeviceSize& offset, VkDeviceSize& consumed);
+
+	Device& device;
+	bool dedicatedTransfer;
+	uint32_t transferFamily;
+	uint32_t graphicsFamily;
+
+	VkBuffer ringBuffer = VK_NULL_HANDLE;
+	MemoryAllocation ringMemory{};
+	VkDeviceSize ringSize;
+	VkDeviceSize ringHead = 0;
+	VkDeviceSize ringUsed = 0;
+	VkDeviceSize copyAlignment;
+
+	Batch recording{};
+	bool isRecording = false;
+	std::deque<Batch> pendingBatches;
+	std::vector<Batch> freeBatches;
+
+	// buffer barriers are merged in a single vkCmdPipelineBarrier at flush
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	VkPipelineStageFlags bufferBarrierStages = 0;
+
+	uint64_t nextBatchId = 0;
+	uint64_t readyBatchCount = 0;
+	uint64_t completedBatchCount = 0;
+
+	uint32_t submitCount = 0;
+	VkDeviceSize bytesStaged = 0;
+	VkDeviceSize bytesCopiedUnstaged = 0;
+
+	bool hostImageCopy = false;
+	// host uploads since the last flush
+	bool hostUploads = false;
+	VkDeviceSize bytesHostCopied = 0;
+};
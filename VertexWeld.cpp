@@ -0,0 +1,160 @@
+#include "VertexWeld.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_WELD_SSE2
+#include <emmintrin.h>
+#endif
+
+// std
+#include <cstring>
+#include <type_traits>
+
+// the hash reads the vertex as three overlapping 16 byte loads at 0, 16 and 28
+static_assert(sizeof(Model::Vertex) == 44, "VertexWeldTable::hash expects the 44 byte Model::Vertex");
+static_assert(std::is_trivially_copyable<Model::Vertex>::value, "VertexWeldTable reads Model::Vertex as raw bytes");
+
+static const size_t LOAD_OFFSETS[3] = { 0, 16, 28 };
+static const uint64_t KEYS[3][2] = {
+	{ 0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull },
+	{ 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull },
+	{ 0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull },
+};
+
+// murmur3 finalizer, spreads the accumulated lanes over every bit of the slot index
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// same steps as the SSE2 version on two 64 bit lanes, the hash does not depend on the platform
+uint64_t VertexWeldTable::hashScalar(const Model::Vertex& vertex)
+{
+	uint64_t acc[2] = { 0x27d4eb2f165667c5ull, 0x9e3779b185ebca87ull };
+
+	for (int i = 0; i < 3; i++) {
+		uint32_t words[4];
+		memcpy(words, reinterpret_cast<const char*>(&vertex) + LOAD_OFFSETS[i], sizeof(words));
+		for (auto& word : words) {
+			if ((word & 0x7fffffffu) == 0) word = 0;
+		}
+
+		uint64_t value[2] = { words[0] | (uint64_t(words[1]) << 32), words[2] | (uint64_t(words[3]) << 32) };
+		for (int lane = 0; lane < 2; lane++) {
+			uint64_t key = value[lane] ^ KEYS[i][lane];
+			acc[lane] += (key & 0xffffffffull) * (key >> 32) + value[lane ^ 1];
+		}
+	}
+
+	return mix(acc[0] ^ (acc[1] * 0x9e3779b97f4a7c15ull));
+}
+
+#ifdef VERTEX_WELD_SSE2
+
+static __m128i loadCanonical(const Model::Vertex& vertex, size_t offset) {
+	__m128 value = _mm_loadu_ps(reinterpret_cast<const float*>(reinterpret_cast<const char*>(&vertex) + offset));
+
+	// -0.f becomes 0.f, they compare equal so they have to hash the same
+	__m128 isZero = _mm_cmpeq_ps(value, _mm_setzero_ps());
+	return _mm_castps_si128(_mm_andnot_ps(isZero, value));
+}
+
+uint64_t VertexWeldTable::hash(const Model::Vertex& vertex)
+{
+	__m128i acc = _mm_set_epi64x(static_cast<int64_t>(0x9e3779b185ebca87ull), static_cast<int64_t>(0x27d4eb2f165667c5ull));
+
+	for (int i = 0; i < 3; i++) {
+		__m128i value = loadCanonical(vertex, LOAD_OFFSETS[i]);
+		__m128i key = _mm_xor_si128(value, _mm_set_epi64x(static_cast<int64_t>(KEYS[i][1]), static_cast<int64_t>(KEYS[i][0])));
+
+		// low * high 32 bits of every 64 bit lane, plus the other lane so no input word is lost
+		__m128i product = _mm_mul_epu32(key, _mm_srli_epi64(key, 32));
+		__m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+		acc = _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+	return mix(lanes[0] ^ (lanes[1] * 0x9e3779b97f4a7c15ull));
+}
+
+bool VertexWeldTable::equal(const Model::Vertex& a, const Model::Vertex& b)
+{
+	const char* pa = reinterpret_cast<const char*>(&a);
+	const char* pb = reinterpret_cast<const char*>(&b);
+
+	// float compare, same result as Vertex::operator== for -0.f and NaN
+	__m128 same = _mm_cmpeq_ps(_mm_loadu_ps(reinterpret_cast<const float*>(pa)), _mm_loadu_ps(reinterpret_cast<const float*>(pb)));
+	same = _mm_and_ps(same, _mm_cmpeq_ps(_mm_loadu_ps(reinterpret_cast<const float*>(pa + 16)), _mm_loadu_ps(reinterpret_cast<const float*>(pb + 16))));
+	same = _mm_and_ps(same, _mm_cmpeq_ps(_mm_loadu_ps(reinterpret_cast<const float*>(pa + 28)), _mm_loadu_ps(reinterpret_cast<const float*>(pb + 28))));
+	return _mm_movemask_ps(same) == 0xF;
+}
+
+#else
+
+uint64_t VertexWeldTable::hash(const Model::Vertex& vertex)
+{
+	return hashScalar(vertex);
+}
+
+bool VertexWeldTable::equal(const Model::Vertex& a, const Model::Vertex& b)
+{
+	return a == b;
+}
+
+#endif
+
+VertexWeldTable::VertexWeldTable(std::vector<Model::Vertex>& vertices, size_t expectedInsertCount) : vertices{ vertices }
+{
+	// most meshes share every vertex between a few triangles, half the inserts being new is a safe upper bound
+	// and at the maximum load of 1/2 this gives about one slot per insert
+	size_t capacity = 16;
+	while (capacity < expectedInsertCount) capacity *= 2;
+
+	slots.assign(capacity, { 0, EMPTY });
+	mask = capacity - 1;
+}
+
+uint32_t VertexWeldTable::insert(const Model::Vertex& vertex)
+{
+	if ((count + 1) * 2 > slots.size()) grow();
+
+	uint32_t h = static_cast<uint32_t>(hash(vertex));
+
+	// linear probing, the first empty slot is where the vertex goes if it is not in the table
+	for (size_t i = h & mask;; i = (i + 1) & mask) {
+		Slot& slot = slots[i];
+
+		if (slot.index == EMPTY) {
+			slot.hash = h;
+			slot.index = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(vertex);
+			count++;
+			return slot.index;
+		}
+
+		if (slot.hash == h && equal(vertices[slot.index], vertex)) {
+			return slot.index;
+		}
+	}
+}
+
+void VertexWeldTable::grow()
+{
+	std::vector<Slot> oldSlots = std::move(slots);
+
+	slots.assign(oldSlots.size() * 2, { 0, EMPTY });
+	mask = slots.size() - 1;
+
+	// the stored hash is enough to place the slots again, no vertex is read
+	for (const Slot& slot : oldSlots) {
+		if (slot.index == EMPTY) continue;
+
+		size_t i = slot.hash & mask;
+		while (slots[i].index != EMPTY) i = (i + 1) & mask;
+		slots[i] = slot;
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Model.h"
+
+// std lib headers
+#include <cstdint>
+#include <vector>
+
+/*
+
+	flat open addressing table used to weld identical vertices while building an index buffer.
+	slots only hold the hash and the index of the vertex, the vertex itself lives in the output
+	vertex array so a probe compares against vertices[index]. the hash and the comparison both
+	read the raw vertex with SSE2, -0.f and 0.f hash the same so the table agrees with Vertex::operator==
+
+*/
+class VertexWeldTable
+{
+public:
+	// sized for expectedIndexCount indices, the table grows if there are more unique vertices than expected
+	VertexWeldTable(std::vector<Model::Vertex>& vertices, size_t expectedIndexCount);
+
+	VertexWeldTable(const VertexWeldTable&) = delete;
+	VertexWeldTable& operator=(const VertexWeldTable&) = delete;
+
+	// index of the vertex in the output array, the vertex is appended the first time it is seen
+	uint32_t insert(const Model::Vertex& vertex);
+
+	size_t getCapacity() const { return slots.size(); }
+
+	static uint64_t hash(const Model::Vertex& vertex);
+	// the hash without SSE2, always built so --verify-weld can compare the two
+	static uint64_t hashScalar(const Model::Vertex& vertex);
+	static bool equal(const Model::Vertex& a, const Model::Vertex& b);
+
+private:
+	static constexpr uint32_t EMPTY = UINT32_MAX;
+
+	struct Slot {
+		uint32_t hash;
+		uint32_t index;
+	};
+
+	void grow();
+
+	std::vector<Model::Vertex>& vertices;
+	std::vector<Slot> slots;
+	size_t mask;
+	size_t count = 0;
+};
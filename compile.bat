@@ -1,5 +1,11 @@
 C:\VulkanSDK\1.3.275.0\Bin\glslc.exe simple_shader.vert -o simple_shader.vert.spv
 C:\VulkanSDK\1.3.275.0\Bin\glslc.exe simple_shader.frag -o simple_shader.frag.spv
+C:\VulkanSDK\1.3.275.0\Bin\glslc.exe simple_shader_packed.vert -o simple_shader_packed.vert.spv
+C:\VulkanSDK\1.3.275.0\Bin\glslc.exe cluster_cull.comp -o cluster_cull.comp.spv
+C:\VulkanSDK\1.3.275.0\Bin\glslc.exe scene_cull.comp -o scene_cull.comp.spv
+C:\VulkanSDK\1.3.275.0\Bin\glslc.exe -DOCCLUSION_PASS scene_cull.comp -o scene_cull_late.comp.spv
+C:\VulkanSDK\1.3.275.0\Bin\glslc.exe depth_pyramid.comp -o depth_pyramid.comp.spv
+C:\VulkanSDK\1.3.275.0\Bin\glslc.exe mip_downsample.comp -o mip_downsample.comp.spv
 
 C:\VulkanSDK\1.3.275.0\Bin\glslc.exe point_light.vert -o point_light.vert.spv
 C:\VulkanSDK\1.3.275.0\Bin\glslc.exe point_light.frag -o point_light.frag.spv
@@ -1,13 +1,809 @@
- #include "App.h"
+#include "App.h"
+#include "Camera.h"
+#include "FrustumCuller.h"
+#include "MemoryAllocator.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshletBuilder.h"
+#include "Model.h"
+#include "RenderSystem.h"
+#include "Texture.h"
+#include "VertexWeld.h"
+#include "point_light_system.h"
 
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <random>
 #include <stdexcept>
+#include <thread>
+
+// --bench-obj <file>: compare the tinyobj loader with the parallel one on the same file
+static void benchmarkObjLoaders(const std::string& filePath) {
+    auto time = [](auto&& function) {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    Model::Builder reference{};
+    float referenceTime = time([&]() { reference.loadModel(filePath); });
+    std::cout << "tinyobj: " << referenceTime << " ms, " << reference.vertices.size() << " vertices, " << reference.indices.size() << " indices\n";
+
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        Model::Builder builder{};
+        float parallelTime = time([&]() { builder.loadModelParallel(filePath, threads); });
+
+        bool identical = builder.vertices == reference.vertices && builder.indices == reference.indices;
+        std::cout << "parallel (" << threads << " threads): " << parallelTime << " ms, x" << referenceTime / parallelTime
+            << (identical ? ", identical output\n" : ", output differs from tinyobj\n");
+
+        if (threads == maxThreads) break;
+    }
+
+    std::unique_ptr<CookedMesh> mesh;
+    float cookedTime = time([&]() { mesh = CookedMesh::open(filePath); });
+    if (mesh) {
+        std::cout << "cooked cache: " << cookedTime << " ms to open and validate, x" << referenceTime / cookedTime << "\n";
+    }
+}
+
+// --verify-obj: the parallel loader on a generated file with quads, negative indices, vertex colors and CRLF lines,
+// against tinyobj on the same mesh already triangulated
+static bool verifyObjLoader() {
+    const auto directory = std::filesystem::temp_directory_path();
+    const std::string polygonPath = (directory / "verify_obj_polygons.obj").string();
+    const std::string trianglePath = (directory / "verify_obj_triangles.obj").string();
+
+    // a grid written row by row, so the negative indices point back across the chunks of the parallel loader
+    // every value is a multiple of 1/8, both parsers read it exactly
+    {
+        std::ofstream polygons{ polygonPath, std::ios::binary };
+        std::ofstream triangles{ trianglePath, std::ios::binary };
+        if (!polygons.is_open() || !triangles.is_open()) {
+            throw std::runtime_error("failed to write the obj files in " + directory.string());
+        }
+
+        const int size = 96;
+        std::mt19937 random{ 3 };
+        polygons << "# verify-obj\r\no grid\r\n";
+        triangles << "# verify-obj\r\no grid\r\n";
+
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                std::string attributes = "v " + std::to_string(x * .5f) + " " + std::to_string(y * .5f) + " " + std::to_string((x * y % 7) * .125f)
+                    + " " + std::to_string((x % 5) * .25f) + " " + std::to_string((y % 5) * .25f) + " " + std::to_string((x + y) % 2 * .5f) + "\r\n"
+                    + "vt " + std::to_string((x % 9) * .125f) + " " + std::to_string((y % 9) * .125f) + "\r\n"
+                    + "vn " + std::to_string((x % 3) * .5f - .5f) + " " + std::to_string((y % 3) * .5f - .5f) + " 1\r\n";
+                polygons << attributes;
+                triangles << attributes;
+            }
+            if (y == 0) continue;
+
+            // faces between the last two rows, every one in the three index forms and with either sign
+            int count = (y + 1) * size;
+            for (int x = 0; x + 1 < size; x++) {
+                int corners[4] = { (y - 1) * size + x, (y - 1) * size + x + 1, y * size + x + 1, y * size + x };
+                int form = random() % 3;
+
+                auto corner = [&](int vertex, bool negative) {
+                    std::string index = std::to_string(negative ? vertex - count : vertex + 1);
+                    if (form == 0) return index + "/" + index + "/" + index;
+                    if (form == 1) return index + "//" + index;
+                    return index;
+                };
+                auto face = [&](std::ofstream& file, std::initializer_list<int> vertices, bool negative) {
+                    file << "f";
+                    for (int vertex : vertices) file << " " << corner(vertex, negative);
+                    file << "\r\n";
+                };
+
+                bool negative = random() % 2 == 0;
+                if (random() % 4 == 0) {
+                    face(polygons, { corners[0], corners[1], corners[2] }, negative);
+                    face(polygons, { corners[0], corners[2], corners[3] }, negative);
+                }
+                else {
+                    face(polygons, { corners[0], corners[1], corners[2], corners[3] }, negative);
+                }
+                face(triangles, { corners[0], corners[1], corners[2] }, false);
+                face(triangles, { corners[0], corners[2], corners[3] }, false);
+            }
+        }
+    }
+
+    Model::Builder reference{};
+    reference.loadModel(trianglePath);
+    std::cout << "tinyobj: " << reference.vertices.size() << " vertices, " << reference.indices.size() << " indices\n";
+
+    bool identical = true;
+    for (unsigned int threads : { 1u, 2u, 3u, 8u, 16u }) {
+        Model::Builder fromPolygons{};
+        fromPolygons.loadModelParallel(polygonPath, threads);
+        Model::Builder fromTriangles{};
+        fromTriangles.loadModelParallel(trianglePath, threads);
+
+        bool same = fromPolygons.vertices == reference.vertices && fromPolygons.indices == reference.indices
+            && fromTriangles.vertices == reference.vertices && fromTriangles.indices == reference.indices;
+        std::cout << "parallel (" << threads << " threads): " << (same ? "identical output\n" : "output differs from tinyobj\n");
+        identical = identical && same;
+    }
+
+    std::filesystem::remove(polygonPath);
+    std::filesystem::remove(trianglePath);
+    return identical;
+}
+
+// every float of a vertex, for ordered containers
+using VertexKey = std::array<float, 11>;
+static VertexKey vertexKey(const Model::Vertex& vertex) {
+    return { vertex.position.x, vertex.position.y, vertex.position.z, vertex.color.r, vertex.color.g, vertex.color.b,
+        vertex.normal.x, vertex.normal.y, vertex.normal.z, vertex.uv.x, vertex.uv.y };
+}
+
+// --verify-weld: the vertex weld table against a std::map on a triangle soup with many duplicates,
+// and the SSE2 hash against the scalar one
+static bool verifyVertexWeld() {
+    // few distinct values so the soup has repeats, copies that only differ by -0.f, color or normal
+    std::mt19937 random{ 11 };
+    auto value = [&]() { return static_cast<float>(static_cast<int>(random() % 9) - 4) * .25f; };
+
+    std::vector<Model::Vertex> pool;
+    for (int i = 0; i < 4000; i++) {
+        Model::Vertex vertex{};
+        vertex.position = { value(), value(), value() };
+        vertex.color = { 1.f, 1.f, 1.f };
+        vertex.normal = { value(), value(), value() };
+        vertex.uv = { value(), value() };
+        pool.push_back(vertex);
+
+        Model::Vertex negativeZero = vertex;
+        if (negativeZero.position.x == 0.f) negativeZero.position.x = -0.f;
+        if (negativeZero.uv.y == 0.f) negativeZero.uv.y = -0.f;
+        pool.push_back(negativeZero);
+
+        Model::Vertex otherColor = vertex;
+        otherColor.color.g = .5f;
+        pool.push_back(otherColor);
+
+        Model::Vertex otherNormal = vertex;
+        otherNormal.normal.z += 2.f;
+        pool.push_back(otherNormal);
+    }
+
+    std::vector<Model::Vertex> soup(300000);
+    for (auto& vertex : soup) vertex = pool[random() % pool.size()];
+
+    uint32_t hashMismatches = 0;
+    for (const auto& vertex : pool) {
+        if (VertexWeldTable::hash(vertex) != VertexWeldTable::hashScalar(vertex)) hashMismatches++;
+    }
+    std::cout << "hash: " << pool.size() << " vertices, " << (hashMismatches == 0 ? "SSE2 and scalar agree\n" : std::to_string(hashMismatches) + " differ from the scalar hash\n");
+
+    auto time = [](auto&& function) {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    std::vector<Model::Vertex> referenceVertices;
+    std::vector<uint32_t> referenceIndices;
+    float mapTime = time([&]() {
+        // the map compares the floats, -0.f and 0.f are the same key like in Vertex::operator==
+        std::map<VertexKey, uint32_t> uniqueVertices;
+        for (const auto& vertex : soup) {
+            auto inserted = uniqueVertices.emplace(vertexKey(vertex), static_cast<uint32_t>(referenceVertices.size()));
+            if (inserted.second) referenceVertices.push_back(vertex);
+            referenceIndices.push_back(inserted.first->second);
+        }
+    });
+
+    // sized for the soup, then sized too small so the table grows on the way
+    bool identical = hashMismatches == 0;
+    for (size_t expectedIndexCount : { soup.size(), size_t{ 16 } }) {
+        std::vector<Model::Vertex> vertices;
+        std::vector<uint32_t> indices;
+        float tableTime = time([&]() {
+            VertexWeldTable uniqueVertices{ vertices, expectedIndexCount };
+            indices.reserve(soup.size());
+            for (const auto& vertex : soup) indices.push_back(uniqueVertices.insert(vertex));
+        });
+
+        bool same = vertices == referenceVertices && indices == referenceIndices;
+        std::cout << "weld table (sized for " << expectedIndexCount << "): " << tableTime << " ms, std::map: " << mapTime << " ms, x" << mapTime / tableTime
+            << (same ? ", same output\n" : ", output differs from std::map\n");
+        identical = identical && same;
+    }
+
+    Model::Builder builder{};
+    builder.vertices = soup;
+    builder.weldVertices();
+    bool welded = builder.vertices == referenceVertices && builder.indices == referenceIndices;
+    std::cout << "weldVertices: " << referenceVertices.size() << " unique of " << soup.size() << (welded ? ", same output\n" : ", output differs from std::map\n");
+
+    return identical && welded;
+}
+
+// --verify-optimizer <file>: the mesh optimizer on the file in its own triangle order and shuffled,
+// the triangles and their winding must stay the same
+static bool verifyMeshOptimizer(const std::string& filePath) {
+    Model::Builder loaded{};
+    loaded.loadModelParallel(filePath);
+
+    // triangles by the values of their vertices, each one starting at its smallest vertex so the winding is kept
+    auto triangles = [](const Model::Builder& builder) {
+        std::vector<std::array<VertexKey, 3>> result;
+        for (size_t i = 0; i + 2 < builder.indices.size(); i += 3) {
+            std::array<VertexKey, 3> triangle{ vertexKey(builder.vertices[builder.indices[i + 0]]),
+                vertexKey(builder.vertices[builder.indices[i + 1]]), vertexKey(builder.vertices[builder.indices[i + 2]]) };
+            std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+            result.push_back(triangle);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+
+    Model::Builder shuffled = loaded;
+    std::vector<uint32_t> order(shuffled.indices.size() / 3);
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937{ 5 });
+    for (size_t i = 0; i < order.size(); i++) {
+        for (int corner = 0; corner < 3; corner++) shuffled.indices[3 * i + corner] = loaded.indices[3 * order[i] + corner];
+    }
+
+    auto reference = triangles(loaded);
+    bool unchanged = true;
+    for (const auto* source : { &loaded, &shuffled }) {
+        for (bool reduceOverdraw : { false, true }) {
+            std::cout << (source == &loaded ? "file order" : "shuffled") << (reduceOverdraw ? ", cache and overdraw: " : ", cache only: ");
+
+            Model::Builder builder = *source;
+            MeshOptimizer::optimize(builder, reduceOverdraw);
+
+            bool same = builder.vertices.size() <= loaded.vertices.size() && triangles(builder) == reference;
+            if (!same) std::cout << "triangles differ from the file\n";
+            unchanged = unchanged && same;
+        }
+    }
+
+    std::cout << "mesh optimizer: " << reference.size() << " triangles, " << (unchanged ? "unchanged\n" : "changed\n");
+    return unchanged;
+}
+
+// --verify-lod [file]: levels of detail of a UV sphere with a seam, and of the file if given. every level has to be
+// coarser than the previous one and its error at least the distance from the full mesh vertices to it
+static bool verifyLods(const char* filePath) {
+    std::vector<std::pair<std::string, Model::Builder>> meshes;
+
+    const int rings = 64;
+    Model::Builder sphere{};
+    for (int i = 0; i <= rings; i++) {
+        for (int j = 0; j <= rings; j++) {
+            float theta = glm::pi<float>() * i / rings;
+            float phi = glm::two_pi<float>() * j / rings;
+
+            Model::Vertex vertex{};
+            vertex.position = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+            vertex.color = { 1.f, 1.f, 1.f };
+            vertex.normal = vertex.position;
+            vertex.uv = { static_cast<float>(j) / rings, static_cast<float>(i) / rings };
+            sphere.vertices.push_back(vertex);
+        }
+    }
+    for (uint32_t i = 0; i < rings; i++) {
+        for (uint32_t j = 0; j < rings; j++) {
+            uint32_t a = i * (rings + 1) + j, b = a + 1, c = a + rings + 1, d = c + 1;
+            sphere.indices.insert(sphere.indices.end(), { a, c, b, b, c, d });
+        }
+    }
+    meshes.emplace_back("uv sphere", std::move(sphere));
+
+    if (filePath) {
+        Model::Builder loaded{};
+        loaded.loadModelParallel(filePath);
+        MeshOptimizer::optimize(loaded);
+        meshes.emplace_back(filePath, std::move(loaded));
+    }
+
+    MeshSimplifier::LodSettings settings{};
+    bool valid = true;
+    for (auto& [name, builder] : meshes) {
+        auto start = std::chrono::high_resolution_clock::now();
+        MeshSimplifier::generateLods(builder, settings);
+        float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+
+        glm::vec3 boundsMin, boundsMax;
+        Model::computeBounds(builder.vertices.data(), builder.vertices.size(), boundsMin, boundsMax);
+        glm::vec3 extent = boundsMax - boundsMin;
+        float size = std::max(extent.x, std::max(extent.y, extent.z));
+        std::cout << name << ": " << builder.indices.size() / 3 << " triangles, " << builder.lods.size() << " level(s) in " << time << " ms\n";
+
+        size_t previousCount = builder.indices.size();
+        float previousError = 0.f;
+        for (const auto& lod : builder.lods) {
+            bool inRange = std::all_of(lod.indices.begin(), lod.indices.end(), [&](uint32_t index) { return index < builder.vertices.size(); });
+            bool ok = inRange && lod.indices.size() % 3 == 0 && lod.indices.size() < previousCount
+                && lod.error >= previousError && lod.error <= settings.maxError * size * 1.001f;
+
+            // brute force over the level, a sample of the vertices is enough on large meshes
+            float measured = 0.f;
+            if (inRange) {
+                size_t step = std::max<size_t>(1, builder.vertices.size() * lod.indices.size() / 3 / 20000000);
+                for (size_t i = 0; i < builder.vertices.size(); i += step) {
+                    glm::vec3 p = builder.vertices[i].position;
+                    float closest = std::numeric_limits<float>::max();
+                    for (size_t t = 0; t + 2 < lod.indices.size(); t += 3) {
+                        closest = std::min(closest, MeshSimplifier::distanceToTriangle(p, builder.vertices[lod.indices[t]].position,
+                            builder.vertices[lod.indices[t + 1]].position, builder.vertices[lod.indices[t + 2]].position));
+                    }
+                    measured = std::max(measured, closest);
+                }
+            }
+            ok = ok && measured <= lod.error + size * 1e-5f;
+
+            std::cout << "  " << lod.indices.size() / 3 << " triangles, error " << lod.error << ", measured " << measured << (ok ? "\n" : ", invalid\n");
+            valid = valid && ok;
+            previousCount = lod.indices.size();
+            previousError = lod.error;
+        }
+    }
+
+    return valid;
+}
+
+// --verify-meshlets <file>: the meshlets of the file have to cover the same triangles within the size limits, and from
+// random cameras no meshlet behind its cone may hold a triangle facing the camera
+static bool verifyMeshlets(const std::string& filePath) {
+    Model::Builder builder{};
+    builder.loadModelParallel(filePath);
+    MeshOptimizer::optimize(builder);
+
+    std::vector<uint32_t> before = builder.indices;
+    auto start = std::chrono::high_resolution_clock::now();
+    MeshletBuilder::build(builder);
+    float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+
+    if (builder.meshlets.empty()) {
+        std::cout << "meshlets: " << builder.indices.size() / 3 << " triangles, below " << MeshletBuilder::MIN_MESHLET_COUNT << " meshlets, drawn whole\n";
+        return builder.indices == before;
+    }
+
+    // only the order of the triangles changes, each one keeps its winding
+    auto triangles = [](const std::vector<uint32_t>& indices) {
+        std::vector<std::array<uint32_t, 3>> result;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            std::array<uint32_t, 3> triangle{ indices[i], indices[i + 1], indices[i + 2] };
+            std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+            result.push_back(triangle);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+
+    uint32_t failures = 0;
+    auto check = [&](bool condition, const char* what) {
+        if (!condition && failures++ < 10) std::cout << "meshlets: " << what << "\n";
+    };
+    check(triangles(builder.indices) == triangles(before), "triangles differ from the mesh");
+
+    glm::vec3 boundsMin, boundsMax;
+    Model::computeBounds(builder.vertices.data(), builder.vertices.size(), boundsMin, boundsMax);
+    float size = glm::length(boundsMax - boundsMin);
+
+    uint32_t nextIndex = 0;
+    uint32_t coneCount = 0;
+    for (const auto& meshlet : builder.meshlets) {
+        check(meshlet.firstIndex == nextIndex && meshlet.indexCount % 3 == 0, "meshlets do not follow each other in the index buffer");
+        nextIndex = meshlet.firstIndex + meshlet.indexCount;
+
+        std::vector<uint32_t> vertices(builder.indices.begin() + meshlet.firstIndex, builder.indices.begin() + nextIndex);
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        check(vertices.size() <= MeshletBuilder::MAX_VERTICES && meshlet.indexCount / 3 <= MeshletBuilder::MAX_TRIANGLES, "meshlet over the size limits");
+
+        for (uint32_t vertex : vertices) {
+            check(glm::length(builder.vertices[vertex].position - meshlet.center) <= meshlet.radius + size * 1e-5f, "vertex outside the bounding sphere");
+        }
+        if (meshlet.coneCutoff <= 1.f) coneCount++;
+    }
+    check(nextIndex == builder.indices.size(), "meshlets do not cover the index buffer");
 
-int main() {
-    App app{};
+    // cameras in a box ten times the size of the mesh, the same cone test as cluster_cull.comp in object space
+    std::mt19937 random{ 1 };
+    std::uniform_real_distribution<float> offset{ -5.f * size, 5.f * size };
+    glm::vec3 center = (boundsMin + boundsMax) * .5f;
+    const int cameraCount = 200;
+    size_t culledCount = 0;
+
+    for (int camera = 0; camera < cameraCount; camera++) {
+        glm::vec3 position = center + glm::vec3{ offset(random), offset(random), offset(random) };
+
+        for (const auto& meshlet : builder.meshlets) {
+            if (meshlet.coneCutoff > 1.f || glm::dot(glm::normalize(meshlet.coneApex - position), meshlet.coneAxis) < meshlet.coneCutoff) continue;
+            culledCount++;
+
+            for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3) {
+                const glm::vec3& p0 = builder.vertices[builder.indices[i + 0]].position;
+                const glm::vec3& p1 = builder.vertices[builder.indices[i + 1]].position;
+                const glm::vec3& p2 = builder.vertices[builder.indices[i + 2]].position;
+
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                check(glm::dot(normal, position - p0) <= 1e-6f * glm::length(normal) * size, "cone culled meshlet with a triangle facing the camera");
+            }
+        }
+    }
+
+    float acmrBefore = MeshOptimizer::analyzeVertexCache(before, builder.vertices.size()).acmr;
+    float acmrAfter = MeshOptimizer::analyzeVertexCache(builder.indices, builder.vertices.size()).acmr;
+    std::cout << "meshlets: " << builder.meshlets.size() << " in " << time << " ms, " << builder.indices.size() / 3.f / builder.meshlets.size()
+        << " triangles on average, " << coneCount << " with a cone, ACMR " << acmrBefore << " -> " << acmrAfter << "\n";
+    std::cout << "cone test: " << culledCount << " of " << builder.meshlets.size() * cameraCount << " meshlets culled over " << cameraCount << " cameras, "
+        << (failures == 0 ? "ok\n" : std::to_string(failures) + " failure(s)\n");
+    return failures == 0;
+}
+
+// --verify-alloc: random allocations and frees in small blocks of each kind of memory, they must never overlap
+static bool verifyMemoryAllocator() {
+    Window window{ 800, 600, "allocator check" };
+    Device device{ window };
+
+    // small blocks so the free lists are split and merged often, with dedicated blocks now and then
+    const VkDeviceSize blockSize = 1024 * 1024;
+    const int iterations = 20000;
+    const size_t maxLive = 1000;
+    const VkMemoryPropertyFlags memoryProperties[] = {
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    };
+
+    MemoryAllocator allocator{ device.device(), device.getPhysicalDevice(), blockSize };
+    VkDeviceSize atomSize = device.properties.limits.nonCoherentAtomSize;
+
+    struct Live {
+        MemoryAllocation allocation;
+        VkDeviceSize size;
+        uint8_t pattern;
+    };
+    std::vector<Live> live;
+    std::mt19937 random{ 7 };
+
+    uint32_t failures = 0;
+    auto check = [&](bool condition, const char* what) {
+        if (!condition && failures++ < 10) std::cout << "memory allocator: " << what << "\n";
+    };
+
+    for (int i = 0; i < iterations; i++) {
+        if (live.empty() || (live.size() < maxLive && random() % 3 != 0)) {
+            VkMemoryRequirements requirements{};
+            requirements.size = random() % 50 == 0 ? blockSize / 2 + random() % blockSize : 1 + random() % 60000;
+            requirements.alignment = VkDeviceSize{ 1 } << (random() % 9);
+            requirements.memoryTypeBits = ~0u;
+
+            Live entry{ allocator.allocate(requirements, memoryProperties[random() % 3], random() % 2 == 0), requirements.size, static_cast<uint8_t>(i) };
+            const MemoryAllocation& allocation = entry.allocation;
+            check(allocation.offset % requirements.alignment == 0, "offset not aligned");
+            check(allocation.size >= requirements.size, "allocation smaller than asked");
+            check(!allocation.nonCoherent || (allocation.offset % atomSize == 0 && allocation.size % atomSize == 0), "non coherent allocation not on the atom size");
+
+            for (const auto& other : live) {
+                if (other.allocation.memory != allocation.memory) continue;
+                check(allocation.offset + allocation.size <= other.allocation.offset || other.allocation.offset + other.allocation.size <= allocation.offset, "overlapping allocations");
+            }
+
+            // checked when freed, a neighbour written over it would show
+            if (allocation.mapped != nullptr) memset(allocation.mapped, entry.pattern, static_cast<size_t>(entry.size));
+            live.push_back(entry);
+        }
+        else {
+            size_t index = random() % live.size();
+            Live& entry = live[index];
+            if (entry.allocation.mapped != nullptr) {
+                const uint8_t* bytes = static_cast<const uint8_t*>(entry.allocation.mapped);
+                check(std::all_of(bytes, bytes + entry.size, [&](uint8_t byte) { return byte == entry.pattern; }), "mapped memory overwritten");
+            }
+            allocator.free(entry.allocation);
+            live.erase(live.begin() + index);
+        }
+    }
+
+    allocator.printStats();
+    for (auto& entry : live) allocator.free(entry.allocation);
+    MemoryStats stats = allocator.getStats();
+    check(stats.allocationCount == 0 && stats.bytesUsed == 0, "memory still used after every free");
+
+    std::cout << "memory allocator: " << iterations << " operations, " << (failures == 0 ? "ok\n" : std::to_string(failures) + " failure(s)\n");
+    return failures == 0;
+}
+
+// every texture of the textures directory, decoded for the device
+static std::vector<Texture::ImageData> loadBenchmarkImages(Device& device) {
+    std::vector<Texture::ImageData> images;
+    for (const auto& file : std::filesystem::directory_iterator("textures")) {
+        try {
+            images.push_back(Texture::loadImageData(file.path().string().c_str(), Texture::getTranscodeTargets(device)));
+        }
+        catch (const std::exception& e) {
+            std::cout << "skipped " << file.path().string() << ": " << e.what() << "\n";
+        }
+    }
+    return images;
+}
+
+// --bench-upload: upload rate of the textures through the staging ring and with VK_EXT_host_image_copy
+static void benchmarkTextureUploads() {
+    Window window{ 800, 600, "upload benchmark" };
+    Device device{ window };
+    UploadContext& uploadContext = device.getUploadContext();
+
+    // decoded once, only the uploads are timed
+    std::vector<Texture::ImageData> images = loadBenchmarkImages(device);
+    VkDeviceSize roundBytes = 0;
+    for (const auto& image : images) {
+        roundBytes += image.levelOffsets.size() > 1 ? image.levelOffsets[1] : static_cast<VkDeviceSize>(image.width) * image.height * 4;
+    }
+
+    // level 0 only, the mip chains would be timed too
+    Texture::SamplerSettings settings{};
+    settings.mipmaps = false;
+    const int rounds = 20;
+
+    float times[2]{};
+    for (bool host : { false, true }) {
+        uploadContext.setHostImageCopy(host);
+        if (host && !uploadContext.isHostImageCopyEnabled()) {
+            std::cout << "host image copy: not supported by the device\n";
+            break;
+        }
+
+        uint32_t submitCount = uploadContext.getSubmitCount();
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int round = 0; round < rounds; round++) {
+            std::vector<std::unique_ptr<Texture>> textures;
+            for (const auto& image : images) {
+                textures.push_back(std::make_unique<Texture>(device, image, settings));
+            }
+            // until the GPU has every texture, the host copies are done already
+            uploadContext.waitIdle();
+        }
+
+        float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+        times[host] = time;
+        std::cout << (host ? "host image copy: " : "staging ring: ") << images.size() << " texture(s), " << time / rounds << " ms per round, "
+            << roundBytes * rounds / (time / 1000.f) / (1024.f * 1024.f) << " MB/s, " << uploadContext.getSubmitCount() - submitCount << " submission(s)\n";
+    }
+
+    if (times[0] > 0.f && times[1] > 0.f) {
+        std::cout << "host image copy: x" << times[0] / times[1] << " the upload rate of the staging ring\n";
+    }
+}
+
+// --bench-mips: load time and GPU time of the mip chains of the textures, compute downsampler against blits in the same run
+static void benchmarkMipGeneration() {
+    Window window{ 800, 600, "mip benchmark" };
+    Device device{ window };
+    UploadContext& uploadContext = device.getUploadContext();
+    MipGenerator& mipGenerator = device.getMipGenerator();
+
+    std::vector<Texture::ImageData> images = loadBenchmarkImages(device);
+    Texture::SamplerSettings settings{};
+    const int rounds = 10;
+
+    for (auto method : { MipGenerator::Method::Compute, MipGenerator::Method::Blit }) {
+        const char* name = method == MipGenerator::Method::Compute ? "compute" : "blit";
+        if (method == MipGenerator::Method::Compute && !mipGenerator.isComputeAvailable()) {
+            std::cout << name << ": mip_downsample.comp.spv not loaded\n";
+            continue;
+        }
+        mipGenerator.setMethod(method);
+
+        // a texture above the compute limits is blitted and counted with the blits
+        MipGenerator::Stats before = mipGenerator.getStats(method);
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int round = 0; round < rounds; round++) {
+            std::vector<std::unique_ptr<Texture>> textures;
+            for (const auto& image : images) {
+                textures.push_back(std::make_unique<Texture>(device, image, settings));
+            }
+            uploadContext.waitIdle();
+        }
+
+        // load time: upload and mip chain of every texture until the GPU is done, the decoding is left out
+        float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+        MipGenerator::Stats after = mipGenerator.getStats(method);
+
+        uint32_t chainCount = after.chainCount - before.chainCount;
+        uint32_t timedCount = after.timedCount - before.timedCount;
+        std::cout << name << ": " << images.size() << " texture(s), " << time / rounds << " ms per round, "
+            << chainCount << " chain(s), " << after.levelCount - before.levelCount << " levels";
+        if (timedCount > 0) {
+            std::cout << ", " << (after.gpuTime - before.gpuTime) / timedCount << " ms gpu per chain";
+        }
+        std::cout << "\n";
+    }
+}
+
+// --bench-pipelines: creation of the pipelines of the app without pipeline cache, then from the one the first device left
+static void benchmarkPipelineCreation() {
+    Window window{ 800, 600, "pipeline benchmark" };
+
+    for (bool warm : { false, true }) {
+        if (!warm) std::filesystem::remove(Device::PIPELINE_CACHE_PATH);
+
+        // written back when the device is destroyed at the end of the round
+        Device device{ window };
+        Renderer renderer{ window, device };
+        AssetLoader assetLoader{ device };
+        TextureRegistry textureRegistry{ device, assetLoader };
+        auto globalSetLayout = DescriptorSetLayout::Builder(device).addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS).build();
+
+        uint32_t creationCount = Pipeline::getCreationCount();
+        float creationTime = Pipeline::getCreationTime();
+        {
+            PointLightSystem pointLightSystem{ device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
+            RenderSystem renderSystem{ device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(), textureRegistry };
+            TextOverlay textOverlay{ device, renderer.getSwapChainRenderPass() };
+        }
+
+        std::cout << (warm ? "warm start: " : "cold start: ") << Pipeline::getCreationCount() - creationCount << " pipeline(s) in "
+            << Pipeline::getCreationTime() - creationTime << " ms\n";
+    }
+}
+
+// --bench-cull: frustum test of 100k bounding spheres, SIMD against one sphere at a time,
+// then every count up to a few SIMD widths so the scalar tail is checked too
+static bool benchmarkFrustumCulling() {
+    const size_t objectCount = 100000;
+    const int rounds = 200;
+
+    // spread around a camera looking down +z, about a fifth of them in view
+    Camera camera{};
+    camera.setPerspectiveProjection(glm::radians(50.f), 16.f / 9.f, .1f, 100.f);
+    camera.setViewDirection(glm::vec3{ 0.f }, glm::vec3{ 0.f, 0.f, 1.f });
+    auto planes = camera.getFrustumPlanes();
+
+    std::mt19937 random{ 42 };
+    std::uniform_real_distribution<float> position{ -100.f, 100.f };
+    std::uniform_real_distribution<float> radius{ .1f, 2.f };
+
+    FrustumCuller culler{};
+    culler.reserve(objectCount);
+    for (size_t i = 0; i < objectCount; i++) {
+        culler.add({ position(random), position(random), position(random) }, radius(random));
+    }
+
+    auto time = [&](auto&& cull, std::vector<uint8_t>& visible, uint32_t& visibleCount) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int round = 0; round < rounds; round++) visibleCount = cull(visible);
+        return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count() / rounds;
+    };
+
+    std::vector<uint8_t> scalarVisible, simdVisible;
+    uint32_t scalarCount = 0, simdCount = 0;
+    float scalarTime = time([&](std::vector<uint8_t>& visible) { return culler.cullScalar(planes, visible); }, scalarVisible, scalarCount);
+    float simdTime = time([&](std::vector<uint8_t>& visible) { return culler.cull(planes, visible); }, simdVisible, simdCount);
+
+    std::cout << objectCount << " objects, " << simdCount << " visible, " << objectCount - simdCount << " culled\n";
+    std::cout << "scalar: " << scalarTime << " ms\n";
+    std::cout << FrustumCuller::getInstructionSet() << ": " << simdTime << " ms, x" << scalarTime / simdTime
+        << (scalarVisible == simdVisible ? ", same result\n" : ", result differs from scalar\n");
+
+    // fewer spheres than the SIMD width, full registers and a tail, around the frustum so both results show up
+    std::uniform_real_distribution<float> near{ -20.f, 20.f };
+    uint32_t tailMismatches = 0;
+    for (size_t count = 1; count <= 33; count++) {
+        FrustumCuller small{};
+        for (size_t i = 0; i < count; i++) {
+            small.add({ near(random), near(random), near(random) }, radius(random));
+        }
+
+        std::vector<uint8_t> scalarSmall, simdSmall;
+        uint32_t scalarSmallCount = small.cullScalar(planes, scalarSmall);
+        uint32_t simdSmallCount = small.cull(planes, simdSmall);
+        if (scalarSmall != simdSmall || scalarSmallCount != simdSmallCount) tailMismatches++;
+    }
+    std::cout << "1 to 33 objects: " << (tailMismatches == 0 ? "same result\n" : std::to_string(tailMismatches) + " count(s) differ from scalar\n");
+
+    return scalarVisible == simdVisible && scalarCount == simdCount && tailMismatches == 0;
+}
+
+int main(int argc, char** argv) {
+    // after any other option, in any order:
+    // --blit-mips: mip chains made with vkCmdBlitImage instead of the compute downsampler
+    // --gpu-driven: objects culled and drawn from the GPU scene
+    // --occlusion: with --gpu-driven, objects hidden behind the ones drawn first are not drawn
+    // --cluster-cull: meshlets outside the frustum or facing away are not drawn, back faces are culled
+    auto mipMethod = MipGenerator::Method::Compute;
+    bool gpuDriven = false;
+    bool occlusionCulling = false;
+    bool clusterCulling = false;
+    while (argc >= 2) {
+        if (strcmp(argv[argc - 1], "--blit-mips") == 0) mipMethod = MipGenerator::Method::Blit;
+        else if (strcmp(argv[argc - 1], "--gpu-driven") == 0) gpuDriven = true;
+        else if (strcmp(argv[argc - 1], "--occlusion") == 0) occlusionCulling = true;
+        else if (strcmp(argv[argc - 1], "--cluster-cull") == 0) clusterCulling = true;
+        else break;
+        argc--;
+    }
 
     try {
+        if (argc == 3 && strcmp(argv[1], "--bench-obj") == 0) {
+            benchmarkObjLoaders(argv[2]);
+            return EXIT_SUCCESS;
+        }
+
+        // --cook <directory> [--force]: build the mesh caches of every obj in the directory
+        if (argc >= 3 && strcmp(argv[1], "--cook") == 0) {
+            bool force = argc == 4 && strcmp(argv[3], "--force") == 0;
+            std::cout << CookedMesh::cookDirectory(argv[2], force) << " mesh(es) cooked\n";
+            return EXIT_SUCCESS;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--verify-obj") == 0) {
+            return verifyObjLoader() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--verify-weld") == 0) {
+            return verifyVertexWeld() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (argc == 3 && strcmp(argv[1], "--verify-optimizer") == 0) {
+            return verifyMeshOptimizer(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if ((argc == 2 || argc == 3) && strcmp(argv[1], "--verify-lod") == 0) {
+            return verifyLods(argc == 3 ? argv[2] : nullptr) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (argc == 3 && strcmp(argv[1], "--verify-meshlets") == 0) {
+            return verifyMeshlets(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--verify-alloc") == 0) {
+            return verifyMemoryAllocator() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--bench-upload") == 0) {
+            benchmarkTextureUploads();
+            return EXIT_SUCCESS;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--bench-mips") == 0) {
+            benchmarkMipGeneration();
+            return EXIT_SUCCESS;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--bench-pipelines") == 0) {
+            benchmarkPipelineCreation();
+            return EXIT_SUCCESS;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "--bench-cull") == 0) {
+            return benchmarkFrustumCulling() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        // --bench-lod: GPU time of the objects with and without levels of detail, on a fixed camera
+        if (argc == 2 && strcmp(argv[1], "--bench-lod") == 0) {
+            App app{ App::Scene::LodBenchmark, mipMethod, gpuDriven, occlusionCulling, clusterCulling };
+            app.run();
+            return EXIT_SUCCESS;
+        }
+
+        App app{ App::Scene::Default, mipMethod, gpuDriven, occlusionCulling, clusterCulling };
         app.run();
     }
     catch (const std::exception& e) {
@@ -16,4 +812,4 @@ int main() {
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
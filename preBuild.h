@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Model.h"
+#include "MeshOptimizer.h"
 
 #include <iostream>
 #include <glm/glm.hpp>
@@ -92,9 +93,10 @@ static std::unique_ptr<Model> createPlane(Device& device, const unsigned int det
     std::cout << modelBuilder.vertices.size() << "\n";
     std::cout << modelBuilder.indices.size() << "\n";
 
+    // the rows above go through the vertex cache once per row, the optimizer walks the grid in cache sized strips
+    MeshOptimizer::optimize(modelBuilder, false);
 
-
-    return std::make_unique<Model>(device, modelBuilder, "textures/floor.jpg");
+    return std::make_unique<Model>(device, modelBuilder);
 }
 
 /*static std::unique_ptr<Model> createPlane1(Device& device, const int detail, const float sizePlane, glm::vec3 color) {
@@ -196,5 +198,5 @@ static std::unique_ptr<Model> createPlane(Device& device, const unsigned int det
     std::cout << modelBuilder.vertices.size() << "\n";
     std::cout << modelBuilder.indices.size() << "\n";
 
-    return std::make_unique<Model>(device, modelBuilder, "");
+    return std::make_unique<Model>(device, modelBuilder);
 }*/
\ No newline at end of file
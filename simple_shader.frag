@@ -22,11 +22,6 @@ layout(set = 0, binding = 0) uniform GlobalUbo {
 	int numLights;
 } ubo;
 
-layout(push_constant) uniform Push {
-	mat4 modelMatrix;
-	mat4 normalMatrix;
-} push;
-
 // Define the texture sampler
 layout(set = 1, binding = 0) uniform sampler2D texSampler;
 
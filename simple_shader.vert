@@ -5,6 +5,10 @@ layout(location = 1) in vec3 color;
 layout(location = 2) in vec3 normal;
 layout(location = 3) in vec2 uv;
 
+// per instance data
+layout(location = 4) in mat4 modelMatrix;
+layout(location = 8) in mat4 normalMatrix;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec3 fragPosWorld;
 layout(location = 2) out vec3 fragNormalWorld;
@@ -26,22 +30,17 @@ layout(set = 0, binding = 0) uniform GlobalUbo {
 } ubo;
 
 
-layout(push_constant) uniform Push {
-	mat4 modelMatrix;
-	mat4 normalMatrix;
-} push;
-
 // Define the texture sampler
 //layout(set = 1, binding = 0) uniform sampler2D texSampler;
 
 
 
 void main() {
-	vec4 positionWorld = push.modelMatrix * vec4(position, 1.0);
+	vec4 positionWorld = modelMatrix * vec4(position, 1.0);
 
 	gl_Position = ubo.projection * ubo.view * positionWorld;
 
-	fragNormalWorld = normalize(mat3(push.normalMatrix)*normal);
+	fragNormalWorld = normalize(mat3(normalMatrix)*normal);
 	fragPosWorld = positionWorld.xyz;
 
 	fragColor = color;
@@ -0,0 +1,58 @@
+#version 450
+
+// Model::PackedVertex, the position is in [0, 1] over the bounds of the mesh,
+// the model matrix of the instance maps it back to object space
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 octahedralNormal;
+layout(location = 3) in vec2 uv;
+
+// per instance data
+layout(location = 4) in mat4 modelMatrix;
+layout(location = 8) in mat4 normalMatrix;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragPosWorld;
+layout(location = 2) out vec3 fragNormalWorld;
+layout(location = 3) out vec2 texCoord;
+
+struct PointLight {
+	vec4 position;
+	vec4 color;
+};
+
+layout(set = 0, binding = 0) uniform GlobalUbo {
+	mat4 projection;
+	mat4 view;
+	mat4 invView;
+	vec4 ambientLightColor;
+	PointLight pointLight[10];
+	vec4 globalLightDir;
+	int numLights;
+} ubo;
+
+
+// Define the texture sampler
+//layout(set = 1, binding = 0) uniform sampler2D texSampler;
+
+
+
+vec3 decodeOctahedral(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() {
+	vec4 positionWorld = modelMatrix * vec4(position, 1.0);
+
+	gl_Position = ubo.projection * ubo.view * positionWorld;
+
+	fragNormalWorld = normalize(mat3(normalMatrix) * decodeOctahedral(octahedralNormal));
+	fragPosWorld = positionWorld.xyz;
+
+	// the color stream is optional and the fragment shader samples the texture only
+	fragColor = vec3(1.0);
+	texCoord = uv;
+}
\ No newline at end of file